@@ -0,0 +1,636 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+import dreamrender;
+import glm;
+import spdlog;
+import vulkan_hpp;
+import vma;
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wc23-extensions"
+constexpr char example_image_data[] = {
+#embed "example.png"
+};
+#pragma clang diagnostic pop
+constexpr std::array<uint8_t, sizeof(example_image_data)> example_image =
+    std::bit_cast<std::array<uint8_t, sizeof(example_image_data)>>(example_image_data);
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_options {
+    std::vector<std::string> scenarios;
+    unsigned int warmup = 60;
+    unsigned int frames = 600;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+
+    unsigned int text_runs = 2000;
+    unsigned int images = 512;
+    unsigned int rects = 600;
+    unsigned int texture_loads = 256;
+    unsigned int model_loads = 32;
+
+    std::filesystem::path font = "/usr/share/fonts/truetype/liberation/LiberationSans-Regular.ttf";
+    std::string output = "-";
+    std::string label;
+};
+
+struct load_result {
+    uint64_t items = 0;
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+};
+
+struct scenario_result {
+    std::string name;
+    dreamrender::frame_statistics cpuFrame;
+    dreamrender::frame_statistics gpuFrame;
+    dreamrender::frame_statistics record;
+    std::map<std::string, dreamrender::frame_statistics> zones;
+    std::optional<load_result> load;
+    uint64_t gpuAllocationBytes = 0;
+    uint64_t gpuBlockBytes = 0;
+    uint64_t peakResidentBytes = 0;
+};
+
+static dreamrender::frame_statistics summarize(std::vector<double> samples) {
+    dreamrender::frame_statistics s{};
+    if(samples.empty()) {
+        return s;
+    }
+    std::ranges::sort(samples);
+    auto percentile = [&](double p) {
+        std::size_t rank = static_cast<std::size_t>(std::ceil(p * samples.size()));
+        return samples[std::clamp<std::size_t>(rank, 1, samples.size()) - 1];
+    };
+    double sum = 0.0;
+    for(double v : samples) {
+        sum += v;
+    }
+    s.samples = samples.size();
+    s.average = sum / samples.size();
+    s.p50 = percentile(0.50);
+    s.p95 = percentile(0.95);
+    s.p99 = percentile(0.99);
+    s.max = samples.back();
+    return s;
+}
+
+static uint64_t peak_resident_bytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage{};
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Common frame structure: one render pass into the swapchain image, with the scenario
+// recording its draws in between. The statistics of the warmup frames are discarded.
+class bench_phase : public dreamrender::phase {
+    public:
+        bench_phase(dreamrender::window* win, const bench_options& options) : dreamrender::phase(win), options(options) {}
+
+        vk::UniqueRenderPass renderPass;
+        std::vector<vk::UniqueFramebuffer> framebuffers;
+
+        std::vector<double> recordTimes;
+        unsigned int renderedFrames = 0;
+
+        void preload() override {
+            phase::preload();
+
+            vk::AttachmentDescription attachment{{}, win->swapchainFormat.format, win->config.sampleCount,
+                vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+                vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+                vk::ImageLayout::eUndefined, win->swapchainFinalLayout};
+            vk::AttachmentReference ref(0, vk::ImageLayout::eColorAttachmentOptimal);
+            vk::SubpassDescription subpass({}, vk::PipelineBindPoint::eGraphics, {}, ref);
+            vk::SubpassDependency dependency(vk::SubpassExternal, 0, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite, {});
+
+            renderPass = device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependency));
+        }
+        void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
+            phase::prepare(swapchainImages, swapchainViews);
+            framebuffers = createFramebuffers(renderPass.get());
+        }
+        void render(int frame, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) override {
+            phase::render(frame, imageAvailable, renderFinished, fence);
+
+            if(renderedFrames == options.warmup) {
+                if(win->frameProfiler) {
+                    win->frameProfiler->reset_statistics();
+                }
+                recordTimes.clear();
+            }
+            renderedFrames++;
+
+            auto start = bench_clock::now();
+            vk::CommandBuffer& commandBuffer = commandBuffers[frame];
+            commandBuffer.begin(vk::CommandBufferBeginInfo());
+            vk::ClearValue clearValue(vk::ClearColorValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
+            vk::RenderPassBeginInfo renderPassInfo(renderPass.get(), framebuffers[frame].get(), vk::Rect2D({0, 0}, win->swapchainExtent), clearValue);
+            commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+
+            vk::Viewport viewport(0.0f, 0.0f, win->swapchainExtent.width, win->swapchainExtent.height, 0.0f, 1.0f);
+            vk::Rect2D scissor({0,0}, win->swapchainExtent);
+            commandBuffer.setViewport(0, viewport);
+            commandBuffer.setScissor(0, scissor);
+
+            record(commandBuffer, frame);
+
+            commandBuffer.endRenderPass();
+            finish(frame);
+            commandBuffer.end();
+            recordTimes.push_back(std::chrono::duration<double, std::milli>(bench_clock::now() - start).count());
+
+            vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+            vk::SubmitInfo submitInfo(1, &imageAvailable, &waitStages, 1, &commandBuffer, 1, &renderFinished);
+            graphicsQueue.submit(submitInfo, fence);
+        }
+
+        // Blocks until the loads started by the scenario have finished.
+        virtual std::optional<load_result> load_results() {
+            return std::nullopt;
+        }
+    protected:
+        const bench_options& options;
+
+        virtual void record(vk::CommandBuffer cmd, int frame) = 0;
+        virtual void finish(int frame) {}
+};
+
+class text_bench : public bench_phase {
+    public:
+        text_bench(dreamrender::window* win, const bench_options& options) : bench_phase(win, options),
+            fontRenderer{options.font.string(), 32, device, allocator, win->swapchainExtent, win->gpuFeatures} {}
+
+        void preload() override {
+            bench_phase::preload();
+            add_task(fontRenderer.preload(loader, {renderPass.get()}, win->config.sampleCount, win->pipelineCache,
+                nullptr, dreamrender::font_renderer::default_start_char, dreamrender::font_renderer::default_end_char,
+                max_length, options.text_runs));
+
+            texts.reserve(options.text_runs);
+            for(unsigned int i = 0; i < options.text_runs; i++) {
+                texts.push_back(std::format("Item {}: the quick brown fox", i));
+            }
+        }
+        void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
+            bench_phase::prepare(swapchainImages, swapchainViews);
+            fontRenderer.prepare(swapchainImages.size());
+        }
+    protected:
+        static constexpr std::size_t max_length = 64;
+
+        dreamrender::font_renderer fontRenderer;
+        std::vector<std::string> texts;
+
+        void record(vk::CommandBuffer cmd, int frame) override {
+            const unsigned int columns = 8;
+            const unsigned int rows = (options.text_runs + columns - 1) / columns;
+            for(unsigned int i = 0; i < texts.size(); i++) {
+                float x = static_cast<float>(i % columns) / columns;
+                float y = static_cast<float>(i / columns) / rows;
+                fontRenderer.renderText(cmd, frame, renderPass.get(), texts[i], x, y, 0.02f,
+                    glm::vec4(1.0f, 1.0f, 1.0f, 0.5f + 0.5f * ((i % 3) / 2.0f)));
+            }
+        }
+        void finish(int frame) override {
+            fontRenderer.finish(frame);
+        }
+};
+
+class image_grid_bench : public bench_phase {
+    public:
+        image_grid_bench(dreamrender::window* win, const bench_options& options) : bench_phase(win, options),
+            imageRenderer(device, win->swapchainExtent, win->gpuFeatures) {}
+
+        void preload() override {
+            bench_phase::preload();
+            imageRenderer.preload({renderPass.get()}, win->config.sampleCount, win->pipelineCache, options.images);
+            add_task(loader->loadTexture(&texture, dreamrender::LoadDataView{example_image, "PNG"}));
+        }
+        void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
+            bench_phase::prepare(swapchainImages, swapchainViews);
+            imageRenderer.prepare(swapchainImages.size());
+        }
+    protected:
+        dreamrender::texture texture{device, allocator};
+        dreamrender::image_renderer imageRenderer;
+
+        void draw_grid(vk::CommandBuffer cmd, int frame, std::span<const dreamrender::texture* const> textures) {
+            if(textures.empty()) {
+                return;
+            }
+            const unsigned int columns = std::max(1u, static_cast<unsigned int>(std::ceil(std::sqrt(options.images * 16.0 / 9.0))));
+            const unsigned int rows = (options.images + columns - 1) / columns;
+            const float size = 1.0f / std::max(columns, rows);
+            for(unsigned int i = 0; i < options.images; i++) {
+                float x = static_cast<float>(i % columns) / columns;
+                float y = static_cast<float>(i / columns) / rows;
+                imageRenderer.renderImage(cmd, frame, renderPass.get(), *textures[i % textures.size()], x, y, size, size);
+            }
+        }
+        void record(vk::CommandBuffer cmd, int frame) override {
+            const dreamrender::texture* textures[] = {&texture};
+            draw_grid(cmd, frame, textures);
+        }
+        void finish(int frame) override {
+            imageRenderer.finish(frame);
+        }
+};
+
+class rect_menu_bench : public bench_phase {
+    public:
+        rect_menu_bench(dreamrender::window* win, const bench_options& options) : bench_phase(win, options),
+            simpleRenderer(device, allocator, win->swapchainExtent, win->gpuFeatures) {}
+
+        void preload() override {
+            bench_phase::preload();
+            simpleRenderer.preload({renderPass.get()}, win->config.sampleCount, win->pipelineCache);
+        }
+        void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
+            bench_phase::prepare(swapchainImages, swapchainViews);
+            simpleRenderer.prepare(swapchainImages.size());
+        }
+    protected:
+        dreamrender::simple_renderer simpleRenderer;
+
+        // Menus of rounded, partially translucent entries, with every tenth one blurred like a shadow.
+        void record(vk::CommandBuffer cmd, int frame) override {
+            const unsigned int columns = 6;
+            const unsigned int rows = (options.rects + columns - 1) / columns;
+            const glm::vec2 cell{1.0f / columns, 1.0f / rows};
+            for(unsigned int i = 0; i < options.rects; i++) {
+                glm::vec2 position{(i % columns) * cell.x, (i / columns) * cell.y};
+                dreamrender::simple_renderer::params p{};
+                p.border_radius = {0.25f, 0.25f, 0.25f, 0.25f};
+                if(i % 10 == 0) {
+                    p.blur = {glm::vec2{0.0f, 0.02f}, glm::vec2{0.0f, 0.0f}, glm::vec2{-0.01f, 0.01f}, glm::vec2{-0.01f, 0.01f}};
+                }
+                float shade = 0.2f + 0.6f * static_cast<float>(i % 7) / 6.0f;
+                simpleRenderer.renderRect(cmd, frame, renderPass.get(), position + cell * 0.05f, cell * 0.9f,
+                    glm::vec4(shade, shade, 1.0f - shade, 0.8f), p);
+            }
+        }
+        void finish(int frame) override {
+            simpleRenderer.finish(frame);
+        }
+};
+
+// Queues all texture loads at once and draws whatever has finished loading.
+class texture_storm_bench : public image_grid_bench {
+    public:
+        using image_grid_bench::image_grid_bench;
+
+        void init() override {
+            image_grid_bench::init();
+            loadStart = bench_clock::now();
+            for(unsigned int i = 0; i < options.texture_loads; i++) {
+                auto& t = textures.emplace_back(std::make_unique<dreamrender::texture>(device, allocator));
+                pending.push_back(loader->loadTexture(t.get(), dreamrender::LoadDataView{example_image, "PNG"}));
+            }
+        }
+        std::optional<load_result> load_results() override {
+            for(auto& f : pending) {
+                f.wait();
+            }
+            check_loads();
+            load_result result{.items = textures.size(), .seconds = std::chrono::duration<double>(loadEnd - loadStart).count()};
+            for(auto& t : textures) {
+                result.bytes += static_cast<uint64_t>(t->width) * t->height * 4;
+            }
+            return result;
+        }
+    protected:
+        std::vector<std::unique_ptr<dreamrender::texture>> textures;
+        std::vector<std::future<void>> pending;
+        std::vector<const dreamrender::texture*> loaded;
+        bench_clock::time_point loadStart;
+        bench_clock::time_point loadEnd;
+
+        void check_loads() {
+            if(loadEnd != bench_clock::time_point{}) {
+                return;
+            }
+            loaded.clear();
+            for(auto& t : textures) {
+                if(t->loaded) {
+                    loaded.push_back(t.get());
+                }
+            }
+            if(loaded.size() == textures.size()) {
+                loadEnd = bench_clock::now();
+            }
+        }
+        void record(vk::CommandBuffer cmd, int frame) override {
+            check_loads();
+            draw_grid(cmd, frame, loaded);
+        }
+};
+
+// Loads copies of a generated sphere while rendering empty frames.
+class model_load_bench : public bench_phase {
+    public:
+        model_load_bench(dreamrender::window* win, const bench_options& options, std::filesystem::path path) :
+            bench_phase(win, options), path(std::move(path)) {}
+
+        void init() override {
+            bench_phase::init();
+            loadStart = bench_clock::now();
+            for(unsigned int i = 0; i < options.model_loads; i++) {
+                auto& m = models.emplace_back(std::make_unique<dreamrender::model>(device, allocator));
+                pending.push_back(loader->loadModel(m.get(), path));
+            }
+        }
+        std::optional<load_result> load_results() override {
+            for(auto& f : pending) {
+                f.wait();
+            }
+            auto loadEnd = bench_clock::now();
+            load_result result{.items = models.size(), .seconds = std::chrono::duration<double>(loadEnd - loadStart).count()};
+            for(auto& m : models) {
+                result.bytes += static_cast<uint64_t>(m->vertexCount) * dreamrender::vertex_size(m->format)
+                    + static_cast<uint64_t>(m->indexCount) * sizeof(uint32_t);
+            }
+            return result;
+        }
+    protected:
+        std::filesystem::path path;
+        std::vector<std::unique_ptr<dreamrender::model>> models;
+        std::vector<std::future<void>> pending;
+        bench_clock::time_point loadStart;
+
+        void record(vk::CommandBuffer cmd, int frame) override {}
+};
+
+static void write_sphere_obj(const std::filesystem::path& path, unsigned int segments, unsigned int rings) {
+    std::ofstream out(path);
+    if(!out) {
+        throw std::runtime_error("Failed to write " + path.string());
+    }
+    for(unsigned int r = 0; r <= rings; r++) {
+        float theta = std::numbers::pi_v<float> * r / rings;
+        for(unsigned int s = 0; s <= segments; s++) {
+            float phi = 2.0f * std::numbers::pi_v<float> * s / segments;
+            glm::vec3 n{std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+            out << std::format("v {} {} {}\nvn {} {} {}\nvt {} {}\n", n.x, n.y, n.z, n.x, n.y, n.z,
+                static_cast<float>(s) / segments, static_cast<float>(r) / rings);
+        }
+    }
+    auto index = [&](unsigned int r, unsigned int s) {
+        return r * (segments + 1) + s + 1;
+    };
+    for(unsigned int r = 0; r < rings; r++) {
+        for(unsigned int s = 0; s < segments; s++) {
+            unsigned int a = index(r, s), b = index(r + 1, s), c = index(r + 1, s + 1), d = index(r, s + 1);
+            out << std::format("f {0}/{0}/{0} {1}/{1}/{1} {2}/{2}/{2}\n", a, b, c);
+            out << std::format("f {0}/{0}/{0} {1}/{1}/{1} {2}/{2}/{2}\n", a, c, d);
+        }
+    }
+}
+
+static std::string json_string(std::string_view value) {
+    std::string result = "\"";
+    for(char c : value) {
+        if(c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if(static_cast<unsigned char>(c) < 0x20) {
+            result += std::format("\\u{:04x}", static_cast<unsigned int>(c));
+        } else {
+            result += c;
+        }
+    }
+    return result + '"';
+}
+
+static void write_statistics(std::ostream& out, const dreamrender::frame_statistics& s) {
+    out << std::format(R"({{"samples":{},"average":{:.4f},"p50":{:.4f},"p95":{:.4f},"p99":{:.4f},"max":{:.4f}}})",
+        s.samples, s.average, s.p50, s.p95, s.p99, s.max);
+}
+
+static void write_json(std::ostream& out, const bench_options& options, const dreamrender::window& window,
+    const std::vector<scenario_result>& results)
+{
+    out << "{\n";
+    out << std::format("  \"label\": {},\n", json_string(options.label));
+    out << std::format("  \"device\": {},\n", json_string(window.deviceProperties.deviceName.data()));
+    out << std::format("  \"extent\": [{}, {}],\n", window.swapchainExtent.width, window.swapchainExtent.height);
+    out << std::format("  \"warmup_frames\": {},\n  \"frames\": {},\n", options.warmup, options.frames);
+    out << "  \"scenarios\": [";
+    for(std::size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << std::format("    {{\n      \"name\": {},\n      \"cpu_frame_ms\": ", json_string(r.name));
+        write_statistics(out, r.cpuFrame);
+        out << ",\n      \"gpu_frame_ms\": ";
+        write_statistics(out, r.gpuFrame);
+        out << ",\n      \"record_ms\": ";
+        write_statistics(out, r.record);
+        out << ",\n      \"gpu_zones_ms\": {";
+        bool first = true;
+        for(const auto& [name, s] : r.zones) {
+            out << (first ? "\n" : ",\n") << std::format("        {}: ", json_string(name));
+            write_statistics(out, s);
+            first = false;
+        }
+        out << (first ? "}" : "\n      }");
+        if(r.load) {
+            const auto& l = *r.load;
+            out << std::format(",\n      \"load\": {{\"items\":{},\"bytes\":{},\"seconds\":{:.4f},\"items_per_second\":{:.2f},\"mib_per_second\":{:.2f}}}",
+                l.items, l.bytes, l.seconds,
+                l.seconds > 0.0 ? l.items / l.seconds : 0.0,
+                l.seconds > 0.0 ? l.bytes / (1024.0 * 1024.0) / l.seconds : 0.0);
+        }
+        out << std::format(",\n      \"memory\": {{\"gpu_allocation_bytes\":{},\"gpu_block_bytes\":{},\"peak_resident_bytes\":{}}}\n    }}",
+            r.gpuAllocationBytes, r.gpuBlockBytes, r.peakResidentBytes);
+    }
+    out << "\n  ]\n}\n";
+}
+
+static void usage() {
+    std::cerr << "Usage: dreams_bench [options] [scenario...]\n"
+        "Scenarios: text, image_grid, rect_menu, texture_storm, model_load (default: all)\n"
+        "Options:\n"
+        "  --frames N         measured frames per scenario (default 600)\n"
+        "  --warmup N         frames discarded before measuring (default 60)\n"
+        "  --size WxH         frame size (default 1920x1080)\n"
+        "  --text-runs N      --images N  --rects N  --texture-loads N  --model-loads N\n"
+        "  --font PATH        font for the text scenario\n"
+        "  --output PATH      JSON output, \"-\" for stdout (default)\n"
+        "  --label TEXT       stored in the output, e.g. a commit hash\n";
+}
+
+static bench_options parse_options(int argc, char** argv) {
+    bench_options options;
+    for(int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = [&]() -> std::string_view {
+            if(i + 1 >= argc) {
+                throw std::invalid_argument(std::format("Missing value for {}", arg));
+            }
+            return argv[++i];
+        };
+        auto number = [&]() {
+            return static_cast<unsigned int>(std::stoul(std::string(value())));
+        };
+        if(arg == "--help" || arg == "-h") {
+            usage();
+            std::exit(0);
+        } else if(arg == "--frames") {
+            options.frames = std::max(1u, number());
+        } else if(arg == "--warmup") {
+            options.warmup = number();
+        } else if(arg == "--size") {
+            std::string size{value()};
+            auto x = size.find('x');
+            if(x == std::string::npos) {
+                throw std::invalid_argument("Size must be given as WxH");
+            }
+            options.width = std::stoul(size.substr(0, x));
+            options.height = std::stoul(size.substr(x + 1));
+        } else if(arg == "--text-runs") {
+            options.text_runs = std::max(1u, number());
+        } else if(arg == "--images") {
+            options.images = std::max(1u, number());
+        } else if(arg == "--rects") {
+            options.rects = std::max(1u, number());
+        } else if(arg == "--texture-loads") {
+            options.texture_loads = std::max(1u, number());
+        } else if(arg == "--model-loads") {
+            options.model_loads = std::max(1u, number());
+        } else if(arg == "--font") {
+            options.font = value();
+        } else if(arg == "--output") {
+            options.output = value();
+        } else if(arg == "--label") {
+            options.label = value();
+        } else if(arg.starts_with("--")) {
+            throw std::invalid_argument(std::format("Unknown option {}", arg));
+        } else {
+            options.scenarios.emplace_back(arg);
+        }
+    }
+    if(options.scenarios.empty()) {
+        options.scenarios = {"text", "image_grid", "rect_menu", "texture_storm", "model_load"};
+    }
+    return options;
+}
+
+int main(int argc, char** argv) {
+    spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+    spdlog::set_level(spdlog::level::info);
+
+    bench_options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        usage();
+        return 1;
+    }
+
+    dreamrender::window_config config;
+    config.title = "dreams_bench";
+    config.name = "dreams-bench";
+    config.headless = true;
+    config.headless_output_dir.clear();
+    config.width = options.width;
+    config.height = options.height;
+    config.profileGpu = true;
+
+    dreamrender::window window{config};
+    window.init();
+
+    std::filesystem::path objPath = std::filesystem::temp_directory_path() / "dreams_bench_sphere.obj";
+    write_sphere_obj(objPath, 128, 64);
+
+    std::vector<scenario_result> results;
+    for(const auto& name : options.scenarios) {
+        bench_phase* phase = nullptr;
+        if(name == "text") {
+            phase = new text_bench(&window, options);
+        } else if(name == "image_grid") {
+            phase = new image_grid_bench(&window, options);
+        } else if(name == "rect_menu") {
+            phase = new rect_menu_bench(&window, options);
+        } else if(name == "texture_storm") {
+            phase = new texture_storm_bench(&window, options);
+        } else if(name == "model_load") {
+            phase = new model_load_bench(&window, options, objPath);
+        } else {
+            spdlog::error("Unknown scenario \"{}\"", name);
+            continue;
+        }
+
+        spdlog::info("Running scenario \"{}\"", name);
+        window.device->waitIdle();
+        window.set_phase(phase);
+        window.config.headless_frames = static_cast<int>(window.totalFrameNumber + options.warmup + options.frames);
+        window.loop();
+        window.device->waitIdle();
+
+        scenario_result result{.name = name};
+        result.load = phase->load_results();
+        result.record = summarize(phase->recordTimes);
+        if(window.frameProfiler) {
+            result.cpuFrame = window.frameProfiler->cpu_frame_statistics();
+            result.gpuFrame = window.frameProfiler->gpu_frame_statistics();
+            result.zones = window.frameProfiler->gpu_zone_statistics();
+        }
+        auto stats = window.allocator.calculateStatistics();
+        result.gpuAllocationBytes = stats.total.statistics.allocationBytes;
+        result.gpuBlockBytes = stats.total.statistics.blockBytes;
+        result.peakResidentBytes = peak_resident_bytes();
+        spdlog::info("Scenario \"{}\": CPU frame p50/p99 {:.3f}/{:.3f} ms, GPU frame p50/p99 {:.3f}/{:.3f} ms",
+            name, result.cpuFrame.p50, result.cpuFrame.p99, result.gpuFrame.p50, result.gpuFrame.p99);
+        results.push_back(std::move(result));
+    }
+    window.device->waitIdle();
+    window.current_renderer.reset();
+    std::filesystem::remove(objPath);
+
+    if(options.output == "-") {
+        write_json(std::cout, options, window, results);
+    } else {
+        std::ofstream out(options.output);
+        if(!out) {
+            spdlog::error("Failed to open {}", options.output);
+            return 1;
+        }
+        write_json(out, options, window, results);
+    }
+    return 0;
+}
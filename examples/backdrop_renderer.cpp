@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+import dreamrender;
+import glm;
+import spdlog;
+import vulkan_hpp;
+
+class backdrop_phase : public dreamrender::phase {
+    public:
+        backdrop_phase(dreamrender::window* win) : dreamrender::phase(win),
+            simpleRenderer(device, allocator, win->swapchainExtent, win->gpuFeatures),
+            backdropRenderer(device, allocator, win->swapchainExtent, win->gpuFeatures) {}
+
+        // The scene is drawn in the first pass, the panel over its blur in the second one,
+        // which loads what the first one stored.
+        vk::UniqueRenderPass scenePass;
+        vk::UniqueRenderPass overlayPass;
+        std::vector<vk::UniqueFramebuffer> sceneFramebuffers;
+        std::vector<vk::UniqueFramebuffer> overlayFramebuffers;
+
+        dreamrender::simple_renderer simpleRenderer;
+        dreamrender::backdrop_renderer backdropRenderer;
+
+        std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+
+        vk::UniqueRenderPass createRenderPass(vk::AttachmentLoadOp loadOp, vk::ImageLayout initialLayout) {
+            vk::AttachmentDescription attachment{{}, win->swapchainFormat.format, win->config.sampleCount,
+                loadOp, vk::AttachmentStoreOp::eStore,
+                vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+                initialLayout, win->swapchainFinalLayout};
+            vk::AttachmentReference ref(0, vk::ImageLayout::eColorAttachmentOptimal);
+            vk::SubpassDescription subpass({}, vk::PipelineBindPoint::eGraphics, {}, ref);
+            vk::SubpassDependency dependency(vk::SubpassExternal, 0, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite, {});
+            return device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependency));
+        }
+
+        void preload() override {
+            phase::preload();
+
+            scenePass = createRenderPass(vk::AttachmentLoadOp::eClear, vk::ImageLayout::eUndefined);
+            overlayPass = createRenderPass(vk::AttachmentLoadOp::eLoad, win->swapchainFinalLayout);
+            simpleRenderer.preload({scenePass.get(), overlayPass.get()}, win->config.sampleCount);
+            backdropRenderer.preload({overlayPass.get()}, win->config.sampleCount);
+        }
+        void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
+            phase::prepare(swapchainImages, swapchainViews);
+
+            sceneFramebuffers = createFramebuffers(scenePass.get());
+            overlayFramebuffers = createFramebuffers(overlayPass.get());
+            simpleRenderer.prepare(swapchainImages.size());
+            backdropRenderer.prepare(swapchainImages.size());
+        }
+        void render(int frame, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) override {
+            phase::render(frame, imageAvailable, renderFinished, fence);
+
+            // The stripes move for two seconds and rest for two, the blur is only redone while they move.
+            float t = std::chrono::duration<float>(std::chrono::system_clock::now() - start).count();
+            float shift = std::floor(t / 4.0f) * 2.0f + std::min(std::fmod(t, 4.0f), 2.0f);
+
+            vk::CommandBuffer& commandBuffer = commandBuffers[frame];
+            commandBuffer.begin(vk::CommandBufferBeginInfo());
+            vk::Viewport viewport(0.0f, 0.0f, win->swapchainExtent.width, win->swapchainExtent.height, 0.0f, 1.0f);
+            vk::Rect2D scissor({0,0}, win->swapchainExtent);
+
+            vk::ClearValue clearValue(vk::ClearColorValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
+            commandBuffer.beginRenderPass(vk::RenderPassBeginInfo(scenePass.get(), sceneFramebuffers[frame].get(), scissor, clearValue), vk::SubpassContents::eInline);
+            commandBuffer.setViewport(0, viewport);
+            commandBuffer.setScissor(0, scissor);
+            for(int i = 0; i < 12; i++) {
+                float x = std::fmod(i * 0.1f + shift * 0.1f, 1.2f) - 0.1f;
+                glm::vec4 color{0.5f + 0.5f * std::sin(i * 1.3f), 0.5f + 0.5f * std::sin(i * 2.1f + 2.0f), 0.5f + 0.5f * std::sin(i * 0.7f + 4.0f), 1.0f};
+                simpleRenderer.renderRect(commandBuffer, frame, scenePass.get(), glm::vec2{x, 0.0f}, glm::vec2{0.05f, 1.0f}, color);
+            }
+            commandBuffer.endRenderPass();
+
+            backdropRenderer.capture(commandBuffer, frame, win->swapchainImages[frame], win->swapchainFinalLayout,
+                "backdrop_example::panel", glm::vec2{0.25f, 0.25f}, glm::vec2{0.5f, 0.5f},
+                dreamrender::damage_key().add(shift).get());
+
+            commandBuffer.beginRenderPass(vk::RenderPassBeginInfo(overlayPass.get(), overlayFramebuffers[frame].get(), scissor), vk::SubpassContents::eInline);
+            commandBuffer.setViewport(0, viewport);
+            commandBuffer.setScissor(0, scissor);
+            backdropRenderer.render(commandBuffer, frame, overlayPass.get(), "backdrop_example::panel", dreamrender::backdrop_style{
+                .border_radius = {0.05f, 0.05f, 0.05f, 0.05f},
+                .tint = glm::vec4{1.0f, 1.0f, 1.0f, 0.15f},
+            });
+            commandBuffer.endRenderPass();
+            commandBuffer.end();
+
+            simpleRenderer.finish(frame);
+            backdropRenderer.finish(frame);
+
+            vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+            vk::SubmitInfo submitInfo(1, &imageAvailable, &waitStages, 1, &commandBuffer, 1, &renderFinished);
+            graphicsQueue.submit(submitInfo, fence);
+        }
+};
+
+int main() {
+    spdlog::set_level(spdlog::level::debug);
+
+    dreamrender::window_config config;
+    config.title = "Backdrop Renderer Example";
+    config.name = "backdrop-renderer-example";
+
+    dreamrender::window window{config};
+    window.init();
+    window.set_phase(new backdrop_phase(&window));
+    window.loop();
+}
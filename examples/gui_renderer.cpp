@@ -1,5 +1,6 @@
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 import dreamrender;
@@ -16,6 +17,10 @@ constexpr char example_image_data[] = {
 constexpr std::array<uint8_t, sizeof(example_image_data)> example_image =
     std::bit_cast<std::array<uint8_t, sizeof(example_image_data)>>(example_image_data);
 
+struct gui_snapshot : dreamrender::frame_snapshot {
+    uint64_t damage = 0;
+};
+
 class simple_phase : public dreamrender::phase {
     public:
         simple_phase(dreamrender::window* win) : dreamrender::phase(win),
@@ -24,7 +29,10 @@ class simple_phase : public dreamrender::phase {
             simpleRenderer(device, allocator, win->swapchainExtent, win->gpuFeatures) {}
 
         vk::UniqueRenderPass renderPass;
+        // Compatible with renderPass, but keeps the previous contents for partial redraws.
+        vk::UniqueRenderPass renderPassLoad;
         std::vector<vk::UniqueFramebuffer> framebuffers;
+        dreamrender::damage_tracker damage;
 
         dreamrender::texture texture{device, allocator};
         dreamrender::font_renderer fontRenderer;
@@ -43,6 +51,9 @@ class simple_phase : public dreamrender::phase {
             vk::SubpassDependency dependency(vk::SubpassExternal, 0, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite, {});
 
             renderPass = device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependency));
+            attachment.loadOp = vk::AttachmentLoadOp::eLoad;
+            attachment.initialLayout = win->swapchainFinalLayout;
+            renderPassLoad = device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependency));
 
             add_task(fontRenderer.preload(loader, {renderPass.get()}, win->config.sampleCount));
             imageRenderer.preload({renderPass.get()}, win->config.sampleCount);
@@ -53,6 +64,7 @@ class simple_phase : public dreamrender::phase {
             phase::prepare(swapchainImages, swapchainViews);
 
             framebuffers = createFramebuffers(renderPass.get());
+            damage.invalidate(win->swapchainExtent);
 
             fontRenderer.prepare(swapchainImages.size());
             imageRenderer.prepare(swapchainImages.size());
@@ -61,21 +73,62 @@ class simple_phase : public dreamrender::phase {
         void init() override {
             phase::init();
         }
-        void render(int frame, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) override {
-            phase::render(frame, imageAvailable, renderFinished, fence);
+        std::unique_ptr<dreamrender::frame_snapshot> update() override {
+            auto snapshot = std::make_unique<gui_snapshot>();
+            damage.begin_frame();
+            {
+                dreamrender::gui_renderer gui(damage, win->swapchainExtent, &fontRenderer, &imageRenderer, &simpleRenderer);
+                draw(gui);
+            }
+            snapshot->unchanged = !damage.end_frame();
+            snapshot->damage = damage.current_generation();
+            return snapshot;
+        }
+        void render(int frame, const dreamrender::frame_snapshot& snapshot, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) override {
+            const auto region = damage.take_region(frame, static_cast<const gui_snapshot&>(snapshot).damage);
+            const bool full = damage.is_full(region);
 
             vk::CommandBuffer& commandBuffer = commandBuffers[frame];
             commandBuffer.begin(vk::CommandBufferBeginInfo());
-            vk::ClearValue clearValue(vk::ClearColorValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
-            vk::RenderPassBeginInfo renderPassInfo(renderPass.get(), framebuffers[frame].get(), vk::Rect2D({0, 0}, win->swapchainExtent), clearValue);
-            commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+            // An empty region means the image is up to date, only the semaphores are needed.
+            if(!region.empty()) {
+                vk::ClearValue clearValue(vk::ClearColorValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
+                const vk::Rect2D bounds = dreamrender::damage_tracker::bounds(region);
+                vk::RenderPassBeginInfo renderPassInfo(full ? renderPass.get() : renderPassLoad.get(), framebuffers[frame].get(), bounds, clearValue);
+                commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+
+                vk::Viewport viewport(0.0f, 0.0f, win->swapchainExtent.width, win->swapchainExtent.height, 0.0f, 1.0f);
+                commandBuffer.setViewport(0, viewport);
+                commandBuffer.setScissor(0, bounds);
+
+                if(!full) {
+                    // The damaged area still shows the old frame, clear it like the full pass would.
+                    vk::ClearAttachment clear(vk::ImageAspectFlagBits::eColor, 0, clearValue);
+                    commandBuffer.clearAttachments(clear, vk::ClearRect(bounds, 0, 1));
+                }
+                {
+                    // Pipelines were built for renderPass, which renderPassLoad is compatible with.
+                    dreamrender::gui_renderer gui(commandBuffer, frame, renderPass.get(), win->swapchainExtent, &fontRenderer, &imageRenderer, &simpleRenderer);
+                    if(!full) {
+                        gui.set_damage(region);
+                    }
+                    draw(gui);
+                }
+                commandBuffer.endRenderPass();
+            }
 
-            vk::Viewport viewport(0.0f, 0.0f, win->swapchainExtent.width, win->swapchainExtent.height, 0.0f, 1.0f);
-            vk::Rect2D scissor({0,0}, win->swapchainExtent);
-            commandBuffer.setViewport(0, viewport);
-            commandBuffer.setScissor(0, scissor);
+            imageRenderer.finish(frame);
+            fontRenderer.finish(frame);
+            commandBuffer.end();
+            set_present_region(region);
 
-            dreamrender::gui_renderer gui(commandBuffer, frame, renderPass.get(), win->swapchainExtent, &fontRenderer, &imageRenderer, &simpleRenderer);
+            vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+            vk::SubmitInfo submitInfo(1, &imageAvailable, &waitStages, 1, &commandBuffer, 1, &renderFinished);
+            graphicsQueue.submit(submitInfo, fence);
+        }
+    private:
+        // Draws the whole GUI, both to find the damage and to render it.
+        void draw(dreamrender::gui_renderer& gui) {
             gui.draw_text("Hello World!", 0.0f, 0.0f, 0.1f);
             gui.draw_image_sized(texture, 0.25f, 0.25f, gui.frame_size.width/2, gui.frame_size.height/2);
             gui.draw_quad(std::array{
@@ -92,16 +145,6 @@ class simple_phase : public dreamrender::phase {
                 }
             });
             gui.draw_text("Sidebar!", 0.75f, 0.0f, 0.1f);
-
-            commandBuffer.endRenderPass();
-
-            imageRenderer.finish(frame);
-            fontRenderer.finish(frame);
-            commandBuffer.end();
-
-            vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-            vk::SubmitInfo submitInfo(1, &imageAvailable, &waitStages, 1, &commandBuffer, 1, &renderFinished);
-            graphicsQueue.submit(submitInfo, fence);
         }
 };
 
@@ -0,0 +1,137 @@
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+import dreamrender;
+import glm;
+import spdlog;
+import vulkan_hpp;
+
+// A unit cube with outward facing, counter-clockwise triangles.
+constexpr std::string_view cube_obj = R"(v -1 -1 -1
+v 1 -1 -1
+v 1 1 -1
+v -1 1 -1
+v -1 -1 1
+v 1 -1 1
+v 1 1 1
+v -1 1 1
+vt 0 0
+vn 0 0 1
+vn 0 0 -1
+vn 1 0 0
+vn -1 0 0
+vn 0 1 0
+vn 0 -1 0
+f 5/1/1 6/1/1 7/1/1
+f 5/1/1 7/1/1 8/1/1
+f 1/1/2 4/1/2 3/1/2
+f 1/1/2 3/1/2 2/1/2
+f 6/1/3 2/1/3 3/1/3
+f 6/1/3 3/1/3 7/1/3
+f 1/1/4 5/1/4 8/1/4
+f 1/1/4 8/1/4 4/1/4
+f 8/1/5 7/1/5 3/1/5
+f 8/1/5 3/1/5 4/1/5
+f 1/1/6 2/1/6 6/1/6
+f 1/1/6 6/1/6 5/1/6
+)";
+
+class model_phase : public dreamrender::phase {
+    public:
+        model_phase(dreamrender::window* win) : dreamrender::phase(win),
+            modelRenderer(device, allocator, win->swapchainExtent, win->gpuFeatures) {}
+
+        vk::UniqueRenderPass renderPass;
+        std::vector<vk::UniqueFramebuffer> framebuffers;
+
+        dreamrender::model cube{device, allocator};
+        dreamrender::model_renderer modelRenderer;
+
+        std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+
+        void preload() override {
+            phase::preload();
+
+            vk::AttachmentDescription attachment{{}, win->swapchainFormat.format, win->config.sampleCount,
+                vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+                vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+                vk::ImageLayout::eUndefined, win->swapchainFinalLayout};
+            vk::AttachmentReference ref(0, vk::ImageLayout::eColorAttachmentOptimal);
+            vk::SubpassDescription subpass({}, vk::PipelineBindPoint::eGraphics, {}, ref);
+            vk::SubpassDependency dependency(vk::SubpassExternal, 0, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite, {});
+
+            renderPass = device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependency));
+
+            modelRenderer.preload({renderPass.get()}, win->config.sampleCount);
+            add_task(loader->loadModel(&cube, dreamrender::LoadDataView{
+                std::span(reinterpret_cast<const uint8_t*>(cube_obj.data()), cube_obj.size()), "OBJ"}));
+        }
+        void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
+            phase::prepare(swapchainImages, swapchainViews);
+
+            framebuffers = createFramebuffers(renderPass.get());
+            modelRenderer.prepare(swapchainImages.size());
+        }
+        void render(int frame, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) override {
+            phase::render(frame, imageAvailable, renderFinished, fence);
+
+            // The camera turns around a grid of cubes, the ones behind it are culled on the GPU.
+            float t = std::chrono::duration<float>(std::chrono::system_clock::now() - start).count();
+            glm::mat4 projection = glm::perspective(glm::radians(60.0f),
+                static_cast<float>(win->swapchainExtent.width) / win->swapchainExtent.height, 0.1f, 100.0f);
+            projection[1][1] *= -1.0f;
+            glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 4.0f, 0.0f),
+                glm::vec3(std::sin(t * 0.3f), 4.0f - 0.5f, std::cos(t * 0.3f)), glm::vec3(0.0f, 1.0f, 0.0f));
+
+            for(int x = -8; x <= 8; x++) {
+                for(int z = -8; z <= 8; z++) {
+                    glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(x * 4.0f, 0.0f, z * 4.0f));
+                    transform = glm::rotate(transform, t + (x + z) * 0.2f, glm::vec3(0.0f, 1.0f, 0.0f));
+                    glm::vec4 color{0.5f + x / 16.0f, 0.5f, 0.5f + z / 16.0f, 1.0f};
+                    modelRenderer.add(frame, cube, transform, color);
+                }
+            }
+
+            vk::CommandBuffer& commandBuffer = commandBuffers[frame];
+            commandBuffer.begin(vk::CommandBufferBeginInfo());
+            modelRenderer.cull(commandBuffer, frame, projection * view);
+
+            vk::ClearValue clearValue(vk::ClearColorValue(std::array<float, 4>{0.1f, 0.1f, 0.1f, 1.0f}));
+            vk::RenderPassBeginInfo renderPassInfo(renderPass.get(), framebuffers[frame].get(), vk::Rect2D({0, 0}, win->swapchainExtent), clearValue);
+            commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+
+            vk::Viewport viewport(0.0f, 0.0f, win->swapchainExtent.width, win->swapchainExtent.height, 0.0f, 1.0f);
+            vk::Rect2D scissor({0,0}, win->swapchainExtent);
+            commandBuffer.setViewport(0, viewport);
+            commandBuffer.setScissor(0, scissor);
+
+            modelRenderer.render(commandBuffer, frame, renderPass.get());
+
+            commandBuffer.endRenderPass();
+            commandBuffer.end();
+
+            modelRenderer.finish(frame);
+
+            vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+            vk::SubmitInfo submitInfo(1, &imageAvailable, &waitStages, 1, &commandBuffer, 1, &renderFinished);
+            graphicsQueue.submit(submitInfo, fence);
+        }
+};
+
+int main() {
+    spdlog::set_level(spdlog::level::debug);
+
+    dreamrender::window_config config;
+    config.title = "Model Renderer Example";
+    config.name = "model-renderer-example";
+
+    dreamrender::window window{config};
+    window.init();
+    window.set_phase(new model_phase(&window));
+    window.loop();
+}
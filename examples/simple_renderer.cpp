@@ -12,6 +12,9 @@ class simple_phase : public dreamrender::phase {
 
         vk::UniqueRenderPass renderPass;
         std::vector<vk::UniqueFramebuffer> framebuffers;
+        // Without a resolve attachment, dynamic rendering is only used without multisampling.
+        bool dynamicRendering = false;
+        vk::RenderPass target;
 
         dreamrender::simple_renderer simpleRenderer;
 
@@ -27,7 +30,13 @@ class simple_phase : public dreamrender::phase {
             vk::SubpassDependency dependency(vk::SubpassExternal, 0, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite, {});
 
             renderPass = device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependency));
-            simpleRenderer.preload({renderPass.get()}, win->config.sampleCount);
+            dynamicRendering = win->gpuFeatures.dynamicRendering && win->config.sampleCount == vk::SampleCountFlagBits::e1;
+            if(dynamicRendering) {
+                simpleRenderer.preload(dreamrender::render_targets::dynamic(win->swapchainFormat.format), win->config.sampleCount);
+            } else {
+                simpleRenderer.preload({renderPass.get()}, win->config.sampleCount);
+                target = renderPass.get();
+            }
         }
         void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
             phase::prepare(swapchainImages, swapchainViews);
@@ -43,16 +52,21 @@ class simple_phase : public dreamrender::phase {
 
             vk::CommandBuffer& commandBuffer = commandBuffers[frame];
             commandBuffer.begin(vk::CommandBufferBeginInfo());
-            vk::ClearValue clearValue(vk::ClearColorValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
-            vk::RenderPassBeginInfo renderPassInfo(renderPass.get(), framebuffers[frame].get(), vk::Rect2D({0, 0}, win->swapchainExtent), clearValue);
-            commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+            vk::ClearColorValue clearColor(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f});
+            if(dynamicRendering) {
+                beginRendering(commandBuffer, frame, clearColor);
+            } else {
+                vk::ClearValue clearValue(clearColor);
+                vk::RenderPassBeginInfo renderPassInfo(renderPass.get(), framebuffers[frame].get(), vk::Rect2D({0, 0}, win->swapchainExtent), clearValue);
+                commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+            }
 
             vk::Viewport viewport(0.0f, 0.0f, win->swapchainExtent.width, win->swapchainExtent.height, 0.0f, 1.0f);
             vk::Rect2D scissor({0,0}, win->swapchainExtent);
             commandBuffer.setViewport(0, viewport);
             commandBuffer.setScissor(0, scissor);
 
-            simpleRenderer.renderQuad(commandBuffer, frame, renderPass.get(), std::array{
+            simpleRenderer.renderQuad(commandBuffer, frame, target, std::array{
                 dreamrender::simple_renderer::vertex_data{{0.75f, 0.0f}, {0.2f, 0.2f, 0.2f, 0.2f}, {0.0f, 0.0f}},
                 dreamrender::simple_renderer::vertex_data{{0.75f, 1.0f}, {0.2f, 0.2f, 0.2f, 0.2f}, {0.0f, 1.0f}},
                 dreamrender::simple_renderer::vertex_data{{0.9f, 0.0f}, {0.0f, 0.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
@@ -65,12 +79,16 @@ class simple_phase : public dreamrender::phase {
                     glm::vec2{-0.05f, 0.05f},
                 }
             });
-            simpleRenderer.renderRect(commandBuffer, frame, renderPass.get(), glm::vec2{0.1f, 0.1f}, glm::vec2{0.25f, 0.2f}, glm::vec4{1.0f, 0.0f, 0.0f, 1.0f},
+            simpleRenderer.renderRect(commandBuffer, frame, target, glm::vec2{0.1f, 0.1f}, glm::vec2{0.25f, 0.2f}, glm::vec4{1.0f, 0.0f, 0.0f, 1.0f},
                 dreamrender::simple_renderer::params{
                     {}, {0.1f, 0.3f, 0.5f, 0.7f}
                 });
 
-            commandBuffer.endRenderPass();
+            if(dynamicRendering) {
+                endRendering(commandBuffer, frame);
+            } else {
+                commandBuffer.endRenderPass();
+            }
             commandBuffer.end();
 
             simpleRenderer.finish(frame);
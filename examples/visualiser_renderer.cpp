@@ -0,0 +1,106 @@
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+import dreamrender;
+import glm;
+import spdlog;
+import vulkan_hpp;
+
+class visualiser_phase : public dreamrender::phase {
+    public:
+        visualiser_phase(dreamrender::window* win) : dreamrender::phase(win),
+            visualiserRenderer(device, allocator, win->swapchainExtent, win->gpuFeatures) {}
+
+        vk::UniqueRenderPass renderPass;
+        std::vector<vk::UniqueFramebuffer> framebuffers;
+
+        dreamrender::visualiser_renderer visualiserRenderer;
+
+        std::vector<float> waveform = std::vector<float>(1024);
+        std::vector<float> spectrum = std::vector<float>(512);
+        std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+
+        void preload() override {
+            phase::preload();
+
+            vk::AttachmentDescription attachment{{}, win->swapchainFormat.format, win->config.sampleCount,
+                vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+                vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+                vk::ImageLayout::eUndefined, win->swapchainFinalLayout};
+            vk::AttachmentReference ref(0, vk::ImageLayout::eColorAttachmentOptimal);
+            vk::SubpassDescription subpass({}, vk::PipelineBindPoint::eGraphics, {}, ref);
+            vk::SubpassDependency dependency(vk::SubpassExternal, 0, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite, {});
+
+            renderPass = device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependency));
+            visualiserRenderer.preload({renderPass.get()}, win->config.sampleCount);
+        }
+        void prepare(std::vector<vk::Image> swapchainImages, std::vector<vk::ImageView> swapchainViews) override {
+            phase::prepare(swapchainImages, swapchainViews);
+
+            framebuffers = createFramebuffers(renderPass.get());
+            visualiserRenderer.prepare(swapchainImages.size());
+        }
+        void init() override {
+            phase::init();
+        }
+        void render(int frame, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) override {
+            phase::render(frame, imageAvailable, renderFinished, fence);
+
+            // Synthetic signal, a real application would feed captured audio here.
+            float t = std::chrono::duration<float>(std::chrono::system_clock::now() - start).count();
+            for(std::size_t i = 0; i < waveform.size(); i++) {
+                float x = static_cast<float>(i) / waveform.size();
+                waveform[i] = 0.6f * std::sin(2.0f * std::numbers::pi_v<float> * (4.0f * x + t))
+                    + 0.2f * std::sin(2.0f * std::numbers::pi_v<float> * (23.0f * x - 3.0f * t));
+            }
+            for(std::size_t i = 0; i < spectrum.size(); i++) {
+                float f = static_cast<float>(i) / spectrum.size();
+                spectrum[i] = std::exp(-8.0f * f) * (0.6f + 0.4f * std::sin(12.0f * f + 2.0f * t));
+            }
+
+            vk::CommandBuffer& commandBuffer = commandBuffers[frame];
+            commandBuffer.begin(vk::CommandBufferBeginInfo());
+            vk::ClearValue clearValue(vk::ClearColorValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
+            vk::RenderPassBeginInfo renderPassInfo(renderPass.get(), framebuffers[frame].get(), vk::Rect2D({0, 0}, win->swapchainExtent), clearValue);
+            commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+
+            vk::Viewport viewport(0.0f, 0.0f, win->swapchainExtent.width, win->swapchainExtent.height, 0.0f, 1.0f);
+            vk::Rect2D scissor({0,0}, win->swapchainExtent);
+            commandBuffer.setViewport(0, viewport);
+            commandBuffer.setScissor(0, scissor);
+
+            visualiserRenderer.renderSamples(commandBuffer, frame, renderPass.get(), waveform,
+                glm::vec2{0.05f, 0.05f}, glm::vec2{0.9f, 0.4f}, glm::vec4{0.3f, 0.8f, 1.0f, 1.0f},
+                dreamrender::visualiser_params{.thickness = 3.0f, .smoothing = 1.5f});
+
+            auto bars = dreamrender::visualiser_params::spectrum(22050.0f / spectrum.size());
+            bars.points = 64;
+            visualiserRenderer.renderSamples(commandBuffer, frame, renderPass.get(), spectrum,
+                glm::vec2{0.05f, 0.55f}, glm::vec2{0.9f, 0.4f}, glm::vec4{1.0f, 0.5f, 0.2f, 1.0f}, bars);
+
+            commandBuffer.endRenderPass();
+            commandBuffer.end();
+
+            visualiserRenderer.finish(frame);
+
+            vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+            vk::SubmitInfo submitInfo(1, &imageAvailable, &waitStages, 1, &commandBuffer, 1, &renderFinished);
+            graphicsQueue.submit(submitInfo, fence);
+        }
+};
+
+int main() {
+    spdlog::set_level(spdlog::level::debug);
+
+    dreamrender::window_config config;
+    config.title = "Visualiser Renderer Example";
+    config.name = "visualiser-renderer-example";
+
+    dreamrender::window window{config};
+    window.init();
+    window.set_phase(new visualiser_phase(&window));
+    window.loop();
+}
@@ -0,0 +1,15 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) out vec2 outTexCoords;
+
+void main()
+{
+	// one triangle covering the whole level
+	outTexCoords = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(outTexCoords*2.0 - vec2(1.0, 1.0), 0.0, 1.0);
+}
@@ -0,0 +1,31 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) in vec2 inTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+layout(push_constant) uniform BlurParams
+{
+	// half a texel of the level that is written
+	vec2 half_texel;
+	float offset;
+} params;
+
+layout(set = 0, binding = 0) uniform sampler2D source;
+
+// Dual filter downsample: the centre and four diagonal taps, each bilinear tap averages four texels.
+void main()
+{
+	vec2 d = params.half_texel * params.offset;
+	vec4 sum = texture(source, inTexCoord) * 4.0;
+	sum += texture(source, inTexCoord - d);
+	sum += texture(source, inTexCoord + d);
+	sum += texture(source, inTexCoord + vec2(d.x, -d.y));
+	sum += texture(source, inTexCoord - vec2(d.x, -d.y));
+	outColor = sum / 8.0;
+}
@@ -0,0 +1,57 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) in vec2 inTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+layout(push_constant) uniform BackdropParams
+{
+	vec4 rect;
+	vec4 uv_rect;
+	vec4 tint;
+	float border_radius[4];
+	float aspect_ratio;
+	float opacity;
+} params;
+
+layout(set = 0, binding = 0) uniform sampler2D backdrop;
+
+void main()
+{
+	// Same rounded corners as simple_renderer.frag
+	float f = 1.0;
+	vec2 factor = vec2(params.aspect_ratio, 1.0);
+	vec2 scaled_position = inTexCoord * factor;
+	if(scaled_position.x < params.border_radius[0] && scaled_position.y < params.border_radius[0]) {
+		float d = distance(scaled_position, vec2(0.0, 0.0)+vec2(params.border_radius[0]));
+		if(d > params.border_radius[0]) {
+			f = 0.0;
+		}
+	}
+	if(scaled_position.x > factor.x - params.border_radius[1] && scaled_position.y < params.border_radius[1]) {
+		float d = distance(scaled_position, vec2(factor.x, 0.0)+vec2(-params.border_radius[1], params.border_radius[1]));
+		if(d > params.border_radius[1]) {
+			f = 0.0;
+		}
+	}
+	if(scaled_position.x > factor.x - params.border_radius[2] && scaled_position.y > factor.y - params.border_radius[2]) {
+		float d = distance(scaled_position, factor-vec2(params.border_radius[2]));
+		if(d > params.border_radius[2]) {
+			f = 0.0;
+		}
+	}
+	if(scaled_position.x < params.border_radius[3] && scaled_position.y > factor.y - params.border_radius[3]) {
+		float d = distance(scaled_position, vec2(0.0, factor.y)+vec2(params.border_radius[3], -params.border_radius[3]));
+		if(d > params.border_radius[3]) {
+			f = 0.0;
+		}
+	}
+
+	vec3 blurred = texture(backdrop, params.uv_rect.xy + inTexCoord * params.uv_rect.zw).rgb;
+	outColor = vec4(mix(blurred, params.tint.rgb, params.tint.a), params.opacity * f);
+}
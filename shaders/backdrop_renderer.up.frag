@@ -0,0 +1,34 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) in vec2 inTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+layout(push_constant) uniform BlurParams
+{
+	// half a texel of the level that is written
+	vec2 half_texel;
+	float offset;
+} params;
+
+layout(set = 0, binding = 0) uniform sampler2D source;
+
+// Dual filter upsample: a ring of four edge taps and four diagonal taps, the diagonals weighted twice.
+void main()
+{
+	vec2 d = params.half_texel * params.offset;
+	vec4 sum = texture(source, inTexCoord + vec2(-d.x * 2.0, 0.0));
+	sum += texture(source, inTexCoord + vec2(d.x * 2.0, 0.0));
+	sum += texture(source, inTexCoord + vec2(0.0, -d.y * 2.0));
+	sum += texture(source, inTexCoord + vec2(0.0, d.y * 2.0));
+	sum += texture(source, inTexCoord + vec2(-d.x, d.y)) * 2.0;
+	sum += texture(source, inTexCoord + vec2(d.x, d.y)) * 2.0;
+	sum += texture(source, inTexCoord + vec2(d.x, -d.y)) * 2.0;
+	sum += texture(source, inTexCoord + vec2(-d.x, -d.y)) * 2.0;
+	outColor = sum / 12.0;
+}
@@ -0,0 +1,34 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) out vec2 outTexCoords;
+
+layout(push_constant) uniform BackdropParams
+{
+	vec4 rect;
+	vec4 uv_rect;
+	vec4 tint;
+	float border_radius[4];
+	float aspect_ratio;
+	float opacity;
+} params;
+
+void main()
+{
+	// vertex array for a square as a triangle strip
+	const vec2 corners[4] = vec2[4](
+		vec2(0.0, 0.0),
+		vec2(1.0, 0.0),
+		vec2(0.0, 1.0),
+		vec2(1.0, 1.0)
+	);
+	vec2 corner = corners[gl_VertexIndex];
+	vec2 position = params.rect.xy + corner * params.rect.zw;
+	outTexCoords = corner;
+
+	gl_Position = vec4(position*2.0 - vec2(1.0, 1.0), 0.0, 1.0);
+}
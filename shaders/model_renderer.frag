@@ -0,0 +1,24 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) in vec3 inNormal;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+layout(push_constant) uniform RenderParams
+{
+	mat4 view_projection;
+	vec4 light;
+} params;
+
+void main()
+{
+	float diffuse = max(dot(normalize(inNormal), normalize(params.light.xyz)), 0.0);
+	outColor = vec4(inColor.rgb * min(params.light.w + diffuse, 1.0), inColor.a);
+}
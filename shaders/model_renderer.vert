@@ -0,0 +1,44 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 outNormal;
+layout(location = 1) out vec4 outColor;
+layout(location = 2) out vec2 outTexCoord;
+
+struct Instance
+{
+	mat4 transform;
+	vec4 color;
+	uint model;
+	uint command;
+	uint pad0;
+	uint pad1;
+};
+layout(set = 0, binding = 0, std430) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+layout(push_constant) uniform RenderParams
+{
+	mat4 view_projection;
+	vec4 light; // direction towards the light, ambient term in w
+} params;
+
+void main()
+{
+	// firstInstance of each draw command is the index of the instance.
+	Instance instance = instances[gl_InstanceIndex];
+	gl_Position = params.view_projection * instance.transform * vec4(inPosition, 1.0);
+	outNormal = mat3(instance.transform) * inNormal;
+	outColor = instance.color;
+	outTexCoord = inTexCoord;
+}
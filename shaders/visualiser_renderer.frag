@@ -0,0 +1,19 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+layout(location = 0) in vec4 inColor;
+// x: distance from the centre line, y: half width, z: distance inside the open edge (all in pixels)
+layout(location = 1) in vec3 inEdge;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	float inside = min(inEdge.y - abs(inEdge.x), inEdge.z);
+	float coverage = clamp(inside + 0.5, 0.0, 1.0);
+	outColor = vec4(inColor.rgb, inColor.a * coverage);
+}
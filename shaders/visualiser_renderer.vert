@@ -0,0 +1,205 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#version 450
+
+const uint MODE_LINE = 0;
+const uint MODE_BARS = 1;
+const uint MODE_FILLED = 2;
+
+const float NO_EDGE = 1.0e4;
+const int MAX_SMOOTHING_RADIUS = 16;
+const int MAX_BAR_SAMPLES = 32;
+
+layout(set = 0, binding = 0, std430) readonly buffer Samples
+{
+	float samples[];
+};
+
+layout(push_constant) uniform VisualiserParams
+{
+	vec4 rect;
+	vec4 color;
+	vec2 frame_size;
+	uint offset;
+	uint count;
+	uint points;
+	uint mode;
+	float thickness;
+	float smoothing;
+	float log_min;
+	float log_max;
+	float baseline;
+	float gap;
+	float min_value;
+	float max_value;
+} params;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec3 outEdge;
+
+float fetch(int i)
+{
+	return samples[params.offset + clamp(i, 0, int(params.count) - 1)];
+}
+
+float sample_linear(float x)
+{
+	float f = floor(x);
+	return mix(fetch(int(f)), fetch(int(f) + 1), x - f);
+}
+
+float sample_smoothed(float x)
+{
+	if(params.smoothing <= 0.0) {
+		return sample_linear(x);
+	}
+	int radius = min(int(ceil(2.0 * params.smoothing)), MAX_SMOOTHING_RADIUS);
+	float sum = 0.0;
+	float weights = 0.0;
+	for(int k = -radius; k <= radius; k++) {
+		float w = exp(-0.5 * float(k*k) / (params.smoothing * params.smoothing));
+		sum += w * sample_linear(x + float(k));
+		weights += w;
+	}
+	return sum / weights;
+}
+
+// Maps t in [0, 1] across the graph to a (fractional) index into the sample array.
+float source_position(float t)
+{
+	float last = float(params.count - 1);
+	if(params.log_min > 0.0) {
+		float hi = params.log_max > params.log_min ? params.log_max : last;
+		return clamp(params.log_min * pow(hi / params.log_min, t), 0.0, last);
+	}
+	return t * last;
+}
+
+float normalized(float v)
+{
+	return clamp((v - params.min_value) / (params.max_value - params.min_value), 0.0, 1.0);
+}
+
+// Pixel position of the value at t, with y growing downwards.
+vec2 graph_point(float t, float value)
+{
+	vec2 origin = params.rect.xy * params.frame_size;
+	vec2 size = params.rect.zw * params.frame_size;
+	return origin + vec2(t * size.x, (1.0 - value) * size.y);
+}
+
+vec4 to_clip(vec2 pixel)
+{
+	return vec4(pixel / params.frame_size * 2.0 - vec2(1.0), 0.0, 1.0);
+}
+
+void emit_line(uint segment, uint corner)
+{
+	const vec2 corners[6] = vec2[6](
+		vec2(0.0, -1.0), vec2(1.0, -1.0), vec2(0.0, 1.0),
+		vec2(0.0, 1.0), vec2(1.0, -1.0), vec2(1.0, 1.0)
+	);
+	vec2 c = corners[corner];
+	float steps = float(params.points - 1);
+
+	float t0 = float(segment) / steps;
+	float t1 = float(segment + 1) / steps;
+	vec2 p0 = graph_point(t0, normalized(sample_smoothed(source_position(t0))));
+	vec2 p1 = graph_point(t1, normalized(sample_smoothed(source_position(t1))));
+
+	vec2 dir = p1 - p0;
+	float len = length(dir);
+	dir = len > 0.0 ? dir / len : vec2(1.0, 0.0);
+	vec2 normal = vec2(-dir.y, dir.x);
+
+	float half_width = 0.5 * params.thickness;
+	float extent = half_width + 1.0; // one extra pixel for the anti-aliased fringe
+	vec2 p = mix(p0, p1, c.x)
+		+ normal * c.y * extent
+		+ dir * (c.x * 2.0 - 1.0) * half_width;
+
+	gl_Position = to_clip(p);
+	outEdge = vec3(c.y * extent, half_width, NO_EDGE);
+}
+
+void emit_filled(uint segment, uint corner)
+{
+	// x: 0 = left, 1 = right; y: 0 = curve, 1 = baseline
+	const vec2 corners[6] = vec2[6](
+		vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+		vec2(0.0, 1.0), vec2(1.0, 0.0), vec2(1.0, 1.0)
+	);
+	vec2 c = corners[corner];
+	float t = float(segment + uint(c.x)) / float(params.points - 1);
+	float value = normalized(sample_smoothed(source_position(t)));
+
+	vec2 curve = graph_point(t, value);
+	vec2 base = graph_point(t, params.baseline);
+	float height = base.y - curve.y;
+	float side = sign(height);
+
+	// Push the curve edge outwards by one pixel so the fringe can fade out.
+	vec2 p = c.y > 0.5 ? base : curve - vec2(0.0, side);
+	float inside = c.y > 0.5 ? abs(height) : -1.0;
+
+	gl_Position = to_clip(p);
+	outEdge = vec3(0.0, NO_EDGE, inside);
+}
+
+void emit_bar(uint bar, uint corner)
+{
+	const vec2 corners[6] = vec2[6](
+		vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+		vec2(0.0, 1.0), vec2(1.0, 0.0), vec2(1.0, 1.0)
+	);
+	vec2 c = corners[corner];
+	float bars = float(params.points);
+
+	float s0 = source_position(float(bar) / bars);
+	float s1 = source_position(float(bar + 1) / bars);
+	float value;
+	if(s1 - s0 <= 1.0) {
+		value = sample_smoothed(0.5 * (s0 + s1));
+	} else {
+		// Several source samples fall into this bar, show the strongest one.
+		value = params.min_value;
+		float step = max(1.0, (s1 - s0) / float(MAX_BAR_SAMPLES));
+		for(float s = s0; s < s1; s += step) {
+			value = max(value, sample_smoothed(s));
+		}
+	}
+	value = normalized(value);
+
+	float t_left = (float(bar) + 0.5 * params.gap) / bars;
+	float t_right = (float(bar + 1) - 0.5 * params.gap) / bars;
+	vec2 left = graph_point(t_left, value);
+	vec2 right = graph_point(t_right, params.baseline);
+	float half_width = 0.5 * (right.x - left.x);
+	float height = right.y - left.y;
+	float side = sign(height);
+
+	vec2 p = vec2(mix(left.x - 1.0, right.x + 1.0, c.x), c.y > 0.5 ? right.y : left.y - side);
+	float across = (c.x * 2.0 - 1.0) * (half_width + 1.0);
+	float inside = c.y > 0.5 ? abs(height) : -1.0;
+
+	gl_Position = to_clip(p);
+	outEdge = vec3(across, half_width, inside);
+}
+
+void main()
+{
+	uint primitive = uint(gl_VertexIndex) / 6;
+	uint corner = uint(gl_VertexIndex) % 6;
+
+	outColor = params.color;
+	if(params.mode == MODE_BARS) {
+		emit_bar(primitive, corner);
+	} else if(params.mode == MODE_FILLED) {
+		emit_filled(primitive, corner);
+	} else {
+		emit_line(primitive, corner);
+	}
+}
@@ -0,0 +1,253 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+export module dreamrender:asset_pack;
+
+import :utils;
+
+import spdlog;
+
+namespace dreamrender {
+
+// A read-only archive of many small assets in one memory-mapped file, so loading them costs
+// no file opens. The file starts with a header and a table of contents sorted by the hash of
+// the asset names, followed by the names and the data of the assets, each aligned.
+// Images may be stored decoded as RGBA, they are then uploaded without decoding.
+export class asset_pack {
+    public:
+        struct entry {
+            uint64_t hash;
+            uint64_t offset;
+            uint64_t size;
+            uint32_t nameOffset;
+            uint32_t nameSize;
+            // Format of the data, like the type of a LoadDataView ("PNG", "OBJ", ...), or "RGBA"
+            // for decoded images of width x height.
+            std::array<char, 8> type;
+            uint32_t width;
+            uint32_t height;
+
+            std::string_view format() const {
+                return std::string_view(type.data(), std::ranges::find(type, '\0') - type.begin());
+            }
+        };
+
+        explicit asset_pack(std::filesystem::path path) : filePath(std::move(path)), file(filePath) {
+            std::span<const uint8_t> data = file.data();
+            file_header header{};
+            if(data.size() < sizeof(header)) {
+                throw std::runtime_error("Asset pack is too small: " + filePath.string());
+            }
+            std::memcpy(&header, data.data(), sizeof(header));
+            if(header.magic != file_magic || header.version != file_version) {
+                throw std::runtime_error("Unknown asset pack format: " + filePath.string());
+            }
+            // Each term is checked on its own, so damaged offsets cannot overflow past the checks.
+            auto fits = [](uint64_t offset, uint64_t size, uint64_t total) {
+                return offset <= total && size <= total - offset;
+            };
+            if(header.count > data.size() / sizeof(entry) || header.tocOffset % alignof(entry) != 0 ||
+               !fits(header.tocOffset, header.count * sizeof(entry), data.size()) ||
+               !fits(header.namesOffset, header.namesSize, data.size()))
+            {
+                throw std::runtime_error("Asset pack is truncated: " + filePath.string());
+            }
+            toc = std::span(reinterpret_cast<const entry*>(data.data() + header.tocOffset), header.count);
+            names = std::string_view(reinterpret_cast<const char*>(data.data() + header.namesOffset), header.namesSize);
+            for(const entry& e : toc) {
+                if(!fits(e.offset, e.size, data.size()) || !fits(e.nameOffset, e.nameSize, names.size())) {
+                    throw std::runtime_error("Asset pack is truncated: " + filePath.string());
+                }
+            }
+            // find relies on it.
+            if(!std::ranges::is_sorted(toc, {}, &entry::hash)) {
+                throw std::runtime_error("Asset pack table of contents is not sorted: " + filePath.string());
+            }
+            spdlog::debug("Opened asset pack {} with {} assets", filePath.string(), toc.size());
+        }
+
+        asset_pack(const asset_pack&) = delete;
+        asset_pack& operator=(const asset_pack&) = delete;
+
+        // Names are relative paths with forward slashes, like "icons/home.png".
+        const entry* find(std::string_view name) const {
+            const uint64_t h = hash(name);
+            auto it = std::ranges::lower_bound(toc, h, {}, &entry::hash);
+            for(; it != toc.end() && it->hash == h; ++it) {
+                if(this->name(*it) == name) {
+                    return &*it;
+                }
+            }
+            return nullptr;
+        }
+        std::string_view name(const entry& e) const {
+            return names.substr(e.nameOffset, e.nameSize);
+        }
+        std::span<const uint8_t> data(const entry& e) const {
+            return file.data().subspan(e.offset, e.size);
+        }
+        // Asks the OS to read the data of the entry ahead, for entries that are loaded soon.
+        void will_need(const entry& e) const {
+            file.will_need(e.offset, e.size);
+        }
+
+        std::span<const entry> entries() const {
+            return toc;
+        }
+        const std::filesystem::path& path() const {
+            return filePath;
+        }
+
+        // FNV-1a of the name.
+        static uint64_t hash(std::string_view name) {
+            uint64_t h = 0xcbf29ce484222325ull;
+            for(char c : name) {
+                h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+            }
+            return h;
+        }
+    private:
+        friend class asset_pack_writer;
+
+        static constexpr std::array<char, 4> file_magic = {'D', 'R', 'A', 'P'};
+        static constexpr uint32_t file_version = 1;
+
+        struct file_header {
+            std::array<char, 4> magic;
+            uint32_t version;
+            uint64_t count;
+            uint64_t tocOffset;
+            uint64_t namesOffset;
+            uint64_t namesSize;
+        };
+
+        std::filesystem::path filePath;
+        mapped_file file;
+        std::span<const entry> toc;
+        std::string_view names;
+};
+
+// Builds an asset_pack, see the dreams_pack tool.
+export class asset_pack_writer {
+    public:
+        // Data of every asset starts at a multiple of alignment, which must be a power of two.
+        explicit asset_pack_writer(uint32_t alignment = 64) : alignment(alignment) {
+            if(alignment == 0 || (alignment & (alignment - 1)) != 0) {
+                throw std::invalid_argument("Alignment must be a power of two");
+            }
+        }
+
+        void add(std::string name, std::vector<uint8_t> data, std::string_view type, uint32_t width = 0, uint32_t height = 0) {
+            if(type.size() >= sizeof(asset_pack::entry::type)) {
+                throw std::invalid_argument("Asset type is too long: " + std::string(type));
+            }
+            if(type == "RGBA" && data.size() != static_cast<std::size_t>(width) * height * 4) {
+                throw std::invalid_argument("Decoded image has the wrong size: " + name);
+            }
+            pending_asset asset{std::move(name), std::move(data), {}, width, height};
+            std::ranges::copy(type, asset.type.begin());
+            assets.push_back(std::move(asset));
+        }
+        std::size_t size() const {
+            return assets.size();
+        }
+
+        // Writes the pack next to path and renames it over path, so it is never partial.
+        void write(const std::filesystem::path& path) {
+            std::ranges::sort(assets, [](const pending_asset& a, const pending_asset& b) {
+                const uint64_t ha = asset_pack::hash(a.name), hb = asset_pack::hash(b.name);
+                return ha != hb ? ha < hb : a.name < b.name;
+            });
+            for(std::size_t i = 1; i < assets.size(); i++) {
+                if(assets[i].name == assets[i - 1].name) {
+                    throw std::invalid_argument("Duplicate asset: " + assets[i].name);
+                }
+            }
+
+            std::string names;
+            std::vector<asset_pack::entry> toc;
+            toc.reserve(assets.size());
+            for(const pending_asset& a : assets) {
+                toc.push_back(asset_pack::entry{
+                    .hash = asset_pack::hash(a.name),
+                    .offset = 0,
+                    .size = a.data.size(),
+                    .nameOffset = static_cast<uint32_t>(names.size()),
+                    .nameSize = static_cast<uint32_t>(a.name.size()),
+                    .type = a.type,
+                    .width = a.width,
+                    .height = a.height,
+                });
+                names += a.name;
+            }
+
+            asset_pack::file_header header{
+                .magic = asset_pack::file_magic,
+                .version = asset_pack::file_version,
+                .count = toc.size(),
+                .tocOffset = sizeof(asset_pack::file_header),
+                .namesOffset = sizeof(asset_pack::file_header) + toc.size() * sizeof(asset_pack::entry),
+                .namesSize = names.size(),
+            };
+            uint64_t offset = align(header.namesOffset + header.namesSize);
+            for(auto& e : toc) {
+                e.offset = offset;
+                offset = align(offset + e.size);
+            }
+
+            auto temporary = path;
+            temporary += ".tmp";
+            {
+                std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                out.write(reinterpret_cast<const char*>(toc.data()), static_cast<std::streamsize>(toc.size() * sizeof(asset_pack::entry)));
+                out.write(names.data(), static_cast<std::streamsize>(names.size()));
+                uint64_t position = header.namesOffset + header.namesSize;
+                const std::vector<char> padding(alignment, 0);
+                for(std::size_t i = 0; i < assets.size(); i++) {
+                    out.write(padding.data(), static_cast<std::streamsize>(toc[i].offset - position));
+                    out.write(reinterpret_cast<const char*>(assets[i].data.data()), static_cast<std::streamsize>(assets[i].data.size()));
+                    position = toc[i].offset + toc[i].size;
+                }
+                if(!out) {
+                    throw std::runtime_error("Failed to write asset pack: " + temporary.string());
+                }
+            }
+            std::filesystem::rename(temporary, path);
+            spdlog::debug("Wrote asset pack {} with {} assets", path.string(), assets.size());
+        }
+    private:
+        struct pending_asset {
+            std::string name;
+            std::vector<uint8_t> data;
+            std::array<char, 8> type;
+            uint32_t width;
+            uint32_t height;
+        };
+
+        uint32_t alignment;
+        std::vector<pending_asset> assets;
+
+        uint64_t align(uint64_t offset) const {
+            return (offset + alignment - 1) & ~static_cast<uint64_t>(alignment - 1);
+        }
+};
+
+}
@@ -0,0 +1,500 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <numbers>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+export module dreamrender:audio_analyser;
+
+import sdl2;
+import spdlog;
+
+namespace dreamrender {
+
+#ifdef __cpp_lib_hardware_interference_size
+constexpr std::size_t cache_line_size = std::hardware_destructive_interference_size;
+#else
+constexpr std::size_t cache_line_size = 64;
+#endif
+
+// Wait-free single-producer/single-consumer ring buffer.
+// Writes that do not fit are truncated instead of blocking the producer.
+export template<typename T>
+class spsc_ring {
+    public:
+        explicit spsc_ring(std::size_t capacity) :
+            buffer(std::bit_ceil(std::max<std::size_t>(capacity, 2))), mask(buffer.size() - 1) {}
+
+        std::size_t capacity() const {
+            return buffer.size();
+        }
+
+        // Producer side. Returns the number of elements written.
+        std::size_t push(std::span<const T> data) {
+            const std::size_t w = write.load(std::memory_order_relaxed);
+            const std::size_t r = read.load(std::memory_order_acquire);
+            const std::size_t count = std::min(data.size(), buffer.size() - (w - r));
+
+            const std::size_t start = w & mask;
+            const std::size_t first = std::min(count, buffer.size() - start);
+            std::copy_n(data.begin(), first, buffer.begin() + start);
+            std::copy_n(data.begin() + first, count - first, buffer.begin());
+
+            write.store(w + count, std::memory_order_release);
+            return count;
+        }
+
+        // Consumer side. Returns the number of elements read.
+        std::size_t pop(std::span<T> data) {
+            const std::size_t r = read.load(std::memory_order_relaxed);
+            const std::size_t w = write.load(std::memory_order_acquire);
+            const std::size_t count = std::min(data.size(), w - r);
+
+            const std::size_t start = r & mask;
+            const std::size_t first = std::min(count, buffer.size() - start);
+            std::copy_n(buffer.begin() + start, first, data.begin());
+            std::copy_n(buffer.begin(), count - first, data.begin() + first);
+
+            read.store(r + count, std::memory_order_release);
+            return count;
+        }
+
+        std::size_t available() const {
+            return write.load(std::memory_order_acquire) - read.load(std::memory_order_relaxed);
+        }
+    private:
+        std::vector<T> buffer;
+        std::size_t mask;
+
+        alignas(cache_line_size) std::atomic<std::size_t> write{0};
+        alignas(cache_line_size) std::atomic<std::size_t> read{0};
+};
+
+// Real-input FFT of a power-of-two size, computed as a half size complex FFT.
+// Data is kept as separate real/imaginary arrays with per-stage contiguous twiddles,
+// so the butterfly loops are plain unit-stride loops the compiler can vectorise.
+export class real_fft {
+    public:
+        explicit real_fft(std::size_t size) : n(size), m(size / 2) {
+            if(size < 4 || !std::has_single_bit(size)) {
+                throw std::invalid_argument("FFT size must be a power of two and at least 4");
+            }
+
+            re.resize(m);
+            im.resize(m);
+            twiddleRe.resize(m);
+            twiddleIm.resize(m);
+            for(std::size_t half = 1; half < m; half *= 2) {
+                for(std::size_t j = 0; j < half; j++) {
+                    double angle = -std::numbers::pi * static_cast<double>(j) / static_cast<double>(half);
+                    twiddleRe[half - 1 + j] = static_cast<float>(std::cos(angle));
+                    twiddleIm[half - 1 + j] = static_cast<float>(std::sin(angle));
+                }
+            }
+
+            splitRe.resize(m + 1);
+            splitIm.resize(m + 1);
+            for(std::size_t k = 0; k <= m; k++) {
+                double angle = -2.0 * std::numbers::pi * static_cast<double>(k) / static_cast<double>(n);
+                splitRe[k] = static_cast<float>(std::cos(angle));
+                splitIm[k] = static_cast<float>(std::sin(angle));
+            }
+
+            const int bits = std::countr_zero(m);
+            reversed.resize(m);
+            for(std::size_t i = 0; i < m; i++) {
+                std::size_t r = 0;
+                for(int b = 0; b < bits; b++) {
+                    r |= ((i >> b) & 1) << (bits - 1 - b);
+                }
+                reversed[i] = static_cast<uint32_t>(r);
+            }
+        }
+
+        std::size_t size() const {
+            return n;
+        }
+        std::size_t bins() const {
+            return m + 1;
+        }
+
+        // Computes |X[k]| for k = 0..size/2 of the real input.
+        void magnitudes(std::span<const float> input, std::span<float> output) {
+            if(input.size() != n || output.size() != m + 1) {
+                throw std::invalid_argument("FFT buffer size mismatch");
+            }
+
+            // Pack even/odd samples as real/imaginary parts, in bit-reversed order.
+            for(std::size_t i = 0; i < m; i++) {
+                re[reversed[i]] = input[2*i];
+                im[reversed[i]] = input[2*i+1];
+            }
+
+            for(std::size_t half = 1; half < m; half *= 2) {
+                const float* wr = twiddleRe.data() + half - 1;
+                const float* wi = twiddleIm.data() + half - 1;
+                for(std::size_t block = 0; block < m; block += 2*half) {
+                    float* ar = re.data() + block;
+                    float* ai = im.data() + block;
+                    float* br = ar + half;
+                    float* bi = ai + half;
+                    for(std::size_t j = 0; j < half; j++) {
+                        float vr = br[j]*wr[j] - bi[j]*wi[j];
+                        float vi = br[j]*wi[j] + bi[j]*wr[j];
+                        br[j] = ar[j] - vr;
+                        bi[j] = ai[j] - vi;
+                        ar[j] += vr;
+                        ai[j] += vi;
+                    }
+                }
+            }
+
+            // Separate the spectra of the even and odd samples and combine them.
+            for(std::size_t k = 0; k <= m; k++) {
+                const std::size_t a = k == m ? 0 : k;
+                const std::size_t b = k == 0 ? 0 : m - k;
+                float zr = re[a], zi = im[a];
+                float cr = re[b], ci = -im[b];
+
+                float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+                float orr = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+
+                float xr = er + splitRe[k]*orr - splitIm[k]*oi;
+                float xi = ei + splitRe[k]*oi + splitIm[k]*orr;
+                output[k] = std::sqrt(xr*xr + xi*xi);
+            }
+        }
+    private:
+        std::size_t n;
+        std::size_t m;
+
+        std::vector<float> re, im;
+        std::vector<float> twiddleRe, twiddleIm;
+        std::vector<float> splitRe, splitIm;
+        std::vector<uint32_t> reversed;
+};
+
+export struct audio_analyser_config {
+    float sample_rate = sdl::mix::default_frequency;
+    // Must be a power of two.
+    unsigned int fft_size = 2048;
+    // Number of new samples between two analyses.
+    unsigned int hop_size = 512;
+    // Mono samples kept between the audio callback and the worker.
+    unsigned int ring_capacity = 16384;
+
+    unsigned int band_count = 32;
+    float min_frequency = 20.0f;
+    float max_frequency = 16000.0f;
+
+    // Decibel range mapped to 0..1 in the spectrum and bands.
+    float min_db = -80.0f;
+    float max_db = 0.0f;
+
+    // Fraction of the previous value kept per analysis when a bin falls (0 = no smoothing).
+    float release = 0.7f;
+};
+
+export struct audio_analysis {
+    // Incremented for every published analysis, 0 means nothing has been analysed yet.
+    uint64_t sequence = 0;
+    float sample_rate = 0.0f;
+    // Frequency distance between two spectrum bins in Hz.
+    float bin_frequency = 0.0f;
+
+    // Largest absolute sample and RMS of the analysed window.
+    float peak = 0.0f;
+    float rms = 0.0f;
+    // Frequency and normalised level of the strongest spectral component.
+    float peak_frequency = 0.0f;
+    float peak_level = 0.0f;
+
+    // fft_size/2+1 bins, normalised to 0..1 over the configured decibel range.
+    std::vector<float> spectrum;
+    // Logarithmically spaced bands between min_frequency and max_frequency.
+    std::vector<float> bands;
+};
+
+// Analyses the mixed audio output.
+// The audio thread only writes into a wait-free ring, FFTs run on a worker thread and
+// the render thread reads the latest result without ever blocking either of them.
+export class audio_analyser {
+    public:
+        audio_analyser(audio_analyser_config config = {}) :
+            config(config), ring(config.ring_capacity), fft(config.fft_size),
+            history(config.fft_size), window(config.fft_size), windowed(config.fft_size),
+            magnitudes(fft.bins()), smoothed(fft.bins()), chunk(config.hop_size)
+        {
+            if(config.hop_size == 0 || config.hop_size > config.fft_size) {
+                throw std::invalid_argument("Hop size must be between 1 and the FFT size");
+            }
+
+            double sum = 0.0;
+            for(unsigned int i = 0; i < config.fft_size; i++) {
+                window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * std::numbers::pi * i / config.fft_size));
+                sum += window[i];
+            }
+            // Scale so a full-scale sine reads as 0 dB.
+            amplitudeScale = static_cast<float>(2.0 / sum);
+
+            const float binFrequency = config.sample_rate / config.fft_size;
+            bandEdges.resize(config.band_count + 1);
+            for(unsigned int b = 0; b <= config.band_count; b++) {
+                float f = config.min_frequency * std::pow(config.max_frequency / config.min_frequency,
+                    static_cast<float>(b) / config.band_count);
+                bandEdges[b] = std::clamp(static_cast<unsigned int>(f / binFrequency), 1u, static_cast<unsigned int>(fft.bins() - 1));
+            }
+
+            for(auto& s : slots) {
+                s.sample_rate = config.sample_rate;
+                s.bin_frequency = binFrequency;
+                s.spectrum.assign(fft.bins(), 0.0f);
+                s.bands.assign(config.band_count, 0.0f);
+            }
+        }
+        ~audio_analyser() {
+            detach_mixer();
+            stop();
+        }
+
+        audio_analyser(const audio_analyser&) = delete;
+        audio_analyser& operator=(const audio_analyser&) = delete;
+
+        const audio_analyser_config& get_config() const {
+            return config;
+        }
+
+        // Producer side: interleaved float samples, downmixed to mono. Never blocks or allocates.
+        // Throws std::invalid_argument if channels is not positive.
+        void push_samples(std::span<const float> interleaved, int channels = 1) {
+            if(channels <= 0) {
+                throw std::invalid_argument("Channel count must be positive");
+            }
+            std::array<float, 512> mono;
+            const std::size_t frames = interleaved.size() / channels;
+            for(std::size_t offset = 0; offset < frames; offset += mono.size()) {
+                const std::size_t count = std::min(mono.size(), frames - offset);
+                for(std::size_t i = 0; i < count; i++) {
+                    float sum = 0.0f;
+                    for(int c = 0; c < channels; c++) {
+                        sum += interleaved[(offset + i)*channels + c];
+                    }
+                    mono[i] = sum / channels;
+                }
+                dropped.fetch_add(count - ring.push(std::span(mono.data(), count)), std::memory_order_relaxed);
+            }
+        }
+        void push_samples(std::span<const int16_t> interleaved, int channels = 1) {
+            if(channels <= 0) {
+                throw std::invalid_argument("Channel count must be positive");
+            }
+            std::array<float, 512> mono;
+            const std::size_t frames = interleaved.size() / channels;
+            for(std::size_t offset = 0; offset < frames; offset += mono.size()) {
+                const std::size_t count = std::min(mono.size(), frames - offset);
+                for(std::size_t i = 0; i < count; i++) {
+                    int sum = 0;
+                    for(int c = 0; c < channels; c++) {
+                        sum += interleaved[(offset + i)*channels + c];
+                    }
+                    mono[i] = static_cast<float>(sum) / (32768.0f * channels);
+                }
+                dropped.fetch_add(count - ring.push(std::span(mono.data(), count)), std::memory_order_relaxed);
+            }
+        }
+
+        // Installs the SDL_mixer postmix hook. Only one postmix hook can be active at a time.
+        bool attach_mixer() {
+            int frequency = 0;
+            uint16_t format = 0;
+            int channels = 0;
+            if(sdl::mix::QuerySpec(&frequency, &format, &channels) == 0) {
+                spdlog::warn("Cannot attach audio analyser, audio is not open: {}", sdl::mix::GetError());
+                return false;
+            }
+            if(format != sdl::mix::format_s16 && format != sdl::mix::format_f32) {
+                spdlog::warn("Audio analyser does not support mixer format {:#x}", format);
+                return false;
+            }
+            if(static_cast<float>(frequency) != config.sample_rate) {
+                spdlog::warn("Audio analyser configured for {} Hz, but mixer runs at {} Hz", config.sample_rate, frequency);
+            }
+            mixerFormat = format;
+            mixerChannels = channels;
+            sdl::mix::SetPostMix(&audio_analyser::postmix, this);
+            mixerAttached = true;
+            return true;
+        }
+        void detach_mixer() {
+            if(mixerAttached) {
+                sdl::mix::SetPostMix(nullptr, nullptr);
+                mixerAttached = false;
+            }
+        }
+
+        void start() {
+            if(worker.joinable()) {
+                return;
+            }
+            quit = false;
+            worker = std::thread(&audio_analyser::analysisThread, this);
+        }
+        void stop() {
+            quit = true;
+            if(worker.joinable()) {
+                worker.join();
+            }
+        }
+
+        // Consumer side: analyses all complete hops available in the ring.
+        // Called by the worker thread, or directly when no worker is running (e.g. for synthetic input).
+        // Returns whether a new analysis was published.
+        bool process() {
+            bool published = false;
+            while(ring.available() >= chunk.size()) {
+                ring.pop(chunk);
+                std::shift_left(history.begin(), history.end(), chunk.size());
+                std::ranges::copy(chunk, history.end() - chunk.size());
+                analyse();
+                published = true;
+            }
+            return published;
+        }
+
+        // Render thread side: the most recent analysis.
+        // The reference stays valid and unchanged until the next call to latest().
+        const audio_analysis& latest() {
+            if(exchange.load(std::memory_order_relaxed) & fresh_bit) {
+                front = exchange.exchange(front, std::memory_order_acq_rel) & index_mask;
+            }
+            return slots[front];
+        }
+
+        // Samples the audio thread had to discard because the worker fell behind.
+        uint64_t dropped_samples() const {
+            return dropped.load(std::memory_order_relaxed);
+        }
+    private:
+        // Three slots form a lock-free double buffer: one is being written, one is being read
+        // and the third holds the newest finished result, so neither side ever waits.
+        static constexpr unsigned int fresh_bit = 4;
+        static constexpr unsigned int index_mask = 3;
+
+        audio_analyser_config config;
+        spsc_ring<float> ring;
+        real_fft fft;
+
+        std::vector<float> history;
+        std::vector<float> window;
+        std::vector<float> windowed;
+        std::vector<float> magnitudes;
+        std::vector<float> smoothed;
+        std::vector<float> chunk;
+        std::vector<unsigned int> bandEdges;
+        float amplitudeScale = 1.0f;
+        uint64_t sequence = 0;
+
+        std::array<audio_analysis, 3> slots;
+        unsigned int back = 0;
+        std::atomic<unsigned int> exchange{1};
+        unsigned int front = 2;
+
+        std::atomic<uint64_t> dropped{0};
+
+        uint16_t mixerFormat = 0;
+        int mixerChannels = 0;
+        bool mixerAttached = false;
+
+        std::thread worker;
+        std::atomic<bool> quit = false;
+
+        static void postmix(void* udata, uint8_t* stream, int len) {
+            auto* self = static_cast<audio_analyser*>(udata);
+            if(self->mixerFormat == sdl::mix::format_f32) {
+                self->push_samples(std::span(reinterpret_cast<const float*>(stream), len / sizeof(float)), self->mixerChannels);
+            } else {
+                self->push_samples(std::span(reinterpret_cast<const int16_t*>(stream), len / sizeof(int16_t)), self->mixerChannels);
+            }
+        }
+
+        void analysisThread() {
+            const auto hopDuration = std::chrono::duration<double>(config.hop_size / config.sample_rate);
+            while(!quit) {
+                if(!process()) {
+                    std::this_thread::sleep_for(hopDuration / 2);
+                }
+            }
+        }
+
+        void analyse() {
+            audio_analysis& out = slots[back];
+
+            float peak = 0.0f;
+            float energy = 0.0f;
+            for(std::size_t i = 0; i < history.size(); i++) {
+                peak = std::max(peak, std::abs(history[i]));
+                energy += history[i] * history[i];
+                windowed[i] = history[i] * window[i];
+            }
+            fft.magnitudes(windowed, magnitudes);
+
+            const float range = config.max_db - config.min_db;
+            std::size_t peakBin = 1;
+            for(std::size_t k = 0; k < magnitudes.size(); k++) {
+                float db = 20.0f * std::log10(std::max(magnitudes[k] * amplitudeScale, 1e-9f));
+                float level = std::clamp((db - config.min_db) / range, 0.0f, 1.0f);
+                smoothed[k] = std::max(level, smoothed[k] * config.release);
+                if(k > 0 && magnitudes[k] > magnitudes[peakBin]) {
+                    peakBin = k;
+                }
+            }
+
+            std::ranges::copy(smoothed, out.spectrum.begin());
+
+            for(unsigned int b = 0; b < config.band_count; b++) {
+                const unsigned int first = bandEdges[b];
+                const unsigned int last = std::max(bandEdges[b + 1], first + 1);
+                float value = 0.0f;
+                for(unsigned int k = first; k < last && k < out.spectrum.size(); k++) {
+                    value = std::max(value, out.spectrum[k]);
+                }
+                out.bands[b] = value;
+            }
+
+            // Parabolic interpolation around the strongest bin for a sub-bin frequency estimate.
+            float offset = 0.0f;
+            if(peakBin + 1 < magnitudes.size()) {
+                float l = magnitudes[peakBin - 1], c = magnitudes[peakBin], r = magnitudes[peakBin + 1];
+                float d = l - 2.0f * c + r;
+                if(d != 0.0f) {
+                    offset = std::clamp(0.5f * (l - r) / d, -0.5f, 0.5f);
+                }
+            }
+
+            out.sequence = ++sequence;
+            out.peak = peak;
+            out.rms = std::sqrt(energy / history.size());
+            out.peak_frequency = (peakBin + offset) * out.bin_frequency;
+            out.peak_level = out.spectrum[peakBin];
+
+            back = exchange.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+        }
+};
+
+}
@@ -0,0 +1,500 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+export module dreamrender:components.backdrop_renderer;
+
+import :debug;
+import :pipeline_compiler;
+import :profiler;
+import :shaders;
+import :texture;
+import :utils;
+
+import glm;
+import vulkan_hpp;
+import vma;
+
+namespace dreamrender {
+
+export struct backdrop_params {
+    // Downsample and upsample steps. Every step halves the resolution once more, so the
+    // radius of the blur roughly doubles with each one while the cost barely grows.
+    unsigned int passes = 4;
+    // Spread of the samples in texels of each level, widens the blur at the same cost.
+    float offset = 1.5f;
+};
+
+export struct backdrop_style {
+    // Rounded corners like simple_params::border_radius.
+    std::array<float, 4> border_radius{};
+    // Mixed over the blurred backdrop by its alpha, e.g. to lighten frosted glass.
+    glm::vec4 tint = glm::vec4(0.0f);
+    float opacity = 1.0f;
+};
+
+export struct backdrop_statistics {
+    // Frames in which the panel was blurred, and frames in which its blur was reused.
+    uint64_t blurred = 0;
+    uint64_t reused = 0;
+    // Region that is captured in pixels, including the margin the blur reads from.
+    vk::Rect2D region;
+    // Resolution of the first level, half of the region.
+    vk::Extent2D resolution;
+    unsigned int passes = 0;
+};
+
+// Blurs what lies behind translucent panels, for frosted glass.
+//
+// capture copies the region under a panel at half resolution and blurs it with the dual
+// filter (Kawase) chain: it is downsampled a number of times and upsampled back, with a few
+// bilinear taps per pixel at every level. render then draws the blur over the panel with the
+// rounded corners of simple_renderer. capture reads the image that was rendered so far, so it
+// must be recorded between two render passes, and the second one has to load the image.
+//
+// Every panel keeps its blur. It is only redone when the panel moves, its parameters change or
+// the key of the content behind it changes, so static backdrops cost nothing but the composite.
+// Its levels are only allocated again when its size changes, which every frame of a resize
+// animation does.
+// Panels are named, the names are used as profiler zones of their blur and must outlive the
+// profiler, string literals are expected.
+export class backdrop_renderer {
+    public:
+        constexpr static unsigned int default_max_panels = 16;
+        constexpr static unsigned int max_passes = 8;
+
+        backdrop_renderer(vk::Device device, vma::Allocator allocator, vk::Extent2D frameSize, const gpu_features& features) :
+            device(device), allocator(allocator), frameSize(frameSize),
+            aspectRatio(static_cast<double>(frameSize.width)/frameSize.height) {}
+        ~backdrop_renderer() {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+        }
+
+        // The pipelines are compiled in the background if a pipeline_compiler is active,
+        // the returned future is ready once they are.
+        std::shared_future<void> preload(const render_targets& targets, vk::SampleCountFlagBits sampleCount,
+            vk::PipelineCache pipelineCache = {}, unsigned int max_panels = default_max_panels)
+        {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+            this->max_panels = max_panels;
+            {
+                vk::SamplerCreateInfo sampler_info({}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eNearest,
+                    vk::SamplerAddressMode::eClampToEdge, vk::SamplerAddressMode::eClampToEdge, vk::SamplerAddressMode::eClampToEdge,
+                    0.0f, false, 0.0f, false, vk::CompareOp::eNever, 0.0f, 0.0f, vk::BorderColor::eFloatTransparentBlack, false);
+                sampler = device.createSamplerUnique(sampler_info);
+            }
+            {
+                std::array<vk::DescriptorSetLayoutBinding, 1> bindings = {
+                    vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment)
+                };
+                descriptorLayout = device.createDescriptorSetLayoutUnique(vk::DescriptorSetLayoutCreateInfo({}, bindings));
+                debugName(device, descriptorLayout.get(), "Backdrop Renderer Descriptor Layout");
+            }
+            {
+                std::array<vk::PushConstantRange, 1> push_constant_ranges = {
+                    vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(composite_constants)),
+                };
+                pipelineLayout = device.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, descriptorLayout.get(), push_constant_ranges));
+                debugName(device, pipelineLayout.get(), "Backdrop Renderer Pipeline Layout");
+            }
+            {
+                std::array<vk::PushConstantRange, 1> push_constant_ranges = {
+                    vk::PushConstantRange(vk::ShaderStageFlagBits::eFragment, 0, sizeof(blur_constants)),
+                };
+                blurLayout = device.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, descriptorLayout.get(), push_constant_ranges));
+                debugName(device, blurLayout.get(), "Backdrop Renderer Blur Pipeline Layout");
+            }
+            {
+                // Every level is written completely, so nothing is loaded. The dependencies order a
+                // level after the previous reads of it and before the reads of the next pass.
+                vk::AttachmentDescription attachment({}, level_format, vk::SampleCountFlagBits::e1,
+                    vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eStore,
+                    vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+                    vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal);
+                vk::AttachmentReference ref(0, vk::ImageLayout::eColorAttachmentOptimal);
+                vk::SubpassDescription subpass({}, vk::PipelineBindPoint::eGraphics, {}, ref);
+                std::array<vk::SubpassDependency, 2> dependencies = {
+                    vk::SubpassDependency(vk::SubpassExternal, 0,
+                        vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                        vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eColorAttachmentWrite, {}),
+                    vk::SubpassDependency(0, vk::SubpassExternal,
+                        vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eFragmentShader,
+                        vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eShaderRead, {}),
+                };
+                blurPass = device.createRenderPassUnique(vk::RenderPassCreateInfo({}, attachment, subpass, dependencies));
+                debugName(device, blurPass.get(), "Backdrop Renderer Blur Render Pass");
+            }
+            pipelinesReady = compile_pipelines("Backdrop Renderer", pipelineCache, [this, targets, sampleCount](vk::PipelineCache cache) {
+                build_pipelines(targets, sampleCount, cache);
+            });
+            return pipelinesReady;
+        }
+
+        // Drops the blur of every panel, the GPU must not use them anymore.
+        void prepare(int frameCount) {
+            panels.clear();
+            frames.clear();
+            frames.resize(frameCount);
+
+            // Besides its current levels, every panel may have a chain retired and one kept from the
+            // previous use in each frame, while its size changes every frame.
+            const uint32_t max_sets = max_panels*(max_passes+1)*(1+2*static_cast<uint32_t>(frameCount));
+            std::array<vk::DescriptorPoolSize, 1> sizes = {
+                vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, max_sets)
+            };
+            descriptorPool = device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo(
+                vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, max_sets, sizes));
+        }
+
+        // Captures and blurs the region under the panel at position and size (0 to 1, like
+        // simple_renderer::renderRect). Must be recorded outside of a render pass. source is the
+        // image rendered so far, which must be in layout and support transfer reads and blits;
+        // it is returned to layout afterwards.
+        //
+        // content identifies what lies behind the panel, like a damage_key of the draws under it.
+        // The previous blur is reused while it stays the same, so content that changes every
+        // frame, like a video, needs a key that does as well.
+        void capture(vk::CommandBuffer cmd, int frame, vk::Image source, vk::ImageLayout layout,
+            std::string_view name, glm::vec2 position, glm::vec2 size, uint64_t content, backdrop_params p = {})
+        {
+            panel& pn = find_panel(name);
+            pn.position = position;
+            pn.size = size;
+
+            // The blur reads a margin around the panel, so it does not fade out at the edges.
+            const unsigned int passes = std::clamp(p.passes, 1u, max_passes);
+            const float margin = (1.0f + p.offset) * static_cast<float>(2u << passes);
+            const glm::vec2 pixels = glm::vec2(frameSize.width, frameSize.height);
+            const glm::vec2 lo = glm::max(glm::floor(position * pixels - margin), glm::vec2(0.0f));
+            const glm::vec2 hi = glm::min(glm::ceil((position + size) * pixels + margin), pixels);
+            if(hi.x - lo.x < 1.0f || hi.y - lo.y < 1.0f) {
+                pn.valid = false;
+                return;
+            }
+            const vk::Rect2D region({static_cast<int32_t>(lo.x), static_cast<int32_t>(lo.y)},
+                {static_cast<uint32_t>(hi.x - lo.x), static_cast<uint32_t>(hi.y - lo.y)});
+
+            if(pn.valid && pn.content == content && pn.region == region && pn.passes == passes && pn.offset == p.offset) {
+                pn.stats.reused++;
+                return;
+            }
+            const vk::Extent2D resolution{std::max(1u, (region.extent.width + 1) / 2), std::max(1u, (region.extent.height + 1) / 2)};
+            if(pn.levels.empty() || pn.resolution != resolution || pn.levels.size() != level_count(resolution, passes)) {
+                allocate_levels(frame, pn, resolution, passes);
+            }
+            pn.content = content;
+            pn.region = region;
+            pn.passes = passes;
+            pn.offset = p.offset;
+            pn.valid = true;
+            pn.stats.blurred++;
+            pn.stats.region = region;
+            pn.stats.resolution = resolution;
+            pn.stats.passes = static_cast<unsigned int>(pn.levels.size() - 1);
+
+            gpu_zone zone(cmd, frame, pn.name);
+            copy_region(cmd, source, layout, region, pn.levels.front());
+
+            pipelinesReady.get();
+            const std::size_t last = pn.levels.size() - 1;
+            for(std::size_t i = 0; i < last; i++) {
+                blur_pass(cmd, downPipelines.get(blurPass.get()), pn.levels[i], pn.levels[i+1], p.offset);
+            }
+            for(std::size_t i = last; i > 0; i--) {
+                blur_pass(cmd, upPipelines.get(blurPass.get()), pn.levels[i], pn.levels[i-1], p.offset);
+            }
+        }
+
+        // Draws the blur of the panel captured last, does nothing if there is none.
+        void render(vk::CommandBuffer cmd, int frame, vk::RenderPass renderPass, std::string_view name, backdrop_style style = {}) {
+            auto it = std::ranges::find(panels, name, &panel::name);
+            if(it == panels.end() || !it->valid) {
+                return;
+            }
+            const panel& pn = *it;
+            const glm::vec2 pixels = glm::vec2(frameSize.width, frameSize.height);
+            const glm::vec2 offset = glm::vec2(pn.region.offset.x, pn.region.offset.y);
+            const glm::vec2 extent = glm::vec2(pn.region.extent.width, pn.region.extent.height);
+
+            composite_constants push{
+                .rect = glm::vec4(pn.position, pn.size),
+                .uv_rect = glm::vec4((pn.position * pixels - offset) / extent, pn.size * pixels / extent),
+                .tint = style.tint,
+                .border_radius = style.border_radius,
+                .aspect_ratio = static_cast<float>(aspectRatio * (pn.size.x/pn.size.y)),
+                .opacity = style.opacity,
+            };
+
+            gpu_zone zone(cmd, frame, "backdrop_renderer::render");
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(renderPass));
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, pn.levels.front().descriptorSet.get(), {});
+            cmd.pushConstants<composite_constants>(pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, push);
+            cmd.draw(4, 1, 0, 0);
+        }
+
+        // Releases the levels replaced while the previous use of this frame was recorded.
+        void finish(int frame) {
+            if(frame < 0 || static_cast<std::size_t>(frame) >= frames.size()) {
+                return;
+            }
+            frames[frame].previous = std::move(frames[frame].retired);
+            frames[frame].retired.clear();
+        }
+
+        // The GPU time of a panel's blur is reported to the profiler under its name.
+        std::optional<backdrop_statistics> statistics(std::string_view name) const {
+            auto it = std::ranges::find(panels, name, &panel::name);
+            if(it == panels.end()) {
+                return std::nullopt;
+            }
+            return it->stats;
+        }
+    private:
+        // Half floats, so dark gradients do not band after blurring.
+        constexpr static vk::Format level_format = vk::Format::eR16G16B16A16Sfloat;
+
+        // Layouts match the push constants in backdrop_renderer.vert/.frag and the blur shaders.
+        struct composite_constants {
+            glm::vec4 rect;
+            glm::vec4 uv_rect;
+            glm::vec4 tint;
+            std::array<float, 4> border_radius;
+            float aspect_ratio;
+            float opacity;
+        };
+        struct blur_constants {
+            glm::vec2 half_texel;
+            float offset;
+        };
+
+        struct level {
+            std::unique_ptr<texture> image;
+            vk::UniqueFramebuffer framebuffer;
+            vk::UniqueDescriptorSet descriptorSet;
+        };
+        struct panel {
+            std::string_view name;
+            glm::vec2 position;
+            glm::vec2 size;
+
+            bool valid = false;
+            uint64_t content = 0;
+            vk::Rect2D region;
+            vk::Extent2D resolution;
+            unsigned int passes = 0;
+            float offset = 0.0f;
+            std::vector<level> levels;
+
+            backdrop_statistics stats;
+        };
+        struct frame_resources {
+            // Levels replaced while this frame was recorded, and while its previous use was.
+            // Frames recorded in between may still read them, until the fence of this one.
+            std::vector<std::vector<level>> retired;
+            std::vector<std::vector<level>> previous;
+        };
+
+        panel& find_panel(std::string_view name) {
+            auto it = std::ranges::find(panels, name, &panel::name);
+            if(it != panels.end()) {
+                return *it;
+            }
+            if(panels.size() >= max_panels) {
+                throw std::runtime_error("Backdrop Renderer: too many panels, raise max_panels");
+            }
+            return panels.emplace_back(panel{.name = name});
+        }
+
+        // Levels are halved until the last one would be smaller than two pixels.
+        static std::size_t level_count(vk::Extent2D resolution, unsigned int passes) {
+            std::size_t count = 1;
+            for(uint32_t w = resolution.width, h = resolution.height; count <= passes && w >= 4 && h >= 4; w /= 2, h /= 2) {
+                count++;
+            }
+            return count;
+        }
+
+        void allocate_levels(int frame, panel& pn, vk::Extent2D resolution, unsigned int passes) {
+            if(!pn.levels.empty() && frame >= 0 && static_cast<std::size_t>(frame) < frames.size()) {
+                frames[frame].retired.push_back(std::move(pn.levels));
+            }
+            pn.levels.clear();
+            pn.resolution = resolution;
+
+            const std::size_t count = level_count(resolution, passes);
+            std::vector<vk::DescriptorSetLayout> layouts(count, descriptorLayout.get());
+            auto sets = device.allocateDescriptorSetsUnique(vk::DescriptorSetAllocateInfo(descriptorPool.get(), layouts));
+            vk::Extent2D extent = resolution;
+            for(std::size_t i = 0; i < count; i++) {
+                level l;
+                l.image = std::make_unique<texture>(device, allocator, extent,
+                    vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled, level_format,
+                    vk::SampleCountFlagBits::e1, i == 0);
+                l.image->name("Backdrop "+std::string(pn.name)+" Level "+std::to_string(i));
+                vk::ImageView view = l.image->imageView.get();
+                l.framebuffer = device.createFramebufferUnique(vk::FramebufferCreateInfo({}, blurPass.get(), view, extent.width, extent.height, 1));
+                l.descriptorSet = std::move(sets[i]);
+                vk::DescriptorImageInfo image_info(sampler.get(), view, vk::ImageLayout::eShaderReadOnlyOptimal);
+                device.updateDescriptorSets(vk::WriteDescriptorSet(l.descriptorSet.get(), 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &image_info), {});
+                pn.levels.push_back(std::move(l));
+                extent = vk::Extent2D{extent.width / 2, extent.height / 2};
+            }
+        }
+
+        // Blits the region into the first level, which downsamples it by half on the way.
+        void copy_region(vk::CommandBuffer cmd, vk::Image source, vk::ImageLayout layout, vk::Rect2D region, const level& target) {
+            const vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+            std::array<vk::ImageMemoryBarrier, 2> before = {
+                vk::ImageMemoryBarrier(vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eTransferRead,
+                    layout, vk::ImageLayout::eTransferSrcOptimal,
+                    vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, source, range),
+                vk::ImageMemoryBarrier({}, vk::AccessFlagBits::eTransferWrite,
+                    vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+                    vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, target.image->image, range),
+            };
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eFragmentShader,
+                vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, before);
+
+            const vk::ImageSubresourceLayers layers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+            vk::ImageBlit blit(layers, {
+                    vk::Offset3D(region.offset.x, region.offset.y, 0),
+                    vk::Offset3D(region.offset.x + static_cast<int32_t>(region.extent.width), region.offset.y + static_cast<int32_t>(region.extent.height), 1)
+                }, layers, {
+                    vk::Offset3D(0, 0, 0),
+                    vk::Offset3D(target.image->width, target.image->height, 1)
+                });
+            cmd.blitImage(source, vk::ImageLayout::eTransferSrcOptimal, target.image->image, vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eLinear);
+
+            std::array<vk::ImageMemoryBarrier, 2> after = {
+                vk::ImageMemoryBarrier(vk::AccessFlagBits::eTransferRead, vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+                    vk::ImageLayout::eTransferSrcOptimal, layout,
+                    vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, source, range),
+                vk::ImageMemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead,
+                    vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                    vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, target.image->image, range),
+            };
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {}, after);
+        }
+
+        void blur_pass(vk::CommandBuffer cmd, vk::Pipeline pipeline, const level& from, const level& to, float offset) {
+            const vk::Extent2D extent{static_cast<uint32_t>(to.image->width), static_cast<uint32_t>(to.image->height)};
+            cmd.beginRenderPass(vk::RenderPassBeginInfo(blurPass.get(), to.framebuffer.get(), vk::Rect2D({0, 0}, extent)), vk::SubpassContents::eInline);
+            cmd.setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f));
+            cmd.setScissor(0, vk::Rect2D({0, 0}, extent));
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, blurLayout.get(), 0, from.descriptorSet.get(), {});
+            blur_constants push{
+                .half_texel = glm::vec2(0.5f / extent.width, 0.5f / extent.height),
+                .offset = offset,
+            };
+            cmd.pushConstants<blur_constants>(blurLayout.get(), vk::ShaderStageFlagBits::eFragment, 0, push);
+            cmd.draw(3, 1, 0, 0);
+            cmd.endRenderPass();
+        }
+
+        void build_pipelines(const render_targets& targets, vk::SampleCountFlagBits sampleCount, vk::PipelineCache pipelineCache) {
+            vk::PipelineVertexInputStateCreateInfo vertex_input{};
+            vk::PipelineTessellationStateCreateInfo tesselation({}, {});
+
+            vk::Viewport v{};
+            vk::Rect2D s{};
+            vk::PipelineViewportStateCreateInfo viewport({}, v, s);
+
+            vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
+            vk::PipelineDepthStencilStateCreateInfo depthStencil({}, false, false);
+
+            std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+            vk::PipelineDynamicStateCreateInfo dynamic({}, dynamicStates);
+
+            {
+                vk::UniqueShaderModule vertexShader = shaders::backdrop_renderer::vert(device);
+                vk::UniqueShaderModule fragmentShader = shaders::backdrop_renderer::frag(device);
+                std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
+                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
+                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main")
+                };
+                vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleStrip);
+                vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
+
+                vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                    vk::BlendFactor::eOne, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                    vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+                vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
+
+                vk::GraphicsPipelineCreateInfo info({},
+                    shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
+                    &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
+                    pipelineLayout.get(), {}, 0, {}, {});
+                pipelines = createPipelines(device, pipelineCache, info, targets, "Backdrop Renderer Pipeline");
+            }
+            {
+                vk::UniqueShaderModule vertexShader = shaders::backdrop_renderer::vert_blur(device);
+                vk::UniqueShaderModule downShader = shaders::backdrop_renderer::frag_down(device);
+                vk::UniqueShaderModule upShader = shaders::backdrop_renderer::frag_up(device);
+                std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
+                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
+                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, downShader.get(), "main")
+                };
+                vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleList);
+                vk::PipelineMultisampleStateCreateInfo multisample({}, vk::SampleCountFlagBits::e1);
+
+                vk::PipelineColorBlendAttachmentState attachment(false, vk::BlendFactor::eOne, vk::BlendFactor::eZero, vk::BlendOp::eAdd,
+                    vk::BlendFactor::eOne, vk::BlendFactor::eZero, vk::BlendOp::eAdd,
+                    vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+                vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
+
+                vk::GraphicsPipelineCreateInfo info({},
+                    shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
+                    &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
+                    blurLayout.get(), {}, 0, {}, {});
+                downPipelines = createPipelines(device, pipelineCache, info, {blurPass.get()}, "Backdrop Renderer Downsample Pipeline");
+                shaders[1].module = upShader.get();
+                upPipelines = createPipelines(device, pipelineCache, info, {blurPass.get()}, "Backdrop Renderer Upsample Pipeline");
+            }
+        }
+
+        vk::Device device;
+        vma::Allocator allocator;
+        vk::Extent2D frameSize;
+        double aspectRatio;
+
+        unsigned int max_panels = default_max_panels;
+
+        vk::UniqueSampler sampler;
+        vk::UniqueDescriptorSetLayout descriptorLayout;
+        vk::UniqueDescriptorPool descriptorPool;
+        vk::UniqueRenderPass blurPass;
+
+        vk::UniquePipelineLayout pipelineLayout;
+        vk::UniquePipelineLayout blurLayout;
+        pipeline_set pipelines;
+        pipeline_set downPipelines;
+        pipeline_set upPipelines;
+        std::shared_future<void> pipelinesReady;
+
+        std::vector<panel> panels;
+        std::vector<frame_resources> frames;
+};
+
+}
@@ -7,10 +7,12 @@ module;
 
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <cuchar>
 #include <future>
+#include <map>
 #include <memory>
 #include <string_view>
 #include <string>
@@ -29,6 +31,11 @@ module;
 
 export module dreamrender:components.font_renderer;
 
+import :font_cache;
+import :job_system;
+import :pipeline_compiler;
+import :memory_tracker;
+import :profiler;
 import :resource_loader;
 import :shaders;
 import :texture;
@@ -85,6 +92,11 @@ export class font_renderer {
                 return false;
             return true;
         }
+#ifdef DREAMRENDER_USE_HARFBUZZ
+        static constexpr font_atlas_mode atlas_mode = font_atlas_mode::shelf;
+#else
+        static constexpr font_atlas_mode atlas_mode = font_atlas_mode::grid;
+#endif
     public:
         static constexpr char default_start_char = 32;
         static constexpr char default_end_char = 127;
@@ -96,7 +108,14 @@ export class font_renderer {
             : fontName(std::move(font_name)), fontSize(font_size), device(device), allocator(allocator),
               aspectRatio(static_cast<double>(frameSize.width) / frameSize.height),
               compat_mode(!check_features(features)) {}
-        ~font_renderer() = default;
+        ~font_renderer() {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+            for(auto& [renderPass, pending] : pendingPipelines) {
+                pending.ready.wait();
+            }
+        }
 
 #ifdef DREAMRENDER_USE_HARFBUZZ
         // Upload required glyphs (with ligatures enabled) into the atlas before drawing
@@ -169,12 +188,15 @@ export class font_renderer {
 #endif
 
         std::shared_future<void> preload(resource_loader* loader,
-            const std::vector<vk::RenderPass>& renderPasses, vk::SampleCountFlagBits sampleCount,
+            const render_targets& targets, vk::SampleCountFlagBits sampleCount,
             vk::PipelineCache pipelineCache = {},
             FT_Library ft = nullptr,
             char32_t startChar = default_start_char, char32_t endChar = default_end_char,
             size_t maxCharacters = default_max_characters, size_t maxTexts = default_max_texts)
         {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
             this->maxCharacters = maxCharacters;
             this->maxTexts = maxTexts;
 
@@ -182,120 +204,144 @@ export class font_renderer {
                 spdlog::warn("Font Renderer: No geometry shader support, falling back to compatibility mode");
             }
 
-            std::unique_ptr<ft_library_wrapper> ftManager;
-            FT_Library ftLib = nullptr;
-            if(ft == nullptr) {
-                ftManager = std::make_unique<ft_library_wrapper>();
-                ftLib = ftManager->get();
-            } else {
-                ftLib = ft;
+            const font_cache_key cacheKey{fontName, fontSize, startChar, endChar, atlas_mode};
+            std::shared_ptr<const cached_font_atlas> cached;
+            if(font_cache* cache = font_cache::active()) {
+                cached = cache->find(cacheKey);
             }
 
-            std::unique_ptr<ft_face_wrapper> ftFace = std::make_unique<ft_face_wrapper>(ftLib, fontName);
-            if(FT_Set_Pixel_Sizes(ftFace->get(), 0, fontSize) != 0) {
-                throw std::runtime_error("Failed to set font size");
+            // FreeType is only needed to build the atlas, a cached one is uploaded as it is.
+            std::unique_ptr<ft_library_wrapper> ftManager;
+            std::unique_ptr<ft_face_wrapper> ftFace;
+            if(!cached) {
+                FT_Library ftLib = ft;
+                if(ftLib == nullptr) {
+                    ftManager = std::make_unique<ft_library_wrapper>();
+                    ftLib = ftManager->get();
+                }
+                ftFace = std::make_unique<ft_face_wrapper>(ftLib, fontName);
+                if(FT_Set_Pixel_Sizes(ftFace->get(), 0, fontSize) != 0) {
+                    throw std::runtime_error("Failed to set font size");
+                }
             }
 #ifdef DREAMRENDER_USE_HARFBUZZ
             int width = 2048, height = 2048;
             spdlog::debug("Font atlas (HB) {}x{}", width, height);
-            // Init line height/baseline from face metrics
-            lineHeight = static_cast<float>(ftFace->get()->size->metrics.height >> 6);
-            baselinePx = (ftFace->get()->size->metrics.ascender >> 6);
             atlasWidth = width; atlasHeight = height; packX = 0; packY = 0; packShelfH = 0;
             // Create atlas texture and pre-populate with a baseline glyph set (ASCII + Latin-1) on CPU.
             // Upload as a single operation via the resource_loader to avoid in-pass copies.
             fontTexture = std::make_unique<texture>(device, allocator, width, height,
                 vk::ImageUsageFlagBits::eSampled, vk::Format::eR8G8B8A8Unorm);
-            std::string fontCapture = fontName; // capture by value for loader thread
-            int fontPx = fontSize;
-            textureReady = loader->loadTexture(fontTexture.get(), [this, width, height, fontCapture, fontPx](uint8_t* p, size_t size){
-                const size_t need = static_cast<size_t>(width) * static_cast<size_t>(height) * 4;
-                if(need > size) throw std::runtime_error("Font atlas staging too small");
-                std::fill(p, p+need, 0x00);
-
-                ft_library_wrapper lib;
-                ft_face_wrapper face(lib.get(), fontCapture);
-                if(FT_Set_Pixel_Sizes(face.get(), 0, fontPx) != 0) {
-                    throw std::runtime_error("Failed to set font size (atlas)");
+            fontTexture->set_memory_tag(memory_tag::font);
+            if(cached) {
+                // The cached atlas holds the baseline glyph set, glyphs staged later are packed after it.
+                const font_atlas_layout& layout = cached->layout();
+                lineHeight = layout.lineHeight;
+                baselinePx = layout.baseline;
+                packX = layout.packer[0]; packY = layout.packer[1]; packShelfH = layout.packer[2];
+                for(const font_cache_glyph& g : cached->glyphs()) {
+                    hbGlyphs.emplace(g.id, from_cache_glyph<HBGlyph>(g));
                 }
-
-                // Reset packer for deterministic CPU build
-                packX = 0; packY = 0; packShelfH = 0;
-                hbGlyphs.clear();
-
-                auto insert_cp = [&](uint32_t cp){
-                    FT_UInt gid = FT_Get_Char_Index(face.get(), cp);
-                    if(gid == 0) return; // missing
-                    if(FT_Load_Glyph(face.get(), gid, FT_LOAD_DEFAULT) != 0) return;
-                    if(FT_Render_Glyph(face.get()->glyph, FT_RENDER_MODE_NORMAL) != 0) return;
-                    FT_GlyphSlot slot = face.get()->glyph;
-                    FT_Bitmap bmp = slot->bitmap;
-
-                    int w = bmp.width, h = bmp.rows;
-                    if(w == 0 || h == 0) {
-                        hbGlyphs.emplace(gid, HBGlyph{ {packX, packY}, {0,0}, {slot->bitmap_left, slot->bitmap_top}, int(slot->advance.x >> 6) });
-                        return;
+                textureReady = loader->loadTexture(fontTexture.get(), [cached](uint8_t* p, size_t size){
+                    cached->copy_to(p, size);
+                });
+            } else {
+                // Init line height/baseline from face metrics
+                lineHeight = static_cast<float>(ftFace->get()->size->metrics.height >> 6);
+                baselinePx = (ftFace->get()->size->metrics.ascender >> 6);
+                std::string fontCapture = fontName; // capture by value for loader thread
+                int fontPx = fontSize;
+                textureReady = loader->loadTexture(fontTexture.get(), [this, width, height, fontCapture, fontPx, cacheKey](uint8_t* p, size_t size){
+                    const size_t need = static_cast<size_t>(width) * static_cast<size_t>(height) * 4;
+                    if(need > size) throw std::runtime_error("Font atlas staging too small");
+                    std::fill(p, p+need, 0x00);
+
+                    ft_library_wrapper lib;
+                    ft_face_wrapper face(lib.get(), fontCapture);
+                    if(FT_Set_Pixel_Sizes(face.get(), 0, fontPx) != 0) {
+                        throw std::runtime_error("Failed to set font size (atlas)");
                     }
-                    if(packX + w > atlasWidth) { packX = 0; packY += packShelfH; packShelfH = 0; }
-                    if(packY + h > atlasHeight) return; // out of space
-                    for(int yy=0; yy<h; ++yy) {
-                        for(int xx=0; xx<w; ++xx) {
-                            uint8_t v = bmp.buffer[yy*bmp.pitch + xx];
-                            size_t o = (static_cast<size_t>(packY+yy) * static_cast<size_t>(width) + static_cast<size_t>(packX+xx)) * 4ull;
-                            p[o+0] = v; p[o+1] = v; p[o+2] = v; p[o+3] = v;
+
+                    // Reset packer for deterministic CPU build
+                    packX = 0; packY = 0; packShelfH = 0;
+                    hbGlyphs.clear();
+
+                    auto insert_cp = [&](uint32_t cp){
+                        FT_UInt gid = FT_Get_Char_Index(face.get(), cp);
+                        if(gid == 0) return; // missing
+                        if(FT_Load_Glyph(face.get(), gid, FT_LOAD_DEFAULT) != 0) return;
+                        if(FT_Render_Glyph(face.get()->glyph, FT_RENDER_MODE_NORMAL) != 0) return;
+                        FT_GlyphSlot slot = face.get()->glyph;
+                        FT_Bitmap bmp = slot->bitmap;
+
+                        int w = bmp.width, h = bmp.rows;
+                        if(w == 0 || h == 0) {
+                            hbGlyphs.emplace(gid, HBGlyph{ {packX, packY}, {0,0}, {slot->bitmap_left, slot->bitmap_top}, int(slot->advance.x >> 6) });
+                            return;
                         }
-                    }
-                    hbGlyphs.emplace(gid, HBGlyph{ {packX, packY}, {w, h}, {slot->bitmap_left, slot->bitmap_top}, int(slot->advance.x >> 6) });
-                    packX += w + 1; packShelfH = std::max(packShelfH, h + 1);
-                };
+                        if(packX + w > atlasWidth) { packX = 0; packY += packShelfH; packShelfH = 0; }
+                        if(packY + h > atlasHeight) return; // out of space
+                        for(int yy=0; yy<h; ++yy) {
+                            for(int xx=0; xx<w; ++xx) {
+                                uint8_t v = bmp.buffer[yy*bmp.pitch + xx];
+                                size_t o = (static_cast<size_t>(packY+yy) * static_cast<size_t>(width) + static_cast<size_t>(packX+xx)) * 4ull;
+                                p[o+0] = v; p[o+1] = v; p[o+2] = v; p[o+3] = v;
+                            }
+                        }
+                        hbGlyphs.emplace(gid, HBGlyph{ {packX, packY}, {w, h}, {slot->bitmap_left, slot->bitmap_top}, int(slot->advance.x >> 6) });
+                        packX += w + 1; packShelfH = std::max(packShelfH, h + 1);
+                    };
+
+                    // Basic ASCII
+                    for(uint32_t cp = 32; cp <= 126; ++cp) insert_cp(cp);
+                    // Latin-1 supplement
+                    for(uint32_t cp = 160; cp <= 255; ++cp) insert_cp(cp);
 
-                // Basic ASCII
-                for(uint32_t cp = 32; cp <= 126; ++cp) insert_cp(cp);
-                // Latin-1 supplement
-                for(uint32_t cp = 160; cp <= 255; ++cp) insert_cp(cp);
-            });
+                    if(font_cache* cache = font_cache::active()) {
+                        std::vector<font_cache_glyph> table;
+                        table.reserve(hbGlyphs.size());
+                        for(const auto& [gid, g] : hbGlyphs) {
+                            table.push_back(to_cache_glyph(gid, g));
+                        }
+                        const font_atlas_layout layout{
+                            .width = static_cast<uint32_t>(width),
+                            .height = static_cast<uint32_t>(height),
+                            .rows = static_cast<uint32_t>(std::min(height, packY + packShelfH)),
+                            .lineHeight = lineHeight,
+                            .baseline = baselinePx,
+                            .packer = {packX, packY, packShelfH},
+                        };
+                        cache->store(cacheKey, layout, table, {p, need});
+                    }
+                });
+            }
 #else
             unsigned int columns = std::ceil(std::sqrt(static_cast<double>(endChar - startChar + 1)));
             unsigned int rows = std::ceil(static_cast<double>(endChar - startChar + 1) / columns);
 
-            // Determine maximum glyph tile size using rendered glyph bitmaps.
-            // On some platforms FreeType does not populate bitmap width/rows
-            // unless the glyph is rendered, which previously produced 0-sized
-            // atlases and garbled text. Render each glyph once to get sizes.
             unsigned int maxWidth = 0;
             unsigned int maxHeight = 0;
             FT_Int baseline = 0;
-
-            FT_Select_Charmap(ftFace->get(), ft_encoding_unicode);
-            for(char32_t c=startChar; c<=endChar; c++) {
-                FT_UInt glyph_index = FT_Get_Char_Index(ftFace->get(), c);
-                FT_Int32 load_flags = FT_LOAD_DEFAULT;
-                if(FT_Load_Glyph(ftFace->get(), glyph_index, load_flags) != 0) {
-                    throw std::runtime_error("Failed to load glyph");
-                }
-                if(FT_Render_Glyph(ftFace->get()->glyph, FT_RENDER_MODE_NORMAL) != 0) {
-                    throw std::runtime_error("Failed to render glyph");
+            long width = 1;
+            long height = 1;
+            if(cached) {
+                const font_atlas_layout& layout = cached->layout();
+                width = layout.width;
+                height = layout.height;
+                for(const font_cache_glyph& g : cached->glyphs()) {
+                    glyphs.emplace(static_cast<char32_t>(g.id), from_cache_glyph<GlyphMetrics>(g));
                 }
-                FT_GlyphSlot slot = ftFace->get()->glyph;
-                baseline = std::max(baseline, slot->bitmap_top);
-                maxWidth = std::max(maxWidth, static_cast<unsigned int>(slot->bitmap.width));
-                maxHeight = std::max(maxHeight, static_cast<unsigned int>(slot->bitmap.rows));
-            }
-            maxWidth += 4;
-            maxHeight += 4;
-
-            long width = std::max(1u, columns * maxWidth);
-            long height = std::max(1u, rows * maxHeight);
-            spdlog::debug("Font texture will be {}x{} ({}x{})", width, height, columns, rows);
-
-            char32_t ch = startChar;
-            for(int r=0; r<rows; r++) {
-                for(int c=0; c<columns; c++) {
-                    if(ch > endChar) {
-                        break;
-                    }
-
-                    FT_UInt glyph_index = FT_Get_Char_Index(ftFace->get(), ch);
+                lineHeight = layout.lineHeight;
+                baselinePx = layout.baseline;
+                spdlog::debug("Font texture will be {}x{} (cached)", width, height);
+            } else {
+                // Determine maximum glyph tile size using rendered glyph bitmaps.
+                // On some platforms FreeType does not populate bitmap width/rows
+                // unless the glyph is rendered, which previously produced 0-sized
+                // atlases and garbled text. Render each glyph once to get sizes.
+                FT_Select_Charmap(ftFace->get(), ft_encoding_unicode);
+                for(char32_t c=startChar; c<=endChar; c++) {
+                    FT_UInt glyph_index = FT_Get_Char_Index(ftFace->get(), c);
                     FT_Int32 load_flags = FT_LOAD_DEFAULT;
                     if(FT_Load_Glyph(ftFace->get(), glyph_index, load_flags) != 0) {
                         throw std::runtime_error("Failed to load glyph");
@@ -304,20 +350,48 @@ export class font_renderer {
                         throw std::runtime_error("Failed to render glyph");
                     }
                     FT_GlyphSlot slot = ftFace->get()->glyph;
-                    int tileX = c * maxWidth;
-                    int tileY = r * maxHeight;
-                    GlyphMetrics gm;
-                    gm.bitmapSize = {slot->bitmap.width, slot->bitmap.rows};
-                    gm.bearing = {slot->bitmap_left, slot->bitmap_top};
-                    gm.advance = (slot->advance.x >> 6);
-                    // top-left of the bitmap inside the tile
-                    gm.atlasPos = {tileX + 0, tileY + (baseline - slot->bitmap_top)};
-                    glyphs.emplace(ch, gm);
-                    ch++;
+                    baseline = std::max(baseline, slot->bitmap_top);
+                    maxWidth = std::max(maxWidth, static_cast<unsigned int>(slot->bitmap.width));
+                    maxHeight = std::max(maxHeight, static_cast<unsigned int>(slot->bitmap.rows));
                 }
+                maxWidth += 4;
+                maxHeight += 4;
+
+                width = std::max(1u, columns * maxWidth);
+                height = std::max(1u, rows * maxHeight);
+                spdlog::debug("Font texture will be {}x{} ({}x{})", width, height, columns, rows);
+
+                char32_t ch = startChar;
+                for(int r=0; r<rows; r++) {
+                    for(int c=0; c<columns; c++) {
+                        if(ch > endChar) {
+                            break;
+                        }
+
+                        FT_UInt glyph_index = FT_Get_Char_Index(ftFace->get(), ch);
+                        FT_Int32 load_flags = FT_LOAD_DEFAULT;
+                        if(FT_Load_Glyph(ftFace->get(), glyph_index, load_flags) != 0) {
+                            throw std::runtime_error("Failed to load glyph");
+                        }
+                        if(FT_Render_Glyph(ftFace->get()->glyph, FT_RENDER_MODE_NORMAL) != 0) {
+                            throw std::runtime_error("Failed to render glyph");
+                        }
+                        FT_GlyphSlot slot = ftFace->get()->glyph;
+                        int tileX = c * maxWidth;
+                        int tileY = r * maxHeight;
+                        GlyphMetrics gm;
+                        gm.bitmapSize = {slot->bitmap.width, slot->bitmap.rows};
+                        gm.bearing = {slot->bitmap_left, slot->bitmap_top};
+                        gm.advance = (slot->advance.x >> 6);
+                        // top-left of the bitmap inside the tile
+                        gm.atlasPos = {tileX + 0, tileY + (baseline - slot->bitmap_top)};
+                        glyphs.emplace(ch, gm);
+                        ch++;
+                    }
+                }
+                lineHeight = static_cast<float>(maxHeight);
+                baselinePx = baseline;
             }
-            lineHeight = static_cast<float>(maxHeight);
-            baselinePx = baseline;
 #endif
 
             struct guarantee_order {
@@ -336,54 +410,95 @@ export class font_renderer {
             // Use UNORM to avoid sRGB gamma interaction on grayscale glyphs
             fontTexture = std::make_unique<texture>(device, allocator, width, height,
                 vk::ImageUsageFlagBits::eSampled, vk::Format::eR8G8B8A8Unorm);
-            textureReady = loader->loadTexture(fontTexture.get(),
-                [
-                    this, columns, rows, maxWidth, maxHeight, startChar, endChar, baseline, width,
-                    go = std::move(go)
-                ](uint8_t* p, size_t size)
-                {
-                    assert(sizeof(uint32_t)*rows*maxHeight*columns*maxWidth <= size);
-                    auto* pixels = reinterpret_cast<uint32_t*>(p);
-
-                    char32_t ch = startChar;
-                    FT_Face ftFace = go.ftFace->get();
-                    FT_Select_Charmap(ftFace, ft_encoding_unicode);
-                    for(int r=0; r<rows; r++) {
-                        for(int c=0; c<columns; c++) {
-                            if(ch > endChar) {
-                                break;
-                            }
-
-                            FT_UInt glyph_index = FT_Get_Char_Index(ftFace, ch);
-                            FT_Int32 load_flags = FT_LOAD_DEFAULT;
-                            if(FT_Load_Glyph(ftFace, glyph_index, load_flags) != 0) {
-                                throw std::runtime_error("Failed to load glyph");
-                            }
-                            if(FT_Render_Glyph(ftFace->glyph, FT_RENDER_MODE_NORMAL) != 0) {
-                                throw std::runtime_error("Failed to render glyph");
-                            }
-                            FT_GlyphSlot slot = ftFace->glyph;
-                            FT_Bitmap bitmap = slot->bitmap;
-                            for(int y=0; y<bitmap.rows; y++) {
-                                for(int x=0; x<bitmap.width; x++) {
+            fontTexture->set_memory_tag(memory_tag::font);
+            if(cached) {
+                textureReady = loader->loadTexture(fontTexture.get(), [cached](uint8_t* p, size_t size) {
+                    cached->copy_to(p, size);
+                });
+            } else {
+                std::vector<font_cache_glyph> table;
+                table.reserve(glyphs.size());
+                for(const auto& [ch, g] : glyphs) {
+                    table.push_back(to_cache_glyph(static_cast<uint32_t>(ch), g));
+                }
+                const font_atlas_layout layout{
+                    .width = static_cast<uint32_t>(width),
+                    .height = static_cast<uint32_t>(height),
+                    .rows = static_cast<uint32_t>(height),
+                    .lineHeight = lineHeight,
+                    .baseline = baselinePx,
+                    .packer = {},
+                };
+                textureReady = loader->loadTexture(fontTexture.get(),
+                    [
+                        this, columns, rows, maxWidth, maxHeight, startChar, endChar, baseline, width, height,
+                        cacheKey, layout, table = std::move(table), go = std::move(go)
+                    ](uint8_t* p, size_t size)
+                    {
+                        assert(sizeof(uint32_t)*rows*maxHeight*columns*maxWidth <= size);
+                        auto* pixels = reinterpret_cast<uint32_t*>(p);
+
+                        auto rasterise = [&](FT_Face ftFace, unsigned int firstRow, unsigned int lastRow) {
+                            char32_t ch = startChar + firstRow * columns;
+                            FT_Select_Charmap(ftFace, ft_encoding_unicode);
+                            for(int r=firstRow; r<lastRow; r++) {
+                                for(int c=0; c<columns; c++) {
                                     if(ch > endChar) {
                                         break;
                                     }
 
-                                    unsigned char pixel_brightness = bitmap.buffer[y * bitmap.pitch + x];
-                                    unsigned int color = pixel_brightness | pixel_brightness << 8 | pixel_brightness << 16 | pixel_brightness << 24;
-
-                                    int dx = x;
-                                    int dy = y + baseline - slot->bitmap_top; // position glyph relative to baseline
-
-                                    pixels[(r*maxHeight + dy)*width + c*maxWidth + dx] = color;
+                                    FT_UInt glyph_index = FT_Get_Char_Index(ftFace, ch);
+                                    FT_Int32 load_flags = FT_LOAD_DEFAULT;
+                                    if(FT_Load_Glyph(ftFace, glyph_index, load_flags) != 0) {
+                                        throw std::runtime_error("Failed to load glyph");
+                                    }
+                                    if(FT_Render_Glyph(ftFace->glyph, FT_RENDER_MODE_NORMAL) != 0) {
+                                        throw std::runtime_error("Failed to render glyph");
+                                    }
+                                    FT_GlyphSlot slot = ftFace->glyph;
+                                    FT_Bitmap bitmap = slot->bitmap;
+                                    for(int y=0; y<bitmap.rows; y++) {
+                                        for(int x=0; x<bitmap.width; x++) {
+                                            if(ch > endChar) {
+                                                break;
+                                            }
+
+                                            unsigned char pixel_brightness = bitmap.buffer[y * bitmap.pitch + x];
+                                            unsigned int color = pixel_brightness | pixel_brightness << 8 | pixel_brightness << 16 | pixel_brightness << 24;
+
+                                            int dx = x;
+                                            int dy = y + baseline - slot->bitmap_top; // position glyph relative to baseline
+
+                                            pixels[(r*maxHeight + dy)*width + c*maxWidth + dx] = color;
+                                        }
+                                    }
+                                    ch++;
                                 }
                             }
-                            ch++;
+                        };
+
+                        // Bands of rows are rasterised on the job system. FreeType faces must not be
+                        // shared between threads, so all bands but the first open their own.
+                        const unsigned int bands = job_system::active() ? job_system::active()->size() : 1;
+                        parallel_for(0, rows, (rows + bands - 1) / bands, [&](std::size_t first, std::size_t last) {
+                            if(first == 0) {
+                                rasterise(go.ftFace->get(), first, last);
+                                return;
+                            }
+                            ft_library_wrapper lib;
+                            ft_face_wrapper face(lib.get(), fontName);
+                            if(FT_Set_Pixel_Sizes(face.get(), 0, fontSize) != 0) {
+                                throw std::runtime_error("Failed to set font size");
+                            }
+                            rasterise(face.get(), first, last);
+                        });
+
+                        if(font_cache* cache = font_cache::active()) {
+                            cache->store(cacheKey, layout, table, {p, static_cast<size_t>(width) * height * 4});
                         }
                     }
-                }
-            );
+                );
+            }
 #endif
 
             // Clamp to edge to avoid bleeding between glyph tiles
@@ -419,12 +534,21 @@ export class font_renderer {
                 debugName(device, pipelineLayout.get(), "Font Renderer Pipeline Layout");
             }
             {
-                // Remember sample count for later on-demand pipeline builds
+                // Remember sample count and format for later on-demand pipeline builds
                 last_sample_count = sampleCount;
-                build_pipelines(renderPasses, pipelineCache);
+                last_color_format = targets.colorFormat;
+                pipelinesReady = compile_pipelines("Font Renderer", pipelineCache, [this, targets, sampleCount](vk::PipelineCache cache) {
+                    pipelines = build_pipelines(targets, sampleCount, cache);
+                });
             }
             return textureReady;
         }
+        // Text is not drawn until the atlas is loaded.
+        bool atlas_ready() const {
+            return textureReady.valid() && textureReady.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }
+        // Ready once the pipelines are compiled, they may be compiled in the background.
+        std::shared_future<void> pipelines_ready() const { return pipelinesReady; }
         // Expose the font atlas for optional debugging (e.g., draw via image_renderer)
         const texture* get_atlas() const { return fontTexture.get(); }
         void prepare(int imageCount) {
@@ -467,7 +591,7 @@ export class font_renderer {
                     }
                     vk::BufferCreateInfo vertex_info({}, size, vk::BufferUsageFlagBits::eVertexBuffer);
                     vma::AllocationCreateInfo va_info({}, vma::MemoryUsage::eCpuToGpu);
-                    auto [vb, va] = allocator.createBufferUnique(vertex_info, va_info);
+                    auto [vb, va] = create_tracked_buffer(allocator, memory_tag::frame_data, vertex_info, va_info);
                     auto& mapping = vertexMappings.emplace_back(allocator, va.get());
                     vertexPointers.push_back(reinterpret_cast<VertexCharacter*>(mapping.get()));
                     vertexBuffers.push_back(std::move(vb));
@@ -480,7 +604,7 @@ export class font_renderer {
                         static_cast<vk::DeviceSize>(maxTexts) * uniformStride,
                         vk::BufferUsageFlagBits::eUniformBuffer);
                     vma::AllocationCreateInfo ua_info({}, vma::MemoryUsage::eCpuToGpu);
-                    auto [ub, ua] = allocator.createBufferUnique(uniform_info, ua_info);
+                    auto [ub, ua] = create_tracked_buffer(allocator, memory_tag::frame_data, uniform_info, ua_info);
                     auto& mapping = uniformMappings.emplace_back(allocator, ua.get());
                     uniformPointers.emplace_back(mapping.get(), alignment);
 
@@ -516,6 +640,7 @@ export class font_renderer {
             if(textureReady.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
                 return;
             }
+            gpu_zone zone(cmd, frame, "font_renderer::renderText");
 
             int compat_factor = compat_mode ? 6 : 1;
             int total_chars = 0;
@@ -637,17 +762,11 @@ export class font_renderer {
                 uniformPointers[frame].offset(uniformOffsets[frame]),
                 sizeof(TextUniform));
 
-            auto itp = pipelines.find(renderPass);
-            if(itp == pipelines.end() || !itp->second) {
-                spdlog::warn("[FontRenderer] Pipeline for renderPass not found; creating on-demand");
-                build_pipelines({renderPass}, {});
-                itp = pipelines.find(renderPass);
-                if(itp == pipelines.end() || !itp->second) {
-                    spdlog::error("[FontRenderer] Failed to build pipeline for current renderPass");
-                    return;
-                }
+            pipelinesReady.get();
+            if(!pipelines.contains(renderPass) && !request_pipeline(renderPass)) {
+                return;
             }
-            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, itp->second.get());
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(renderPass));
             cmd.bindVertexBuffers(0, vertexBuffers[frame].get(), compat_factor*vertexOffsets[frame]*sizeof(VertexCharacter));
             cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, descriptorSets[frame], uniformPointers[frame].offset(uniformOffsets[frame]));
             cmd.draw(compat_factor*total_chars, 1, 0, 0);
@@ -694,7 +813,43 @@ export class font_renderer {
             return ((size + alignment - 1) / alignment) * alignment;
         }
 
-        void build_pipelines(const std::vector<vk::RenderPass>& renderPasses, vk::PipelineCache pipelineCache) {
+        // Render passes that were not passed to preload get their pipeline compiled in the
+        // background, and text drawn with them is skipped until it is ready instead of stalling the frame.
+        // A null render pass (dynamic rendering) needs the colour format from preload.
+        bool request_pipeline(vk::RenderPass renderPass) {
+            auto it = pendingPipelines.find(renderPass);
+            if(it == pendingPipelines.end()) {
+                if(!renderPass && last_color_format == vk::Format::eUndefined) {
+                    spdlog::error("[FontRenderer] Dynamic rendering used, but no colour format was passed to preload");
+                    pendingPipelines.emplace(renderPass, pending_pipeline{});
+                    return false;
+                }
+                spdlog::warn("[FontRenderer] Pipeline for renderPass not found; compiling on-demand");
+                auto result = std::make_shared<pipeline_set>();
+                render_targets targets = renderPass ? render_targets{renderPass} : render_targets::dynamic(last_color_format);
+                auto ready = compile_pipelines("Font Renderer (on-demand)", {},
+                    [this, targets, result, sampleCount = last_sample_count](vk::PipelineCache cache) {
+                        *result = build_pipelines(targets, sampleCount, cache);
+                    });
+                it = pendingPipelines.emplace(renderPass, pending_pipeline{std::move(ready), std::move(result)}).first;
+            }
+            auto& pending = it->second;
+            if(!pending.result || pending.ready.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return false;
+            }
+            try {
+                pending.ready.get();
+            } catch(const std::exception& e) {
+                spdlog::error("[FontRenderer] Failed to build pipeline for current renderPass: {}", e.what());
+                pending.result.reset();
+                return false;
+            }
+            pipelines.merge(std::move(*pending.result));
+            pendingPipelines.erase(it);
+            return true;
+        }
+
+        pipeline_set build_pipelines(const render_targets& targets, vk::SampleCountFlagBits sampleCount, vk::PipelineCache pipelineCache) {
             vk::UniqueShaderModule vertexShader = compat_mode ?
                 shaders::font_renderer::vert_compat(device) :
                 shaders::font_renderer::vert(device);
@@ -728,7 +883,7 @@ export class font_renderer {
             vk::PipelineViewportStateCreateInfo viewport({}, v, s);
 
             vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
-            vk::PipelineMultisampleStateCreateInfo multisample({}, last_sample_count);
+            vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
             vk::PipelineDepthStencilStateCreateInfo depthStencil({}, false, false);
 
             vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
@@ -742,12 +897,30 @@ export class font_renderer {
             vk::GraphicsPipelineCreateInfo pipeline_info({}, shaderStages, &vertex_input,
                 &input_assembly, &tesselation, &viewport, &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic, pipelineLayout.get(), {});
 
-            auto newPipelines = createPipelines(device, pipelineCache, pipeline_info, renderPasses, "Font Renderer Pipeline");
-            for(auto& [rp, p] : newPipelines) {
-                pipelines[rp] = std::move(p);
-            }
+            return createPipelines(device, pipelineCache, pipeline_info, targets, "Font Renderer Pipeline");
+        }
+
+        // GlyphMetrics and HBGlyph share their layout with the glyphs of a cached atlas.
+        template<typename Glyph>
+        static font_cache_glyph to_cache_glyph(uint32_t id, const Glyph& g) {
+            return font_cache_glyph{
+                .id = id,
+                .atlasPos = {g.atlasPos.x, g.atlasPos.y},
+                .bitmapSize = {g.bitmapSize.x, g.bitmapSize.y},
+                .bearing = {g.bearing.x, g.bearing.y},
+                .advance = g.advance,
+            };
         }
-        
+        template<typename Glyph>
+        static Glyph from_cache_glyph(const font_cache_glyph& g) {
+            return Glyph{
+                .atlasPos = {g.atlasPos[0], g.atlasPos[1]},
+                .bitmapSize = {g.bitmapSize[0], g.bitmapSize[1]},
+                .bearing = {g.bearing[0], g.bearing[1]},
+                .advance = g.advance,
+            };
+        }
+
 #ifdef DREAMRENDER_USE_HARFBUZZ
         struct HBGlyph {
             glm::ivec2 atlasPos;
@@ -799,6 +972,7 @@ export class font_renderer {
 
         bool compat_mode{};
         vk::SampleCountFlagBits last_sample_count{vk::SampleCountFlagBits::e1};
+        vk::Format last_color_format{vk::Format::eUndefined};
 
 #ifdef DREAMRENDER_USE_HARFBUZZ
         struct HbBufferDeleter { void operator()(hb_buffer_t* b) const noexcept { if(b) hb_buffer_destroy(b); } };
@@ -854,19 +1028,26 @@ export class font_renderer {
         vk::UniqueSampler sampler;
 
         vk::UniquePipelineLayout pipelineLayout;
-        UniquePipelineMap pipelines;
+        pipeline_set pipelines;
+        std::shared_future<void> pipelinesReady;
+        struct pending_pipeline {
+            std::shared_future<void> ready;
+            // Reset once compiling failed, so it is not retried every frame.
+            std::shared_ptr<pipeline_set> result;
+        };
+        std::map<vk::RenderPass, pending_pipeline> pendingPipelines;
 
         vk::UniqueDescriptorSetLayout descriptorLayout;
         vk::UniqueDescriptorPool descriptorPool;
         std::vector<vk::DescriptorSet> descriptorSets;
 
         std::vector<vma::UniqueBuffer> uniformBuffers;
-        std::vector<vma::UniqueAllocation> uniformMemories;
+        std::vector<tracked_allocation> uniformMemories;
         std::vector<vk::DeviceSize> uniformOffsets;
         std::vector<vma::MemoryMapping> uniformMappings;
 
         std::vector<vma::UniqueBuffer> vertexBuffers;
-        std::vector<vma::UniqueAllocation> vertexMemories;
+        std::vector<tracked_allocation> vertexMemories;
         std::vector<uint32_t> vertexOffsets;
         std::vector<vma::MemoryMapping> vertexMappings;
 };
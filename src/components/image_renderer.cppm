@@ -8,9 +8,12 @@ module;
 #include <vector>
 #include <array>
 #include <cstdint>
+#include <future>
 
 export module dreamrender:components.image_renderer;
 
+import :pipeline_compiler;
+import :profiler;
 import :shaders;
 import :texture;
 import :utils;
@@ -41,11 +44,20 @@ export class image_renderer {
         image_renderer(vk::Device device, vk::Extent2D frameSize, const gpu_features& features) : device(device), frameSize(frameSize),
             aspectRatio(static_cast<double>(frameSize.width)/frameSize.height), features(features),
             compat_mode(!check_features(features)) {}
-        ~image_renderer() = default;
+        ~image_renderer() {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+        }
 
-        void preload(const std::vector<vk::RenderPass>& renderPasses, vk::SampleCountFlagBits sampleCount,
+        // The pipelines are compiled in the background if a pipeline_compiler is active,
+        // the returned future is ready once they are.
+        std::shared_future<void> preload(const render_targets& targets, vk::SampleCountFlagBits sampleCount,
             vk::PipelineCache pipelineCache = {}, unsigned int max_images = default_max_images)
         {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
             this->max_images = max_images;
             if(compat_mode) {
                 spdlog::warn("Image Renderer: No update-after-bind support, falling back to compatibility mode");
@@ -83,41 +95,6 @@ export class image_renderer {
                 debugName(device, pipelineLayout.get(), "Image Renderer Pipeline Layout");
             }
             {
-                vk::UniqueShaderModule vertexShader = shaders::image_renderer::vert(device);
-                vk::UniqueShaderModule fragmentShader =
-                    compat_mode ? shaders::image_renderer::frag_compat(device) :
-                                  shaders::image_renderer::frag(device);
-                std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
-                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
-                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main")
-                };
-
-                vk::PipelineVertexInputStateCreateInfo vertex_input{};
-                vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleStrip);
-                vk::PipelineTessellationStateCreateInfo tesselation({}, {});
-
-                vk::Viewport v{};
-                vk::Rect2D s{};
-                vk::PipelineViewportStateCreateInfo viewport({}, v, s);
-
-                vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
-                vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
-                vk::PipelineDepthStencilStateCreateInfo depthStencil({}, false, false);
-
-                vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
-                    vk::BlendFactor::eOne, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
-                    vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
-                vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
-
-                std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
-                vk::PipelineDynamicStateCreateInfo dynamic({}, dynamicStates);
-
-                vk::GraphicsPipelineCreateInfo info({},
-                    shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
-                    &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
-                    pipelineLayout.get(), renderPasses[0], 0, {}, {});
-                pipelines = createPipelines(device, pipelineCache, info, renderPasses, "Image Renderer Pipeline");
-
                 // Glass pipeline: simple descriptor set with one sampler and alternate fragment shader
                 std::array<vk::DescriptorSetLayoutBinding,1> glassBindings = {
                     vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment)
@@ -129,18 +106,11 @@ export class image_renderer {
                 pipelineLayoutGlass = device.createPipelineLayoutUnique(
                     vk::PipelineLayoutCreateInfo({}, glassDescriptorLayout.get(), glassPush));
                 debugName(device, pipelineLayoutGlass.get(), "Image Renderer Glass Pipeline Layout");
-
-                vk::UniqueShaderModule glassFrag = shaders::image_renderer::frag_glass(device);
-                std::array<vk::PipelineShaderStageCreateInfo, 2> glassStages = {
-                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
-                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, glassFrag.get(), "main")
-                };
-                vk::GraphicsPipelineCreateInfo ginfo({},
-                    glassStages, &vertex_input, &input_assembly, &tesselation, &viewport,
-                    &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
-                    pipelineLayoutGlass.get(), renderPasses[0], 0, {}, {});
-                pipelinesGlass = createPipelines(device, pipelineCache, ginfo, renderPasses, "Image Renderer Glass Pipeline");
             }
+            pipelinesReady = compile_pipelines("Image Renderer", pipelineCache, [this, targets, sampleCount](vk::PipelineCache cache) {
+                build_pipelines(targets, sampleCount, cache);
+            });
+            return pipelinesReady;
         }
 
         void prepare(int frameCount) {
@@ -206,11 +176,13 @@ export class image_renderer {
         {
             if(!iconView) return;
             if(frame < 0 || static_cast<std::size_t>(frame) >= glassDescriptorSets.size()) return;
+            gpu_zone zone(cmd, frame, "image_renderer::renderImageGlass");
             vk::DescriptorImageInfo img(sampler.get(), iconView, vk::ImageLayout::eShaderReadOnlyOptimal);
             vk::WriteDescriptorSet write(glassDescriptorSets[frame], 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &img);
             device.updateDescriptorSets(write, {});
 
-            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelinesGlass[renderPass].get());
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelinesGlass.get(renderPass));
             cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayoutGlass.get(), 0, glassDescriptorSets[frame], {});
 
             glm::vec2 pos = glm::vec2(x, y)*2.0f - glm::vec2(1.0f);
@@ -255,7 +227,9 @@ export class image_renderer {
                 imageInfos[frame].push_back(image_info);
             }
 
-            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines[renderPass].get());
+            gpu_zone zone(cmd, frame, "image_renderer::renderImage");
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(renderPass));
             cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, descriptorSet, {});
 
             glm::vec2 pos = glm::vec2(x, y)*2.0f - glm::vec2(1.0f);
@@ -307,7 +281,9 @@ export class image_renderer {
                 imageInfos[frame].push_back(image_info);
             }
 
-            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines[renderPass].get());
+            gpu_zone zone(cmd, frame, "image_renderer::renderImageSized");
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(renderPass));
             cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, descriptorSet, {});
 
             double scaleX = static_cast<double>(width) / frameSize.width;
@@ -331,6 +307,54 @@ export class image_renderer {
             renderImageSized(cmd, frame, renderPass, texture.imageView.get(), x, y, width == -1 ? texture.width : width, height == -1 ? texture.height : height, color);
         }
     private:
+        void build_pipelines(const render_targets& targets, vk::SampleCountFlagBits sampleCount, vk::PipelineCache pipelineCache) {
+            vk::UniqueShaderModule vertexShader = shaders::image_renderer::vert(device);
+            vk::UniqueShaderModule fragmentShader =
+                compat_mode ? shaders::image_renderer::frag_compat(device) :
+                              shaders::image_renderer::frag(device);
+            std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main")
+            };
+
+            vk::PipelineVertexInputStateCreateInfo vertex_input{};
+            vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleStrip);
+            vk::PipelineTessellationStateCreateInfo tesselation({}, {});
+
+            vk::Viewport v{};
+            vk::Rect2D s{};
+            vk::PipelineViewportStateCreateInfo viewport({}, v, s);
+
+            vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
+            vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
+            vk::PipelineDepthStencilStateCreateInfo depthStencil({}, false, false);
+
+            vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::BlendFactor::eOne, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+            vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
+
+            std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+            vk::PipelineDynamicStateCreateInfo dynamic({}, dynamicStates);
+
+            vk::GraphicsPipelineCreateInfo info({},
+                shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
+                &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
+                pipelineLayout.get(), {}, 0, {}, {});
+            pipelines = createPipelines(device, pipelineCache, info, targets, "Image Renderer Pipeline");
+
+            vk::UniqueShaderModule glassFrag = shaders::image_renderer::frag_glass(device);
+            std::array<vk::PipelineShaderStageCreateInfo, 2> glassStages = {
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, glassFrag.get(), "main")
+            };
+            vk::GraphicsPipelineCreateInfo ginfo({},
+                glassStages, &vertex_input, &input_assembly, &tesselation, &viewport,
+                &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
+                pipelineLayoutGlass.get(), {}, 0, {}, {});
+            pipelinesGlass = createPipelines(device, pipelineCache, ginfo, targets, "Image Renderer Glass Pipeline");
+        }
+
         vk::Device device;
         vk::Extent2D frameSize;
         double aspectRatio;
@@ -345,12 +369,13 @@ export class image_renderer {
         vk::UniqueDescriptorPool descriptorPool;
         std::vector<vk::DescriptorSet> descriptorSets;
         vk::UniquePipelineLayout pipelineLayout;
-        UniquePipelineMap pipelines;
+        pipeline_set pipelines;
 
         // Glass variant
         vk::UniqueDescriptorSetLayout glassDescriptorLayout;
         vk::UniquePipelineLayout pipelineLayoutGlass;
-        UniquePipelineMap pipelinesGlass;
+        pipeline_set pipelinesGlass;
+        std::shared_future<void> pipelinesReady;
         vk::UniqueDescriptorPool glassDescriptorPool;
         std::vector<vk::DescriptorSet> glassDescriptorSets;
 
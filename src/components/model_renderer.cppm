@@ -0,0 +1,404 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+export module dreamrender:components.model_renderer;
+
+import :memory_tracker;
+import :model;
+import :pipeline_compiler;
+import :profiler;
+import :shaders;
+import :utils;
+
+import glm;
+import vulkan_hpp;
+import vma;
+
+namespace dreamrender {
+
+export struct model_params {
+    // Direction towards the light in world space.
+    glm::vec3 light_direction = glm::vec3(0.3f, 0.5f, 1.0f);
+    float ambient = 0.2f;
+};
+
+// Draws instances of models, culled against the view frustum on the GPU.
+//
+// Instances are collected with add, then cull records a compute pass that tests the bounds of
+// every instance and writes a draw command per visible one, grouped by model. render issues one
+// indirect draw per model, so the number of draw calls does not grow with the instance count.
+// With drawIndirectCount the commands are compacted and counted on the GPU, otherwise culled
+// instances get a command that draws nothing.
+//
+// The pipeline tests and writes depth if the render pass has a depth attachment. Viewport and
+// scissor are dynamic and not set by render, the caller sets them after beginning the render pass.
+export class model_renderer {
+    public:
+        constexpr static unsigned int default_max_instances = 16*1024;
+        constexpr static unsigned int default_max_models = 256;
+
+        model_renderer(vk::Device device, vma::Allocator allocator, vk::Extent2D /*frameSize*/, const gpu_features& features) :
+            device(device), allocator(allocator),
+            compact(features.vulkan12Features.drawIndirectCount),
+            multiDraw(features.features.multiDrawIndirect)
+        {
+            if(!features.features.drawIndirectFirstInstance) {
+                throw std::runtime_error("model_renderer requires drawIndirectFirstInstance");
+            }
+        }
+        ~model_renderer() {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+        }
+
+        // The pipelines are compiled in the background if a pipeline_compiler is active,
+        // the returned future is ready once they are.
+        std::shared_future<void> preload(const render_targets& targets, vk::SampleCountFlagBits sampleCount,
+            vk::PipelineCache pipelineCache = {},
+            unsigned int max_instances = default_max_instances, unsigned int max_models = default_max_models)
+        {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+            this->max_instances = max_instances;
+            this->max_models = max_models;
+            {
+                std::array<vk::DescriptorSetLayoutBinding, 4> bindings = {
+                    vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex),
+                    vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+                    vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+                    vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+                };
+                vk::DescriptorSetLayoutCreateInfo layout_info({}, bindings);
+                descriptorLayout = device.createDescriptorSetLayoutUnique(layout_info);
+                debugName(device, descriptorLayout.get(), "Model Renderer Descriptor Layout");
+            }
+            {
+                vk::PushConstantRange range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(cull_constants));
+                vk::PipelineLayoutCreateInfo layout_info({}, descriptorLayout.get(), range);
+                cullLayout = device.createPipelineLayoutUnique(layout_info);
+                debugName(device, cullLayout.get(), "Model Renderer Cull Pipeline Layout");
+            }
+            {
+                vk::PushConstantRange range(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(render_constants));
+                vk::PipelineLayoutCreateInfo layout_info({}, descriptorLayout.get(), range);
+                pipelineLayout = device.createPipelineLayoutUnique(layout_info);
+                debugName(device, pipelineLayout.get(), "Model Renderer Pipeline Layout");
+            }
+            pipelinesReady = compile_pipelines("Model Renderer", pipelineCache, [this, targets, sampleCount](vk::PipelineCache cache) {
+                build_pipelines(targets, sampleCount, cache);
+            });
+            return pipelinesReady;
+        }
+
+        void prepare(int frameCount) {
+            std::array<vk::DescriptorPoolSize, 1> sizes = {
+                vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, static_cast<uint32_t>(frameCount) * 4)
+            };
+            descriptorPool = device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo({}, frameCount, sizes));
+            std::vector<vk::DescriptorSetLayout> layouts(frameCount, descriptorLayout.get());
+            std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo(descriptorPool.get(), layouts));
+
+            frames.clear();
+            frames.resize(frameCount);
+            for(int i = 0; i < frameCount; i++) {
+                frame_resources& f = frames[i];
+                f.descriptorSet = sets[i];
+
+                vma::AllocationCreateInfo hostInfo({}, vma::MemoryUsage::eCpuToGpu);
+                vma::AllocationCreateInfo deviceInfo({}, vma::MemoryUsage::eGpuOnly);
+                std::tie(f.instanceBuffer, f.instanceAllocation) = create_tracked_buffer(allocator, memory_tag::frame_data,
+                    vk::BufferCreateInfo({}, sizeof(instance_data) * max_instances, vk::BufferUsageFlagBits::eStorageBuffer), hostInfo);
+                std::tie(f.modelBuffer, f.modelAllocation) = create_tracked_buffer(allocator, memory_tag::frame_data,
+                    vk::BufferCreateInfo({}, sizeof(model_data) * max_models, vk::BufferUsageFlagBits::eStorageBuffer), hostInfo);
+                std::tie(f.commandBuffer, f.commandAllocation) = create_tracked_buffer(allocator, memory_tag::frame_data,
+                    vk::BufferCreateInfo({}, sizeof(vk::DrawIndexedIndirectCommand) * max_instances,
+                        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer), deviceInfo);
+                std::tie(f.countBuffer, f.countAllocation) = create_tracked_buffer(allocator, memory_tag::frame_data,
+                    vk::BufferCreateInfo({}, sizeof(uint32_t) * max_models,
+                        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst), deviceInfo);
+                f.instanceMapping = vma::MemoryMapping(allocator, f.instanceAllocation.get());
+                f.modelMapping = vma::MemoryMapping(allocator, f.modelAllocation.get());
+
+                std::array<vk::DescriptorBufferInfo, 4> bufferInfos = {
+                    vk::DescriptorBufferInfo(f.instanceBuffer.get(), 0, vk::WholeSize),
+                    vk::DescriptorBufferInfo(f.modelBuffer.get(), 0, vk::WholeSize),
+                    vk::DescriptorBufferInfo(f.commandBuffer.get(), 0, vk::WholeSize),
+                    vk::DescriptorBufferInfo(f.countBuffer.get(), 0, vk::WholeSize),
+                };
+                std::array<vk::WriteDescriptorSet, 4> writes;
+                for(uint32_t b = 0; b < writes.size(); b++) {
+                    writes[b] = vk::WriteDescriptorSet(f.descriptorSet, b, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &bufferInfos[b]);
+                }
+                device.updateDescriptorSets(writes, {});
+            }
+        }
+
+        // Adds an instance for this frame. Models that are not loaded yet are skipped.
+        void add(int frame, const model& m, const glm::mat4& transform, glm::vec4 color = glm::vec4(1.0f)) {
+            if(!m.loaded || m.indexCount <= 0) {
+                return;
+            }
+            if(m.format != vertex_format::full) {
+                throw std::runtime_error("model_renderer only draws models with vertex_format::full");
+            }
+            frame_resources& f = frames[frame];
+            if(f.instances.size() >= max_instances) {
+                throw std::runtime_error("Too many model instances");
+            }
+            auto it = std::ranges::find(f.models, &m);
+            if(it == f.models.end()) {
+                if(f.models.size() >= max_models) {
+                    throw std::runtime_error("Too many models");
+                }
+                it = f.models.insert(f.models.end(), &m);
+            }
+            f.instances.push_back(instance_data{
+                .transform = transform,
+                .color = color,
+                .model = static_cast<uint32_t>(it - f.models.begin()),
+            });
+        }
+
+        // Records the culling pass for the instances added this frame. Must be recorded
+        // outside of the render pass that draws them.
+        void cull(vk::CommandBuffer cmd, int frame, const glm::mat4& viewProjection) {
+            frame_resources& f = frames[frame];
+            f.viewProjection = viewProjection;
+            f.culled = true;
+            if(f.instances.empty()) {
+                return;
+            }
+
+            // Every model gets a range of commands large enough for all of its instances.
+            f.batches.assign(f.models.size(), batch{});
+            for(const auto& instance : f.instances) {
+                f.batches[instance.model].size++;
+            }
+            uint32_t first = 0;
+            for(auto& b : f.batches) {
+                b.first = first;
+                first += b.size;
+            }
+            std::vector<uint32_t> next(f.models.size(), 0);
+            for(auto& instance : f.instances) {
+                instance.command = f.batches[instance.model].first + next[instance.model]++;
+            }
+
+            auto* models = static_cast<model_data*>(f.modelMapping.get());
+            for(std::size_t i = 0; i < f.models.size(); i++) {
+                models[i] = model_data{
+                    .bounds_min = glm::vec4(f.models[i]->min, 1.0f),
+                    .bounds_max = glm::vec4(f.models[i]->max, 1.0f),
+                    .index_count = static_cast<uint32_t>(f.models[i]->indexCount),
+                    .first_command = f.batches[i].first,
+                };
+            }
+            std::memcpy(f.instanceMapping.get(), f.instances.data(), f.instances.size() * sizeof(instance_data));
+            allocator.flushAllocation(f.modelAllocation.get(), 0, f.models.size() * sizeof(model_data));
+            allocator.flushAllocation(f.instanceAllocation.get(), 0, f.instances.size() * sizeof(instance_data));
+
+            gpu_zone zone(cmd, frame, "model_renderer::cull");
+            cmd.fillBuffer(f.countBuffer.get(), 0, f.models.size() * sizeof(uint32_t), 0);
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {},
+                vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite), {}, {});
+
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline.get());
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullLayout.get(), 0, f.descriptorSet, {});
+            cull_constants push{
+                .view_projection = viewProjection,
+                .instance_count = static_cast<uint32_t>(f.instances.size()),
+                .compact = compact ? 1u : 0u,
+            };
+            cmd.pushConstants<cull_constants>(cullLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, push);
+            cmd.dispatch((push.instance_count + 63) / 64, 1, 1);
+
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader, {},
+                vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead), {}, {});
+        }
+
+        // Draws the visible instances culled for this frame.
+        void render(vk::CommandBuffer cmd, int frame, vk::RenderPass renderPass, model_params p = {}) {
+            frame_resources& f = frames[frame];
+            if(!f.culled) {
+                throw std::runtime_error("model_renderer::render without cull");
+            }
+            if(f.instances.empty()) {
+                return;
+            }
+
+            gpu_zone zone(cmd, frame, "model_renderer::render");
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(renderPass));
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, f.descriptorSet, {});
+            render_constants push{
+                .view_projection = f.viewProjection,
+                .light = glm::vec4(p.light_direction, p.ambient),
+            };
+            cmd.pushConstants<render_constants>(pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, push);
+
+            constexpr vk::DeviceSize stride = sizeof(vk::DrawIndexedIndirectCommand);
+            for(std::size_t i = 0; i < f.models.size(); i++) {
+                const auto [vertexBuffer, vertexOffset] = f.models[i]->get_vertex_buffer();
+                const auto [indexBuffer, indexOffset] = f.models[i]->get_index_buffer();
+                cmd.bindVertexBuffers(0, vertexBuffer, vertexOffset);
+                cmd.bindIndexBuffer(indexBuffer, indexOffset, vk::IndexType::eUint32);
+
+                const batch& b = f.batches[i];
+                if(compact) {
+                    cmd.drawIndexedIndirectCount(f.commandBuffer.get(), b.first * stride,
+                        f.countBuffer.get(), i * sizeof(uint32_t), b.size, stride);
+                } else if(multiDraw) {
+                    cmd.drawIndexedIndirect(f.commandBuffer.get(), b.first * stride, b.size, stride);
+                } else {
+                    for(uint32_t c = 0; c < b.size; c++) {
+                        cmd.drawIndexedIndirect(f.commandBuffer.get(), (b.first + c) * stride, 1, stride);
+                    }
+                }
+            }
+        }
+
+        void finish(int frame) {
+            frame_resources& f = frames[frame];
+            f.instances.clear();
+            f.models.clear();
+            f.culled = false;
+        }
+    private:
+        void build_pipelines(const render_targets& targets, vk::SampleCountFlagBits sampleCount, vk::PipelineCache pipelineCache) {
+            {
+                vk::UniqueShaderModule shader = shaders::model_renderer::comp(device);
+                vk::ComputePipelineCreateInfo info({},
+                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, shader.get(), "main"),
+                    cullLayout.get());
+                cullPipeline = device.createComputePipelineUnique(pipelineCache, info).value;
+                debugName(device, cullPipeline.get(), "Model Renderer Cull Pipeline");
+            }
+
+            vk::UniqueShaderModule vertexShader = shaders::model_renderer::vert(device);
+            vk::UniqueShaderModule fragmentShader = shaders::model_renderer::frag(device);
+            std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main")
+            };
+
+            vk::VertexInputBindingDescription binding(0, sizeof(vertex_data), vk::VertexInputRate::eVertex);
+            auto attributes = vertex_data::attributes(0);
+            vk::PipelineVertexInputStateCreateInfo vertex_input({}, binding, attributes);
+            vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleList);
+            vk::PipelineTessellationStateCreateInfo tesselation({}, {});
+
+            vk::Viewport v{};
+            vk::Rect2D s{};
+            vk::PipelineViewportStateCreateInfo viewport({}, v, s);
+
+            vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eBack, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
+            vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
+            vk::PipelineDepthStencilStateCreateInfo depthStencil({}, true, true, vk::CompareOp::eLessOrEqual);
+
+            vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::BlendFactor::eOne, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+            vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
+
+            std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+            vk::PipelineDynamicStateCreateInfo dynamic({}, dynamicStates);
+
+            vk::GraphicsPipelineCreateInfo info({},
+                shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
+                &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
+                pipelineLayout.get(), {}, 0, {}, {});
+            pipelines = createPipelines(device, pipelineCache, info, targets, "Model Renderer Pipeline");
+        }
+
+        // Layouts match the std430 buffers in model_renderer.comp and model_renderer.vert.
+        struct instance_data {
+            glm::mat4 transform;
+            glm::vec4 color;
+            uint32_t model;
+            // Slot of the instance's command if the commands are not compacted.
+            uint32_t command = 0;
+            uint32_t pad[2] = {};
+        };
+        static_assert(sizeof(instance_data) == 96);
+        struct model_data {
+            glm::vec4 bounds_min;
+            glm::vec4 bounds_max;
+            uint32_t index_count;
+            uint32_t first_command;
+            uint32_t pad[2] = {};
+        };
+        static_assert(sizeof(model_data) == 48);
+        struct cull_constants {
+            glm::mat4 view_projection;
+            uint32_t instance_count;
+            uint32_t compact;
+        };
+        struct render_constants {
+            glm::mat4 view_projection;
+            glm::vec4 light;
+        };
+        static_assert(sizeof(render_constants) <= 128, "push constants must fit the guaranteed minimum size");
+
+        struct batch {
+            uint32_t first = 0;
+            uint32_t size = 0;
+        };
+        struct frame_resources {
+            vk::DescriptorSet descriptorSet;
+
+            vma::UniqueBuffer instanceBuffer;
+            tracked_allocation instanceAllocation;
+            vma::MemoryMapping instanceMapping;
+            vma::UniqueBuffer modelBuffer;
+            tracked_allocation modelAllocation;
+            vma::MemoryMapping modelMapping;
+            vma::UniqueBuffer commandBuffer;
+            tracked_allocation commandAllocation;
+            vma::UniqueBuffer countBuffer;
+            tracked_allocation countAllocation;
+
+            std::vector<instance_data> instances;
+            std::vector<const model*> models;
+            std::vector<batch> batches;
+            glm::mat4 viewProjection{1.0f};
+            bool culled = false;
+        };
+
+        vk::Device device;
+        vma::Allocator allocator;
+        bool compact;
+        bool multiDraw;
+
+        unsigned int max_instances = default_max_instances;
+        unsigned int max_models = default_max_models;
+
+        std::vector<frame_resources> frames;
+
+        vk::UniqueDescriptorSetLayout descriptorLayout;
+        vk::UniqueDescriptorPool descriptorPool;
+
+        vk::UniquePipelineLayout cullLayout;
+        vk::UniquePipeline cullPipeline;
+        vk::UniquePipelineLayout pipelineLayout;
+        pipeline_set pipelines;
+        std::shared_future<void> pipelinesReady;
+};
+
+}
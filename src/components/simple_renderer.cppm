@@ -5,12 +5,16 @@
  */
 module;
 
+#include <future>
 #include <vector>
 
 #include <iostream>
 
 export module dreamrender:components.simple_renderer;
 
+import :pipeline_compiler;
+import :memory_tracker;
+import :profiler;
 import :shaders;
 import :texture;
 import :utils;
@@ -41,11 +45,20 @@ export class simple_renderer {
         simple_renderer(vk::Device device, vma::Allocator allocator, vk::Extent2D frameSize, const gpu_features& features) :
             device(device), allocator(allocator), frameSize(frameSize),
             aspectRatio(static_cast<double>(frameSize.width)/frameSize.height) {}
-        ~simple_renderer() = default;
+        ~simple_renderer() {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+        }
 
-        void preload(const std::vector<vk::RenderPass>& renderPasses, vk::SampleCountFlagBits sampleCount,
+        // The pipelines are compiled in the background if a pipeline_compiler is active,
+        // the returned future is ready once they are.
+        std::shared_future<void> preload(const render_targets& targets, vk::SampleCountFlagBits sampleCount,
             vk::PipelineCache pipelineCache = {})
         {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
             {
                 std::array<vk::PushConstantRange, 1> push_constant_ranges = {
                     vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(params)),
@@ -54,46 +67,10 @@ export class simple_renderer {
                 pipelineLayout = device.createPipelineLayoutUnique(layout_info);
                 debugName(device, pipelineLayout.get(), "Simple Renderer Pipeline Layout");
             }
-            {
-                vk::UniqueShaderModule vertexShader = shaders::simple_renderer::vert(device);
-                vk::UniqueShaderModule fragmentShader = shaders::simple_renderer::frag(device);
-                std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
-                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
-                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main")
-                };
-
-                vk::VertexInputBindingDescription binding(0, sizeof(vertex_data), vk::VertexInputRate::eVertex);
-                std::array attributes = {
-                    vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat, offsetof(vertex_data, position)),
-                    vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(vertex_data, color)),
-                    vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32Sfloat, offsetof(vertex_data, tex_coords)),
-                };
-                vk::PipelineVertexInputStateCreateInfo vertex_input({}, binding, attributes);
-                vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleList);
-                vk::PipelineTessellationStateCreateInfo tesselation({}, {});
-
-                vk::Viewport v{};
-                vk::Rect2D s{};
-                vk::PipelineViewportStateCreateInfo viewport({}, v, s);
-
-                vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
-                vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
-                vk::PipelineDepthStencilStateCreateInfo depthStencil({}, false, false);
-
-                vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
-                    vk::BlendFactor::eOne, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
-                    vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
-                vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
-
-                std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
-                vk::PipelineDynamicStateCreateInfo dynamic({}, dynamicStates);
-
-                vk::GraphicsPipelineCreateInfo info({},
-                    shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
-                    &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
-                    pipelineLayout.get(), renderPasses[0], 0, {}, {});
-                pipelines = createPipelines(device, pipelineCache, info, renderPasses, "Simple Renderer Pipeline");
-            }
+            pipelinesReady = compile_pipelines("Simple Renderer", pipelineCache, [this, targets, sampleCount](vk::PipelineCache cache) {
+                build_pipelines(targets, sampleCount, cache);
+            });
+            return pipelinesReady;
         }
 
         void prepare(int frameCount) {
@@ -106,7 +83,7 @@ export class simple_renderer {
                 vk::BufferCreateInfo bufferInfo({}, sizeof(vertex_data)*vertexCount,
                     vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive);
                 vma::AllocationCreateInfo allocationInfo({}, vma::MemoryUsage::eCpuToGpu);
-                auto [b, a] = allocator.createBufferUnique(bufferInfo, allocationInfo);
+                auto [b, a] = create_tracked_buffer(allocator, memory_tag::frame_data, bufferInfo, allocationInfo);
                 auto& mapping = vertexBufferMappings.emplace_back(allocator, a.get());
                 vertexBufferPointers.push_back(reinterpret_cast<vertex_data*>(mapping.get()));
                 vertexBuffers.push_back(std::move(b));
@@ -125,8 +102,10 @@ export class simple_renderer {
                 static_cast<vk::DeviceSize>(firstVertex) * sizeof(vertex_data),
                 static_cast<vk::DeviceSize>(vertices.size()) * sizeof(vertex_data));
 
+            gpu_zone zone(cmd, frame, "simple_renderer::renderGeneric");
             cmd.bindVertexBuffers(0, vertexBuffers[frame].get(), {0});
-            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines[renderPass].get());
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(renderPass));
             cmd.pushConstants(pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(params), &p);
             cmd.draw(vertices.size(), 1, firstVertex, 0);
 
@@ -160,6 +139,47 @@ export class simple_renderer {
             vertexCounts[frame] = 0;
         }
     private:
+        void build_pipelines(const render_targets& targets, vk::SampleCountFlagBits sampleCount, vk::PipelineCache pipelineCache) {
+            vk::UniqueShaderModule vertexShader = shaders::simple_renderer::vert(device);
+            vk::UniqueShaderModule fragmentShader = shaders::simple_renderer::frag(device);
+            std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main")
+            };
+
+            vk::VertexInputBindingDescription binding(0, sizeof(vertex_data), vk::VertexInputRate::eVertex);
+            std::array attributes = {
+                vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat, offsetof(vertex_data, position)),
+                vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(vertex_data, color)),
+                vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32Sfloat, offsetof(vertex_data, tex_coords)),
+            };
+            vk::PipelineVertexInputStateCreateInfo vertex_input({}, binding, attributes);
+            vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleList);
+            vk::PipelineTessellationStateCreateInfo tesselation({}, {});
+
+            vk::Viewport v{};
+            vk::Rect2D s{};
+            vk::PipelineViewportStateCreateInfo viewport({}, v, s);
+
+            vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
+            vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
+            vk::PipelineDepthStencilStateCreateInfo depthStencil({}, false, false);
+
+            vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::BlendFactor::eOne, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+            vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
+
+            std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+            vk::PipelineDynamicStateCreateInfo dynamic({}, dynamicStates);
+
+            vk::GraphicsPipelineCreateInfo info({},
+                shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
+                &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
+                pipelineLayout.get(), {}, 0, {}, {});
+            pipelines = createPipelines(device, pipelineCache, info, targets, "Simple Renderer Pipeline");
+        }
+
         constexpr static unsigned int vertexCount = 4096;
 
         vk::Device device;
@@ -168,13 +188,14 @@ export class simple_renderer {
         double aspectRatio;
 
         std::vector<vma::UniqueBuffer> vertexBuffers;
-        std::vector<vma::UniqueAllocation> vertexBufferAllocations;
+        std::vector<tracked_allocation> vertexBufferAllocations;
         std::vector<vma::MemoryMapping> vertexBufferMappings;
         std::vector<vertex_data*> vertexBufferPointers;
         std::vector<unsigned int> vertexCounts;
 
         vk::UniquePipelineLayout pipelineLayout;
-        UniquePipelineMap pipelines;
+        pipeline_set pipelines;
+        std::shared_future<void> pipelinesReady;
 };
 
 }
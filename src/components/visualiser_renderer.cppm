@@ -0,0 +1,285 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <future>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+export module dreamrender:components.visualiser_renderer;
+
+import :pipeline_compiler;
+import :memory_tracker;
+import :profiler;
+import :shaders;
+import :utils;
+
+import glm;
+import vulkan_hpp;
+import vma;
+
+namespace dreamrender {
+
+export enum class visualiser_mode : uint32_t {
+    line = 0,
+    bars = 1,
+    filled = 2,
+};
+
+export struct visualiser_params {
+    visualiser_mode mode = visualiser_mode::line;
+
+    // Number of points (line/filled) or bars to draw, 0 draws one per sample.
+    unsigned int points = 0;
+    // Line thickness in pixels.
+    float thickness = 2.0f;
+    // Gaussian smoothing radius in samples, 0 disables smoothing.
+    float smoothing = 0.0f;
+
+    // Logarithmic x axis between these sample indices (e.g. FFT bins), disabled if log_min <= 0.
+    // A log_max of 0 means the last sample.
+    float log_min = 0.0f;
+    float log_max = 0.0f;
+
+    // Value range mapped to the bottom and top of the graph.
+    float min_value = -1.0f;
+    float max_value = 1.0f;
+    // Where bars and filled areas start, 0 is the bottom and 1 the top of the graph.
+    float baseline = 0.0f;
+    // Fraction of each bar slot left empty.
+    float gap = 0.2f;
+
+    // Helper for FFT magnitudes: logarithmic axis from min_frequency to max_frequency.
+    static visualiser_params spectrum(float bin_frequency, float min_frequency = 20.0f, float max_frequency = 20000.0f) {
+        visualiser_params p{};
+        p.mode = visualiser_mode::bars;
+        p.min_value = 0.0f;
+        p.max_value = 1.0f;
+        p.log_min = std::max(min_frequency / bin_frequency, 1.0f);
+        p.log_max = max_frequency / bin_frequency;
+        return p;
+    }
+};
+
+export class visualiser_renderer {
+    public:
+        constexpr static unsigned int default_max_samples = 64*1024;
+
+        visualiser_renderer(vk::Device device, vma::Allocator allocator, vk::Extent2D frameSize, const gpu_features& features) :
+            device(device), allocator(allocator), frameSize(frameSize) {}
+        ~visualiser_renderer() {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+        }
+
+        // The pipelines are compiled in the background if a pipeline_compiler is active,
+        // the returned future is ready once they are.
+        std::shared_future<void> preload(const render_targets& targets, vk::SampleCountFlagBits sampleCount,
+            vk::PipelineCache pipelineCache = {}, unsigned int max_samples = default_max_samples)
+        {
+            if(pipelinesReady.valid()) {
+                pipelinesReady.wait();
+            }
+            this->max_samples = max_samples;
+            {
+                std::array<vk::DescriptorSetLayoutBinding, 1> bindings = {
+                    vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex)
+                };
+                vk::DescriptorSetLayoutCreateInfo layout_info({}, bindings);
+                descriptorLayout = device.createDescriptorSetLayoutUnique(layout_info);
+                debugName(device, descriptorLayout.get(), "Visualiser Renderer Descriptor Layout");
+            }
+            {
+                std::array<vk::PushConstantRange, 1> push_constant_ranges = {
+                    vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(push_constants)),
+                };
+                vk::PipelineLayoutCreateInfo layout_info({}, descriptorLayout.get(), push_constant_ranges);
+                pipelineLayout = device.createPipelineLayoutUnique(layout_info);
+                debugName(device, pipelineLayout.get(), "Visualiser Renderer Pipeline Layout");
+            }
+            pipelinesReady = compile_pipelines("Visualiser Renderer", pipelineCache, [this, targets, sampleCount](vk::PipelineCache cache) {
+                build_pipelines(targets, sampleCount, cache);
+            });
+            return pipelinesReady;
+        }
+
+        void prepare(int frameCount) {
+            std::array<vk::DescriptorPoolSize, 1> sizes = {
+                vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, static_cast<uint32_t>(frameCount))
+            };
+            descriptorPool = device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo({}, frameCount, sizes));
+            std::vector<vk::DescriptorSetLayout> layouts(frameCount, descriptorLayout.get());
+            descriptorSets = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo(descriptorPool.get(), layouts));
+
+            samplePointers.clear();
+            sampleMappings.clear();
+            sampleBuffers.clear();
+            sampleAllocations.clear();
+            sampleCounts.clear();
+
+            std::vector<vk::DescriptorBufferInfo> bufferInfos(frameCount);
+            std::vector<vk::WriteDescriptorSet> writes(frameCount);
+            for(int i = 0; i < frameCount; i++) {
+                vk::BufferCreateInfo bufferInfo({}, sizeof(float)*max_samples,
+                    vk::BufferUsageFlagBits::eStorageBuffer, vk::SharingMode::eExclusive);
+                vma::AllocationCreateInfo allocationInfo({}, vma::MemoryUsage::eCpuToGpu);
+                auto [b, a] = create_tracked_buffer(allocator, memory_tag::frame_data, bufferInfo, allocationInfo);
+                auto& mapping = sampleMappings.emplace_back(allocator, a.get());
+                samplePointers.push_back(reinterpret_cast<float*>(mapping.get()));
+
+                bufferInfos[i] = vk::DescriptorBufferInfo(b.get(), 0, vk::WholeSize);
+                writes[i] = vk::WriteDescriptorSet(descriptorSets[i], 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &bufferInfos[i]);
+
+                sampleBuffers.push_back(std::move(b));
+                sampleAllocations.push_back(std::move(a));
+                sampleCounts.push_back(0);
+            }
+            device.updateDescriptorSets(writes, {});
+        }
+
+        // Draws values as a graph inside the rectangle at position/size (normalized screen coordinates).
+        // Only the samples are uploaded, the geometry is expanded on the GPU.
+        void renderSamples(vk::CommandBuffer cmd, int frame, vk::RenderPass renderPass, std::span<const float> samples,
+            glm::vec2 position, glm::vec2 size, glm::vec4 color, visualiser_params p = {})
+        {
+            if(samples.size() < 2) {
+                return;
+            }
+            if(sampleCounts[frame] + samples.size() > max_samples) {
+                throw std::runtime_error("Too many samples");
+            }
+
+            const auto firstSample = sampleCounts[frame];
+            std::ranges::copy(samples, samplePointers[frame] + firstSample);
+            allocator.flushAllocation(
+                sampleAllocations[frame].get(),
+                static_cast<vk::DeviceSize>(firstSample) * sizeof(float),
+                static_cast<vk::DeviceSize>(samples.size()) * sizeof(float));
+            sampleCounts[frame] += samples.size();
+
+            unsigned int points = p.points == 0 ? static_cast<unsigned int>(samples.size()) : p.points;
+            uint32_t vertices = 0;
+            if(p.mode == visualiser_mode::bars) {
+                vertices = 6 * points;
+            } else {
+                if(points < 2) {
+                    return;
+                }
+                vertices = 6 * (points - 1);
+            }
+
+            push_constants push{
+                .rect = {position, size},
+                .color = color,
+                .frame_size = {static_cast<float>(frameSize.width), static_cast<float>(frameSize.height)},
+                .offset = firstSample,
+                .count = static_cast<uint32_t>(samples.size()),
+                .points = points,
+                .mode = static_cast<uint32_t>(p.mode),
+                .thickness = p.thickness,
+                .smoothing = p.smoothing,
+                .log_min = p.log_min,
+                .log_max = p.log_max,
+                .baseline = p.baseline,
+                .gap = std::clamp(p.gap, 0.0f, 1.0f),
+                .min_value = p.min_value,
+                .max_value = p.max_value,
+            };
+
+            gpu_zone zone(cmd, frame, "visualiser_renderer::renderSamples");
+            pipelinesReady.get();
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(renderPass));
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, descriptorSets[frame], {});
+            cmd.pushConstants<push_constants>(pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex, 0, push);
+            cmd.draw(vertices, 1, 0, 0);
+        }
+
+        void finish(int frame) {
+            sampleCounts[frame] = 0;
+        }
+    private:
+        void build_pipelines(const render_targets& targets, vk::SampleCountFlagBits sampleCount, vk::PipelineCache pipelineCache) {
+            vk::UniqueShaderModule vertexShader = shaders::visualiser_renderer::vert(device);
+            vk::UniqueShaderModule fragmentShader = shaders::visualiser_renderer::frag(device);
+            std::array<vk::PipelineShaderStageCreateInfo, 2> shaders = {
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main"),
+                vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main")
+            };
+
+            // All geometry is expanded from gl_VertexIndex, there are no vertex attributes.
+            vk::PipelineVertexInputStateCreateInfo vertex_input{};
+            vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleList);
+            vk::PipelineTessellationStateCreateInfo tesselation({}, {});
+
+            vk::Viewport v{};
+            vk::Rect2D s{};
+            vk::PipelineViewportStateCreateInfo viewport({}, v, s);
+
+            vk::PipelineRasterizationStateCreateInfo rasterization({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
+            vk::PipelineMultisampleStateCreateInfo multisample({}, sampleCount);
+            vk::PipelineDepthStencilStateCreateInfo depthStencil({}, false, false);
+
+            vk::PipelineColorBlendAttachmentState attachment(true, vk::BlendFactor::eSrcAlpha, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::BlendFactor::eOne, vk::BlendFactor::eOneMinusSrcAlpha, vk::BlendOp::eAdd,
+                vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+            vk::PipelineColorBlendStateCreateInfo colorBlend({}, false, vk::LogicOp::eClear, attachment);
+
+            std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+            vk::PipelineDynamicStateCreateInfo dynamic({}, dynamicStates);
+
+            vk::GraphicsPipelineCreateInfo info({},
+                shaders, &vertex_input, &input_assembly, &tesselation, &viewport,
+                &rasterization, &multisample, &depthStencil, &colorBlend, &dynamic,
+                pipelineLayout.get(), {}, 0, {}, {});
+            pipelines = createPipelines(device, pipelineCache, info, targets, "Visualiser Renderer Pipeline");
+        }
+
+        struct push_constants {
+            glm::vec4 rect;
+            glm::vec4 color;
+            glm::vec2 frame_size;
+            uint32_t offset;
+            uint32_t count;
+            uint32_t points;
+            uint32_t mode;
+            float thickness;
+            float smoothing;
+            float log_min;
+            float log_max;
+            float baseline;
+            float gap;
+            float min_value;
+            float max_value;
+        };
+        static_assert(sizeof(push_constants) <= 128, "push constants must fit the guaranteed minimum size");
+
+        vk::Device device;
+        vma::Allocator allocator;
+        vk::Extent2D frameSize;
+
+        unsigned int max_samples = default_max_samples;
+
+        std::vector<vma::UniqueBuffer> sampleBuffers;
+        std::vector<tracked_allocation> sampleAllocations;
+        std::vector<vma::MemoryMapping> sampleMappings;
+        std::vector<float*> samplePointers;
+        std::vector<uint32_t> sampleCounts;
+
+        vk::UniqueDescriptorSetLayout descriptorLayout;
+        vk::UniqueDescriptorPool descriptorPool;
+        std::vector<vk::DescriptorSet> descriptorSets;
+
+        vk::UniquePipelineLayout pipelineLayout;
+        pipeline_set pipelines;
+        std::shared_future<void> pipelinesReady;
+};
+
+}
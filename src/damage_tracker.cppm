@@ -0,0 +1,314 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+export module dreamrender:damage_tracker;
+
+import vulkan_hpp;
+
+namespace dreamrender {
+
+// Builds the key that identifies the content of a draw, see damage_tracker::add.
+// Values are hashed bytewise, so they must not contain padding.
+export class damage_key {
+    public:
+        template<typename T>
+            requires std::is_trivially_copyable_v<T>
+        damage_key& add(const T& value) {
+            return add_bytes(&value, sizeof(T));
+        }
+        damage_key& add(std::string_view text) {
+            add(text.size());
+            return add_bytes(text.data(), text.size());
+        }
+        template<typename T>
+            requires std::is_trivially_copyable_v<T>
+        damage_key& add_range(std::span<const T> values) {
+            add(values.size());
+            return add_bytes(values.data(), values.size_bytes());
+        }
+        uint64_t get() const {
+            return hash;
+        }
+    private:
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        damage_key& add_bytes(const void* data, std::size_t size) {
+            const auto* bytes = static_cast<const unsigned char*>(data);
+            for(std::size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+            }
+            return *this;
+        }
+};
+
+// Finds the parts of the screen that changed between frames.
+//
+// Every frame the draws are reported with a key of their content and their bounds in pixels.
+// Draws that are not in the previous frame, and draws of the previous frame that are gone,
+// damage their bounds. A draw's key includes the keys of earlier draws it overlaps, so a
+// change in what lies underneath or in the drawing order damages it as well.
+//
+// Each swapchain image holds an older frame, so the region that must be redrawn for an image
+// is the union of the damage since that image was last drawn. end_frame is meant to be called
+// from phase::update and take_region from phase::render, which may run on different threads,
+// so every member takes the lock.
+export class damage_tracker {
+    public:
+        // Damage beyond this share of the frame redraws the whole frame.
+        static constexpr double full_frame_threshold = 0.7;
+        // Damage is merged into at most this many rectangles.
+        static constexpr std::size_t max_rects = 8;
+        // Frames of damage that are remembered. Images that are older are redrawn completely.
+        static constexpr std::size_t history_length = 8;
+
+        explicit damage_tracker(vk::Extent2D extent = {}) : extent(extent) {}
+
+        void begin_frame() {
+            std::scoped_lock<std::mutex> l(lock);
+            current.clear();
+            extraDamage.clear();
+        }
+        // Bounds are clipped to the frame, draws outside of it are ignored.
+        void add(uint64_t key, vk::Rect2D bounds) {
+            std::scoped_lock<std::mutex> l(lock);
+            bounds = intersect(bounds, full());
+            if(empty(bounds)) {
+                return;
+            }
+            current.push_back(draw{key, bounds});
+        }
+        // Damages a region whose content changed without its draw changing, e.g. a video texture.
+        void damage(vk::Rect2D region) {
+            std::scoped_lock<std::mutex> l(lock);
+            region = intersect(region, full());
+            if(!empty(region)) {
+                extraDamage.push_back(region);
+            }
+        }
+        // Compares the frame with the previous one. Returns false if nothing changed.
+        bool end_frame() {
+            std::scoped_lock<std::mutex> l(lock);
+            for(std::size_t i = 0; i < current.size(); i++) {
+                damage_key key;
+                key.add(current[i].key).add(current[i].bounds);
+                for(std::size_t j = 0; j < i; j++) {
+                    if(intersects(current[i].bounds, current[j].bounds)) {
+                        key.add(current[j].key);
+                    }
+                }
+                current[i].key = key.get();
+            }
+
+            std::vector<vk::Rect2D> rects = std::move(extraDamage);
+            extraDamage.clear();
+            diff(previous, current, rects);
+            std::swap(previous, current);
+
+            if(rects.empty()) {
+                return false;
+            }
+            merge(rects);
+
+            generation++;
+            history.push_back(frame_damage{generation, std::move(rects)});
+            while(history.size() > history_length) {
+                history.pop_front();
+            }
+            return true;
+        }
+        // Increases with every frame that changed, phases pass it from update to render.
+        uint64_t current_generation() const {
+            std::scoped_lock<std::mutex> l(lock);
+            return generation;
+        }
+
+        // Region of the image that must be redrawn for it to show the given generation,
+        // and remembers that it will. Empty if the image is already up to date.
+        std::vector<vk::Rect2D> take_region(unsigned int image, uint64_t generation) {
+            std::scoped_lock<std::mutex> l(lock);
+            if(image >= imageGenerations.size()) {
+                imageGenerations.resize(image + 1);
+            }
+            std::optional<uint64_t> last = std::exchange(imageGenerations[image], generation);
+            if(last && *last >= generation) {
+                return {};
+            }
+            const uint64_t oldest = history.empty() ? generation + 1 : history.front().generation;
+            if(!last || *last + 1 < oldest) {
+                return {full()};
+            }
+
+            std::vector<vk::Rect2D> rects;
+            for(const auto& h : history) {
+                if(h.generation > *last && h.generation <= generation) {
+                    rects.insert(rects.end(), h.rects.begin(), h.rects.end());
+                }
+            }
+            merge(rects);
+            return rects;
+        }
+
+        // Forgets the content of all images, e.g. after the swapchain was recreated.
+        void invalidate(vk::Extent2D extent) {
+            std::scoped_lock<std::mutex> l(lock);
+            this->extent = extent;
+            imageGenerations.clear();
+            previous.clear();
+        }
+
+        bool is_full(std::span<const vk::Rect2D> rects) const {
+            std::scoped_lock<std::mutex> l(lock);
+            return rects.size() == 1 && rects[0] == full();
+        }
+
+        static bool empty(const vk::Rect2D& r) {
+            return r.extent.width == 0 || r.extent.height == 0;
+        }
+        static bool intersects(const vk::Rect2D& a, const vk::Rect2D& b) {
+            return !empty(intersect(a, b));
+        }
+        static vk::Rect2D intersect(const vk::Rect2D& a, const vk::Rect2D& b) {
+            const int64_t x0 = std::max<int64_t>(a.offset.x, b.offset.x);
+            const int64_t y0 = std::max<int64_t>(a.offset.y, b.offset.y);
+            const int64_t x1 = std::min<int64_t>(right(a), right(b));
+            const int64_t y1 = std::min<int64_t>(bottom(a), bottom(b));
+            if(x1 <= x0 || y1 <= y0) {
+                return vk::Rect2D({static_cast<int32_t>(x0), static_cast<int32_t>(y0)}, {0, 0});
+            }
+            return vk::Rect2D({static_cast<int32_t>(x0), static_cast<int32_t>(y0)},
+                {static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0)});
+        }
+        static vk::Rect2D unite(const vk::Rect2D& a, const vk::Rect2D& b) {
+            if(empty(a)) {
+                return b;
+            }
+            if(empty(b)) {
+                return a;
+            }
+            const int64_t x0 = std::min<int64_t>(a.offset.x, b.offset.x);
+            const int64_t y0 = std::min<int64_t>(a.offset.y, b.offset.y);
+            const int64_t x1 = std::max<int64_t>(right(a), right(b));
+            const int64_t y1 = std::max<int64_t>(bottom(a), bottom(b));
+            return vk::Rect2D({static_cast<int32_t>(x0), static_cast<int32_t>(y0)},
+                {static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0)});
+        }
+        static vk::Rect2D bounds(std::span<const vk::Rect2D> rects) {
+            vk::Rect2D result{};
+            for(const auto& r : rects) {
+                result = unite(result, r);
+            }
+            return result;
+        }
+    private:
+        struct draw {
+            uint64_t key;
+            vk::Rect2D bounds;
+        };
+        struct frame_damage {
+            uint64_t generation;
+            std::vector<vk::Rect2D> rects;
+        };
+
+        vk::Extent2D extent;
+        std::vector<draw> previous;
+        std::vector<draw> current;
+        std::vector<vk::Rect2D> extraDamage;
+
+        mutable std::mutex lock;
+        uint64_t generation = 0;
+        std::deque<frame_damage> history;
+        std::vector<std::optional<uint64_t>> imageGenerations;
+
+        vk::Rect2D full() const {
+            return vk::Rect2D({0, 0}, extent);
+        }
+        static int64_t right(const vk::Rect2D& r) {
+            return static_cast<int64_t>(r.offset.x) + r.extent.width;
+        }
+        static int64_t bottom(const vk::Rect2D& r) {
+            return static_cast<int64_t>(r.offset.y) + r.extent.height;
+        }
+        static uint64_t area(const vk::Rect2D& r) {
+            return static_cast<uint64_t>(r.extent.width) * r.extent.height;
+        }
+
+        // Adds the bounds of the draws that are only in one of the frames.
+        static void diff(std::vector<draw> a, std::vector<draw> b, std::vector<vk::Rect2D>& out) {
+            auto by_key = [](const draw& x, const draw& y) { return x.key < y.key; };
+            std::ranges::sort(a, by_key);
+            std::ranges::sort(b, by_key);
+            auto ia = a.begin(), ib = b.begin();
+            while(ia != a.end() || ib != b.end()) {
+                if(ib == b.end() || (ia != a.end() && ia->key < ib->key)) {
+                    out.push_back((ia++)->bounds);
+                } else if(ia == a.end() || ib->key < ia->key) {
+                    out.push_back((ib++)->bounds);
+                } else {
+                    ++ia;
+                    ++ib;
+                }
+            }
+        }
+
+        // Merges overlapping rectangles, then the pairs that waste the least area until
+        // at most max_rects are left. Large damage becomes a single full frame rectangle.
+        void merge(std::vector<vk::Rect2D>& rects) const {
+            bool merged = true;
+            while(merged) {
+                merged = false;
+                for(std::size_t i = 0; i < rects.size() && !merged; i++) {
+                    for(std::size_t j = i + 1; j < rects.size(); j++) {
+                        if(intersects(rects[i], rects[j])) {
+                            rects[i] = unite(rects[i], rects[j]);
+                            rects.erase(rects.begin() + j);
+                            merged = true;
+                            break;
+                        }
+                    }
+                }
+            }
+            while(rects.size() > max_rects) {
+                std::size_t bestI = 0, bestJ = 1;
+                int64_t bestWaste = std::numeric_limits<int64_t>::max();
+                for(std::size_t i = 0; i < rects.size(); i++) {
+                    for(std::size_t j = i + 1; j < rects.size(); j++) {
+                        const int64_t waste = static_cast<int64_t>(area(unite(rects[i], rects[j])))
+                            - static_cast<int64_t>(area(rects[i])) - static_cast<int64_t>(area(rects[j]));
+                        if(waste < bestWaste) {
+                            bestWaste = waste;
+                            bestI = i;
+                            bestJ = j;
+                        }
+                    }
+                }
+                rects[bestI] = unite(rects[bestI], rects[bestJ]);
+                rects.erase(rects.begin() + bestJ);
+            }
+
+            uint64_t total = 0;
+            for(const auto& r : rects) {
+                total += area(r);
+            }
+            if(!rects.empty() && static_cast<double>(total) > full_frame_threshold * area(full())) {
+                rects = {full()};
+            }
+        }
+};
+
+}
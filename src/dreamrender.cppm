@@ -7,16 +7,34 @@ module;
 
 export module dreamrender;
 
+export import :asset_pack;
+export import :audio_analyser;
+export import :damage_tracker;
 export import :debug;
+export import :font_cache;
+export import :frame_encoder;
+export import :frame_pacer;
 export import :gui_renderer;
 export import :input;
+export import :input_log;
+export import :job_system;
+export import :memory_tracker;
+export import :mesh_optimizer;
 export import :model;
 export import :phase;
+export import :pipeline_compiler;
+export import :profiler;
 export import :resource_loader;
+export import :streaming_texture;
+export import :terminal_presenter;
 export import :texture;
 export import :utils;
+export import :video_output;
 export import :window;
 
+export import :components.backdrop_renderer;
 export import :components.font_renderer;
 export import :components.image_renderer;
+export import :components.model_renderer;
 export import :components.simple_renderer;
+export import :components.visualiser_renderer;
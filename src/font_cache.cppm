@@ -0,0 +1,317 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+export module dreamrender:font_cache;
+
+import :utils;
+
+import spdlog;
+
+namespace dreamrender {
+
+// How a font_renderer lays out its atlas. Entries are only used for the mode they were built for.
+export enum class font_atlas_mode : uint32_t {
+    // One tile per character of a range, glyphs are keyed by code point.
+    grid,
+    // Glyphs packed onto shelves for HarfBuzz shaping, glyphs are keyed by glyph index.
+    shelf,
+};
+
+export struct font_cache_key {
+    std::filesystem::path font;
+    int size;
+    char32_t first;
+    char32_t last;
+    font_atlas_mode mode;
+};
+
+export struct font_cache_glyph {
+    uint32_t id;
+    std::array<int32_t, 2> atlasPos;
+    std::array<int32_t, 2> bitmapSize;
+    std::array<int32_t, 2> bearing;
+    int32_t advance;
+};
+
+export struct font_atlas_layout {
+    uint32_t width;
+    uint32_t height;
+    // Rows of the atlas that are stored, the rows below them are empty.
+    uint32_t rows;
+    float lineHeight;
+    int32_t baseline;
+    // Shelf packer position (x, y, shelf height) to continue packing from.
+    std::array<int32_t, 3> packer;
+};
+
+// A font atlas read from the cache. The glyph table is copied, the pixels stay mapped.
+export class cached_font_atlas {
+    public:
+        const font_atlas_layout& layout() const {
+            return atlasLayout;
+        }
+        std::span<const font_cache_glyph> glyphs() const {
+            return glyphTable;
+        }
+
+        // Writes the atlas as RGBA into a buffer of at least width * height * 4 bytes.
+        void copy_to(uint8_t* p, size_t size) const {
+            const size_t need = static_cast<size_t>(atlasLayout.width) * atlasLayout.height * 4;
+            if(need > size) {
+                throw std::runtime_error("Font atlas staging too small");
+            }
+            // Glyphs are stored as coverage and expanded into all four channels.
+            for(size_t i = 0; i < coverage.size(); i++) {
+                const uint32_t v = coverage[i] * 0x01010101u;
+                std::memcpy(p + i * 4, &v, sizeof(v));
+            }
+            std::memset(p + coverage.size() * 4, 0, need - coverage.size() * 4);
+        }
+    private:
+        friend class font_cache;
+
+        cached_font_atlas(mapped_file file) : file(std::move(file)) {}
+
+        mapped_file file;
+        font_atlas_layout atlasLayout{};
+        std::vector<font_cache_glyph> glyphTable;
+        std::span<const uint8_t> coverage;
+};
+
+// Keeps prebuilt font atlases and their glyph metrics on disk, so fonts that were loaded
+// before are uploaded without FreeType. Every font, size, character range and atlas mode has
+// one entry, which records a hash of the font file it was built from. An entry is replaced
+// once the font file changes and discarded if it is from another version or damaged.
+export class font_cache {
+    public:
+        explicit font_cache(std::filesystem::path directory) : directory(std::move(directory)) {}
+        ~font_cache() {
+            font_cache* self = this;
+            current.compare_exchange_strong(self, nullptr);
+        }
+
+        font_cache(const font_cache&) = delete;
+        font_cache& operator=(const font_cache&) = delete;
+
+        // The cache the font renderers use, if any.
+        static font_cache* active() {
+            return current.load(std::memory_order_acquire);
+        }
+        static void set_active(font_cache* c) {
+            current.store(c, std::memory_order_release);
+        }
+
+        // Returns the atlas built for key, or nullptr if there is none or it is stale.
+        std::shared_ptr<const cached_font_atlas> find(const font_cache_key& key) {
+            const std::filesystem::path path = entry_path(key);
+            std::error_code ec;
+            if(!std::filesystem::exists(path, ec)) {
+                spdlog::debug("No cached atlas for font {} at size {}", key.font.string(), key.size);
+                return nullptr;
+            }
+            try {
+                const uint64_t fontHash = font_hash(key.font);
+                std::shared_ptr<cached_font_atlas> atlas{new cached_font_atlas(mapped_file(path))};
+                std::span<const uint8_t> data = atlas->file.data();
+
+                auto discard = [&](std::string_view reason) {
+                    spdlog::info("Discarding cached atlas for font {}: {}", key.font.string(), reason);
+                    atlas.reset();
+                    std::filesystem::remove(path, ec);
+                    return nullptr;
+                };
+
+                file_header header{};
+                if(data.size() < sizeof(header)) {
+                    return discard("file is too small");
+                }
+                std::memcpy(&header, data.data(), sizeof(header));
+                if(header.magic != file_magic || header.version != file_version) {
+                    return discard("unknown file format");
+                }
+                if(header.fontHash != fontHash) {
+                    return discard("the font file changed");
+                }
+                if(header.size != key.size || header.first != key.first || header.last != key.last ||
+                   header.mode != static_cast<uint32_t>(key.mode))
+                {
+                    return discard("it was built for another size, range or mode");
+                }
+                const font_atlas_layout& layout = header.layout;
+                const size_t glyphBytes = static_cast<size_t>(header.glyphCount) * sizeof(font_cache_glyph);
+                const size_t pixelBytes = static_cast<size_t>(layout.width) * layout.rows;
+                if(layout.rows > layout.height || data.size() != sizeof(header) + glyphBytes + pixelBytes) {
+                    return discard("data is truncated");
+                }
+                std::span<const uint8_t> table = data.subspan(sizeof(header), glyphBytes);
+                if(header.hash != hash(std::as_bytes(table), hash(std::as_bytes(std::span(&header.layout, 1))))) {
+                    return discard("data is corrupt");
+                }
+
+                atlas->atlasLayout = layout;
+                atlas->glyphTable.resize(header.glyphCount);
+                std::memcpy(atlas->glyphTable.data(), table.data(), glyphBytes);
+                atlas->coverage = data.subspan(sizeof(header) + glyphBytes, pixelBytes);
+                spdlog::debug("Using cached {}x{} atlas for font {} at size {}", layout.width, layout.height, key.font.string(), key.size);
+                return atlas;
+            } catch(const std::exception& e) {
+                spdlog::warn("Failed to read cached atlas for font {}: {}", key.font.string(), e.what());
+                return nullptr;
+            }
+        }
+
+        // Writes the atlas built for key, pixels are the RGBA atlas of layout.width * layout.height.
+        // Only the first channel and the first layout.rows rows are kept. Safe to call from any thread.
+        // The file is written next to the entry and renamed over it, so it is never partial.
+        void store(const font_cache_key& key, const font_atlas_layout& layout,
+            std::span<const font_cache_glyph> glyphs, std::span<const uint8_t> pixels) noexcept
+        {
+            try {
+                const size_t pixelCount = static_cast<size_t>(layout.width) * layout.rows;
+                if(layout.rows > layout.height || pixels.size() < pixelCount * 4) {
+                    throw std::invalid_argument("Atlas is smaller than its layout");
+                }
+                std::vector<uint8_t> coverage(pixelCount);
+                for(size_t i = 0; i < pixelCount; i++) {
+                    coverage[i] = pixels[i * 4];
+                }
+
+                const std::span<const std::byte> table = std::as_bytes(glyphs);
+                file_header header{
+                    .magic = file_magic,
+                    .version = file_version,
+                    .fontHash = font_hash(key.font),
+                    .size = key.size,
+                    .first = static_cast<uint32_t>(key.first),
+                    .last = static_cast<uint32_t>(key.last),
+                    .mode = static_cast<uint32_t>(key.mode),
+                    .glyphCount = static_cast<uint32_t>(glyphs.size()),
+                    .reserved = 0,
+                    .layout = layout,
+                    .hash = 0,
+                };
+                header.hash = hash(table, hash(std::as_bytes(std::span(&header.layout, 1))));
+
+                const std::filesystem::path path = entry_path(key);
+                std::filesystem::create_directories(path.parent_path());
+                auto temporary = path;
+                temporary += std::format(".{}.tmp", temporaryCounter.fetch_add(1, std::memory_order_relaxed));
+                {
+                    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+                    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                    out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size()));
+                    out.write(reinterpret_cast<const char*>(coverage.data()), static_cast<std::streamsize>(coverage.size()));
+                    if(!out) {
+                        spdlog::warn("Failed to write font cache: {}", temporary.string());
+                        std::error_code ec;
+                        std::filesystem::remove(temporary, ec);
+                        return;
+                    }
+                }
+                std::filesystem::rename(temporary, path);
+                spdlog::debug("Cached {}x{} atlas for font {} at size {}", layout.width, layout.height, key.font.string(), key.size);
+            } catch(const std::exception& e) {
+                spdlog::warn("Failed to cache atlas for font {}: {}", key.font.string(), e.what());
+            }
+        }
+    private:
+        static constexpr std::array<char, 4> file_magic = {'D', 'R', 'F', 'C'};
+        static constexpr uint32_t file_version = 1;
+
+        struct file_header {
+            std::array<char, 4> magic;
+            uint32_t version;
+            uint64_t fontHash;
+            int32_t size;
+            uint32_t first;
+            uint32_t last;
+            uint32_t mode;
+            uint32_t glyphCount;
+            uint32_t reserved;
+            font_atlas_layout layout;
+            uint64_t hash;
+        };
+        struct hashed_font {
+            std::filesystem::file_time_type modified;
+            std::uintmax_t size;
+            uint64_t hash;
+        };
+
+        static inline std::atomic<font_cache*> current = nullptr;
+
+        std::filesystem::path directory;
+        std::atomic<uint64_t> temporaryCounter = 0;
+
+        std::mutex hashLock;
+        std::map<std::filesystem::path, hashed_font> fontHashes;
+
+        // FNV-1a over 64 bit words, then over the remaining bytes.
+        static uint64_t hash(std::span<const std::byte> data, uint64_t h = 0xcbf29ce484222325ull) {
+            size_t i = 0;
+            for(; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+                uint64_t word;
+                std::memcpy(&word, data.data() + i, sizeof(word));
+                h = (h ^ word) * 0x100000001b3ull;
+            }
+            for(; i < data.size(); i++) {
+                h = (h ^ std::to_integer<uint64_t>(data[i])) * 0x100000001b3ull;
+            }
+            return h;
+        }
+
+        // Hash of the contents of a font file. It is remembered while the file's size and
+        // modification time stay the same, so every size of a font reads it only once.
+        uint64_t font_hash(const std::filesystem::path& font) {
+            const std::filesystem::file_time_type modified = std::filesystem::last_write_time(font);
+            const std::uintmax_t size = std::filesystem::file_size(font);
+            {
+                std::scoped_lock<std::mutex> l(hashLock);
+                if(auto it = fontHashes.find(font); it != fontHashes.end() &&
+                   it->second.modified == modified && it->second.size == size)
+                {
+                    return it->second.hash;
+                }
+            }
+            const uint64_t h = hash(std::as_bytes(mapped_file(font).data()));
+            std::scoped_lock<std::mutex> l(hashLock);
+            fontHashes[font] = hashed_font{modified, size, h};
+            return h;
+        }
+
+        std::filesystem::path entry_path(const font_cache_key& key) const {
+            std::error_code ec;
+            std::filesystem::path font = std::filesystem::absolute(key.font, ec);
+            const std::string name = (ec ? key.font : font).string();
+            const std::array<uint32_t, 4> parameters = {
+                static_cast<uint32_t>(key.size), static_cast<uint32_t>(key.first),
+                static_cast<uint32_t>(key.last), static_cast<uint32_t>(key.mode)
+            };
+            uint64_t h = hash(std::as_bytes(std::span(name)));
+            h = hash(std::as_bytes(std::span(parameters)), h);
+            return directory / std::format("{:016x}.bin", h);
+        }
+};
+
+}
@@ -0,0 +1,212 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+export module dreamrender:frame_encoder;
+
+import :job_system;
+
+import spdlog;
+
+namespace dreamrender {
+
+// Encodes frames read back from the GPU, on the active job system or a pool of its own.
+// Frames are encoded in parallel, but the commit stage and the release of the pixel
+// memory happen strictly in submission order. submit() blocks once max_queued frames
+// are in flight, which throttles rendering to the speed of the encoders.
+export class frame_encoder {
+    public:
+        using stage_function = std::function<void(uint64_t frame, std::span<const char> pixels)>;
+        using release_function = std::function<void()>;
+
+        // A thread count of 0 encodes on the active job system, or on half of the hardware
+        // threads if there is none.
+        frame_encoder(unsigned int threadCount, std::size_t maxQueued, stage_function encode, stage_function commit = {}) :
+            maxQueued(std::max<std::size_t>(1, maxQueued)), encode(std::move(encode)), commit(std::move(commit))
+        {
+            if(threadCount == 0) {
+                jobs = job_system::active();
+                threadCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+            }
+            if(jobs) {
+                return;
+            }
+            for(unsigned int i = 0; i < threadCount; i++) {
+                threads.emplace_back(&frame_encoder::encodeThread, this);
+            }
+        }
+        ~frame_encoder() {
+            wait_idle();
+            if(jobs) {
+                jobs->wait(running);
+            }
+            {
+                std::scoped_lock<std::mutex> l(lock);
+                quit = true;
+            }
+            workAvailable.notify_all();
+            for(auto& t : threads) {
+                if(t.joinable()) {
+                    t.join();
+                }
+            }
+        }
+
+        frame_encoder(const frame_encoder&) = delete;
+        frame_encoder& operator=(const frame_encoder&) = delete;
+
+        // The pixels must stay valid until release is called.
+        void submit(uint64_t frame, std::span<const char> pixels, release_function release) {
+            {
+                std::unique_lock<std::mutex> l(lock);
+                spaceAvailable.wait(l, [this]{ return pending < maxQueued; });
+                queue.push_back(job{nextSequence++, frame, pixels, std::move(release)});
+                pending++;
+            }
+            if(jobs) {
+                // Every job encodes the oldest queued frame.
+                jobs->submit([this]{ encodeJob(); }, job_options{.priority = job_priority::low, .signal = &running});
+            } else {
+                workAvailable.notify_one();
+            }
+        }
+        // Whether the frames are encoded on the job system.
+        bool on_job_system() const {
+            return jobs != nullptr;
+        }
+
+        // Queues a frame that is identical to the previous one. It skips the encode stage
+        // and reaches the commit stage with empty pixels.
+        void repeat(uint64_t frame) {
+            submit(frame, {}, {});
+        }
+
+        // Blocks until every submitted frame has been committed and released.
+        void wait_idle() {
+            std::unique_lock<std::mutex> l(lock);
+            idle.wait(l, [this]{ return pending == 0; });
+        }
+
+        std::size_t queued() {
+            std::scoped_lock<std::mutex> l(lock);
+            return pending;
+        }
+        uint64_t frames_written() const {
+            return committed.load(std::memory_order_relaxed);
+        }
+    private:
+        struct job {
+            uint64_t sequence;
+            uint64_t frame;
+            std::span<const char> pixels;
+            release_function release;
+        };
+
+        std::size_t maxQueued;
+        stage_function encode;
+        stage_function commit;
+
+        std::mutex lock;
+        std::condition_variable workAvailable;
+        std::condition_variable spaceAvailable;
+        std::condition_variable idle;
+        std::deque<job> queue;
+        std::map<uint64_t, job> finished;
+        uint64_t nextSequence = 0;
+        uint64_t nextCommit = 0;
+        std::size_t pending = 0;
+        bool committing = false;
+        bool quit = false;
+
+        std::atomic<uint64_t> committed = 0;
+        std::vector<std::thread> threads;
+        job_system* jobs = nullptr;
+        job_counter running;
+
+        void encodeThread() {
+            for(;;) {
+                job j;
+                {
+                    std::unique_lock<std::mutex> l(lock);
+                    workAvailable.wait(l, [this]{ return quit || !queue.empty(); });
+                    if(queue.empty()) {
+                        return;
+                    }
+                    j = std::move(queue.front());
+                    queue.pop_front();
+                }
+                process(std::move(j));
+            }
+        }
+        void encodeJob() {
+            job j;
+            {
+                std::scoped_lock<std::mutex> l(lock);
+                j = std::move(queue.front());
+                queue.pop_front();
+            }
+            process(std::move(j));
+        }
+
+        void process(job j) {
+            if(encode && !j.pixels.empty()) {
+                try {
+                    encode(j.frame, j.pixels);
+                } catch(const std::exception& e) {
+                    spdlog::error("Failed to encode frame {}: {}", j.frame, e.what());
+                }
+            }
+
+            std::unique_lock<std::mutex> l(lock);
+            finished.emplace(j.sequence, std::move(j));
+            // Whoever finds the next frame in order commits it, one thread at a time.
+            if(committing) {
+                return;
+            }
+            committing = true;
+            for(auto it = finished.find(nextCommit); it != finished.end(); it = finished.find(nextCommit)) {
+                job c = std::move(it->second);
+                finished.erase(it);
+                nextCommit++;
+                l.unlock();
+
+                if(commit) {
+                    try {
+                        commit(c.frame, c.pixels);
+                    } catch(const std::exception& e) {
+                        spdlog::error("Failed to write frame {}: {}", c.frame, e.what());
+                    }
+                }
+                if(c.release) {
+                    c.release();
+                }
+                committed.fetch_add(1, std::memory_order_relaxed);
+
+                l.lock();
+                pending--;
+                spaceAvailable.notify_one();
+            }
+            committing = false;
+            if(pending == 0) {
+                idle.notify_all();
+            }
+        }
+};
+
+}
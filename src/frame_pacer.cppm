@@ -0,0 +1,168 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+export module dreamrender:frame_pacer;
+
+namespace dreamrender {
+
+export struct frame_pacing_config {
+    // Frames the CPU may record ahead of the GPU, 1 gives the lowest latency.
+    unsigned int render_ahead = 2;
+    // Wait for the frame's fence before polling input, so input is sampled as late as possible.
+    bool late_input = false;
+    // The last part of a wait is spun instead of slept, to avoid oversleeping.
+    std::chrono::microseconds spin_threshold{1500};
+    // Use a synthetic clock that advances exactly one frame interval per frame (headless only).
+    bool synthetic_clock = false;
+};
+
+export class pacing_clock {
+    public:
+        using time_point = std::chrono::steady_clock::time_point;
+        using duration = std::chrono::steady_clock::duration;
+
+        virtual ~pacing_clock() = default;
+        virtual time_point now() = 0;
+        virtual void sleep_until(time_point target) = 0;
+};
+
+// Sleeps until shortly before the target and spins for the rest.
+export class hybrid_clock : public pacing_clock {
+    public:
+        explicit hybrid_clock(std::chrono::microseconds spinThreshold) : spinThreshold(spinThreshold) {}
+
+        time_point now() override {
+            return std::chrono::steady_clock::now();
+        }
+        void sleep_until(time_point target) override {
+            if(target - now() > spinThreshold) {
+                std::this_thread::sleep_until(target - spinThreshold);
+            }
+            while(now() < target) {
+                std::this_thread::yield();
+            }
+        }
+    private:
+        std::chrono::microseconds spinThreshold;
+};
+
+// Time only moves when the pacer waits or when advanced manually,
+// which makes paced runs reproducible regardless of how long frames really take.
+export class synthetic_clock : public pacing_clock {
+    public:
+        time_point now() override {
+            return current;
+        }
+        void sleep_until(time_point target) override {
+            current = std::max(current, target);
+        }
+        void advance(duration d) {
+            current += d;
+        }
+    private:
+        time_point current{};
+};
+
+export class frame_pacer {
+    public:
+        using time_point = pacing_clock::time_point;
+        using duration = pacing_clock::duration;
+
+        // Interval the synthetic clock advances by per frame while no interval is set.
+        static constexpr duration default_synthetic_interval =
+            std::chrono::duration_cast<duration>(std::chrono::duration<double>(1.0 / 60.0));
+
+        frame_pacer(frame_pacing_config config = {}) : config(config) {
+            if(config.synthetic_clock) {
+                clock = std::make_unique<synthetic_clock>();
+            } else {
+                clock = std::make_unique<hybrid_clock>(config.spin_threshold);
+            }
+            nextFrame = clock->now();
+        }
+
+        const frame_pacing_config& get_config() const {
+            return config;
+        }
+        pacing_clock& get_clock() {
+            return *clock;
+        }
+
+        // Zero disables the limiter. The synthetic clock then still advances by
+        // default_synthetic_interval per frame, so time keeps moving.
+        void set_interval(duration interval) {
+            this->interval = interval;
+        }
+        duration get_interval() const {
+            return interval;
+        }
+
+        // Waits for the start of the next frame. Deadlines are kept on a fixed grid so
+        // overslept frames do not drift, but after a long stall the grid is restarted.
+        void wait_for_next_frame() {
+            const duration step = interval > duration::zero() ? interval :
+                config.synthetic_clock ? default_synthetic_interval : duration::zero();
+            if(step > duration::zero()) {
+                nextFrame += step;
+                time_point now = clock->now();
+                if(now > nextFrame + step) {
+                    nextFrame = now;
+                }
+                clock->sleep_until(nextFrame);
+            }
+            frameStart = clock->now();
+        }
+        time_point frame_start() const {
+            return frameStart;
+        }
+
+        // Latency is measured in real time even with the synthetic clock.
+        void input_sampled() {
+            inputTime = std::chrono::steady_clock::now();
+        }
+        time_point input_time() const {
+            return inputTime;
+        }
+        // The time the submitted frame's input was sampled is passed in, so frames may be
+        // submitted on another thread than the one sampling input, as long as it is always the same one.
+        void submitted(time_point sampled) {
+            auto latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sampled).count();
+            averageLatency = samples == 0 ? latency : averageLatency + (latency - averageLatency) * 0.05;
+            maxLatency = std::max(maxLatency, latency);
+            samples++;
+        }
+
+        // Exponential moving average of the time from sampling input to submitting the frame.
+        double input_latency_ms() const {
+            return averageLatency;
+        }
+        // Largest latency since the last call.
+        double take_max_input_latency_ms() {
+            return std::exchange(maxLatency, 0.0);
+        }
+    private:
+        frame_pacing_config config;
+        std::unique_ptr<pacing_clock> clock;
+
+        duration interval = duration::zero();
+        time_point nextFrame;
+        time_point frameStart;
+        time_point inputTime;
+
+        double averageLatency = 0.0;
+        double maxLatency = 0.0;
+        uint64_t samples = 0;
+};
+
+}
@@ -5,7 +5,11 @@
  */
 module;
 
+#include <cmath>
 #include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string_view>
 #include <vector>
 #include <algorithm>
@@ -15,22 +19,43 @@ export module dreamrender:gui_renderer;
 import :components.font_renderer;
 import :components.image_renderer;
 import :components.simple_renderer;
+import :components.visualiser_renderer;
+import :damage_tracker;
+import :profiler;
 
 import glm;
 import vulkan_hpp;
 
 namespace dreamrender {
 
+// Damage tracking: a gui_renderer constructed with a damage_tracker instead of a command
+// buffer records nothing and only reports its draws to the tracker, which is meant to be done in
+// phase::update. If the tracker saw no change, the frame can be skipped (frame_snapshot::unchanged).
+// Otherwise phase::render draws the same GUI again, restricted to the region returned by
+// damage_tracker::take_region, inside a render pass that loads the previous image contents.
+// Only the bounds of that region are redrawn, draws outside of it are not recorded at all.
 export class gui_renderer {
     public:
         gui_renderer(vk::CommandBuffer commandBuffer, int frame, vk::RenderPass renderPass,
             vk::Extent2D frameSize,
-            font_renderer* fontRenderer, image_renderer* imageRenderer, simple_renderer* simpleRenderer)
+            font_renderer* fontRenderer, image_renderer* imageRenderer, simple_renderer* simpleRenderer,
+            visualiser_renderer* visualiserRenderer = nullptr)
             :
             commandBuffer(commandBuffer), frame(frame), renderPass(renderPass),
             frame_size(frameSize), aspect_ratio(static_cast<double>(frameSize.width) / frameSize.height),
-            font_renderer(fontRenderer), image_renderer(imageRenderer), simple_renderer(simpleRenderer)
+            font_renderer(fontRenderer), image_renderer(imageRenderer), simple_renderer(simpleRenderer),
+            visualiser_renderer(visualiserRenderer),
+            clip({0, 0}, frameSize),
+            zone(commandBuffer, frame, "gui_renderer")
         {}
+        // Only reports draws to the tracker, see above. The renderers are used for measuring text.
+        gui_renderer(damage_tracker& tracker, vk::Extent2D frameSize,
+            font_renderer* fontRenderer, image_renderer* imageRenderer, simple_renderer* simpleRenderer,
+            visualiser_renderer* visualiserRenderer = nullptr)
+            : gui_renderer({}, -1, {}, frameSize, fontRenderer, imageRenderer, simpleRenderer, visualiserRenderer)
+        {
+            this->tracker = &tracker;
+        }
 
         const vk::Extent2D frame_size;
         const double aspect_ratio;
@@ -64,17 +89,23 @@ export class gui_renderer {
                 vk::Offset2D{static_cast<int32_t>(x*frame_size.width), static_cast<int32_t>(y*frame_size.height)},
                 vk::Extent2D{static_cast<uint32_t>(width*frame_size.width), static_cast<uint32_t>(height*frame_size.height)}
             };
-            commandBuffer.setScissor(0, scissor);
+            set_clip(scissor);
         }
         void set_clip(vk::Rect2D scissor) {
-            commandBuffer.setScissor(0, scissor);
+            clip = scissor;
+            set_scissor(scissor);
         }
         void reset_clip() {
-            vk::Rect2D scissor{
+            set_clip(vk::Rect2D{
                 vk::Offset2D{0, 0},
                 frame_size
-            };
-            commandBuffer.setScissor(0, scissor);
+            });
+        }
+
+        // Restricts all following draws to the bounds of the damaged region.
+        void set_damage(std::span<const vk::Rect2D> region) {
+            damage = damage_tracker::bounds(region);
+            set_scissor(scissor_stack.empty() ? clip : scissor_stack.back());
         }
 
         // Zoom helpers: apply a temporary viewport/scissor scale centered on screen
@@ -90,7 +121,7 @@ export class gui_renderer {
             vp.width = nw;
             vp.height = nh;
             viewport_stack.push_back(vp);
-            commandBuffer.setViewport(0, vp);
+            set_viewport(vp);
 
             vk::Rect2D scissor({0,0}, frame_size);
             scissor.offset.x = static_cast<int32_t>(vp.x);
@@ -98,22 +129,15 @@ export class gui_renderer {
             scissor.extent.width  = static_cast<uint32_t>(vp.width);
             scissor.extent.height = static_cast<uint32_t>(vp.height);
             scissor_stack.push_back(scissor);
-            commandBuffer.setScissor(0, scissor);
+            set_scissor(scissor);
         }
         void pop_zoom() {
             if(!viewport_stack.empty()) viewport_stack.pop_back();
             if(!scissor_stack.empty()) scissor_stack.pop_back();
             // Restore to previous or full
-            if(!viewport_stack.empty()) {
-                commandBuffer.setViewport(0, viewport_stack.back());
-            } else {
-                vk::Viewport vp(0.0f, 0.0f,
-                    static_cast<float>(frame_size.width),
-                    static_cast<float>(frame_size.height), 0.0f, 1.0f);
-                commandBuffer.setViewport(0, vp);
-            }
+            set_viewport(current_viewport());
             if(!scissor_stack.empty()) {
-                commandBuffer.setScissor(0, scissor_stack.back());
+                set_scissor(scissor_stack.back());
             } else {
                 reset_clip();
             }
@@ -123,14 +147,18 @@ export class gui_renderer {
             glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0),
             bool centerH = false, bool centerV = false)
         {
+            glm::vec2 size = measure_text(text, scale);
             if(centerH || centerV) {
-                glm::vec2 size = measure_text(text, scale);
                 if(centerH)
                     x -= size.x / 2.0f;
                 if(centerV)
                     y -= size.y / 2.0f;
             }
-            apply_view();
+            // Glyphs may reach a bit beyond their advance and line height.
+            size.y *= static_cast<float>(std::ranges::count(text, '\n') + 1);
+            glm::vec2 overhang = glm::vec2(0.25f * scale / static_cast<float>(aspect_ratio), 0.25f * scale);
+            if(!report(damage_key().add(text).add(scale).add(color*this->color).add(font_renderer->atlas_ready()), glm::vec2(x, y) - overhang, size + 2.0f*overhang))
+                return;
             font_renderer->renderText(commandBuffer, frame, renderPass, text, x, y, scale, color*this->color);
         }
         glm::vec2 measure_text(std::string_view text, float scale) const {
@@ -140,7 +168,9 @@ export class gui_renderer {
         void draw_image(const texture& texture, float x, float y, float scaleX = 1.0f, float scaleY = 1.0f,
             glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0))
         {
-            apply_view();
+            if(!report(damage_key().add(texture.imageView.get()).add(texture.loaded.load()).add(color*this->color),
+                glm::vec2(x, y), glm::vec2(scaleX / static_cast<float>(aspect_ratio), scaleY)))
+                return;
             image_renderer->renderImage(commandBuffer, frame, renderPass, texture, x, y, scaleX, scaleY, color*this->color);
         }
         void draw_image_a(const texture& texture, float x, float y, float scaleX = 1.0f, float scaleY = 1.0f,
@@ -157,32 +187,43 @@ export class gui_renderer {
                 }
                 scaleX *= static_cast<float>(texture.width) / texture.height;
             }
-            apply_view();
+            if(!report(damage_key().add(texture.imageView.get()).add(texture.loaded.load()).add(color*this->color),
+                glm::vec2(x, y), glm::vec2(scaleX / static_cast<float>(aspect_ratio), scaleY)))
+                return;
             image_renderer->renderImage(commandBuffer, frame, renderPass, texture, x, y, scaleX, scaleY, color*this->color);
         }
         // Experimental: glass effect for icons (no background refraction; self-contained effect)
         void draw_image_glass(const texture& texture, float x, float y, float scaleX = 1.0f, float scaleY = 1.0f,
             glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0))
         {
-            apply_view();
+            if(!report(damage_key().add(texture.imageView.get()).add(texture.loaded.load()).add(color*this->color).add(1),
+                glm::vec2(x, y), glm::vec2(scaleX / static_cast<float>(aspect_ratio), scaleY)))
+                return;
             image_renderer->renderImageGlass(commandBuffer, frame, renderPass, texture.imageView.get(), x, y, scaleX, scaleY, color*this->color);
         }
         void draw_image(vk::ImageView view, float x, float y, float scaleX = 1.0f, float scaleY = 1.0f,
             glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0))
         {
-            apply_view();
+            if(!report(damage_key().add(view).add(color*this->color),
+                glm::vec2(x, y), glm::vec2(scaleX / static_cast<float>(aspect_ratio), scaleY)))
+                return;
             image_renderer->renderImage(commandBuffer, frame, renderPass, view, x, y, scaleX, scaleY, color*this->color);
         }
         void draw_image_sized(const texture& texture, float x, float y, int width = -1, int height = -1,
             glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0))
         {
-            apply_view();
+            glm::vec2 size = glm::vec2(width == -1 ? texture.width : width, height == -1 ? texture.height : height) /
+                glm::vec2(frame_size.width, frame_size.height);
+            if(!report(damage_key().add(texture.imageView.get()).add(texture.loaded.load()).add(color*this->color), glm::vec2(x, y), size))
+                return;
             image_renderer->renderImageSized(commandBuffer, frame, renderPass, texture, x, y, width, height, color*this->color);
         }
         void draw_image_sized(vk::ImageView view, float x, float y, int width, int height,
             glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0))
         {
-            apply_view();
+            glm::vec2 size = glm::vec2(width, height) / glm::vec2(frame_size.width, frame_size.height);
+            if(!report(damage_key().add(view).add(color*this->color), glm::vec2(x, y), size))
+                return;
             image_renderer->renderImageSized(commandBuffer, frame, renderPass, view, x, y, width, height, color*this->color);
         }
 
@@ -193,7 +234,8 @@ export class gui_renderer {
             for(auto& v : vertices_vector) {
                 v.color *= color;
             }
-            apply_view();
+            if(!report_vertices(vertices_vector, p))
+                return;
             simple_renderer->renderGeneric(commandBuffer, frame, renderPass, vertices_vector, p);
         }
         void draw_quad(std::ranges::range auto vertices, simple_renderer::params p = {})
@@ -203,14 +245,29 @@ export class gui_renderer {
             for(auto& v : vertices_vector) {
                 v.color *= color;
             }
-            apply_view();
+            if(!report_vertices(vertices_vector, p))
+                return;
             simple_renderer->renderQuad(commandBuffer, frame, renderPass, vertices_vector, p);
         }
         void draw_rect(glm::vec2 position, glm::vec2 size, glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0), simple_renderer::params p = {}) {
-            apply_view();
+            if(!report(damage_key().add(position).add(size).add(color*this->color).add(p), position, size))
+                return;
             simple_renderer->renderRect(commandBuffer, frame, renderPass, position, size, color*this->color, p);
         }
 
+        void draw_visualiser(std::span<const float> samples, glm::vec2 position, glm::vec2 size,
+            glm::vec4 color = glm::vec4(1.0, 1.0, 1.0, 1.0), visualiser_params p = {})
+        {
+            if(!visualiser_renderer) {
+                throw std::runtime_error("gui_renderer::draw_visualiser requires a visualiser_renderer");
+            }
+            // Lines may reach beyond the graph by their thickness.
+            glm::vec2 overhang = glm::vec2(p.thickness) / glm::vec2(frame_size.width, frame_size.height);
+            if(!report(damage_key().add_range(samples).add(color*this->color).add(p), position - overhang, size + 2.0f*overhang))
+                return;
+            visualiser_renderer->renderSamples(commandBuffer, frame, renderPass, samples, position, size, color*this->color, p);
+        }
+
         void reset() {
             reset_color();
             reset_clip();
@@ -226,6 +283,9 @@ export class gui_renderer {
         simple_renderer* get_simple_renderer() {
             return simple_renderer;
         }
+        visualiser_renderer* get_visualiser_renderer() {
+            return visualiser_renderer;
+        }
         vk::CommandBuffer get_command_buffer() {
             return commandBuffer;
         }
@@ -236,17 +296,85 @@ export class gui_renderer {
             return renderPass;
         }
     private:
+        // Extra pixels around the bounds of every draw, for antialiasing and rounding.
+        static constexpr int32_t damage_padding = 2;
+
         void apply_view() {
             if(!viewport_stack.empty()) {
-                commandBuffer.setViewport(0, viewport_stack.back());
+                set_viewport(viewport_stack.back());
             }
             if(!scissor_stack.empty()) {
-                commandBuffer.setScissor(0, scissor_stack.back());
+                set_scissor(scissor_stack.back());
+            }
+        }
+        void set_viewport(const vk::Viewport& viewport) {
+            if(commandBuffer) {
+                commandBuffer.setViewport(0, viewport);
+            }
+        }
+        void set_scissor(vk::Rect2D scissor) {
+            if(!commandBuffer) {
+                return;
+            }
+            if(damage) {
+                scissor = damage_tracker::intersect(scissor, *damage);
+            }
+            commandBuffer.setScissor(0, scissor);
+        }
+        vk::Viewport current_viewport() const {
+            if(!viewport_stack.empty()) {
+                return viewport_stack.back();
+            }
+            return vk::Viewport(0.0f, 0.0f,
+                static_cast<float>(frame_size.width),
+                static_cast<float>(frame_size.height), 0.0f, 1.0f);
+        }
+
+        // Bounds of a draw in pixels, given in normalized coordinates, clipped like the draw itself.
+        vk::Rect2D pixel_bounds(glm::vec2 position, glm::vec2 size) const {
+            const vk::Viewport vp = current_viewport();
+            glm::vec2 a = glm::vec2(vp.x, vp.y) + glm::min(position, position + size) * glm::vec2(vp.width, vp.height);
+            glm::vec2 b = glm::vec2(vp.x, vp.y) + glm::max(position, position + size) * glm::vec2(vp.width, vp.height);
+            const int32_t x0 = static_cast<int32_t>(std::floor(a.x)) - damage_padding;
+            const int32_t y0 = static_cast<int32_t>(std::floor(a.y)) - damage_padding;
+            const int32_t x1 = static_cast<int32_t>(std::ceil(b.x)) + damage_padding;
+            const int32_t y1 = static_cast<int32_t>(std::ceil(b.y)) + damage_padding;
+            vk::Rect2D bounds({x0, y0}, {static_cast<uint32_t>(std::max(0, x1 - x0)), static_cast<uint32_t>(std::max(0, y1 - y0))});
+            return damage_tracker::intersect(bounds, scissor_stack.empty() ? clip : scissor_stack.back());
+        }
+        // Reports the draw to the damage tracker when measuring, and returns whether it
+        // must be recorded, which is only the case when drawing and it touches the damage.
+        bool report(damage_key key, glm::vec2 position, glm::vec2 size) {
+            vk::Rect2D bounds = pixel_bounds(position, size);
+            if(!commandBuffer) {
+                if(tracker) {
+                    key.add(current_viewport());
+                    tracker->add(key.get(), bounds);
+                }
+                return false;
             }
+            if(damage && !damage_tracker::intersects(bounds, *damage)) {
+                return false;
+            }
+            apply_view();
+            return true;
+        }
+        bool report_vertices(std::span<const simple_renderer::vertex_data> vertices, const simple_renderer::params& p) {
+            if(vertices.empty()) {
+                return false;
+            }
+            glm::vec2 lo = vertices[0].position, hi = vertices[0].position;
+            for(const auto& v : vertices) {
+                lo = glm::min(lo, v.position);
+                hi = glm::max(hi, v.position);
+            }
+            return report(damage_key().add_range(vertices).add(p), lo, hi - lo);
         }
+
         font_renderer* font_renderer;
         image_renderer* image_renderer;
         simple_renderer* simple_renderer;
+        visualiser_renderer* visualiser_renderer;
 
         vk::CommandBuffer commandBuffer;
         int frame;
@@ -257,6 +385,13 @@ export class gui_renderer {
 
         std::vector<vk::Viewport> viewport_stack;
         std::vector<vk::Rect2D> scissor_stack;
+        vk::Rect2D clip;
+
+        damage_tracker* tracker = nullptr;
+        std::optional<vk::Rect2D> damage;
+
+        // Spans the GPU zones of all draws made through this renderer.
+        gpu_group zone;
 };
 
 }
@@ -0,0 +1,214 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+export module dreamrender:input_log;
+
+import sdl2;
+
+export namespace input {
+    enum class event_type : uint8_t {
+        key_down,
+        key_up,
+        button_down,
+        button_up,
+        axis_motion,
+        controller_added,
+        controller_removed,
+        quit,
+    };
+
+    // An input event as it is passed to the handlers. Controllers are identified by their
+    // joystick instance id, control is the button or axis.
+    struct event {
+        event_type type;
+        sdl::Keysym key{};
+        sdl::JoystickID controller{};
+        uint8_t control{};
+        int16_t value{};
+    };
+
+    // Writes the input events of a session to a binary log, each with the frame it was applied to.
+    //
+    // The log starts with a magic, a version and the frame interval in nanoseconds. Each event is
+    // the frame delta to the previous event, the type and its fields, with integers as
+    // (zigzag) LEB128 varints, so a typical key press takes five bytes.
+    class recorder {
+        public:
+            static constexpr std::array<char, 8> magic = {'D', 'R', 'I', 'N', 'P', 'U', 'T', '\0'};
+            static constexpr uint32_t version = 1;
+
+            recorder(const std::filesystem::path& path, std::chrono::nanoseconds interval) : out(path, std::ios::binary) {
+                if(!out) {
+                    throw std::runtime_error("Failed to open input log for writing: " + path.string());
+                }
+                out.write(magic.data(), magic.size());
+                write_varint(version);
+                write_varint(static_cast<uint64_t>(interval.count()));
+            }
+
+            void record(uint64_t frame, const event& e) {
+                write_varint(frame - lastFrame);
+                lastFrame = frame;
+                out.put(static_cast<char>(e.type));
+                switch(e.type) {
+                    case event_type::key_down:
+                    case event_type::key_up:
+                        write_varint(static_cast<uint64_t>(e.key.scancode));
+                        write_signed(e.key.sym);
+                        write_varint(e.key.mod);
+                        break;
+                    case event_type::button_down:
+                    case event_type::button_up:
+                        write_signed(e.controller);
+                        out.put(static_cast<char>(e.control));
+                        break;
+                    case event_type::axis_motion:
+                        write_signed(e.controller);
+                        out.put(static_cast<char>(e.control));
+                        write_signed(e.value);
+                        break;
+                    case event_type::controller_added:
+                    case event_type::controller_removed:
+                        write_signed(e.controller);
+                        break;
+                    case event_type::quit:
+                        break;
+                }
+                count++;
+            }
+            uint64_t events() const {
+                return count;
+            }
+        private:
+            std::ofstream out;
+            uint64_t lastFrame = 0;
+            uint64_t count = 0;
+
+            void write_varint(uint64_t v) {
+                do {
+                    uint8_t byte = v & 0x7f;
+                    v >>= 7;
+                    out.put(static_cast<char>(byte | (v ? 0x80 : 0)));
+                } while(v);
+            }
+            void write_signed(int64_t v) {
+                write_varint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+            }
+    };
+
+    // Reads a log written by recorder and hands out the events of each frame.
+    class replayer {
+        public:
+            explicit replayer(const std::filesystem::path& path) {
+                std::ifstream in(path, std::ios::binary);
+                if(!in) {
+                    throw std::runtime_error("Failed to open input log: " + path.string());
+                }
+                data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                if(data.size() < recorder::magic.size() || std::memcmp(data.data(), recorder::magic.data(), recorder::magic.size()) != 0) {
+                    throw std::runtime_error("Not an input log: " + path.string());
+                }
+                pos = recorder::magic.size();
+                if(uint64_t v = read_varint(); v != recorder::version) {
+                    throw std::runtime_error("Unsupported input log version " + std::to_string(v) + ": " + path.string());
+                }
+                interval = std::chrono::nanoseconds(read_varint());
+                read_next();
+            }
+
+            // The frame interval of the recorded session, zero if it ran without a limiter.
+            std::chrono::nanoseconds frame_interval() const {
+                return interval;
+            }
+            bool finished() const {
+                return !pending;
+            }
+            // Appends the events of all frames up to and including the given one.
+            void poll(uint64_t frame, std::vector<event>& out) {
+                while(pending && nextFrame <= frame) {
+                    out.push_back(next);
+                    read_next();
+                }
+            }
+        private:
+            std::vector<char> data;
+            std::size_t pos = 0;
+            std::chrono::nanoseconds interval{};
+
+            bool pending = false;
+            uint64_t nextFrame = 0;
+            event next{};
+
+            void read_next() {
+                pending = false;
+                if(pos >= data.size()) {
+                    return;
+                }
+                nextFrame += read_varint();
+                next = event{static_cast<event_type>(read_byte())};
+                switch(next.type) {
+                    case event_type::key_down:
+                    case event_type::key_up:
+                        next.key.scancode = static_cast<decltype(next.key.scancode)>(read_varint());
+                        next.key.sym = static_cast<decltype(next.key.sym)>(read_signed());
+                        next.key.mod = static_cast<uint16_t>(read_varint());
+                        break;
+                    case event_type::button_down:
+                    case event_type::button_up:
+                        next.controller = static_cast<sdl::JoystickID>(read_signed());
+                        next.control = read_byte();
+                        break;
+                    case event_type::axis_motion:
+                        next.controller = static_cast<sdl::JoystickID>(read_signed());
+                        next.control = read_byte();
+                        next.value = static_cast<int16_t>(read_signed());
+                        break;
+                    case event_type::controller_added:
+                    case event_type::controller_removed:
+                        next.controller = static_cast<sdl::JoystickID>(read_signed());
+                        break;
+                    case event_type::quit:
+                        break;
+                    default:
+                        throw std::runtime_error("Corrupt input log: unknown event type " + std::to_string(static_cast<int>(next.type)));
+                }
+                pending = true;
+            }
+            uint8_t read_byte() {
+                if(pos >= data.size()) {
+                    throw std::runtime_error("Corrupt input log: unexpected end");
+                }
+                return static_cast<uint8_t>(data[pos++]);
+            }
+            uint64_t read_varint() {
+                uint64_t v = 0;
+                for(int shift = 0; shift < 64; shift += 7) {
+                    uint8_t byte = read_byte();
+                    v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    if(!(byte & 0x80)) {
+                        return v;
+                    }
+                }
+                throw std::runtime_error("Corrupt input log: varint too long");
+            }
+            int64_t read_signed() {
+                uint64_t v = read_varint();
+                return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+            }
+    };
+}
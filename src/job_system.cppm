@@ -0,0 +1,440 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+export module dreamrender:job_system;
+
+import spdlog;
+
+namespace dreamrender {
+
+export enum class job_priority : uint8_t {
+    high,
+    normal,
+    low,
+};
+constexpr std::size_t job_priority_count = 3;
+
+export class job_counter;
+export class job_system;
+
+struct scheduled_job {
+    std::function<void()> fn;
+    job_counter* signal = nullptr;
+    job_priority priority = job_priority::normal;
+};
+
+// Counts outstanding jobs. Jobs submitted with a counter as signal increment it and decrement
+// it when they finish, jobs submitted after a counter only start once it reached zero.
+// A counter must outlive the jobs that reference it.
+export class job_counter {
+    public:
+        job_counter() = default;
+        job_counter(const job_counter&) = delete;
+        job_counter& operator=(const job_counter&) = delete;
+
+        void add(uint32_t count = 1) {
+            pending.fetch_add(count, std::memory_order_relaxed);
+        }
+        // Schedules the jobs waiting for the counter when it reaches zero.
+        void done(uint32_t count = 1);
+
+        bool idle() const {
+            return pending.load(std::memory_order_acquire) == 0;
+        }
+        uint32_t value() const {
+            return pending.load(std::memory_order_relaxed);
+        }
+        // Blocks until the counter is zero without running jobs, see job_system::wait.
+        void wait() {
+            std::unique_lock<std::mutex> l(lock);
+            zero.wait(l, [this]{ return idle(); });
+        }
+    private:
+        friend class job_system;
+        struct continuation {
+            job_system* system;
+            scheduled_job job;
+        };
+
+        std::atomic<uint32_t> pending = 0;
+        std::mutex lock;
+        std::condition_variable zero;
+        std::vector<continuation> continuations;
+};
+
+export struct job_options {
+    job_priority priority = job_priority::normal;
+    // Incremented on submit and decremented when the job finished.
+    job_counter* signal = nullptr;
+    // The job starts once this counter is zero.
+    job_counter* after = nullptr;
+};
+
+// A pool of workers that run short CPU jobs for the whole engine.
+//
+// Every worker has a deque per priority. Jobs submitted from a worker go to its own deques,
+// which it works on newest first, while idle workers steal the oldest jobs of the others.
+// Jobs submitted from other threads are spread over the workers. Higher priorities are always
+// taken first, from any worker, before a worker looks at lower ones.
+export class job_system {
+    public:
+        struct worker_stats {
+            uint64_t jobs;
+            uint64_t steals;
+            std::chrono::nanoseconds busy;
+        };
+
+        // A thread count of 0 uses one worker per hardware thread.
+        explicit job_system(unsigned int threadCount = 0) {
+            if(threadCount == 0) {
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+            }
+            for(unsigned int i = 0; i < threadCount; i++) {
+                workers.push_back(std::make_unique<worker>());
+                lastBusy.push_back(0);
+            }
+            lastSample = std::chrono::steady_clock::now();
+            for(unsigned int i = 0; i < threadCount; i++) {
+                workers[i]->thread = std::thread(&job_system::work, this, i);
+            }
+            spdlog::debug("Started job system with {} workers", threadCount);
+        }
+        // Runs the jobs that are still queued before the workers quit.
+        ~job_system() {
+            job_system* self = this;
+            current.compare_exchange_strong(self, nullptr);
+            {
+                std::scoped_lock<std::mutex> l(sleepLock);
+                quit = true;
+            }
+            sleep.notify_all();
+            for(auto& w : workers) {
+                if(w->thread.joinable()) {
+                    w->thread.join();
+                }
+            }
+        }
+
+        job_system(const job_system&) = delete;
+        job_system& operator=(const job_system&) = delete;
+
+        // The job system the engine's subsystems submit to, if any.
+        static job_system* active() {
+            return current.load(std::memory_order_acquire);
+        }
+        static void set_active(job_system* j) {
+            current.store(j, std::memory_order_release);
+        }
+
+        unsigned int size() const {
+            return static_cast<unsigned int>(workers.size());
+        }
+        // Whether the calling thread is one of the workers.
+        bool on_worker() const {
+            return workerSystem == this;
+        }
+
+        // Exceptions thrown by fn are logged, use async to receive them.
+        void submit(std::function<void()> fn, job_options options = {}) {
+            if(options.signal) {
+                options.signal->add();
+            }
+            scheduled_job j{std::move(fn), options.signal, options.priority};
+            if(options.after) {
+                std::scoped_lock<std::mutex> l(options.after->lock);
+                if(!options.after->idle()) {
+                    options.after->continuations.push_back({this, std::move(j)});
+                    return;
+                }
+            }
+            enqueue(std::move(j));
+        }
+
+        template<typename F>
+        auto async(F&& fn, job_priority priority = job_priority::normal) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+            using result = std::invoke_result_t<std::decay_t<F>>;
+            auto task = std::make_shared<std::packaged_task<result()>>(std::forward<F>(fn));
+            std::future<result> f = task->get_future();
+            submit([task]{ (*task)(); }, job_options{.priority = priority});
+            return f;
+        }
+
+        // Waits until the counter is zero. Workers run other jobs in the meantime, so jobs
+        // may wait for the jobs they submitted.
+        void wait(job_counter& counter) {
+            if(!on_worker()) {
+                counter.wait();
+                return;
+            }
+            while(!counter.idle()) {
+                scheduled_job j;
+                bool stolen = false;
+                if(try_pop(workerIndex, j, stolen)) {
+                    execute(j, workerIndex, stolen);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            // The job that finished the counter may still hold its lock.
+            std::scoped_lock<std::mutex> l(counter.lock);
+        }
+
+        // Calls fn(first, last) for consecutive ranges of at most grain indices in [begin, end).
+        // The calling thread works on the ranges as well, so this is safe to call from a job.
+        // The first exception thrown by fn is rethrown once all ranges are done.
+        template<typename F>
+        void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F&& fn, job_priority priority = job_priority::high) {
+            if(begin >= end) {
+                return;
+            }
+            grain = std::max<std::size_t>(1, grain);
+            const std::size_t chunks = (end - begin + grain - 1) / grain;
+            if(chunks == 1) {
+                fn(begin, end);
+                return;
+            }
+
+            auto state = std::make_shared<parallel_range>();
+            state->begin = begin;
+            state->end = end;
+            state->grain = grain;
+            state->chunks = chunks;
+            state->body = std::ref(fn);
+            const std::size_t helpers = std::min<std::size_t>(workers.size(), chunks - 1);
+            for(std::size_t i = 0; i < helpers; i++) {
+                submit([state]{ state->run(); }, job_options{.priority = priority});
+            }
+            state->run();
+            state->wait();
+            if(state->error) {
+                std::rethrow_exception(state->error);
+            }
+        }
+
+        std::vector<worker_stats> stats() const {
+            std::vector<worker_stats> s;
+            for(const auto& w : workers) {
+                s.push_back(worker_stats{
+                    .jobs = w->jobs.load(std::memory_order_relaxed),
+                    .steals = w->steals.load(std::memory_order_relaxed),
+                    .busy = std::chrono::nanoseconds(w->busy.load(std::memory_order_relaxed)),
+                });
+            }
+            return s;
+        }
+        // The share of time each worker spent running jobs since the previous call.
+        std::vector<double> utilisation() {
+            std::scoped_lock<std::mutex> l(statsLock);
+            auto now = std::chrono::steady_clock::now();
+            const double wall = std::chrono::duration<double, std::nano>(now - lastSample).count();
+            lastSample = now;
+            std::vector<double> u;
+            for(std::size_t i = 0; i < workers.size(); i++) {
+                const uint64_t busy = workers[i]->busy.load(std::memory_order_relaxed);
+                u.push_back(wall > 0 ? std::min(1.0, static_cast<double>(busy - lastBusy[i]) / wall) : 0.0);
+                lastBusy[i] = busy;
+            }
+            return u;
+        }
+    private:
+        friend class job_counter;
+
+        struct worker {
+            std::mutex lock;
+            std::array<std::deque<scheduled_job>, job_priority_count> queues;
+            std::thread thread;
+
+            std::atomic<uint64_t> jobs = 0;
+            std::atomic<uint64_t> steals = 0;
+            std::atomic<uint64_t> busy = 0;
+        };
+        struct parallel_range {
+            std::size_t begin, end, grain, chunks;
+            std::function<void(std::size_t, std::size_t)> body;
+            std::atomic<std::size_t> next = 0;
+            std::atomic<std::size_t> completed = 0;
+
+            std::mutex lock;
+            std::condition_variable finished;
+            std::exception_ptr error;
+
+            // Helpers that start after all ranges were taken return without touching body,
+            // which only lives as long as the call to parallel_for.
+            void run() {
+                for(std::size_t c = next.fetch_add(1); c < chunks; c = next.fetch_add(1)) {
+                    const std::size_t first = begin + c * grain;
+                    try {
+                        body(first, std::min(end, first + grain));
+                    } catch(...) {
+                        std::scoped_lock<std::mutex> l(lock);
+                        if(!error) {
+                            error = std::current_exception();
+                        }
+                    }
+                    if(completed.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks) {
+                        std::scoped_lock<std::mutex> l(lock);
+                        finished.notify_all();
+                    }
+                }
+            }
+            void wait() {
+                std::unique_lock<std::mutex> l(lock);
+                finished.wait(l, [this]{ return completed.load(std::memory_order_acquire) == chunks; });
+            }
+        };
+
+        static inline std::atomic<job_system*> current = nullptr;
+        static inline thread_local job_system* workerSystem = nullptr;
+        static inline thread_local unsigned int workerIndex = 0;
+
+        std::vector<std::unique_ptr<worker>> workers;
+        std::atomic<unsigned int> nextWorker = 0;
+        std::atomic<std::size_t> queued = 0;
+
+        std::mutex sleepLock;
+        std::condition_variable sleep;
+        bool quit = false;
+
+        std::mutex statsLock;
+        std::chrono::steady_clock::time_point lastSample;
+        std::vector<uint64_t> lastBusy;
+
+        void enqueue(scheduled_job j) {
+            const unsigned int target = on_worker() ? workerIndex :
+                nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+            {
+                worker& w = *workers[target];
+                std::scoped_lock<std::mutex> l(w.lock);
+                w.queues[static_cast<std::size_t>(j.priority)].push_back(std::move(j));
+            }
+            queued.fetch_add(1, std::memory_order_release);
+            {
+                std::scoped_lock<std::mutex> l(sleepLock);
+            }
+            sleep.notify_one();
+        }
+
+        // Takes the newest job of the worker's own deque or the oldest of another worker's,
+        // for the highest priority that has any.
+        bool try_pop(unsigned int self, scheduled_job& out, bool& stolen) {
+            const std::size_t n = workers.size();
+            for(std::size_t p = 0; p < job_priority_count; p++) {
+                if(self < n) {
+                    worker& w = *workers[self];
+                    std::scoped_lock<std::mutex> l(w.lock);
+                    if(!w.queues[p].empty()) {
+                        out = std::move(w.queues[p].back());
+                        w.queues[p].pop_back();
+                        queued.fetch_sub(1, std::memory_order_relaxed);
+                        stolen = false;
+                        return true;
+                    }
+                }
+                for(std::size_t i = 1; i <= n; i++) {
+                    const std::size_t victim = (self + i) % n;
+                    if(victim == self) {
+                        continue;
+                    }
+                    worker& w = *workers[victim];
+                    std::scoped_lock<std::mutex> l(w.lock);
+                    if(!w.queues[p].empty()) {
+                        out = std::move(w.queues[p].front());
+                        w.queues[p].pop_front();
+                        queued.fetch_sub(1, std::memory_order_relaxed);
+                        stolen = true;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        void execute(scheduled_job& j, unsigned int index, bool stolen) {
+            const auto start = std::chrono::steady_clock::now();
+            try {
+                j.fn();
+            } catch(const std::exception& e) {
+                spdlog::error("Job failed: {}", e.what());
+            } catch(...) {
+                spdlog::error("Job failed with unknown exception");
+            }
+            if(index < workers.size()) {
+                worker& w = *workers[index];
+                w.busy.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+                w.jobs.fetch_add(1, std::memory_order_relaxed);
+                if(stolen) {
+                    w.steals.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if(j.signal) {
+                j.signal->done();
+            }
+        }
+
+        void work(unsigned int index) {
+            workerSystem = this;
+            workerIndex = index;
+            for(;;) {
+                scheduled_job j;
+                bool stolen = false;
+                if(try_pop(index, j, stolen)) {
+                    execute(j, index, stolen);
+                    continue;
+                }
+                std::unique_lock<std::mutex> l(sleepLock);
+                sleep.wait(l, [this]{ return quit || queued.load(std::memory_order_acquire) > 0; });
+                if(quit && queued.load(std::memory_order_acquire) == 0) {
+                    return;
+                }
+            }
+        }
+};
+
+void job_counter::done(uint32_t count) {
+    std::vector<continuation> ready;
+    {
+        std::scoped_lock<std::mutex> l(lock);
+        if(pending.fetch_sub(count, std::memory_order_acq_rel) != count) {
+            return;
+        }
+        ready.swap(continuations);
+        zero.notify_all();
+    }
+    for(auto& c : ready) {
+        c.system->enqueue(std::move(c.job));
+    }
+}
+
+// Runs fn over [begin, end) on the active job system, or on the calling thread if there is none.
+export template<typename F>
+void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F&& fn) {
+    if(job_system* jobs = job_system::active()) {
+        jobs->parallel_for(begin, end, grain, std::forward<F>(fn));
+    } else if(begin < end) {
+        fn(begin, end);
+    }
+}
+
+}
@@ -0,0 +1,328 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+export module dreamrender:memory_tracker;
+
+import spdlog;
+import vulkan_hpp;
+import vma;
+
+namespace dreamrender {
+
+// The subsystem an allocation belongs to.
+export enum class memory_tag : uint8_t {
+    other,
+    texture,
+    font,
+    // Per-frame vertex, uniform and sample buffers of the renderers.
+    frame_data,
+    staging,
+    headless_output,
+    model,
+};
+export constexpr std::size_t memory_tag_count = 7;
+
+export constexpr std::string_view to_string(memory_tag tag) {
+    switch(tag) {
+        case memory_tag::other: return "other";
+        case memory_tag::texture: return "texture";
+        case memory_tag::font: return "font";
+        case memory_tag::frame_data: return "frame_data";
+        case memory_tag::staging: return "staging";
+        case memory_tag::headless_output: return "headless_output";
+        case memory_tag::model: return "model";
+    }
+    return "unknown";
+}
+export std::optional<memory_tag> parse_memory_tag(std::string_view name) {
+    for(std::size_t i = 0; i < memory_tag_count; i++) {
+        if(to_string(static_cast<memory_tag>(i)) == name) {
+            return static_cast<memory_tag>(i);
+        }
+    }
+    return std::nullopt;
+}
+
+// Counts the live bytes and allocations of every tag and memory heap.
+//
+// Allocations are reported with track() and untrack(), which do nothing if no tracker is
+// active. The tag is kept in the allocation's user data, so nothing has to be looked up when it
+// is freed, and the allocation is named after its tag in the VMA statistics.
+export class memory_tracker {
+    public:
+        memory_tracker(vma::Allocator allocator, const vk::PhysicalDeviceMemoryProperties& properties) :
+            allocator(allocator), properties(properties) {}
+        ~memory_tracker() {
+            memory_tracker* self = this;
+            current.compare_exchange_strong(self, nullptr);
+        }
+
+        memory_tracker(const memory_tracker&) = delete;
+        memory_tracker& operator=(const memory_tracker&) = delete;
+
+        static memory_tracker* active() {
+            return current.load(std::memory_order_acquire);
+        }
+        static void set_active(memory_tracker* t) {
+            current.store(t, std::memory_order_release);
+        }
+
+        static void track(vma::Allocation allocation, memory_tag tag) {
+            if(memory_tracker* t = active(); t && allocation) {
+                t->add(allocation, tag);
+            }
+        }
+        // Must be called before the allocation is freed.
+        static void untrack(vma::Allocation allocation) {
+            if(memory_tracker* t = active(); t && allocation) {
+                t->remove(allocation);
+            }
+        }
+        // Moves a tracked allocation to another tag.
+        static void retag(vma::Allocation allocation, memory_tag tag) {
+            if(memory_tracker* t = active(); t && allocation) {
+                t->remove(allocation);
+                t->add(allocation, tag);
+            }
+        }
+
+        // A warning is logged whenever the tag grows beyond this, 0 disables it.
+        void set_threshold(memory_tag tag, vk::DeviceSize bytes) {
+            tags[index(tag)].threshold.store(bytes, std::memory_order_relaxed);
+        }
+
+        vk::DeviceSize bytes(memory_tag tag) const {
+            return tags[index(tag)].bytes.load(std::memory_order_relaxed);
+        }
+        uint64_t count(memory_tag tag) const {
+            return tags[index(tag)].count.load(std::memory_order_relaxed);
+        }
+        vk::DeviceSize peak_bytes(memory_tag tag) const {
+            return tags[index(tag)].peak.load(std::memory_order_relaxed);
+        }
+        vk::DeviceSize heap_bytes(uint32_t heap) const {
+            return heaps.at(heap).bytes.load(std::memory_order_relaxed);
+        }
+
+        // Warns once when a heap's usage reaches the given share of the budget VMA reports,
+        // and again after it dropped below it.
+        void check_budget(double share = 0.9) {
+            auto budgets = allocator.getHeapBudgets();
+            for(uint32_t i = 0; i < properties.memoryHeapCount && i < budgets.size(); i++) {
+                const bool over = budgets[i].budget > 0 && budgets[i].usage >= share * budgets[i].budget;
+                if(over && !heaps[i].overBudget) {
+                    spdlog::warn("Memory heap {} uses {:.1f} of {:.1f} MiB budget ({:.1f} MiB tracked)", i,
+                        mib(budgets[i].usage), mib(budgets[i].budget), mib(heap_bytes(i)));
+                }
+                heaps[i].overBudget = over;
+            }
+        }
+
+        // Tags, heaps with their VMA budget, and VMA's own detailed statistics under "vma".
+        std::string dump_json() const {
+            std::string out = "{\n  \"tags\": {";
+            for(std::size_t i = 0; i < memory_tag_count; i++) {
+                const auto& t = tags[i];
+                out += std::format("{}\n    \"{}\": {{\"bytes\": {}, \"count\": {}, \"peak_bytes\": {}, \"threshold\": {}}}",
+                    i == 0 ? "" : ",", to_string(static_cast<memory_tag>(i)),
+                    t.bytes.load(std::memory_order_relaxed), t.count.load(std::memory_order_relaxed),
+                    t.peak.load(std::memory_order_relaxed), t.threshold.load(std::memory_order_relaxed));
+            }
+            out += "\n  },\n  \"heaps\": [";
+            auto budgets = allocator.getHeapBudgets();
+            for(uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+                const auto& h = heaps[i];
+                const bool local = static_cast<bool>(properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+                out += std::format("{}\n    {{\"index\": {}, \"size\": {}, \"device_local\": {}, \"tracked_bytes\": {}, \"tracked_count\": {}",
+                    i == 0 ? "" : ",", i, properties.memoryHeaps[i].size, local ? "true" : "false",
+                    h.bytes.load(std::memory_order_relaxed), h.count.load(std::memory_order_relaxed));
+                if(i < budgets.size()) {
+                    out += std::format(", \"usage\": {}, \"budget\": {}, \"allocation_bytes\": {}, \"block_bytes\": {}",
+                        budgets[i].usage, budgets[i].budget,
+                        budgets[i].statistics.allocationBytes, budgets[i].statistics.blockBytes);
+                }
+                out += "}";
+            }
+            out += "\n  ],\n  \"vma\": ";
+            char* stats = allocator.buildStatsString(true);
+            out += stats ? stats : "null";
+            allocator.freeStatsString(stats);
+            out += "\n}\n";
+            return out;
+        }
+        void save_json(const std::filesystem::path& path) const {
+            std::ofstream out(path);
+            out << dump_json();
+            if(!out) {
+                throw std::runtime_error("Failed to write memory report: " + path.string());
+            }
+            spdlog::info("Saved memory report to {}", path.string());
+        }
+    private:
+        struct tag_counters {
+            std::atomic<vk::DeviceSize> bytes = 0;
+            std::atomic<uint64_t> count = 0;
+            std::atomic<vk::DeviceSize> peak = 0;
+            std::atomic<vk::DeviceSize> threshold = 0;
+            std::atomic<bool> overThreshold = false;
+        };
+        struct heap_counters {
+            std::atomic<vk::DeviceSize> bytes = 0;
+            std::atomic<uint64_t> count = 0;
+            // Only used by check_budget.
+            bool overBudget = false;
+        };
+
+        static inline std::atomic<memory_tracker*> current = nullptr;
+
+        vma::Allocator allocator;
+        vk::PhysicalDeviceMemoryProperties properties;
+        std::array<tag_counters, memory_tag_count> tags;
+        std::array<heap_counters, vk::MaxMemoryHeaps> heaps;
+
+        static std::size_t index(memory_tag tag) {
+            return static_cast<std::size_t>(tag);
+        }
+        static double mib(vk::DeviceSize bytes) {
+            return static_cast<double>(bytes) / (1024.0 * 1024.0);
+        }
+
+        // The user data holds the tag plus one, so untracked allocations are recognised.
+        void add(vma::Allocation allocation, memory_tag tag) {
+            vma::AllocationInfo info = allocator.getAllocationInfo(allocation);
+            allocator.setAllocationUserData(allocation, reinterpret_cast<void*>(static_cast<uintptr_t>(index(tag)) + 1));
+            allocator.setAllocationName(allocation, to_string(tag).data());
+
+            auto& t = tags[index(tag)];
+            const vk::DeviceSize total = t.bytes.fetch_add(info.size, std::memory_order_relaxed) + info.size;
+            t.count.fetch_add(1, std::memory_order_relaxed);
+            vk::DeviceSize peak = t.peak.load(std::memory_order_relaxed);
+            while(total > peak && !t.peak.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {}
+
+            auto& h = heaps[properties.memoryTypes[info.memoryType].heapIndex];
+            h.bytes.fetch_add(info.size, std::memory_order_relaxed);
+            h.count.fetch_add(1, std::memory_order_relaxed);
+
+            const vk::DeviceSize threshold = t.threshold.load(std::memory_order_relaxed);
+            if(threshold > 0 && total > threshold && !t.overThreshold.exchange(true, std::memory_order_relaxed)) {
+                spdlog::warn("GPU memory for \"{}\" exceeds its threshold: {:.1f} of {:.1f} MiB in {} allocations",
+                    to_string(tag), mib(total), mib(threshold), t.count.load(std::memory_order_relaxed));
+            }
+        }
+        void remove(vma::Allocation allocation) {
+            vma::AllocationInfo info = allocator.getAllocationInfo(allocation);
+            const uintptr_t data = reinterpret_cast<uintptr_t>(info.pUserData);
+            if(data == 0 || data > memory_tag_count) {
+                return;
+            }
+            allocator.setAllocationUserData(allocation, nullptr);
+
+            auto& t = tags[data - 1];
+            const vk::DeviceSize total = t.bytes.fetch_sub(info.size, std::memory_order_relaxed) - info.size;
+            t.count.fetch_sub(1, std::memory_order_relaxed);
+            if(total <= t.threshold.load(std::memory_order_relaxed)) {
+                t.overThreshold.store(false, std::memory_order_relaxed);
+            }
+
+            auto& h = heaps[properties.memoryTypes[info.memoryType].heapIndex];
+            h.bytes.fetch_sub(info.size, std::memory_order_relaxed);
+            h.count.fetch_sub(1, std::memory_order_relaxed);
+        }
+};
+
+// An allocation that is reported to the active memory_tracker for as long as it lives.
+export class tracked_allocation {
+    public:
+        tracked_allocation() = default;
+        tracked_allocation(vma::UniqueAllocation allocation, memory_tag tag) : allocation(std::move(allocation)) {
+            memory_tracker::track(this->allocation.get(), tag);
+        }
+        ~tracked_allocation() {
+            reset();
+        }
+        tracked_allocation(tracked_allocation&&) = default;
+        tracked_allocation& operator=(tracked_allocation&& other) {
+            if(this != &other) {
+                reset();
+                allocation = std::move(other.allocation);
+            }
+            return *this;
+        }
+
+        vma::Allocation get() const {
+            return allocation.get();
+        }
+        explicit operator bool() const {
+            return static_cast<bool>(allocation);
+        }
+        void reset() {
+            if(allocation) {
+                memory_tracker::untrack(allocation.get());
+                allocation.reset();
+            }
+        }
+    private:
+        vma::UniqueAllocation allocation;
+};
+
+// Like vma::Allocator::createBufferUnique, with the allocation tracked under the tag.
+export std::pair<vma::UniqueBuffer, tracked_allocation> create_tracked_buffer(vma::Allocator allocator, memory_tag tag,
+    const vk::BufferCreateInfo& bufferInfo, const vma::AllocationCreateInfo& allocationInfo)
+{
+    auto [buffer, allocation] = allocator.createBufferUnique(bufferInfo, allocationInfo);
+    return {std::move(buffer), tracked_allocation(std::move(allocation), tag)};
+}
+
+// Parses per-tag thresholds such as "texture=512M,staging=64M" (suffixes K, M and G).
+export std::map<memory_tag, vk::DeviceSize> parse_memory_thresholds(std::string_view spec) {
+    std::map<memory_tag, vk::DeviceSize> result;
+    while(!spec.empty()) {
+        std::string_view entry = spec.substr(0, spec.find(','));
+        spec.remove_prefix(std::min(spec.size(), entry.size() + 1));
+        const auto eq = entry.find('=');
+        std::optional<memory_tag> tag = eq == std::string_view::npos ? std::nullopt : parse_memory_tag(entry.substr(0, eq));
+        if(!tag) {
+            spdlog::warn("Ignoring invalid memory threshold \"{}\"", entry);
+            continue;
+        }
+        std::string value{entry.substr(eq + 1)};
+        vk::DeviceSize multiplier = 1;
+        if(!value.empty()) {
+            switch(value.back()) {
+                case 'K': case 'k': multiplier = 1024ull; break;
+                case 'M': case 'm': multiplier = 1024ull * 1024; break;
+                case 'G': case 'g': multiplier = 1024ull * 1024 * 1024; break;
+                default: break;
+            }
+            if(multiplier != 1) {
+                value.pop_back();
+            }
+        }
+        try {
+            result[*tag] = std::stoull(value) * multiplier;
+        } catch(const std::exception&) {
+            spdlog::warn("Ignoring invalid memory threshold \"{}\"", entry);
+        }
+    }
+    return result;
+}
+
+}
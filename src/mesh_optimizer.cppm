@@ -0,0 +1,247 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+export module dreamrender:mesh_optimizer;
+
+import :model;
+
+import glm;
+
+namespace dreamrender {
+
+// Reorders the triangles of an indexed triangle list so consecutive triangles reuse the
+// vertices still in the post-transform cache, using Tipsify (Sander et al., "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007).
+export void optimize_vertex_cache(std::span<uint32_t> indices, std::size_t vertexCount, unsigned int cacheSize = 16) {
+    if(indices.size() % 3 != 0) {
+        throw std::invalid_argument("Index count is not a multiple of three");
+    }
+    const std::size_t triangleCount = indices.size() / 3;
+    if(triangleCount == 0) {
+        return;
+    }
+
+    // Triangles using each vertex, as offsets into one array.
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for(uint32_t i : indices) {
+        if(i >= vertexCount) {
+            throw std::out_of_range("Index out of range");
+        }
+        liveTriangles[i]++;
+    }
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for(std::size_t v = 0; v < vertexCount; v++) {
+        offsets[v + 1] = offsets[v] + liveTriangles[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for(std::size_t t = 0; t < triangleCount; t++) {
+            for(int k = 0; k < 3; k++) {
+                adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+            }
+        }
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    uint32_t time = cacheSize + 1;
+    std::size_t cursor = 0;
+    int64_t fanning = indices[0];
+    while(fanning >= 0) {
+        const uint32_t f = static_cast<uint32_t>(fanning);
+        candidates.clear();
+        for(uint32_t a = offsets[f]; a < offsets[f + 1]; a++) {
+            const uint32_t t = adjacency[a];
+            if(emitted[t]) {
+                continue;
+            }
+            for(int k = 0; k < 3; k++) {
+                const uint32_t v = indices[t * 3 + k];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if(time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        // Continue with the candidate that stays in the cache the longest after
+        // emitting its remaining triangles.
+        fanning = -1;
+        int64_t bestPriority = -1;
+        for(uint32_t v : candidates) {
+            if(liveTriangles[v] == 0) {
+                continue;
+            }
+            int64_t priority = 0;
+            if(time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                priority = time - cacheTime[v];
+            }
+            if(priority > bestPriority) {
+                bestPriority = priority;
+                fanning = v;
+            }
+        }
+        if(fanning >= 0) {
+            continue;
+        }
+        // Dead end, go back to a recently used vertex or the next one in input order.
+        while(!deadEnd.empty()) {
+            const uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if(liveTriangles[v] > 0) {
+                fanning = v;
+                break;
+            }
+        }
+        while(fanning < 0 && cursor < vertexCount) {
+            if(liveTriangles[cursor] > 0) {
+                fanning = static_cast<int64_t>(cursor);
+            }
+            cursor++;
+        }
+    }
+    std::ranges::copy(output, indices.begin());
+}
+
+// Reorders the vertices in the order the indices first reference them and remaps the indices,
+// so vertex fetch reads memory sequentially. Unreferenced vertices are removed.
+export template<typename Vertex>
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::span<uint32_t> indices) {
+    constexpr uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertices.size(), unused);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for(uint32_t& i : indices) {
+        if(remap[i] == unused) {
+            remap[i] = static_cast<uint32_t>(reordered.size());
+            reordered.push_back(vertices[i]);
+        }
+        i = remap[i];
+    }
+    vertices = std::move(reordered);
+}
+
+// Average number of vertex shader invocations per triangle with a FIFO cache of the given size,
+// between 0.5 for an ideal mesh and 3.
+export float average_cache_miss_ratio(std::span<const uint32_t> indices, std::size_t vertexCount, unsigned int cacheSize = 16) {
+    if(indices.size() < 3) {
+        return 0.0f;
+    }
+    std::vector<uint64_t> insertedAt(vertexCount, 0);
+    uint64_t time = cacheSize + 1;
+    std::size_t misses = 0;
+    for(uint32_t i : indices) {
+        if(time - insertedAt[i] > cacheSize) {
+            insertedAt[i] = time++;
+            misses++;
+        }
+    }
+    return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
+
+// IEEE 754 binary16, rounded to nearest.
+export uint16_t float_to_half(float value) {
+    const uint32_t x = std::bit_cast<uint32_t>(value);
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t exponent = (x >> 23) & 0xff;
+    uint32_t mantissa = x & 0x7fffff;
+
+    if(exponent == 0xff) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    const int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if(halfExponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+    if(halfExponent <= 0) {
+        if(halfExponent < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000;
+        const uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+        uint32_t half = mantissa >> shift;
+        if((mantissa >> (shift - 1)) & 1) {
+            half++;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = sign | (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    // A carry into the exponent rounds up to the next power of two or infinity, as it should.
+    if(mantissa & 0x1000) {
+        half++;
+    }
+    return static_cast<uint16_t>(half);
+}
+
+// Projects a normal onto the octahedron and unfolds it into [-1, 1]^2 as 16 bit snorm.
+export std::array<int16_t, 2> octahedral_encode(glm::vec3 n) {
+    const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if(l1 == 0.0f) {
+        return {0, 0};
+    }
+    float x = n.x / l1;
+    float y = n.y / l1;
+    if(n.z < 0.0f) {
+        const float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    auto snorm = [](float v) {
+        return static_cast<int16_t>(std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+    };
+    return {snorm(x), snorm(y)};
+}
+
+// Quantises vertices to packed_vertex_data relative to the bounds min and max.
+export std::vector<packed_vertex_data> pack_vertices(std::span<const vertex_data> vertices, glm::vec3 min, glm::vec3 max) {
+    const glm::vec3 extent = max - min;
+    auto unorm = [](float v, float lo, float size) {
+        if(size <= 0.0f) {
+            return uint16_t{0};
+        }
+        return static_cast<uint16_t>(std::lround(std::clamp((v - lo) / size, 0.0f, 1.0f) * 65535.0f));
+    };
+
+    std::vector<packed_vertex_data> packed;
+    packed.reserve(vertices.size());
+    for(const auto& v : vertices) {
+        packed.push_back(packed_vertex_data{
+            .position = {
+                unorm(v.position.x, min.x, extent.x),
+                unorm(v.position.y, min.y, extent.y),
+                unorm(v.position.z, min.z, extent.z),
+                0,
+            },
+            .normal = octahedral_encode(v.normal),
+            .texCoord = {float_to_half(v.texCoord.x), float_to_half(v.texCoord.y)},
+        });
+    }
+    return packed;
+}
+
+}
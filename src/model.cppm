@@ -12,6 +12,7 @@ module;
 #include <limits>
 #include <memory>
 #include <span>
+#include <tuple>
 
 export module dreamrender:model;
 
@@ -19,6 +20,7 @@ import glm;
 import vulkan_hpp;
 import vma;
 
+import :memory_tracker;
 import :utils;
 
 namespace dreamrender {
@@ -38,6 +40,44 @@ export struct vertex_data
     }
 };
 
+// Compact vertex layout, half the size of vertex_data.
+//
+// Positions are 16 bit unorm relative to the bounds of the model (w is unused), normals are
+// octahedral encoded as two 16 bit snorm and texture coordinates are half floats. Shaders
+// get the position in [0, 1] and map it to the bounds, e.g. with model::packed_transform,
+// and decode the normal from the octahedron.
+export struct packed_vertex_data
+{
+    std::array<uint16_t, 4> position;
+    std::array<int16_t, 2> normal;
+    std::array<uint16_t, 2> texCoord;
+
+    static std::array<vk::VertexInputAttributeDescription, 3> attributes(uint32_t binding) {
+        return {
+            vk::VertexInputAttributeDescription(0, binding, vk::Format::eR16G16B16A16Unorm, offsetof(packed_vertex_data, position)),
+            vk::VertexInputAttributeDescription(1, binding, vk::Format::eR16G16Snorm, offsetof(packed_vertex_data, normal)),
+            vk::VertexInputAttributeDescription(2, binding, vk::Format::eR16G16Sfloat, offsetof(packed_vertex_data, texCoord)),
+        };
+    }
+};
+static_assert(sizeof(packed_vertex_data) == sizeof(vertex_data) / 2);
+
+export enum class vertex_format {
+    full,
+    packed,
+};
+
+export constexpr std::size_t vertex_size(vertex_format format) {
+    return format == vertex_format::packed ? sizeof(packed_vertex_data) : sizeof(vertex_data);
+}
+
+// How resource_loader prepares a model's geometry.
+export struct model_load_options {
+    // Reorders the indices for the post-transform vertex cache and the vertices for fetch locality.
+    bool optimize = false;
+    vertex_format format = vertex_format::full;
+};
+
 export struct abstract_model {
     virtual ~abstract_model() = default;
     abstract_model() = default;
@@ -50,12 +90,20 @@ export struct abstract_model {
     virtual void create_buffers(std::span<const vertex_data> vertices, std::span<const uint32_t> indices) {
         this->vertexCount = static_cast<int>(vertices.size());
         this->indexCount = static_cast<int>(indices.size());
+        this->format = vertex_format::full;
+    };
+    // Packed vertices are quantised relative to the bounds min and max.
+    virtual void create_buffers(std::span<const packed_vertex_data> vertices, std::span<const uint32_t> indices, glm::vec3 min, glm::vec3 max) {
+        this->vertexCount = static_cast<int>(vertices.size());
+        this->indexCount = static_cast<int>(indices.size());
+        this->format = vertex_format::packed;
     };
     [[nodiscard]] virtual std::tuple<vk::Buffer, vk::DeviceSize> get_vertex_buffer() const = 0;
     [[nodiscard]] virtual std::tuple<vk::Buffer, vk::DeviceSize> get_index_buffer() const = 0;
 
     int indexCount = -1;
     int vertexCount = -1;
+    vertex_format format = vertex_format::full;
 
     bool loaded = false;
 
@@ -69,6 +117,8 @@ export struct model : public abstract_model
     model(vk::Device device, vma::Allocator allocator)
         : device(device), allocator(allocator) {}
     ~model() {
+        memory_tracker::untrack(vertexAllocation);
+        memory_tracker::untrack(indexAllocation);
         allocator.destroyBuffer(vertexBuffer, vertexAllocation);
         allocator.destroyBuffer(indexBuffer, indexAllocation);
     }
@@ -83,21 +133,20 @@ export struct model : public abstract_model
 
     void create_buffers(std::span<const vertex_data> vertices, std::span<const uint32_t> indices) override {
         abstract_model::create_buffers(vertices, indices);
-
-        vk::BufferCreateInfo vertex_info({}, sizeof(vertex_data)*vertexCount,
-            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive);
-        vk::BufferCreateInfo index_info({}, sizeof(uint32_t)*indexCount,
-            vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive);
-        vma::AllocationCreateInfo alloc_info({}, vma::MemoryUsage::eGpuOnly);
-
-        auto [vb, va] = allocator.createBuffer(vertex_info, alloc_info); vertexBuffer = vb; vertexAllocation = va;
-        auto [ib, ia] = allocator.createBuffer(index_info, alloc_info); indexBuffer = ib; indexAllocation = ia;
+        allocate_buffers();
 
         for(auto& v : vertices) {
             min = glm::min(min, v.position);
             max = glm::max(max, v.position);
         }
     }
+    void create_buffers(std::span<const packed_vertex_data> vertices, std::span<const uint32_t> indices, glm::vec3 min, glm::vec3 max) override {
+        abstract_model::create_buffers(vertices, indices, min, max);
+        allocate_buffers();
+
+        this->min = min;
+        this->max = max;
+    }
     [[nodiscard]] std::tuple<vk::Buffer, vk::DeviceSize> get_vertex_buffer() const override {
         return {vertexBuffer, 0};
     }
@@ -105,8 +154,30 @@ export struct model : public abstract_model
         return {indexBuffer, 0};
     }
 
+    // Maps packed positions in [0, 1] to model space, identity for full vertices.
+    [[nodiscard]] glm::mat4 packed_transform() const {
+        if(format != vertex_format::packed) {
+            return glm::mat4(1.0f);
+        }
+        return glm::scale(glm::translate(glm::mat4(1.0f), min), max - min);
+    }
+
     glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
     glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    private:
+        void allocate_buffers() {
+            vk::BufferCreateInfo vertex_info({}, vertex_size(format)*vertexCount,
+                vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive);
+            vk::BufferCreateInfo index_info({}, sizeof(uint32_t)*indexCount,
+                vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive);
+            vma::AllocationCreateInfo alloc_info({}, vma::MemoryUsage::eGpuOnly);
+
+            auto [vb, va] = allocator.createBuffer(vertex_info, alloc_info); vertexBuffer = vb; vertexAllocation = va;
+            auto [ib, ia] = allocator.createBuffer(index_info, alloc_info); indexBuffer = ib; indexAllocation = ia;
+            memory_tracker::track(vertexAllocation, memory_tag::model);
+            memory_tracker::track(indexAllocation, memory_tag::model);
+        }
 };
 
 }
@@ -5,6 +5,8 @@
  */
 module;
 
+#include <optional>
+#include <span>
 #include <vector>
 
 module dreamrender;
@@ -19,7 +21,7 @@ namespace dreamrender {
 phase::phase(window* window) :
     win(window),
     instance(window->instance.get()), device(window->device.get()),
-    allocator(window->allocator), loader(window->loader.get()),
+    allocator(window->allocator), loader(window->loader.get()), sharedObjects(&window->sharedObjects),
     graphicsQueue(window->graphicsQueue), graphicsFamily(window->queueFamilyIndices.graphicsFamily.value())
 {
 
@@ -32,4 +34,45 @@ std::vector<vk::UniqueFramebuffer> phase::createFramebuffers(vk::RenderPass rend
     return createFramebuffers(renderPass, win->swapchainImageViewsRaw, win->swapchainExtent);
 }
 
+
+void phase::beginRendering(vk::CommandBuffer cmd, int frame, std::optional<vk::ClearColorValue> clear) const {
+    // The previous contents are only kept if there is nothing to clear.
+    vk::ImageLayout oldLayout = clear ? vk::ImageLayout::eUndefined : win->swapchainFinalLayout;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        {}, {}, {}, vk::ImageMemoryBarrier(
+            {}, vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+            oldLayout, vk::ImageLayout::eColorAttachmentOptimal,
+            vk::QueueFamilyIgnored, vk::QueueFamilyIgnored,
+            win->swapchainImages[frame],
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+
+    vk::RenderingAttachmentInfo attachment = vk::RenderingAttachmentInfo()
+        .setImageView(win->swapchainImageViewsRaw[frame])
+        .setImageLayout(vk::ImageLayout::eColorAttachmentOptimal)
+        .setLoadOp(clear ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eLoad)
+        .setStoreOp(vk::AttachmentStoreOp::eStore)
+        .setClearValue(clear.value_or(vk::ClearColorValue{}));
+    cmd.beginRenderingKHR(vk::RenderingInfo()
+        .setRenderArea(vk::Rect2D({0, 0}, win->swapchainExtent))
+        .setLayerCount(1)
+        .setColorAttachments(attachment));
+}
+void phase::endRendering(vk::CommandBuffer cmd, int frame) const {
+    cmd.endRenderingKHR();
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eBottomOfPipe,
+        {}, {}, {}, vk::ImageMemoryBarrier(
+            vk::AccessFlagBits::eColorAttachmentWrite, {},
+            vk::ImageLayout::eColorAttachmentOptimal, win->swapchainFinalLayout,
+            vk::QueueFamilyIgnored, vk::QueueFamilyIgnored,
+            win->swapchainImages[frame],
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+}
+
+void phase::set_present_region(std::span<const vk::Rect2D> region) const {
+    win->presentRegion.clear();
+    for(const auto& r : region) {
+        win->presentRegion.emplace_back(r.offset, r.extent, 0);
+    }
+}
+
 }
@@ -5,8 +5,18 @@
  */
 module;
 
+#include <chrono>
+#include <concepts>
 #include <cstdint>
 #include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <typeindex>
 #include <vector>
 
 export module dreamrender:phase;
@@ -19,6 +29,53 @@ import vma;
 namespace dreamrender {
 
 export class window;
+export class phase;
+
+// State a phase needs to render one frame, produced by phase::update.
+// Phases derive from it to carry their own state; the window fills in the fields below.
+export struct frame_snapshot {
+    virtual ~frame_snapshot() = default;
+
+    const phase* source = nullptr;
+    uint64_t frame_number = 0;
+    // Start of the frame on the pacing clock, see window::frame_time.
+    std::chrono::steady_clock::time_point time;
+    std::chrono::steady_clock::time_point input_time;
+    // Set by update() if the frame would look exactly like the previous one, the window then
+    // skips it entirely unless the swapchain images need to be drawn again (see damage_tracker).
+    bool unchanged = false;
+};
+
+// Objects that phases share instead of building them again, such as renderers with their
+// pipelines and font atlases. An object lives as long as a phase holds it, so a phase that is
+// staged with window::queue_phase picks up the objects of the phase it replaces.
+export class shared_objects {
+    public:
+        // Returns the object stored under key, or stores the one create returns.
+        template<typename T, std::invocable F>
+        std::shared_ptr<T> get(const std::string& key, F&& create) {
+            std::scoped_lock l(lock);
+            auto it = objects.find(key);
+            if(it != objects.end()) {
+                if(std::shared_ptr<void> object = it->second.object.lock()) {
+                    if(it->second.type != typeid(T)) {
+                        throw std::runtime_error("Shared object \"" + key + "\" has a different type");
+                    }
+                    return std::static_pointer_cast<T>(object);
+                }
+            }
+            std::shared_ptr<T> object = std::forward<F>(create)();
+            objects.insert_or_assign(key, entry{typeid(T), object});
+            return object;
+        }
+    private:
+        struct entry {
+            std::type_index type;
+            std::weak_ptr<void> object;
+        };
+        std::mutex lock;
+        std::map<std::string, entry> objects;
+};
 
 export class phase
 {
@@ -26,6 +83,8 @@ export class phase
         phase(window*);
         virtual ~phase() {}
 
+        // With window::queue_phase, preload() and prepare() run on a background thread while the
+        // current phase keeps rendering, and init() runs once it stopped rendering.
         virtual void preload() {
             pool = device.createCommandPoolUnique(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, graphicsFamily));
         }
@@ -34,6 +93,16 @@ export class phase
             commandBuffers = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(pool.get(), vk::CommandBufferLevel::ePrimary, imageCount));
         }
         virtual void init() {}
+        // Called on the main thread once input was handled for the frame.
+        // With window_config::threaded_render the snapshot is rendered on the render thread
+        // while input and the update of the next frame are handled, so anything render() reads
+        // that the input handlers or update() change must be copied into the snapshot.
+        virtual std::unique_ptr<frame_snapshot> update() {
+            return std::make_unique<frame_snapshot>();
+        }
+        virtual void render(int frame, const frame_snapshot& snapshot, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) {
+            render(frame, imageAvailable, renderFinished, fence);
+        }
         virtual void render(int frame, vk::Semaphore imageAvailable, vk::Semaphore renderFinished, vk::Fence fence) {}
 
         void waitLoad() {
@@ -74,6 +143,7 @@ export class phase
         vk::Device device;
         vma::Allocator allocator;
         resource_loader* loader;
+        shared_objects* sharedObjects;
 
         uint32_t graphicsFamily;
         vk::Queue graphicsQueue;
@@ -84,6 +154,14 @@ export class phase
         vk::UniqueCommandPool pool;
         std::vector<vk::CommandBuffer> commandBuffers;
 
+        // Returns the object shared under key, creating it if no phase holds it. The current phase
+        // may still render with it while a staged phase preloads, so per-frame state of shared
+        // objects, like the buffers of a renderer's prepare(), belongs into init().
+        template<typename T, std::invocable F>
+        std::shared_ptr<T> shared(const std::string& key, F&& create) {
+            return sharedObjects->get<T>(key, std::forward<F>(create));
+        }
+
         // Utility functions
         std::vector<vk::UniqueFramebuffer> createFramebuffers(vk::RenderPass renderPass, const std::vector<vk::ImageView>& swapchainViews, vk::Extent2D extent) const {
             std::vector<vk::UniqueFramebuffer> framebuffers;
@@ -95,6 +173,15 @@ export class phase
         }
         std::vector<vk::UniqueFramebuffer> createFramebuffers(vk::RenderPass renderPass, const std::vector<vk::ImageView>& swapchainViews) const;
         std::vector<vk::UniqueFramebuffer> createFramebuffers(vk::RenderPass renderPass) const;
+
+        // Dynamic rendering into the swapchain image of the frame, instead of a render pass and framebuffers.
+        // Only available with gpu_features::dynamicRendering; renderers then take a null render pass.
+        void beginRendering(vk::CommandBuffer cmd, int frame, std::optional<vk::ClearColorValue> clear = std::nullopt) const;
+        void endRendering(vk::CommandBuffer cmd, int frame) const;
+
+        // Tells the presentation engine which parts of the image render() changed
+        // (VK_KHR_incremental_present). Must be called from render(), ignored if unsupported.
+        void set_present_region(std::span<const vk::Rect2D> region) const;
 };
 
 }
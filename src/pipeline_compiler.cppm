@@ -0,0 +1,346 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+export module dreamrender:pipeline_compiler;
+
+import :utils;
+
+import spdlog;
+import vulkan_hpp;
+
+namespace dreamrender {
+
+// Builds pipelines on worker threads. Every worker has its own pipeline cache, seeded with
+// the cache loaded from disk, so workers never contend on a cache. The caches are merged
+// and written to disk whenever all submitted work is done, and once more on destruction.
+//
+// The file starts with a header of our own that records the device and driver it was
+// written for and a checksum, so a cache from another GPU, another driver or a partial
+// write is discarded instead of being handed to the driver.
+export class pipeline_compiler {
+    public:
+        // A thread count of 0 uses half of the hardware threads, at most 4.
+        pipeline_compiler(vk::Device device, const vk::PhysicalDeviceProperties& properties,
+            std::filesystem::path path, unsigned int threadCount = 0) :
+            device(device), path(std::move(path)),
+            vendorID(properties.vendorID), deviceID(properties.deviceID), driverVersion(properties.driverVersion)
+        {
+            std::ranges::copy(properties.pipelineCacheUUID, uuid.begin());
+
+            std::vector<uint8_t> data = load();
+            mainCache = device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo({}, data.size(), data.data()));
+            debugName(device, mainCache.get(), "Pipeline Cache");
+            lastSavedHash = data.empty() ? 0 : hash(data);
+
+            if(threadCount == 0) {
+                threadCount = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+            }
+            for(unsigned int i=0; i<threadCount; i++) {
+                workerCaches.push_back(device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo({}, data.size(), data.data())));
+                debugName(device, workerCaches.back().get(), "Pipeline Cache (Worker #"+std::to_string(i)+")");
+            }
+            for(unsigned int i=0; i<threadCount; i++) {
+                threads.emplace_back(&pipeline_compiler::worker, this, i);
+            }
+        }
+        ~pipeline_compiler() {
+            pipeline_compiler* self = this;
+            current.compare_exchange_strong(self, nullptr);
+            {
+                std::scoped_lock<std::mutex> l(lock);
+                quit = true;
+                jobs.clear();
+            }
+            cv.notify_all();
+            idle.notify_all();
+            for(auto& t : threads) {
+                if(t.joinable()) {
+                    t.join();
+                }
+            }
+            save();
+        }
+
+        pipeline_compiler(const pipeline_compiler&) = delete;
+        pipeline_compiler& operator=(const pipeline_compiler&) = delete;
+
+        // The compiler that the renderers submit their pipelines to, if any.
+        static pipeline_compiler* active() {
+            return current.load(std::memory_order_acquire);
+        }
+        static void set_active(pipeline_compiler* c) {
+            current.store(c, std::memory_order_release);
+        }
+
+        // For pipelines that are created synchronously.
+        vk::PipelineCache cache() const {
+            return mainCache.get();
+        }
+
+        // Runs build on a worker thread with that worker's cache. Everything build
+        // references must stay alive until the returned future is ready.
+        std::shared_future<void> submit(std::string name, std::function<void(vk::PipelineCache)> build) {
+            std::shared_future<void> f;
+            {
+                std::scoped_lock<std::mutex> l(lock);
+                jobs.push_back(job{std::move(name), std::move(build), {}});
+                f = jobs.back().promise.get_future().share();
+            }
+            cv.notify_one();
+            return f;
+        }
+
+        // Waits until every submitted job is done, or the compiler is destroyed. Must not be called
+        // from inside a job.
+        void wait_idle() {
+            std::unique_lock<std::mutex> l(lock);
+            idle.wait(l, [this]{ return quit || (jobs.empty() && running == 0); });
+        }
+        std::size_t pending() const {
+            std::scoped_lock<std::mutex> l(lock);
+            return jobs.size() + running;
+        }
+
+        // Merges the caches and writes them if anything changed since the last save.
+        // The file is written next to the target and renamed over it, so it is never partial.
+        void save() noexcept {
+            std::scoped_lock<std::mutex> l(saveLock);
+            try {
+                vk::UniquePipelineCache merged = device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo());
+                std::vector<vk::PipelineCache> sources{mainCache.get()};
+                for(auto& c : workerCaches) {
+                    sources.push_back(c.get());
+                }
+                device.mergePipelineCaches(merged.get(), sources);
+
+                std::vector<uint8_t> data = device.getPipelineCacheData(merged.get());
+                const uint64_t dataHash = hash(data);
+                if(data.empty() || dataHash == lastSavedHash) {
+                    return;
+                }
+
+                file_header header = make_header();
+                header.size = data.size();
+                header.hash = dataHash;
+
+                std::filesystem::create_directories(path.parent_path());
+                auto temporary = path;
+                temporary += ".tmp";
+                {
+                    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+                    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                    out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+                    if(!out) {
+                        spdlog::warn("Failed to write pipeline cache: {}", temporary.string());
+                        return;
+                    }
+                }
+                std::filesystem::rename(temporary, path);
+                lastSavedHash = dataHash;
+                spdlog::debug("Saved pipeline cache of {} bytes", data.size());
+            } catch(const std::exception& e) {
+                spdlog::warn("Failed to save pipeline cache: {}", e.what());
+            }
+        }
+    private:
+        static constexpr std::array<char, 4> file_magic = {'D', 'R', 'P', 'C'};
+        static constexpr uint32_t file_version = 1;
+
+        struct file_header {
+            std::array<char, 4> magic;
+            uint32_t version;
+            uint32_t vendorID;
+            uint32_t deviceID;
+            uint32_t driverVersion;
+            std::array<uint8_t, vk::UuidSize> uuid;
+            uint64_t size;
+            uint64_t hash;
+        };
+        struct job {
+            std::string name;
+            std::function<void(vk::PipelineCache)> build;
+            std::promise<void> promise;
+        };
+
+        static inline std::atomic<pipeline_compiler*> current = nullptr;
+
+        vk::Device device;
+        std::filesystem::path path;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        std::array<uint8_t, vk::UuidSize> uuid;
+
+        vk::UniquePipelineCache mainCache;
+        std::vector<vk::UniquePipelineCache> workerCaches;
+
+        mutable std::mutex lock;
+        std::condition_variable cv;
+        std::condition_variable idle;
+        std::deque<job> jobs;
+        unsigned int running = 0;
+        bool quit = false;
+        std::vector<std::thread> threads;
+
+        std::mutex saveLock;
+        uint64_t lastSavedHash = 0;
+
+        static uint64_t hash(std::span<const uint8_t> data) {
+            uint64_t h = 0xcbf29ce484222325ull;
+            for(uint8_t b : data) {
+                h = (h ^ b) * 0x100000001b3ull;
+            }
+            return h;
+        }
+
+        file_header make_header() const {
+            return file_header{
+                .magic = file_magic,
+                .version = file_version,
+                .vendorID = vendorID,
+                .deviceID = deviceID,
+                .driverVersion = driverVersion,
+                .uuid = uuid,
+                .size = 0,
+                .hash = 0,
+            };
+        }
+
+        // Returns the cached data if it was written for this device and driver and is intact.
+        std::vector<uint8_t> load() const {
+            std::ifstream in(path, std::ios::binary);
+            if(!in) {
+                spdlog::debug("No existing pipeline cache found");
+                return {};
+            }
+            std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+            file_header header{};
+            if(file.size() < sizeof(header)) {
+                spdlog::info("Discarding pipeline cache: file is too small");
+                return {};
+            }
+            std::memcpy(&header, file.data(), sizeof(header));
+            const file_header expected = make_header();
+            if(header.magic != file_magic || header.version != file_version) {
+                spdlog::info("Discarding pipeline cache: unknown file format");
+                return {};
+            }
+            if(header.vendorID != expected.vendorID || header.deviceID != expected.deviceID ||
+               header.driverVersion != expected.driverVersion || header.uuid != expected.uuid)
+            {
+                spdlog::info("Discarding pipeline cache: it was written for another device or driver");
+                return {};
+            }
+            std::span<const uint8_t> data = std::span<const uint8_t>(file).subspan(sizeof(header));
+            if(header.size != data.size() || header.hash != hash(data)) {
+                spdlog::info("Discarding pipeline cache: data is truncated or corrupt");
+                return {};
+            }
+
+            // The driver's own header (VkPipelineCacheHeaderVersionOne) must agree as well.
+            uint32_t headerSize = 0, headerVersion = 0, vendor = 0, deviceId = 0;
+            std::array<uint8_t, vk::UuidSize> cacheUUID{};
+            if(data.size() < 16 + cacheUUID.size()) {
+                spdlog::info("Discarding pipeline cache: missing driver header");
+                return {};
+            }
+            std::memcpy(&headerSize, data.data() + 0, 4);
+            std::memcpy(&headerVersion, data.data() + 4, 4);
+            std::memcpy(&vendor, data.data() + 8, 4);
+            std::memcpy(&deviceId, data.data() + 12, 4);
+            std::memcpy(cacheUUID.data(), data.data() + 16, cacheUUID.size());
+            if(headerSize < 16 + cacheUUID.size() || headerVersion != static_cast<uint32_t>(vk::PipelineCacheHeaderVersion::eOne) ||
+               vendor != vendorID || deviceId != deviceID || cacheUUID != uuid)
+            {
+                spdlog::info("Discarding pipeline cache: driver header does not match the device");
+                return {};
+            }
+
+            spdlog::debug("Loaded pipeline cache of {} bytes", data.size());
+            return {data.begin(), data.end()};
+        }
+
+        void worker(unsigned int index) {
+            for(;;) {
+                job j;
+                {
+                    std::unique_lock<std::mutex> l(lock);
+                    cv.wait(l, [this]{ return quit || !jobs.empty(); });
+                    if(quit) {
+                        return;
+                    }
+                    j = std::move(jobs.front());
+                    jobs.pop_front();
+                    running++;
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                try {
+                    j.build(workerCaches[index].get());
+                    j.promise.set_value();
+                    spdlog::debug("Compiled pipelines \"{}\" in {:.1f} ms", j.name,
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                } catch(const std::exception& e) {
+                    spdlog::error("Failed to compile pipelines \"{}\": {}", j.name, e.what());
+                    j.promise.set_exception(std::current_exception());
+                } catch(...) {
+                    j.promise.set_exception(std::current_exception());
+                }
+
+                bool done = false;
+                {
+                    std::scoped_lock<std::mutex> l(lock);
+                    running--;
+                    done = jobs.empty() && running == 0 && !quit;
+                }
+                // Waiters are released before the cache is written, so they do not wait on the disk.
+                if(done) {
+                    idle.notify_all();
+                    save();
+                }
+            }
+        }
+};
+
+// Runs build on the active compiler, unless the caller asked for a different cache,
+// in which case it runs right away like before.
+export std::shared_future<void> compile_pipelines(std::string name, vk::PipelineCache pipelineCache,
+    std::function<void(vk::PipelineCache)> build)
+{
+    pipeline_compiler* compiler = pipeline_compiler::active();
+    if(compiler && (!pipelineCache || pipelineCache == compiler->cache())) {
+        return compiler->submit(std::move(name), std::move(build));
+    }
+    std::promise<void> done;
+    build(pipelineCache);
+    done.set_value();
+    return done.get_future().share();
+}
+
+}
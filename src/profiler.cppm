@@ -0,0 +1,529 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+export module dreamrender:profiler;
+
+import :utils;
+
+import spdlog;
+import vulkan_hpp;
+
+namespace dreamrender {
+
+// Rolling distribution of a per-frame duration, in milliseconds.
+export struct frame_statistics {
+    std::size_t samples = 0;
+    double average = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+export struct profiler_config {
+    // Timestamp zones per frame, each one takes two queries.
+    unsigned int max_gpu_zones = 1024;
+    // Frames kept for the rolling statistics.
+    std::size_t history = 600;
+    // Events kept for the trace export, the oldest ones are dropped first.
+    std::size_t max_trace_events = 1 << 20;
+};
+
+// Collects CPU zones from any thread and GPU timestamp zones recorded into the frame's
+// command buffers. Every frame (swapchain image) has its own query pool, which is only
+// read back once the fence of its previous use has been waited on, so reading never stalls.
+//
+// Zone names are not copied and must outlive the profiler, string literals are expected.
+export class profiler {
+    public:
+        using clock = std::chrono::steady_clock;
+        static constexpr uint32_t invalid_zone = UINT32_MAX;
+
+        // GPU zones need timestamp support on the graphics queue and hostQueryReset,
+        // without them only CPU zones are collected.
+        profiler(vk::Device device, const vk::PhysicalDeviceProperties& properties, uint32_t timestampValidBits,
+            bool hostQueryReset, profiler_config config = {}) :
+            device(device), config(config), epoch(clock::now()),
+            timestampPeriod(properties.limits.timestampPeriod),
+            timestampMask(timestampValidBits >= 64 ? ~uint64_t{0} : (uint64_t{1} << timestampValidBits) - 1),
+            gpuEnabled(timestampValidBits > 0 && hostQueryReset && config.max_gpu_zones > 0)
+        {
+            if(!gpuEnabled) {
+                spdlog::warn("GPU timestamps are not supported (valid bits: {}, host query reset: {}), only CPU zones will be profiled",
+                    timestampValidBits, hostQueryReset);
+            }
+        }
+        ~profiler() {
+            profiler* self = this;
+            current.compare_exchange_strong(self, nullptr);
+        }
+
+        profiler(const profiler&) = delete;
+        profiler& operator=(const profiler&) = delete;
+
+        // The profiler that the zones of the renderers report to, if any.
+        static profiler* active() {
+            return current.load(std::memory_order_acquire);
+        }
+        static void set_active(profiler* p) {
+            current.store(p, std::memory_order_release);
+        }
+
+        bool gpu_enabled() const {
+            return gpuEnabled;
+        }
+
+        // Must only be called while none of the frames are executing.
+        void set_frame_count(unsigned int frameCount) {
+            slots.clear();
+            slots.resize(frameCount);
+            if(!gpuEnabled) {
+                return;
+            }
+            const uint32_t queryCount = config.max_gpu_zones * 2;
+            for(auto& slot : slots) {
+                slot.pool = device.createQueryPoolUnique(vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, queryCount));
+                debugName(device, slot.pool.get(), "Profiler Query Pool");
+                device.resetQueryPool(slot.pool.get(), 0, queryCount);
+            }
+        }
+
+        // Call once the previous submission of this frame has retired, before anything is recorded for it.
+        void begin_frame(int frame, uint64_t frameNumber) {
+            auto now = clock::now();
+            {
+                std::scoped_lock<std::mutex> l(lock);
+                if(lastFrameStart != clock::time_point{}) {
+                    push_sample(cpuFrameTimes, milliseconds(now - lastFrameStart));
+                }
+            }
+            lastFrameStart = now;
+            currentFrameNumber.store(frameNumber, std::memory_order_relaxed);
+
+            if(frame < 0 || static_cast<std::size_t>(frame) >= slots.size()) {
+                return;
+            }
+            auto& slot = slots[frame];
+            if(slot.pending) {
+                collect(slot);
+            }
+            if(gpuEnabled && slot.queries > 0) {
+                device.resetQueryPool(slot.pool.get(), 0, slot.queries);
+            }
+            slot.zones.clear();
+            slot.queries = 0;
+            slot.openGroup = invalid_zone;
+            slot.lastEnd = invalid_zone;
+            slot.frameNumber = frameNumber;
+            slot.pending = false;
+        }
+        // Call after the frame has been submitted.
+        void end_frame(int frame) {
+            if(frame < 0 || static_cast<std::size_t>(frame) >= slots.size()) {
+                return;
+            }
+            auto& slot = slots[frame];
+            close_gpu_group(frame, slot.openGroup);
+            slot.submitted = clock::now();
+            slot.pending = !slot.zones.empty();
+        }
+
+        // Thread-safe.
+        void record_cpu(std::string_view name, clock::time_point start, clock::time_point end) {
+            std::scoped_lock<std::mutex> l(lock);
+            auto [it, inserted] = threads.try_emplace(std::this_thread::get_id(), static_cast<uint32_t>(threads.size() + 1));
+            push_event(trace_event{
+                .name = name,
+                .thread = it->second,
+                .frame = currentFrameNumber.load(std::memory_order_relaxed),
+                .start = microseconds(start - epoch),
+                .duration = microseconds(end - start),
+            });
+        }
+
+        // GPU zones must be opened and closed on the thread that records the frame,
+        // and only while the command buffer is recording.
+        uint32_t begin_gpu(vk::CommandBuffer cmd, int frame, std::string_view name) {
+            if(!gpuEnabled || frame < 0 || static_cast<std::size_t>(frame) >= slots.size()) {
+                return invalid_zone;
+            }
+            auto& slot = slots[frame];
+            if(slot.queries + 2 > config.max_gpu_zones * 2) {
+                droppedZones.fetch_add(1, std::memory_order_relaxed);
+                return invalid_zone;
+            }
+            const uint32_t query = slot.queries;
+            slot.queries += 2;
+            cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.pool.get(), query);
+            slot.zones.push_back(gpu_zone_record{name, query, invalid_zone});
+            return static_cast<uint32_t>(slot.zones.size() - 1);
+        }
+        void end_gpu(vk::CommandBuffer cmd, int frame, uint32_t zone) {
+            if(zone == invalid_zone || frame < 0 || static_cast<std::size_t>(frame) >= slots.size()) {
+                return;
+            }
+            auto& slot = slots[frame];
+            if(zone >= slot.zones.size()) {
+                return;
+            }
+            auto& record = slot.zones[zone];
+            cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, slot.pool.get(), record.begin + 1);
+            record.end = record.begin + 1;
+            slot.lastEnd = record.end;
+        }
+
+        // A group only writes its start timestamp and ends with the last zone closed inside it,
+        // so it may be closed after the command buffer has been ended.
+        // Opening a group closes the previous one of the same frame.
+        uint32_t begin_gpu_group(vk::CommandBuffer cmd, int frame, std::string_view name) {
+            if(!gpuEnabled || frame < 0 || static_cast<std::size_t>(frame) >= slots.size()) {
+                return invalid_zone;
+            }
+            close_gpu_group(frame, slots[frame].openGroup);
+            uint32_t zone = begin_gpu(cmd, frame, name);
+            slots[frame].openGroup = zone;
+            slots[frame].lastEnd = invalid_zone;
+            return zone;
+        }
+        void close_gpu_group(int frame, uint32_t zone) {
+            if(zone == invalid_zone || frame < 0 || static_cast<std::size_t>(frame) >= slots.size()) {
+                return;
+            }
+            auto& slot = slots[frame];
+            if(slot.openGroup != zone) {
+                return;
+            }
+            slot.zones[zone].end = slot.lastEnd;
+            slot.openGroup = invalid_zone;
+        }
+
+        // Time between the starts of consecutive frames.
+        frame_statistics cpu_frame_statistics() const {
+            std::scoped_lock<std::mutex> l(lock);
+            return statistics(cpuFrameTimes);
+        }
+        // Time from the first to the last GPU timestamp of a frame.
+        frame_statistics gpu_frame_statistics() const {
+            std::scoped_lock<std::mutex> l(lock);
+            return statistics(gpuFrameTimes);
+        }
+        // Total GPU time per zone name and frame, over the frames in which the zone appeared.
+        std::map<std::string, frame_statistics> gpu_zone_statistics() const {
+            std::scoped_lock<std::mutex> l(lock);
+            std::map<std::string, frame_statistics> result;
+            for(const auto& [name, samples] : zoneTimes) {
+                result.emplace(std::string(name), statistics(samples));
+            }
+            return result;
+        }
+        uint64_t dropped_gpu_zones() const {
+            return droppedZones.load(std::memory_order_relaxed);
+        }
+        // Starts the rolling statistics over, for example after a warmup. The trace is kept.
+        void reset_statistics() {
+            std::scoped_lock<std::mutex> l(lock);
+            cpuFrameTimes.clear();
+            gpuFrameTimes.clear();
+            zoneTimes.clear();
+            lastFrameStart = {};
+            droppedZones.store(0, std::memory_order_relaxed);
+        }
+
+        // Chrome trace event format, viewable in chrome://tracing or Perfetto.
+        // GPU zones are placed relative to the submission of their frame, their durations are exact.
+        void write_chrome_trace(std::ostream& out) const {
+            std::scoped_lock<std::mutex> l(lock);
+            out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            out << R"({"name":"thread_name","ph":"M","pid":1,"tid":0,"args":{"name":"GPU"}})";
+            for(const auto& [id, index] : threads) {
+                out << std::format(",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"CPU {}\"}}}}", index, index);
+            }
+            for(const auto& e : events) {
+                out << ",\n{\"name\":";
+                write_json_string(out, e.name);
+                out << std::format(",\"cat\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"frame\":{}}}}}",
+                    e.thread == 0 ? "gpu" : "cpu", e.thread, e.start, e.duration, e.frame);
+            }
+            out << "\n]}\n";
+        }
+        void save_chrome_trace(const std::filesystem::path& path) const {
+            if(path.has_parent_path() && !std::filesystem::exists(path.parent_path())) {
+                std::filesystem::create_directories(path.parent_path());
+            }
+            std::ofstream out(path);
+            if(!out) {
+                throw std::runtime_error("Failed to open trace file: " + path.string());
+            }
+            write_chrome_trace(out);
+            spdlog::info("Saved profiler trace to {}", path.string());
+        }
+    private:
+        struct gpu_zone_record {
+            std::string_view name;
+            uint32_t begin;
+            uint32_t end;
+        };
+        struct frame_slot {
+            vk::UniqueQueryPool pool;
+            std::vector<gpu_zone_record> zones;
+            uint32_t queries = 0;
+            uint32_t openGroup = invalid_zone;
+            uint32_t lastEnd = invalid_zone;
+            uint64_t frameNumber = 0;
+            clock::time_point submitted;
+            bool pending = false;
+        };
+        struct trace_event {
+            std::string_view name;
+            uint32_t thread;
+            uint64_t frame;
+            double start;
+            double duration;
+        };
+
+        static inline std::atomic<profiler*> current = nullptr;
+
+        vk::Device device;
+        profiler_config config;
+        clock::time_point epoch;
+        float timestampPeriod;
+        uint64_t timestampMask;
+        bool gpuEnabled;
+
+        std::vector<frame_slot> slots;
+        std::vector<uint64_t> results;
+        clock::time_point lastFrameStart{};
+        std::atomic<uint64_t> currentFrameNumber = 0;
+        std::atomic<uint64_t> droppedZones = 0;
+
+        mutable std::mutex lock;
+        std::deque<double> cpuFrameTimes;
+        std::deque<double> gpuFrameTimes;
+        std::map<std::string_view, std::deque<double>> zoneTimes;
+        std::deque<trace_event> events;
+        std::map<std::thread::id, uint32_t> threads;
+
+        static double milliseconds(clock::duration d) {
+            return std::chrono::duration<double, std::milli>(d).count();
+        }
+        static double microseconds(clock::duration d) {
+            return std::chrono::duration<double, std::micro>(d).count();
+        }
+
+        void push_sample(std::deque<double>& samples, double value) {
+            samples.push_back(value);
+            while(samples.size() > config.history) {
+                samples.pop_front();
+            }
+        }
+        void push_event(const trace_event& e) {
+            if(config.max_trace_events == 0) {
+                return;
+            }
+            if(events.size() >= config.max_trace_events) {
+                events.pop_front();
+            }
+            events.push_back(e);
+        }
+
+        // Nearest-rank percentiles.
+        static frame_statistics statistics(const std::deque<double>& samples) {
+            frame_statistics s{};
+            if(samples.empty()) {
+                return s;
+            }
+            std::vector<double> sorted(samples.begin(), samples.end());
+            std::ranges::sort(sorted);
+            auto percentile = [&](double p) {
+                std::size_t rank = static_cast<std::size_t>(std::ceil(p * sorted.size()));
+                return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+            };
+            s.samples = sorted.size();
+            double sum = 0.0;
+            for(double v : sorted) {
+                sum += v;
+            }
+            s.average = sum / sorted.size();
+            s.p50 = percentile(0.50);
+            s.p95 = percentile(0.95);
+            s.p99 = percentile(0.99);
+            s.max = sorted.back();
+            return s;
+        }
+
+        // The frame's fence has been waited on, so all results should be available.
+        // Queries that are not are skipped instead of waited for.
+        void collect(frame_slot& slot) {
+            slot.pending = false;
+            if(slot.queries == 0) {
+                return;
+            }
+            results.resize(static_cast<std::size_t>(slot.queries) * 2);
+            vk::Result r = device.getQueryPoolResults(slot.pool.get(), 0, slot.queries,
+                results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t),
+                vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+            if(r != vk::Result::eSuccess && r != vk::Result::eNotReady) {
+                spdlog::warn("Failed to read GPU timestamps of frame {}: {}", slot.frameNumber, vk::to_string(r));
+                return;
+            }
+
+            struct resolved {
+                std::string_view name;
+                uint64_t begin;
+                uint64_t end;
+            };
+            std::vector<resolved> zones;
+            zones.reserve(slot.zones.size());
+            uint64_t first = UINT64_MAX, last = 0;
+            for(const auto& z : slot.zones) {
+                if(z.end == invalid_zone || results[2*z.begin + 1] == 0 || results[2*z.end + 1] == 0) {
+                    continue;
+                }
+                uint64_t begin = results[2*z.begin] & timestampMask;
+                uint64_t end = results[2*z.end] & timestampMask;
+                if(end < begin) {
+                    continue;
+                }
+                zones.push_back(resolved{z.name, begin, end});
+                first = std::min(first, begin);
+                last = std::max(last, end);
+            }
+            if(zones.empty()) {
+                return;
+            }
+
+            auto ticks_ms = [this](uint64_t ticks) {
+                return static_cast<double>(ticks) * timestampPeriod / 1e6;
+            };
+            std::map<std::string_view, double> totals;
+            for(const auto& z : zones) {
+                totals[z.name] += ticks_ms(z.end - z.begin);
+            }
+
+            std::scoped_lock<std::mutex> l(lock);
+            push_sample(gpuFrameTimes, ticks_ms(last - first));
+            for(const auto& [name, total] : totals) {
+                push_sample(zoneTimes[name], total);
+            }
+            const double base = microseconds(slot.submitted - epoch);
+            for(const auto& z : zones) {
+                push_event(trace_event{
+                    .name = z.name,
+                    .thread = 0,
+                    .frame = slot.frameNumber,
+                    .start = base + ticks_ms(z.begin - first) * 1e3,
+                    .duration = ticks_ms(z.end - z.begin) * 1e3,
+                });
+            }
+        }
+
+        static void write_json_string(std::ostream& out, std::string_view s) {
+            out << '"';
+            for(char c : s) {
+                switch(c) {
+                    case '"': out << "\\\""; break;
+                    case '\\': out << "\\\\"; break;
+                    case '\n': out << "\\n"; break;
+                    case '\t': out << "\\t"; break;
+                    default:
+                        if(static_cast<unsigned char>(c) < 0x20) {
+                            out << std::format("\\u{:04x}", static_cast<unsigned int>(c));
+                        } else {
+                            out << c;
+                        }
+                }
+            }
+            out << '"';
+        }
+};
+
+// Measures the enclosing scope on the CPU, if a profiler is active.
+export class cpu_zone {
+    public:
+        explicit cpu_zone(std::string_view name) : owner(profiler::active()), name(name) {
+            if(owner) {
+                start = profiler::clock::now();
+            }
+        }
+        ~cpu_zone() {
+            if(owner) {
+                owner->record_cpu(name, start, profiler::clock::now());
+            }
+        }
+        cpu_zone(const cpu_zone&) = delete;
+        cpu_zone& operator=(const cpu_zone&) = delete;
+    private:
+        profiler* owner;
+        std::string_view name;
+        profiler::clock::time_point start;
+};
+
+// Measures the GPU work recorded into cmd within the enclosing scope, if a profiler is active.
+// Must be destroyed before the command buffer is ended.
+export class gpu_zone {
+    public:
+        gpu_zone(vk::CommandBuffer cmd, int frame, std::string_view name) : owner(profiler::active()), cmd(cmd), frame(frame) {
+            if(owner) {
+                zone = owner->begin_gpu(cmd, frame, name);
+            }
+        }
+        ~gpu_zone() {
+            if(owner) {
+                owner->end_gpu(cmd, frame, zone);
+            }
+        }
+        gpu_zone(const gpu_zone&) = delete;
+        gpu_zone& operator=(const gpu_zone&) = delete;
+    private:
+        profiler* owner;
+        vk::CommandBuffer cmd;
+        int frame;
+        uint32_t zone = profiler::invalid_zone;
+};
+
+// Groups the GPU zones opened during its lifetime, see profiler::begin_gpu_group.
+// Unlike gpu_zone it may outlive the recording of the command buffer.
+export class gpu_group {
+    public:
+        // Nothing is recorded without a command buffer, e.g. for a gui_renderer that only measures.
+        gpu_group(vk::CommandBuffer cmd, int frame, std::string_view name) : owner(cmd ? profiler::active() : nullptr), frame(frame) {
+            if(owner) {
+                zone = owner->begin_gpu_group(cmd, frame, name);
+            }
+        }
+        ~gpu_group() {
+            if(owner) {
+                owner->close_gpu_group(frame, zone);
+            }
+        }
+        gpu_group(const gpu_group&) = delete;
+        gpu_group& operator=(const gpu_group&) = delete;
+    private:
+        profiler* owner;
+        int frame;
+        uint32_t zone = profiler::invalid_zone;
+};
+
+}
@@ -9,21 +9,40 @@ module;
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <cctype>
+#include <cmath>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <iterator>
 #include <istream>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <span>
 #include <sstream>
+#include <streambuf>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#ifdef DREAMRENDER_USE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
 module dreamrender;
 
+import :asset_pack;
 import :debug;
+import :job_system;
+import :mesh_optimizer;
+import :model;
 import :resource_loader;
 import :texture;
 import :utils;
@@ -36,8 +55,6 @@ import vma;
 
 namespace dreamrender {
 
-    constexpr unsigned int safe_size = 256;
-
     static void upload_to_allocation(vma::Allocator allocator, vma::Allocation allocation, const void* src, vk::DeviceSize size) {
         if(size == 0) {
             return;
@@ -49,8 +66,156 @@ namespace dreamrender {
         allocator.unmapMemory(allocation);
     }
 
+    // Downscales an RGBA image with an area filter: every destination pixel is the average of the
+    // source pixels it covers, weighted by their coverage. Rows are filtered first, then columns,
+    // with the column pass written as plain loops over whole rows so that it vectorizes.
+    // Both passes are split into bands of rows on the job system.
+    static void area_resize(const uint8_t* src, uint32_t width, uint32_t height, std::size_t pitch,
+        uint8_t* dst, uint32_t dstWidth, uint32_t dstHeight)
+    {
+        struct contribution {
+            uint32_t first;
+            uint32_t count;
+            std::size_t weights;
+        };
+        auto build = [](uint32_t size, uint32_t dstSize, std::vector<contribution>& contributions, std::vector<float>& weights) {
+            const double scale = static_cast<double>(size) / dstSize;
+            contributions.resize(dstSize);
+            for(uint32_t i = 0; i < dstSize; i++) {
+                const double start = i * scale;
+                const double end = std::min<double>(size, (i + 1) * scale);
+                const uint32_t first = static_cast<uint32_t>(start);
+                const uint32_t last = std::min(size, static_cast<uint32_t>(std::ceil(end)));
+                contributions[i] = {first, last - first, weights.size()};
+                for(uint32_t j = first; j < last; j++) {
+                    const double overlap = std::min<double>(j + 1, end) - std::max<double>(j, start);
+                    weights.push_back(static_cast<float>(overlap / (end - start)));
+                }
+            }
+        };
+        std::vector<contribution> columns, rows;
+        std::vector<float> columnWeights, rowWeights;
+        build(width, dstWidth, columns, columnWeights);
+        build(height, dstHeight, rows, rowWeights);
+
+        const std::size_t rowSize = static_cast<std::size_t>(dstWidth) * 4;
+        std::vector<float> horizontal(rowSize * height);
+        parallel_for(0, height, 64, [&](std::size_t first, std::size_t last) {
+            for(std::size_t y = first; y < last; y++) {
+                const uint8_t* in = src + y * pitch;
+                float* out = horizontal.data() + y * rowSize;
+                for(uint32_t x = 0; x < dstWidth; x++) {
+                    const contribution& c = columns[x];
+                    float acc[4] = {};
+                    for(uint32_t k = 0; k < c.count; k++) {
+                        const float w = columnWeights[c.weights + k];
+                        const uint8_t* p = in + static_cast<std::size_t>(c.first + k) * 4;
+                        for(int ch = 0; ch < 4; ch++) {
+                            acc[ch] += w * p[ch];
+                        }
+                    }
+                    for(int ch = 0; ch < 4; ch++) {
+                        out[x * 4 + ch] = acc[ch];
+                    }
+                }
+            }
+        });
+
+        parallel_for(0, dstHeight, 32, [&](std::size_t first, std::size_t last) {
+            std::vector<float> acc(rowSize);
+            for(std::size_t y = first; y < last; y++) {
+                const contribution& c = rows[y];
+                std::ranges::fill(acc, 0.0f);
+                for(uint32_t k = 0; k < c.count; k++) {
+                    const float w = rowWeights[c.weights + k];
+                    const float* in = horizontal.data() + (c.first + k) * rowSize;
+                    for(std::size_t i = 0; i < rowSize; i++) {
+                        acc[i] += w * in[i];
+                    }
+                }
+                uint8_t* out = dst + y * rowSize;
+                for(std::size_t i = 0; i < rowSize; i++) {
+                    out[i] = static_cast<uint8_t>(std::clamp(acc[i] + 0.5f, 0.0f, 255.0f));
+                }
+            }
+        });
+    }
+
+#ifdef DREAMRENDER_USE_LIBJPEG
+    static bool is_jpeg(std::span<const uint8_t> data) {
+        return data.size() > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+    }
+
+    struct jpeg_error_handler {
+        jpeg_error_mgr mgr;
+        std::jmp_buf jump;
+        char message[JMSG_LENGTH_MAX];
+    };
+
+    // Decodes a JPEG to RGBA. DCT scaling (1/2, 1/4 or 1/8) skips most of the work for images
+    // that are much larger than the hint, the result is still at least as large as the hint.
+    static bool decode_jpeg(std::span<const uint8_t> data, const texture_size_hint& hint,
+        std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height, std::string& error)
+    {
+        // libjpeg reports errors by longjmp, so nothing with a destructor may be created below.
+        jpeg_decompress_struct cinfo{};
+        jpeg_error_handler handler{};
+        cinfo.err = jpeg_std_error(&handler.mgr);
+        handler.mgr.error_exit = [](j_common_ptr c) {
+            auto* h = reinterpret_cast<jpeg_error_handler*>(c->err);
+            (*c->err->format_message)(c, h->message);
+            std::longjmp(h->jump, 1);
+        };
+        if(setjmp(handler.jump)) {
+            jpeg_destroy_decompress(&cinfo);
+            error = handler.message;
+            return false;
+        }
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data.data()), static_cast<unsigned long>(data.size()));
+        jpeg_read_header(&cinfo, TRUE);
+
+        auto [targetWidth, targetHeight] = hint.fit(cinfo.image_width, cinfo.image_height);
+        unsigned int denom = 1;
+        while(denom < 8 && cinfo.image_width / (denom * 2) >= targetWidth && cinfo.image_height / (denom * 2) >= targetHeight) {
+            denom *= 2;
+        }
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+#ifdef JCS_EXTENSIONS
+        cinfo.out_color_space = JCS_EXT_RGBA;
+#else
+        cinfo.out_color_space = JCS_RGB;
+#endif
+        jpeg_start_decompress(&cinfo);
+
+        width = cinfo.output_width;
+        height = cinfo.output_height;
+        const int components = cinfo.output_components;
+        pixels.resize(static_cast<std::size_t>(width) * height * 4);
+        while(cinfo.output_scanline < cinfo.output_height) {
+            uint8_t* row = pixels.data() + static_cast<std::size_t>(cinfo.output_scanline) * width * 4;
+            JSAMPROW rows[1] = {row};
+            jpeg_read_scanlines(&cinfo, rows, 1);
+            if(components == 3) {
+                for(uint32_t x = width; x-- > 0;) {
+                    row[x * 4 + 3] = 0xFF;
+                    row[x * 4 + 2] = row[x * 3 + 2];
+                    row[x * 4 + 1] = row[x * 3 + 1];
+                    row[x * 4 + 0] = row[x * 3 + 0];
+                }
+            }
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return true;
+    }
+#endif
+
     std::string LoadTask::source_name() const {
-        if(std::holds_alternative<std::filesystem::path>(src))
+        if(pack)
+            return std::format("{} in {}", packedName, pack->path().string());
+        else if(std::holds_alternative<std::filesystem::path>(src))
             return std::get<std::filesystem::path>(src).string();
         else if(std::holds_alternative<LoaderFunction>(src))
             return "dynamic data";
@@ -69,44 +234,109 @@ namespace dreamrender {
         return true;
     }
 
-    bool load_texture(
-        int index, LoadTask& task, std::mutex& lock,
-        vk::Device device, vma::Allocator allocator, vma::Allocation allocation,
-        vk::CommandBuffer commandBuffer,
-        uint8_t* decodeBuffer, size_t stagingSize, vk::Buffer stagingBuffer)
+    struct decoded_resource {
+        // Textures: tightly packed RGBA, or whatever a LoaderFunction wrote.
+        std::vector<uint8_t> pixels;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // The data fills an image that already exists.
+        bool dynamic = false;
+
+        std::vector<vertex_data> vertices;
+        std::vector<packed_vertex_data> packedVertices;
+        std::vector<uint32_t> indices;
+        glm::vec3 min{};
+        glm::vec3 max{};
+    };
+
+    static void decode_texture(LoadTask& task, size_t stagingSize, decoded_resource& out)
     {
-        std::string name = task.source_name();
-        texture* tex = std::get<texture*>(task.dst);
+        const std::string name = task.source_name();
+        const texture* tex = std::get<texture*>(task.dst);
         if(std::holds_alternative<std::filesystem::path>(task.src) ||
             (std::holds_alternative<LoadDataView>(task.src) && std::get<LoadDataView>(task.src).type != "RAW"))
         {
-            sdl::unique_surface surface;
-            auto upload_transparent_fallback = [&]() {
-                if(!check_state(index, task)) {
-                    return false;
+            auto transparent_fallback = [&]() {
+                out.width = 1;
+                out.height = 1;
+                out.pixels = {0xFF, 0xFF, 0xFF, 0x00};
+            };
+
+            // Scales the image down to the size hint, or to fit into the staging buffer.
+            // Textures that already have an image get the image at exactly that size.
+            auto fit_rgba = [&](const uint8_t* pixels, uint32_t width, uint32_t height, std::size_t pitch) {
+                auto [w, h] = tex->imageView ? std::pair<uint32_t, uint32_t>(tex->width, tex->height) : task.hint.fit(width, height);
+                if(static_cast<size_t>(w) * h * 4 > stagingSize) {
+                    const double scale = std::sqrt(static_cast<double>(stagingSize / 4) / (static_cast<double>(w) * h));
+                    spdlog::warn("[Resource Loader] Image {} is too large ({}x{}), scaling it to {}x{}", name, w, h,
+                        static_cast<uint32_t>(w * scale), static_cast<uint32_t>(h * scale));
+                    w = std::max(1u, static_cast<uint32_t>(w * scale));
+                    h = std::max(1u, static_cast<uint32_t>(h * scale));
+                }
+
+                out.width = w;
+                out.height = h;
+                out.pixels.resize(static_cast<size_t>(w) * h * 4);
+                if(w != width || h != height) {
+                    area_resize(pixels, width, height, pitch, out.pixels.data(), w, h);
+                } else if(pitch != static_cast<size_t>(width) * 4) {
+                    for(uint32_t y = 0; y < height; y++) {
+                        std::memcpy(out.pixels.data() + static_cast<size_t>(y) * width * 4, pixels + y * pitch, static_cast<size_t>(width) * 4);
+                    }
                 } else {
-                    std::scoped_lock<std::mutex> l(lock);
-                    tex->create_image(1, 1);
+                    std::memcpy(out.pixels.data(), pixels, out.pixels.size());
                 }
+            };
 
-                const size_t uploadSize = static_cast<size_t>(tex->width) * static_cast<size_t>(tex->height) * 4;
-                if(uploadSize == 0 || uploadSize > stagingSize) {
-                    spdlog::error("[Resource Loader {}] Cannot create fallback for {}x{} texture {}", index,
-                        tex->width, tex->height, name);
-                    return false;
+            if(std::holds_alternative<LoadDataView>(task.src) && std::get<LoadDataView>(task.src).type == "RGBA") {
+                const auto& data = std::get<LoadDataView>(task.src);
+                if(data.width == 0 || data.height == 0 || data.data.size() < static_cast<size_t>(data.width) * data.height * 4) {
+                    spdlog::error("[Resource Loader] Decoded image {} is smaller than {}x{}; using transparent fallback", name, data.width, data.height);
+                    transparent_fallback();
+                    return;
                 }
+                fit_rgba(data.data.data(), data.width, data.height, static_cast<size_t>(data.width) * 4);
+                return;
+            }
 
-                std::fill(decodeBuffer, decodeBuffer + uploadSize, 0x00);
-                for(size_t i = 0; i + 3 < uploadSize; i += 4) {
-                    decodeBuffer[i + 0] = 0xFF;
-                    decodeBuffer[i + 1] = 0xFF;
-                    decodeBuffer[i + 2] = 0xFF;
-                    decodeBuffer[i + 3] = 0x00;
+#ifdef DREAMRENDER_USE_LIBJPEG
+            if(!task.hint.empty()) {
+                std::vector<uint8_t> file;
+                std::span<const uint8_t> data;
+                if(std::holds_alternative<std::filesystem::path>(task.src)) {
+                    const auto& path = std::get<std::filesystem::path>(task.src);
+                    std::string ext = path.extension().string();
+                    std::ranges::transform(ext, ext.begin(), [](unsigned char c){ return std::tolower(c); });
+                    if(ext == ".jpg" || ext == ".jpeg") {
+                        std::ifstream in(path, std::ios::binary);
+                        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                        data = file;
+                    }
+                } else {
+                    data = std::get<LoadDataView>(task.src).data;
                 }
-                upload_to_allocation(allocator, allocation, decodeBuffer, uploadSize);
-                return true;
-            };
 
+                if(is_jpeg(data)) {
+                    std::vector<uint8_t> pixels;
+                    uint32_t width = 0, height = 0;
+                    std::string error;
+                    if(decode_jpeg(data, task.hint, pixels, width, height, error)) {
+                        auto [w, h] = tex->imageView ? std::pair<uint32_t, uint32_t>(tex->width, tex->height) : task.hint.fit(width, height);
+                        if(w == width && h == height && pixels.size() <= stagingSize) {
+                            out.width = width;
+                            out.height = height;
+                            out.pixels = std::move(pixels);
+                        } else {
+                            fit_rgba(pixels.data(), width, height, static_cast<size_t>(width) * 4);
+                        }
+                        return;
+                    }
+                    spdlog::warn("[Resource Loader] Failed to decode JPEG {} ({}), trying SDL_image", name, error);
+                }
+            }
+#endif
+
+            sdl::unique_surface surface;
             if(std::holds_alternative<std::filesystem::path>(task.src))
             {
                 const auto& path = std::get<std::filesystem::path>(task.src);
@@ -120,77 +350,70 @@ namespace dreamrender {
             }
             if(!surface)
             {
-                spdlog::error("[Resource Loader {}] Failed to load image {}; using transparent fallback", index, name);
-                if(!upload_transparent_fallback())
-                    return false;
+                spdlog::error("[Resource Loader] Failed to load image {}; using transparent fallback", name);
+                transparent_fallback();
+                return;
             }
-            else
+            if(surface->format->format != sdl::PixelFormatEnumVales::RGBA32)
             {
-                bool fallbackUploaded = false;
-                if(surface->format->format != sdl::PixelFormatEnumVales::RGBA32)
-                {
-                    sdl::unique_surface newSurface = sdl::unique_surface{sdl::ConvertSurfaceFormat(surface.get(), sdl::PixelFormatEnumVales::RGBA32, 0)};
-                    if(!newSurface) {
-                        spdlog::error("[Resource Loader {}] Failed to convert image {}; using transparent fallback", index, name);
-                        if(!upload_transparent_fallback())
-                            return false;
-                        fallbackUploaded = true;
-                    } else {
-                        surface = std::move(newSurface);
-                    }
-                }
-
-                if(!fallbackUploaded)
-                {
-                    std::size_t size = surface->w * surface->h * surface->format->BytesPerPixel;
-                    if(size > stagingSize)
-                    {
-                        spdlog::warn("[Resource Loader {}] Image {} is too large ({} bytes), scaling it to {}x{}", index, name, size,
-                            safe_size, safe_size);
-                        sdl::unique_surface newSurface = sdl::unique_surface{sdl::CreateRGBSurface(0, safe_size, safe_size, 32, 0, 0, 0, 0)};
-                        if(!newSurface || sdl::BlitScaled(surface.get(), nullptr, newSurface.get(), nullptr) != 0) {
-                            spdlog::error("[Resource Loader {}] Failed to scale image {}; using transparent fallback", index, name);
-                            if(!upload_transparent_fallback())
-                                return false;
-                            fallbackUploaded = true;
-                        } else {
-                            surface = std::move(newSurface);
-                            size = surface->w * surface->h * surface->format->BytesPerPixel;
-                            assert(size <= stagingSize);
-                        }
-                    }
-
-                    if(!fallbackUploaded)
-                    {
-                        if(!check_state(index, task)) {
-                            return false;
-                        } else {
-                            std::scoped_lock<std::mutex> l(lock);
-                            tex->create_image(surface->w, surface->h);
-                        }
-
-                        sdl::surface_lock lock{surface.get()};
-                        upload_to_allocation(allocator, allocation, lock.pixels(), surface->w * surface->h * 4);
-                    }
+                sdl::unique_surface newSurface = sdl::unique_surface{sdl::ConvertSurfaceFormat(surface.get(), sdl::PixelFormatEnumVales::RGBA32, 0)};
+                if(!newSurface) {
+                    spdlog::error("[Resource Loader] Failed to convert image {}; using transparent fallback", name);
+                    transparent_fallback();
+                    return;
                 }
+                surface = std::move(newSurface);
             }
+
+            sdl::surface_lock surfaceLock{surface.get()};
+            fit_rgba(static_cast<const uint8_t*>(surfaceLock.pixels()),
+                static_cast<uint32_t>(surface->w), static_cast<uint32_t>(surface->h), static_cast<size_t>(surface->pitch));
         }
         else
         {
-            name = "dynamic data";
+            out.dynamic = true;
             size_t uploadSize = stagingSize;
             if(tex->width > 0 && tex->height > 0) {
                 uploadSize = std::min(uploadSize, static_cast<size_t>(tex->width) * static_cast<size_t>(tex->height) * 4);
             }
 
-            std::fill(decodeBuffer, decodeBuffer + uploadSize, 0x00);
-            std::get<LoaderFunction>(task.src)(decodeBuffer, stagingSize);
-            upload_to_allocation(allocator, allocation, decodeBuffer, uploadSize);
+            if(std::holds_alternative<LoaderFunction>(task.src)) {
+                // The function may use the whole staging size.
+                out.pixels.resize(stagingSize);
+                std::get<LoaderFunction>(task.src)(out.pixels.data(), stagingSize);
+                out.pixels.resize(uploadSize);
+                // It may wait for an upload thread a while, so it should not keep the whole staging size.
+                out.pixels.shrink_to_fit();
+            } else {
+                const auto& data = std::get<LoadDataView>(task.src).data;
+                out.pixels.assign(data.begin(), data.begin() + std::min(uploadSize, data.size()));
+                out.pixels.resize(uploadSize);
+            }
+        }
+    }
+
+    bool load_texture(
+        int index, LoadTask& task, decoded_resource& decoded, std::mutex& lock,
+        vk::Device device, vma::Allocator allocator, vma::Allocation allocation,
+        vk::CommandBuffer commandBuffer,
+        size_t stagingSize, vk::Buffer stagingBuffer)
+    {
+        std::string name = decoded.dynamic ? "dynamic data" : task.source_name();
+        texture* tex = std::get<texture*>(task.dst);
+        if(decoded.pixels.size() > stagingSize) {
+            spdlog::error("[Resource Loader {}] Texture {} is too large for staging buffer ({} > {} bytes)",
+                index, name, decoded.pixels.size(), stagingSize);
+            return false;
+        }
 
-            if(!check_state(index, task)) {
-                return false;
-            } // no need to create the image, because it already needs to be created
+        if(!check_state(index, task)) {
+            return false;
         }
+        if(!decoded.dynamic) {
+            std::scoped_lock<std::mutex> l(lock);
+            tex->create_image(static_cast<int>(decoded.width), static_cast<int>(decoded.height));
+        } // dynamic data fills an image that already exists
+        upload_to_allocation(allocator, allocation, decoded.pixels.data(), decoded.pixels.size());
 
         commandBuffer.begin(vk::CommandBufferBeginInfo());
 
@@ -291,26 +514,79 @@ namespace dreamrender {
         }
     }
 
+    // Reads a LoadDataView in place.
+    struct span_streambuf : std::streambuf {
+        explicit span_streambuf(std::span<const uint8_t> data) {
+            char* p = const_cast<char*>(reinterpret_cast<const char*>(data.data()));
+            setg(p, p, p + data.size());
+        }
+    };
+
+    static void decode_model(const LoadTask& task, decoded_resource& out)
+    {
+        if(std::holds_alternative<LoadDataView>(task.src)) {
+            span_streambuf buffer(std::get<LoadDataView>(task.src).data);
+            std::istream obj(&buffer);
+            load_obj(obj, out.vertices, out.indices);
+        } else {
+            std::ifstream obj(std::get<std::filesystem::path>(task.src));
+            load_obj(obj, out.vertices, out.indices);
+        }
+
+        const model_load_options& options = task.modelOptions;
+        if(options.optimize) {
+            const float before = average_cache_miss_ratio(out.indices, out.vertices.size());
+            optimize_vertex_cache(out.indices, out.vertices.size());
+            optimize_vertex_fetch(out.vertices, out.indices);
+            spdlog::debug("[Resource Loader] Optimized model {}: ACMR {:.3f} -> {:.3f}",
+                task.source_name(), before, average_cache_miss_ratio(out.indices, out.vertices.size()));
+        }
+        if(options.format == vertex_format::packed) {
+            out.min = glm::vec3(std::numeric_limits<float>::max());
+            out.max = glm::vec3(std::numeric_limits<float>::lowest());
+            for(const auto& v : out.vertices) {
+                out.min = glm::min(out.min, v.position);
+                out.max = glm::max(out.max, v.position);
+            }
+            out.packedVertices = pack_vertices(out.vertices, out.min, out.max);
+            out.vertices.clear();
+        }
+    }
+
+    std::shared_ptr<decoded_resource> decode_resource(LoadTask& task, size_t stagingSize)
+    {
+        auto decoded = std::make_shared<decoded_resource>();
+        if(task.type == LoadType::Texture) {
+            decode_texture(task, stagingSize, *decoded);
+        } else if(task.type == LoadType::Model) {
+            decode_model(task, *decoded);
+        }
+        return decoded;
+    }
+
     bool load_model(
-        int index, LoadTask& task,
+        int index, LoadTask& task, decoded_resource& decoded,
         vk::Device device, vma::Allocator allocator, vma::Allocation allocation,
         vk::CommandBuffer commandBuffer,
         size_t stagingSize, vk::Buffer stagingBuffer)
     {
-        std::ifstream obj(std::get<std::filesystem::path>(task.src));
-        std::vector<vertex_data> vertices;
-        std::vector<uint32_t> indices;
-        load_obj(obj, vertices, indices);
-
         if(!check_state(index, task)) {
             return false;
         }
 
         abstract_model* mesh = std::get<abstract_model*>(task.dst);
-        mesh->create_buffers(vertices, indices);
+        const std::vector<uint32_t>& indices = decoded.indices;
+        std::span<const std::byte> vertexBytes;
+        if(task.modelOptions.format == vertex_format::packed) {
+            vertexBytes = std::as_bytes(std::span<const packed_vertex_data>(decoded.packedVertices));
+            mesh->create_buffers(decoded.packedVertices, indices, decoded.min, decoded.max);
+        } else {
+            vertexBytes = std::as_bytes(std::span<const vertex_data>(decoded.vertices));
+            mesh->create_buffers(decoded.vertices, indices);
+        }
 
         vk::DeviceSize vertexOffset = 0;
-        vk::DeviceSize vertexSize = vertices.size() * sizeof(vertex_data);
+        vk::DeviceSize vertexSize = vertexBytes.size();
         vk::DeviceSize indexOffset = vertexSize;
         vk::DeviceSize indexSize = indices.size() * sizeof(uint32_t);
         vk::DeviceSize uploadSize = vertexSize + indexSize;
@@ -322,7 +598,7 @@ namespace dreamrender {
 
         void* buf = allocator.mapMemory(allocation);
         if(vertexSize > 0) {
-            std::memcpy(static_cast<uint8_t*>(buf) + vertexOffset, vertices.data(), static_cast<std::size_t>(vertexSize));
+            std::memcpy(static_cast<uint8_t*>(buf) + vertexOffset, vertexBytes.data(), static_cast<std::size_t>(vertexSize));
         }
         if(indexSize > 0) {
             std::memcpy(static_cast<uint8_t*>(buf) + indexOffset, indices.data(), static_cast<std::size_t>(indexSize));
@@ -5,24 +5,32 @@
  */
 module;
 
+#include <algorithm>
 #include <cstdint>
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <exception>
 #include <filesystem>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <span>
 #include <stdexcept>
+#include <string>
 #include <string_view>
 #include <thread>
+#include <utility>
 #include <variant>
 #include <version>
 
 export module dreamrender:resource_loader;
 
+import :asset_pack;
+import :job_system;
+import :memory_tracker;
 import :texture;
 import :model;
 import :utils;
@@ -52,9 +60,44 @@ export using LoaderFunction = std::function<void(uint8_t*, size_t)>;
 export struct LoadDataView {
     std::span<const uint8_t> data;
     std::string type;
+    // Size of decoded images of type "RGBA".
+    uint32_t width = 0;
+    uint32_t height = 0;
 
     LoadDataView(std::span<const uint8_t> data, std::string_view type = "") : data(data), type(type) {}
+    // Decoded, tightly packed RGBA pixels.
+    LoadDataView(std::span<const uint8_t> data, uint32_t width, uint32_t height) : data(data), type("RGBA"), width(width), height(height) {}
 };
+// Largest size an image is decoded at. It is scaled down to fit into the box, preserving its
+// aspect ratio, and never scaled up. Zero leaves a dimension unbounded.
+export struct texture_size_hint {
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    static texture_size_hint max_dimension(uint32_t size) {
+        return {size, size};
+    }
+    bool empty() const {
+        return width == 0 && height == 0;
+    }
+    std::pair<uint32_t, uint32_t> fit(uint32_t w, uint32_t h) const {
+        double scale = 1.0;
+        if(width > 0 && w > width) {
+            scale = std::min(scale, static_cast<double>(width) / w);
+        }
+        if(height > 0 && h > height) {
+            scale = std::min(scale, static_cast<double>(height) / h);
+        }
+        if(scale >= 1.0) {
+            return {w, h};
+        }
+        return {std::max(1u, static_cast<uint32_t>(w * scale + 0.5)), std::max(1u, static_cast<uint32_t>(h * scale + 0.5))};
+    }
+};
+
+// The CPU side of a load (decoded pixels, parsed geometry), see decode_resource.
+struct decoded_resource;
+
 struct LoadTask
 {
     LoadType type;
@@ -63,20 +106,38 @@ struct LoadTask
     std::promise<void> promise;
 
     std::shared_ptr<std::atomic<loading_state>> state = {};
+    texture_size_hint hint = {};
+    model_load_options modelOptions = {};
+
+    std::shared_ptr<decoded_resource> decoded;
+    std::exception_ptr decodeError;
+    // Counted in resource_loader's decodes in flight until an upload thread takes it.
+    bool decodeSlot = false;
+
+    // The pack a path was resolved to, it keeps the data of src alive.
+    std::shared_ptr<const asset_pack> pack;
+    std::string packedName;
 
     std::string source_name() const;
 };
 
+// Reads and decodes the source of a task, without touching the GPU. Runs on the job system.
+std::shared_ptr<decoded_resource> decode_resource(LoadTask& task, size_t stagingSize);
 bool load_model(
-    int index, LoadTask& task,
+    int index, LoadTask& task, decoded_resource& decoded,
     vk::Device device, vma::Allocator allocator, vma::Allocation allocation,
     vk::CommandBuffer commandBuffer,
     size_t stagingSize, vk::Buffer stagingBuffer);
 bool load_texture(
-    int index, LoadTask& task, std::mutex& lock,
+    int index, LoadTask& task, decoded_resource& decoded, std::mutex& lock,
     vk::Device device, vma::Allocator allocator, vma::Allocation allocation,
     vk::CommandBuffer commandBuffer,
-    uint8_t* decodeBuffer, size_t stagingSize, vk::Buffer stagingBuffer);
+    size_t stagingSize, vk::Buffer stagingBuffer);
+
+// Decodes on the active job system and uploads on one thread per transfer queue, which own
+// the queue, a command buffer and a staging buffer each. Without a job system the upload
+// threads decode as well. Only a few decodes per upload thread run ahead of the uploads, so
+// decoded data does not pile up while many resources are queued.
 
 export class resource_loader
 {
@@ -94,6 +155,12 @@ export class resource_loader
         }
 
         ~resource_loader() {
+            {
+                std::scoped_lock<std::mutex> l(lock);
+                stopping = true;
+                decodeBacklog.clear();
+            }
+            decoding.wait();
             {
                 std::scoped_lock<std::mutex> l(lock);
                 quit = true;
@@ -106,86 +173,52 @@ export class resource_loader
             }
         }
 
-        std::future<void> loadTexture(texture* texture, std::filesystem::path path) {
-            std::future<void> f;
-            {
-                std::scoped_lock<std::mutex> l(lock);
-
-                loading_state state = loading_state::none;
-                if(!texture->state->compare_exchange_strong(state, loading_state::queued)) {
-                    throw std::runtime_error("Texture is in invalid state");
-                }
+        // Paths under root are loaded from the pack if it contains them, with the path relative
+        // to root as their name. Packs mounted later are searched first.
+        void mount(std::shared_ptr<const asset_pack> pack, std::filesystem::path root = {}) {
+            std::scoped_lock<std::mutex> l(mountLock);
+            mounts.insert(mounts.begin(), mounted_pack{std::move(pack), root.lexically_normal()});
+        }
 
-                tasks.push(LoadTask{.type = LoadType::Texture, .src = path, .dst = texture, .promise = std::promise<void>(), .state = texture->state});
-                f = tasks.back().promise.get_future();
+        std::future<void> loadTexture(texture* texture, std::filesystem::path path, texture_size_hint hint = {}) {
+            loading_state state = loading_state::none;
+            if(!texture->state->compare_exchange_strong(state, loading_state::queued)) {
+                throw std::runtime_error("Texture is in invalid state");
             }
-            cv.notify_one();
-            return f;
+            LoadTask task{.type = LoadType::Texture, .src = path, .dst = texture, .promise = std::promise<void>(), .state = texture->state, .hint = hint};
+            resolve(task);
+            return enqueue(std::move(task));
         }
         std::future<void> loadTexture(texture* texture, LoaderFunction loader) {
-            std::future<void> f;
-            {
-                std::scoped_lock<std::mutex> l(lock);
-
-                loading_state state = loading_state::none;
-                if(!texture->state->compare_exchange_strong(state, loading_state::queued)) {
-                    throw std::runtime_error("Texture is in invalid state");
-                }
-
-                tasks.push(LoadTask{.type = LoadType::Texture, .src = std::move(loader), .dst = texture, .promise = std::promise<void>(), .state = texture->state});
-                f = tasks.back().promise.get_future();
+            loading_state state = loading_state::none;
+            if(!texture->state->compare_exchange_strong(state, loading_state::queued)) {
+                throw std::runtime_error("Texture is in invalid state");
             }
-            cv.notify_one();
-            return f;
+            return enqueue(LoadTask{.type = LoadType::Texture, .src = std::move(loader), .dst = texture, .promise = std::promise<void>(), .state = texture->state});
         }
-        std::future<void> loadTexture(texture* texture, LoadDataView data) {
-            std::future<void> f;
-            {
-                std::scoped_lock<std::mutex> l(lock);
-
-                loading_state state = loading_state::none;
-                if(!texture->state->compare_exchange_strong(state, loading_state::queued)) {
-                    throw std::runtime_error("Texture is in invalid state");
-                }
-
-                tasks.push(LoadTask{.type = LoadType::Texture, .src = data, .dst = texture, .promise = std::promise<void>(), .state = texture->state});
-                f = tasks.back().promise.get_future();
+        std::future<void> loadTexture(texture* texture, LoadDataView data, texture_size_hint hint = {}) {
+            loading_state state = loading_state::none;
+            if(!texture->state->compare_exchange_strong(state, loading_state::queued)) {
+                throw std::runtime_error("Texture is in invalid state");
             }
-            cv.notify_one();
-            return f;
+            return enqueue(LoadTask{.type = LoadType::Texture, .src = data, .dst = texture, .promise = std::promise<void>(), .state = texture->state, .hint = hint});
         }
 
-        std::future<void> loadModel(abstract_model* model, std::filesystem::path filename) {
-            std::future<void> f;
-            {
-                std::scoped_lock<std::mutex> l(lock);
-
-                loading_state state = loading_state::none;
-                if(!model->state->compare_exchange_strong(state, loading_state::queued)) {
-                    throw std::runtime_error("Model is in invalid state");
-                }
-
-                tasks.push(LoadTask{.type = LoadType::Model, .src = filename, .dst = model, .promise = std::promise<void>(), .state = model->state});
-                f = tasks.back().promise.get_future();
+        std::future<void> loadModel(abstract_model* model, std::filesystem::path filename, model_load_options options = {}) {
+            loading_state state = loading_state::none;
+            if(!model->state->compare_exchange_strong(state, loading_state::queued)) {
+                throw std::runtime_error("Model is in invalid state");
             }
-            cv.notify_one();
-            return f;
+            LoadTask task{.type = LoadType::Model, .src = filename, .dst = model, .promise = std::promise<void>(), .state = model->state, .modelOptions = options};
+            resolve(task);
+            return enqueue(std::move(task));
         }
-        std::future<void> loadModel(abstract_model* model, LoadDataView data) {
-            std::future<void> f;
-            {
-                std::scoped_lock<std::mutex> l(lock);
-
-                loading_state state = loading_state::none;
-                if(!model->state->compare_exchange_strong(state, loading_state::queued)) {
-                    throw std::runtime_error("Model is in invalid state");
-                }
-
-                tasks.push(LoadTask{.type = LoadType::Model, .src = data, .dst = model, .promise = std::promise<void>(), .state = model->state});
-                f = tasks.back().promise.get_future();
+        std::future<void> loadModel(abstract_model* model, LoadDataView data, model_load_options options = {}) {
+            loading_state state = loading_state::none;
+            if(!model->state->compare_exchange_strong(state, loading_state::queued)) {
+                throw std::runtime_error("Model is in invalid state");
             }
-            cv.notify_one();
-            return f;
+            return enqueue(LoadTask{.type = LoadType::Model, .src = data, .dst = model, .promise = std::promise<void>(), .state = model->state, .modelOptions = options});
         }
 
         vk::Device getDevice() const { return device; }
@@ -202,6 +235,106 @@ export class resource_loader
         std::queue<LoadTask> tasks;
         std::condition_variable cv;
         bool quit = false;
+        // Decode jobs that have not handed their task to the upload threads yet.
+        job_counter decoding;
+        // Decoded data waits for an upload thread, so only a few decodes per upload thread may
+        // run ahead of them. The others wait in the backlog. Guarded by lock.
+        constexpr static std::size_t decodes_per_upload_thread = 4;
+        std::size_t decodesInFlight = 0;
+        std::deque<std::shared_ptr<LoadTask>> decodeBacklog;
+        bool stopping = false;
+
+        struct mounted_pack {
+            std::shared_ptr<const asset_pack> pack;
+            std::filesystem::path root;
+        };
+        std::mutex mountLock;
+        std::vector<mounted_pack> mounts;
+
+        // Replaces a path that is in a mounted pack with a view of the pack's mapping, and asks
+        // the OS to read it ahead while the task waits to be decoded.
+        void resolve(LoadTask& task) {
+            const std::filesystem::path path = std::get<std::filesystem::path>(task.src).lexically_normal();
+            std::scoped_lock<std::mutex> l(mountLock);
+            for(const mounted_pack& m : mounts) {
+                std::filesystem::path relative = m.root.empty() ? path : path.lexically_relative(m.root);
+                if(relative.empty() || *relative.begin() == "..") {
+                    continue;
+                }
+                const std::string name = relative.generic_string();
+                const asset_pack::entry* e = m.pack->find(name);
+                if(!e) {
+                    continue;
+                }
+                m.pack->will_need(*e);
+                task.src = e->format() == "RGBA" ?
+                    LoadDataView(m.pack->data(*e), e->width, e->height) :
+                    LoadDataView(m.pack->data(*e), e->format());
+                task.pack = m.pack;
+                task.packedName = name;
+                return;
+            }
+        }
+
+        std::future<void> enqueue(LoadTask task) {
+            std::future<void> f = task.promise.get_future();
+            {
+                std::scoped_lock<std::mutex> l(lock);
+                if(job_system::active()) {
+                    auto shared = std::make_shared<LoadTask>(std::move(task));
+                    if(decodesInFlight >= decodes_per_upload_thread * std::max<std::size_t>(1, threads.size())) {
+                        decodeBacklog.push_back(std::move(shared));
+                    } else {
+                        decodesInFlight++;
+                        submit_decode(std::move(shared));
+                    }
+                    return f;
+                }
+                tasks.push(std::move(task));
+            }
+            cv.notify_one();
+            return f;
+        }
+
+        // Decodes a task that holds one of the decodes in flight, with lock held, so the
+        // destructor cannot miss a job submitted from an upload thread.
+        void submit_decode(std::shared_ptr<LoadTask> shared) {
+            shared->decodeSlot = true;
+            job_system* jobs = job_system::active();
+            if(!jobs) {
+                // The upload threads decode it themselves.
+                tasks.push(std::move(*shared));
+                cv.notify_one();
+                return;
+            }
+            jobs->submit([this, shared]() {
+                LoadTask& t = *shared;
+                // Tasks of destroyed resources are dropped by the upload threads.
+                if(t.state->load(std::memory_order_acquire) == loading_state::queued) {
+                    try {
+                        t.decoded = decode_resource(t, stagingSize);
+                    } catch(...) {
+                        t.decodeError = std::current_exception();
+                    }
+                }
+                {
+                    std::scoped_lock<std::mutex> l(lock);
+                    tasks.push(std::move(t));
+                }
+                cv.notify_one();
+            }, job_options{.signal = &decoding});
+        }
+        // Called with lock held when an upload thread took a decoded task. Its slot passes on
+        // to the next task of the backlog, if any.
+        void release_decode_slot() {
+            if(stopping || decodeBacklog.empty()) {
+                decodesInFlight--;
+                return;
+            }
+            std::shared_ptr<LoadTask> next = std::move(decodeBacklog.front());
+            decodeBacklog.pop_front();
+            submit_decode(std::move(next));
+        }
 
         void loadThread(int index, vk::Queue queue) {
             vk::UniqueCommandPool pool;
@@ -222,10 +355,9 @@ export class resource_loader
                 vk::BufferCreateInfo buffer_info({}, stagingSize, vk::BufferUsageFlagBits::eTransferSrc, vk::SharingMode::eExclusive);
                 vma::AllocationCreateInfo alloc_info({}, vma::MemoryUsage::eCpuToGpu);
                 std::tie(stagingBuffer, allocation) = allocator.createBuffer(buffer_info, alloc_info);
+                memory_tracker::track(allocation, memory_tag::staging);
             }
 
-            std::unique_ptr<uint8_t[]> cpuBuffer = std::make_unique<uint8_t[]>(stagingSize);
-
             spdlog::info("[Resource Loader {}]: Started", index);
             std::unique_lock<std::mutex> l(lock);
             do
@@ -238,6 +370,9 @@ export class resource_loader
                 {
                     auto task = std::move(tasks.front());
                     tasks.pop();
+                    if(task.decodeSlot) {
+                        release_decode_slot();
+                    }
                     l.unlock();
 
                     if(task.state->load() != loading_state::queued) {
@@ -253,13 +388,19 @@ export class resource_loader
                     std::exception_ptr error;
                     bool okay = false;
                     try {
+                        if(task.decodeError) {
+                            std::rethrow_exception(task.decodeError);
+                        }
+                        if(!task.decoded) {
+                            task.decoded = decode_resource(task, stagingSize);
+                        }
                         if(task.type == LoadType::Texture)
                         {
-                            okay = load_texture(index, task, lock, device, allocator, allocation, commandBuffer.get(), cpuBuffer.get(), stagingSize, stagingBuffer);
+                            okay = load_texture(index, task, *task.decoded, lock, device, allocator, allocation, commandBuffer.get(), stagingSize, stagingBuffer);
                         }
                         else if(task.type == LoadType::Model)
                         {
-                            okay = load_model(index, task, device, allocator, allocation, commandBuffer.get(), stagingSize, stagingBuffer);
+                            okay = load_model(index, task, *task.decoded, device, allocator, allocation, commandBuffer.get(), stagingSize, stagingBuffer);
                         }
                         if(okay) {
                             std::array<vk::SubmitInfo, 1> submits = {
@@ -304,6 +445,7 @@ export class resource_loader
                         } catch(...) {
                         }
                     }
+                    task.decoded.reset();
                     if(!okay && !error) {
                         error = std::make_exception_ptr(std::runtime_error("Failed loading " + task.source_name()));
                     }
@@ -321,6 +463,7 @@ export class resource_loader
                 }
             } while(!quit);
 
+            memory_tracker::untrack(allocation);
             allocator.destroyBuffer(stagingBuffer, allocation);
             spdlog::info("[Resource Loader {}]: Quit", index);
         }
@@ -15,6 +15,49 @@ import vulkan_hpp;
 
 namespace dreamrender::shaders {
 
+namespace backdrop_renderer {
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wc23-extensions"
+    constexpr char vert_array[] = {
+    #embed "shaders/backdrop_renderer.vert.spv"
+    };
+    constexpr char frag_array[] = {
+    #embed "shaders/backdrop_renderer.frag.spv"
+    };
+    constexpr char vert_blur_array[] = {
+    #embed "shaders/backdrop_renderer.blur.vert.spv"
+    };
+    constexpr char frag_down_array[] = {
+    #embed "shaders/backdrop_renderer.down.frag.spv"
+    };
+    constexpr char frag_up_array[] = {
+    #embed "shaders/backdrop_renderer.up.frag.spv"
+    };
+    #pragma clang diagnostic pop
+
+    constexpr std::array vert_shader = convert<std::to_array(vert_array), uint32_t>();
+    constexpr std::array frag_shader = convert<std::to_array(frag_array), uint32_t>();
+    constexpr std::array vert_blur_shader = convert<std::to_array(vert_blur_array), uint32_t>();
+    constexpr std::array frag_down_shader = convert<std::to_array(frag_down_array), uint32_t>();
+    constexpr std::array frag_up_shader = convert<std::to_array(frag_up_array), uint32_t>();
+
+    vk::UniqueShaderModule vert(vk::Device device) {
+        return createShader(device, vert_shader);
+    }
+    vk::UniqueShaderModule frag(vk::Device device) {
+        return createShader(device, frag_shader);
+    }
+    vk::UniqueShaderModule vert_blur(vk::Device device) {
+        return createShader(device, vert_blur_shader);
+    }
+    vk::UniqueShaderModule frag_down(vk::Device device) {
+        return createShader(device, frag_down_shader);
+    }
+    vk::UniqueShaderModule frag_up(vk::Device device) {
+        return createShader(device, frag_up_shader);
+    }
+}
+
 namespace font_renderer {
     #pragma clang diagnostic push
     #pragma clang diagnostic ignored "-Wc23-extensions"
@@ -87,6 +130,35 @@ namespace image_renderer {
     }
 }
 
+namespace model_renderer {
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wc23-extensions"
+    constexpr char vert_array[] = {
+    #embed "shaders/model_renderer.vert.spv"
+    };
+    constexpr char frag_array[] = {
+    #embed "shaders/model_renderer.frag.spv"
+    };
+    constexpr char comp_array[] = {
+    #embed "shaders/model_renderer.comp.spv"
+    };
+    #pragma clang diagnostic pop
+
+    constexpr std::array vert_shader = convert<std::to_array(vert_array), uint32_t>();
+    constexpr std::array frag_shader = convert<std::to_array(frag_array), uint32_t>();
+    constexpr std::array comp_shader = convert<std::to_array(comp_array), uint32_t>();
+
+    vk::UniqueShaderModule vert(vk::Device device) {
+        return createShader(device, vert_shader);
+    }
+    vk::UniqueShaderModule frag(vk::Device device) {
+        return createShader(device, frag_shader);
+    }
+    vk::UniqueShaderModule comp(vk::Device device) {
+        return createShader(device, comp_shader);
+    }
+}
+
 namespace simple_renderer {
     #pragma clang diagnostic push
     #pragma clang diagnostic ignored "-Wc23-extensions"
@@ -109,4 +181,41 @@ namespace simple_renderer {
     }
 }
 
+namespace visualiser_renderer {
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wc23-extensions"
+    constexpr char vert_array[] = {
+    #embed "shaders/visualiser_renderer.vert.spv"
+    };
+    constexpr char frag_array[] = {
+    #embed "shaders/visualiser_renderer.frag.spv"
+    };
+    #pragma clang diagnostic pop
+
+    constexpr std::array vert_shader = convert<std::to_array(vert_array), uint32_t>();
+    constexpr std::array frag_shader = convert<std::to_array(frag_array), uint32_t>();
+
+    vk::UniqueShaderModule vert(vk::Device device) {
+        return createShader(device, vert_shader);
+    }
+    vk::UniqueShaderModule frag(vk::Device device) {
+        return createShader(device, frag_shader);
+    }
+}
+
+namespace yuv_convert {
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wc23-extensions"
+    constexpr char comp_array[] = {
+    #embed "shaders/yuv_convert.comp.spv"
+    };
+    #pragma clang diagnostic pop
+
+    constexpr std::array comp_shader = convert<std::to_array(comp_array), uint32_t>();
+
+    vk::UniqueShaderModule comp(vk::Device device) {
+        return createShader(device, comp_shader);
+    }
+}
+
 }
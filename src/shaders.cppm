@@ -11,6 +11,14 @@ import vulkan_hpp;
 
 export namespace dreamrender::shaders {
 
+namespace backdrop_renderer {
+    vk::UniqueShaderModule vert(vk::Device device);
+    vk::UniqueShaderModule frag(vk::Device device);
+    vk::UniqueShaderModule vert_blur(vk::Device device);
+    vk::UniqueShaderModule frag_down(vk::Device device);
+    vk::UniqueShaderModule frag_up(vk::Device device);
+}
+
 namespace font_renderer {
     vk::UniqueShaderModule vert(vk::Device device);
     vk::UniqueShaderModule vert_compat(vk::Device device);
@@ -25,9 +33,24 @@ namespace image_renderer {
     vk::UniqueShaderModule frag_glass(vk::Device device);
 }
 
+namespace model_renderer {
+    vk::UniqueShaderModule vert(vk::Device device);
+    vk::UniqueShaderModule frag(vk::Device device);
+    vk::UniqueShaderModule comp(vk::Device device);
+}
+
 namespace simple_renderer {
     vk::UniqueShaderModule vert(vk::Device device);
     vk::UniqueShaderModule frag(vk::Device device);
 }
 
+namespace visualiser_renderer {
+    vk::UniqueShaderModule vert(vk::Device device);
+    vk::UniqueShaderModule frag(vk::Device device);
+}
+
+namespace yuv_convert {
+    vk::UniqueShaderModule comp(vk::Device device);
+}
+
 }
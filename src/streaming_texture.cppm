@@ -0,0 +1,249 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+export module dreamrender:streaming_texture;
+
+import :debug;
+import :memory_tracker;
+import :texture;
+
+import spdlog;
+import vulkan_hpp;
+import vma;
+
+namespace dreamrender {
+
+// A texture whose content is replaced every frame, e.g. by video or a camera preview.
+//
+// The producer writes directly into one of a ring of persistently mapped staging buffers with
+// begin_write and end_write, from any thread. The phase then records the copy of the newest
+// written buffer into the image on its own command buffer with record_upload, so the update
+// happens on the graphics queue of the frame it appears in, without a fence wait or another
+// copy on the CPU. The ring has two buffers more than frames in flight, so the producer can
+// always write while the GPU copies from the others.
+export class streaming_texture {
+    public:
+        streaming_texture(vk::Device device, vma::Allocator allocator, int width, int height, int frameCount,
+            vk::Format format = vk::Format::eR8G8B8A8Srgb) :
+            device(device), allocator(allocator),
+            image(device, allocator, width, height, vk::ImageUsageFlagBits::eSampled, format)
+        {
+            if(texel_size(format) == 0) {
+                throw std::invalid_argument("Unsupported streaming texture format: " + vk::to_string(format));
+            }
+            slotSize = static_cast<vk::DeviceSize>(width) * height * texel_size(format);
+
+            vk::BufferCreateInfo buffer_info({}, slotSize, vk::BufferUsageFlagBits::eTransferSrc, vk::SharingMode::eExclusive);
+            vma::AllocationCreateInfo alloc_info(vma::AllocationCreateFlagBits::eMapped, vma::MemoryUsage::eCpuToGpu);
+            slots.resize(static_cast<std::size_t>(frameCount) + 2);
+            for(auto& s : slots) {
+                vma::AllocationInfo info;
+                auto [buffer, allocation] = allocator.createBufferUnique(buffer_info, alloc_info, &info);
+                s.data = static_cast<uint8_t*>(info.pMappedData);
+                s.buffer = std::move(buffer);
+                s.allocation = tracked_allocation(std::move(allocation), memory_tag::staging);
+            }
+            image.set_memory_tag(memory_tag::texture);
+        }
+        streaming_texture(const streaming_texture&) = delete;
+        streaming_texture& operator=(const streaming_texture&) = delete;
+
+        // Returns memory for a complete image (tightly packed rows), or nullptr if the
+        // producer is still writing the previous one.
+        uint8_t* begin_write() {
+            std::scoped_lock<std::mutex> l(lock);
+            if(writing) {
+                return nullptr;
+            }
+            std::optional<std::size_t> oldestReady;
+            for(std::size_t i = 0; i < slots.size(); i++) {
+                if(slots[i].state == slot_state::free) {
+                    writing = i;
+                    break;
+                }
+                if(slots[i].state == slot_state::ready && (!oldestReady || slots[i].sequence < slots[*oldestReady].sequence)) {
+                    oldestReady = i;
+                }
+            }
+            if(!writing && oldestReady) {
+                // The producer is ahead of the renderer, the oldest image is never shown.
+                writing = oldestReady;
+                dropped++;
+            }
+            if(!writing) {
+                return nullptr;
+            }
+            slots[*writing].state = slot_state::writing;
+            return slots[*writing].data;
+        }
+        // Publishes the written image. It is uploaded by the first record_upload for
+        // frame number target or later, 0 shows it as soon as possible.
+        void end_write(uint64_t target = 0) {
+            std::scoped_lock<std::mutex> l(lock);
+            if(!writing) {
+                throw std::logic_error("streaming_texture::end_write without begin_write");
+            }
+            slot& s = slots[*writing];
+            allocator.flushAllocation(s.allocation.get(), 0, slotSize);
+            s.state = slot_state::ready;
+            s.sequence = ++sequence;
+            s.target = target;
+            writing.reset();
+        }
+        // Writes an image with the function, like resource_loader::loadTexture, but into mapped memory.
+        template<typename F>
+        bool update(F&& fn, uint64_t target = 0) {
+            uint8_t* data = begin_write();
+            if(!data) {
+                return false;
+            }
+            try {
+                fn(data, static_cast<std::size_t>(slotSize));
+            } catch(...) {
+                std::scoped_lock<std::mutex> l(lock);
+                slots[*writing].state = slot_state::free;
+                writing.reset();
+                throw;
+            }
+            end_write(target);
+            return true;
+        }
+
+        // Records the copy of the newest published image into the texture. frame is the index
+        // of the frame in flight, frameNumber the frame that is rendered. Must be called before
+        // the render pass that samples the texture. Returns true if the content changed.
+        bool record_upload(vk::CommandBuffer cmd, int frame, uint64_t frameNumber = std::numeric_limits<uint64_t>::max()) {
+            std::scoped_lock<std::mutex> l(lock);
+            // The window waited for the previous use of this frame index, so its copy is done.
+            for(auto& s : slots) {
+                if(s.state == slot_state::in_flight && s.frame == frame) {
+                    s.state = slot_state::free;
+                }
+            }
+
+            std::optional<std::size_t> newest;
+            for(std::size_t i = 0; i < slots.size(); i++) {
+                const slot& s = slots[i];
+                if(s.state == slot_state::ready && s.target <= frameNumber && (!newest || s.sequence > slots[*newest].sequence)) {
+                    newest = i;
+                }
+            }
+            if(!newest) {
+                return false;
+            }
+            for(auto& s : slots) {
+                if(s.state == slot_state::ready && s.sequence < slots[*newest].sequence) {
+                    s.state = slot_state::free;
+                    dropped++;
+                }
+            }
+            slot& s = slots[*newest];
+            s.state = slot_state::in_flight;
+            s.frame = frame;
+
+            const vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+            // Earlier frames on the queue may still sample the image.
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+                vk::ImageMemoryBarrier(
+                    {}, vk::AccessFlagBits::eTransferWrite,
+                    uploads == 0 ? vk::ImageLayout::eUndefined : vk::ImageLayout::eShaderReadOnlyOptimal,
+                    vk::ImageLayout::eTransferDstOptimal,
+                    vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, image.image, range));
+            vk::BufferImageCopy copy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+                {}, {static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height), 1});
+            cmd.copyBufferToImage(s.buffer.get(), image.image, vk::ImageLayout::eTransferDstOptimal, copy);
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
+                vk::ImageMemoryBarrier(
+                    vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead,
+                    vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                    vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, image.image, range));
+
+            uploads++;
+            image.loaded.store(true, std::memory_order_release);
+            return true;
+        }
+
+        // The sampled image, it is loaded after the first upload was recorded.
+        texture& get() {
+            return image;
+        }
+        vk::ImageView view() const {
+            return image.imageView.get();
+        }
+        bool ready() const {
+            return image.loaded.load(std::memory_order_acquire);
+        }
+        std::size_t size() const {
+            return static_cast<std::size_t>(slotSize);
+        }
+        // Published images that were replaced before they could be shown.
+        uint64_t dropped_frames() const {
+            std::scoped_lock<std::mutex> l(lock);
+            return dropped;
+        }
+        void name(const std::string& name) {
+            image.name(name);
+            for(std::size_t i = 0; i < slots.size(); i++) {
+                debugName(device, slots[i].buffer.get(), name + " Staging " + std::to_string(i));
+            }
+        }
+
+        static unsigned int texel_size(vk::Format format) {
+            switch(format) {
+                case vk::Format::eR8G8B8A8Unorm:
+                case vk::Format::eR8G8B8A8Srgb:
+                case vk::Format::eB8G8R8A8Unorm:
+                case vk::Format::eB8G8R8A8Srgb:
+                    return 4;
+                case vk::Format::eR8Unorm:
+                    return 1;
+                case vk::Format::eR16G16B16A16Sfloat:
+                    return 8;
+                default:
+                    return 0;
+            }
+        }
+    private:
+        enum class slot_state {
+            free,
+            writing,
+            ready,
+            in_flight,
+        };
+        struct slot {
+            tracked_allocation allocation;
+            vma::UniqueBuffer buffer;
+            uint8_t* data = nullptr;
+            slot_state state = slot_state::free;
+            uint64_t sequence = 0;
+            uint64_t target = 0;
+            int frame = -1;
+        };
+
+        vk::Device device;
+        vma::Allocator allocator;
+        texture image;
+        vk::DeviceSize slotSize;
+
+        mutable std::mutex lock;
+        std::vector<slot> slots;
+        std::optional<std::size_t> writing;
+        uint64_t sequence = 0;
+        uint64_t uploads = 0;
+        uint64_t dropped = 0;
+};
+
+}
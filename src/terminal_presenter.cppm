@@ -0,0 +1,248 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if __linux__
+#include <cerrno>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+export module dreamrender:terminal_presenter;
+
+import spdlog;
+import vulkan_hpp;
+
+namespace dreamrender {
+
+// Shows RGBA frames in a true colour terminal using half block characters.
+// Only cells that changed since the previous frame are sent, and each frame
+// is a single write to stdout.
+export class terminal_presenter {
+    public:
+        terminal_presenter() {
+            output.reserve(1024*1024);
+        }
+        ~terminal_presenter() {
+            if(initialized) {
+                output.clear();
+                output += "\x1B[0m\x1B[?25h\n";
+                flush();
+            }
+        }
+
+        terminal_presenter(const terminal_presenter&) = delete;
+        terminal_presenter& operator=(const terminal_presenter&) = delete;
+
+        void present(std::span<const char> data, vk::Extent2D extent) {
+            layout(extent);
+            downsample(reinterpret_cast<const uint8_t*>(data.data()), extent);
+
+            output.clear();
+            if(!initialized) {
+                output += "\x1B[?25l";
+                initialized = true;
+            }
+            if(fullRedraw) {
+                output += "\x1B[0m\x1B[2J";
+                currentBackground = currentForeground = invalid_color;
+            }
+
+            int cursorRow = -1, cursorColumn = -1;
+            for(unsigned int row = 0; row < rows; row++) {
+                for(unsigned int column = 0; column < columns; column++) {
+                    const std::size_t i = row * columns + column;
+                    const uint32_t upper = halves[2*row*columns + column];
+                    const uint32_t lower = (2*row + 1 < halfRows) ? halves[(2*row + 1)*columns + column] : 0;
+                    const uint64_t cell = (static_cast<uint64_t>(upper) << 32) | lower;
+                    if(!fullRedraw && cells[i] == cell) {
+                        continue;
+                    }
+                    cells[i] = cell;
+
+                    if(cursorRow != static_cast<int>(row) || cursorColumn != static_cast<int>(column)) {
+                        output += "\x1B[";
+                        append_number(row + 1);
+                        output += ';';
+                        append_number(column + 1);
+                        output += 'H';
+                    }
+                    if(upper != currentBackground) {
+                        append_color("\x1B[48;2;", upper);
+                        currentBackground = upper;
+                    }
+                    if(lower != currentForeground) {
+                        append_color("\x1B[38;2;", lower);
+                        currentForeground = lower;
+                    }
+                    output += "▄";
+                    cursorRow = static_cast<int>(row);
+                    cursorColumn = static_cast<int>(column) + 1;
+                }
+            }
+            fullRedraw = false;
+            flush();
+
+            frames++;
+            bytes += output.size();
+            auto now = std::chrono::steady_clock::now();
+            if(now - lastReport >= std::chrono::seconds(5)) {
+                double seconds = std::chrono::duration<double>(now - lastReport).count();
+                if(frames > 0 && lastReport.time_since_epoch().count() != 0) {
+                    spdlog::debug("Terminal output: {:.1f} FPS, {:.1f} KiB per frame",
+                        frames / seconds, bytes / 1024.0 / frames);
+                }
+                lastReport = now;
+                frames = 0;
+                bytes = 0;
+            }
+        }
+    private:
+        static constexpr uint32_t invalid_color = 0xFFFFFFFF;
+
+        std::string output;
+        bool initialized = false;
+        bool fullRedraw = true;
+        uint32_t currentBackground = invalid_color;
+        uint32_t currentForeground = invalid_color;
+
+        unsigned short terminalColumns = 0, terminalRows = 0;
+        vk::Extent2D frameExtent{};
+        unsigned int blockWidth = 1, blockHeight = 1;
+        unsigned int columns = 0, rows = 0, halfRows = 0;
+
+        std::vector<uint32_t> sums;
+        // Packed 0xRRGGBB colour of the upper and lower half of each cell
+        std::vector<uint32_t> halves;
+        std::vector<uint64_t> cells;
+
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        std::chrono::steady_clock::time_point lastReport{};
+
+        void layout(vk::Extent2D extent) {
+#if __linux__
+            struct winsize w{};
+            ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+            if(w.ws_col == 0 || w.ws_row == 0) {
+                w = {24, 80, 0, 0};
+            }
+#else
+            struct winsize {
+                unsigned short ws_row;
+                unsigned short ws_col;
+                unsigned short ws_xpixel;
+                unsigned short ws_ypixel;
+            } w = {24, 80, 640, 480};
+#endif
+            if(w.ws_col == terminalColumns && w.ws_row == terminalRows && extent == frameExtent) {
+                return;
+            }
+            terminalColumns = w.ws_col;
+            terminalRows = w.ws_row;
+            frameExtent = extent;
+
+            float x_per_c = static_cast<float>(w.ws_xpixel) / static_cast<float>(w.ws_col);
+            float y_per_c = static_cast<float>(w.ws_ypixel) / static_cast<float>(w.ws_row);
+            float character_ratio = w.ws_xpixel == 0 ? 2.0f : x_per_c / y_per_c;
+            character_ratio /= 2.0;
+
+            float fsx = static_cast<float>(extent.width) / w.ws_col;
+            float fsy = static_cast<float>(extent.height) / (w.ws_row*2) / character_ratio;
+            fsx = std::max(fsx, fsy);
+            fsy = fsx * character_ratio;
+            blockWidth = std::max(1, static_cast<int>(std::ceil(fsx)));
+            blockHeight = std::max(1, static_cast<int>(std::ceil(fsy)));
+
+            columns = std::min<unsigned int>((extent.width + blockWidth - 1) / blockWidth, w.ws_col);
+            halfRows = std::min<unsigned int>((extent.height + blockHeight - 1) / blockHeight, 2u * w.ws_row);
+            rows = (halfRows + 1) / 2;
+
+            sums.assign(static_cast<std::size_t>(extent.width) * 4, 0);
+            halves.assign(static_cast<std::size_t>(halfRows) * columns, 0);
+            cells.assign(static_cast<std::size_t>(rows) * columns, 0);
+            fullRedraw = true;
+        }
+
+        // Box filter: whole pixel rows are accumulated into per-column sums with a
+        // contiguous loop the compiler vectorises, then the columns of each block are summed.
+        void downsample(const uint8_t* pixels, vk::Extent2D extent) {
+            const std::size_t stride = static_cast<std::size_t>(extent.width) * 4;
+            for(unsigned int half = 0; half < halfRows; half++) {
+                std::ranges::fill(sums, 0);
+                const unsigned int y0 = half * blockHeight;
+                const unsigned int y1 = std::min(y0 + blockHeight, extent.height);
+                for(unsigned int y = y0; y < y1; y++) {
+                    const uint8_t* row = pixels + y * stride;
+                    uint32_t* s = sums.data();
+                    for(std::size_t i = 0; i < stride; i++) {
+                        s[i] += row[i];
+                    }
+                }
+
+                for(unsigned int column = 0; column < columns; column++) {
+                    const unsigned int x0 = column * blockWidth;
+                    const unsigned int x1 = std::min(x0 + blockWidth, extent.width);
+                    uint32_t r = 0, g = 0, b = 0;
+                    for(unsigned int x = x0; x < x1; x++) {
+                        r += sums[4*x + 0];
+                        g += sums[4*x + 1];
+                        b += sums[4*x + 2];
+                    }
+                    const uint32_t count = std::max(1u, (x1 - x0) * (y1 - y0));
+                    halves[half * columns + column] = ((r / count) << 16) | ((g / count) << 8) | (b / count);
+                }
+            }
+        }
+
+        void append_number(unsigned int value) {
+            char buffer[10];
+            auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            output.append(buffer, end);
+        }
+        void append_color(std::string_view prefix, uint32_t color) {
+            output += prefix;
+            append_number((color >> 16) & 0xFF);
+            output += ';';
+            append_number((color >> 8) & 0xFF);
+            output += ';';
+            append_number(color & 0xFF);
+            output += 'm';
+        }
+
+        void flush() {
+#if __linux__
+            std::string_view remaining = output;
+            while(!remaining.empty()) {
+                ssize_t n = ::write(STDOUT_FILENO, remaining.data(), remaining.size());
+                if(n < 0) {
+                    if(errno == EINTR || errno == EAGAIN) {
+                        continue;
+                    }
+                    spdlog::error("Failed to write terminal output: {}", errno);
+                    return;
+                }
+                remaining.remove_prefix(static_cast<std::size_t>(n));
+            }
+#else
+            std::fwrite(output.data(), 1, output.size(), stdout);
+            std::fflush(stdout);
+#endif
+        }
+};
+
+}
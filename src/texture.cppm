@@ -13,6 +13,7 @@ module;
 export module dreamrender:texture;
 
 import :debug;
+import :memory_tracker;
 import :utils;
 
 import vulkan_hpp;
@@ -38,6 +39,7 @@ export struct texture
             vk::SharingMode::eExclusive);
         vma::AllocationCreateInfo alloc_info({}, vma::MemoryUsage::eGpuOnly);
         std::tie(image, allocation) = allocator.createImage(image_info, alloc_info);
+        memory_tracker::track(allocation, memoryTag);
 
         view_info = vk::ImageViewCreateInfo({}, image, vk::ImageViewType::e2D, format,
         vk::ComponentMapping(), vk::ImageSubresourceRange(aspects, 0, 1, 0, 1));
@@ -71,7 +73,7 @@ export struct texture
     texture(texture&& other)
         : device(other.device), allocator(other.allocator), image(other.image), allocation(other.allocation),
         width(other.width), height(other.height), imageView(std::move(other.imageView)),
-        image_info(other.image_info), view_info(other.view_info)
+        image_info(other.image_info), view_info(other.view_info), memoryTag(other.memoryTag)
     {
         other.image = nullptr;
         other.allocation = nullptr;
@@ -88,6 +90,7 @@ export struct texture
 
         imageView.reset();
         if(image && allocation) {
+            memory_tracker::untrack(allocation);
             allocator.destroyImage(image, allocation);
         }
     }
@@ -102,6 +105,7 @@ export struct texture
 
         vma::AllocationCreateInfo alloc_info({}, vma::MemoryUsage::eGpuOnly);
         std::tie(image, allocation) = allocator.createImage(image_info, alloc_info);
+        memory_tracker::track(allocation, memoryTag);
 
         view_info.image = image;
         imageView = device.createImageViewUnique(view_info);
@@ -110,6 +114,13 @@ export struct texture
         debugName(device, image, name+" Image");
         debugName(device, imageView.get(), name+" Image View");
     }
+    // The subsystem the image is accounted to, textures created by the loader default to texture.
+    void set_memory_tag(memory_tag tag) {
+        memoryTag = tag;
+        if(allocation) {
+            memory_tracker::retag(allocation, tag);
+        }
+    }
     double aspectRatio() {
         return static_cast<double>(width)/height;
     }
@@ -129,6 +140,7 @@ export struct texture
     private:
     vk::ImageCreateInfo image_info;
     vk::ImageViewCreateInfo view_info;
+    memory_tag memoryTag = memory_tag::texture;
 
     std::shared_ptr<std::atomic<loading_state>> state = std::make_shared<std::atomic<loading_state>>(loading_state::none);
     friend class resource_loader;
@@ -6,6 +6,7 @@
 module;
 
 #include <cmath>
+#include <algorithm>
 #include <array>
 #include <bit>
 #include <concepts>
@@ -13,10 +14,15 @@ module;
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <initializer_list>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <span>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #ifdef __GNUG__
@@ -24,8 +30,10 @@ module;
 #endif
 
 #if __linux__
+#include <fcntl.h>
 #include <poll.h>
-#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
@@ -63,6 +71,10 @@ export struct gpu_features {
     vk::PhysicalDeviceFeatures features;
     vk::PhysicalDeviceVulkan12Features vulkan12Features;
     vk::PhysicalDeviceLimits limits;
+    // VK_KHR_dynamic_rendering is enabled, renderers can be preloaded with render_targets::dynamic.
+    bool dynamicRendering = false;
+    // VK_KHR_incremental_present is enabled, see phase::set_present_region.
+    bool incrementalPresent = false;
 };
 
 export vk::UniqueShaderModule createShader(vk::Device device, std::span<const uint32_t> code) {
@@ -83,24 +95,111 @@ export vk::UniqueShaderModule createShader(vk::Device device, const std::filesys
     return shader;
 }
 
-export using UniquePipelineMap = std::map<vk::RenderPass, vk::UniquePipeline>;
+// What a renderer builds its pipelines for: any number of render passes and, with
+// dynamic rendering (see gpu_features::dynamicRendering), the colour attachment format.
+// The sample count is passed separately to the renderers.
+export struct render_targets {
+    std::vector<vk::RenderPass> renderPasses;
+    vk::Format colorFormat = vk::Format::eUndefined;
+
+    render_targets() = default;
+    render_targets(std::initializer_list<vk::RenderPass> renderPasses) : renderPasses(renderPasses) {}
+    render_targets(std::vector<vk::RenderPass> renderPasses) : renderPasses(std::move(renderPasses)) {}
+
+    static render_targets dynamic(vk::Format colorFormat, std::vector<vk::RenderPass> renderPasses = {}) {
+        render_targets targets(std::move(renderPasses));
+        targets.colorFormat = colorFormat;
+        return targets;
+    }
+    bool has_dynamic() const {
+        return colorFormat != vk::Format::eUndefined;
+    }
+};
+
+// Pipelines of one renderer. With dynamic rendering a pipeline only depends on the attachment
+// formats and sample count, which are fixed per renderer, so it is looked up with a null render pass.
+// The few render passes of the fallback path are kept in a flat vector.
+export class pipeline_set {
+    public:
+        // Throws if the renderer was not preloaded for the render pass, see contains.
+        vk::Pipeline get(vk::RenderPass renderPass) const {
+            vk::Pipeline pipeline = find(renderPass);
+            if(!pipeline) {
+                throw std::invalid_argument(renderPass ? "No pipeline for the render pass" : "No pipeline for dynamic rendering");
+            }
+            return pipeline;
+        }
+        bool contains(vk::RenderPass renderPass) const {
+            return static_cast<bool>(find(renderPass));
+        }
+        void insert(vk::RenderPass renderPass, vk::UniquePipeline pipeline) {
+            if(!renderPass) {
+                dynamicPipeline = std::move(pipeline);
+                return;
+            }
+            for(auto& [rp, p] : passes) {
+                if(rp == renderPass) {
+                    p = std::move(pipeline);
+                    return;
+                }
+            }
+            passes.emplace_back(renderPass, std::move(pipeline));
+        }
+        void merge(pipeline_set&& other) {
+            if(other.dynamicPipeline) {
+                insert({}, std::move(other.dynamicPipeline));
+            }
+            for(auto& [rp, p] : other.passes) {
+                insert(rp, std::move(p));
+            }
+            other.passes.clear();
+        }
+    private:
+        vk::Pipeline find(vk::RenderPass renderPass) const {
+            if(!renderPass) {
+                return dynamicPipeline.get();
+            }
+            for(const auto& [rp, pipeline] : passes) {
+                if(rp == renderPass) {
+                    return pipeline.get();
+                }
+            }
+            return {};
+        }
+
+        vk::UniquePipeline dynamicPipeline;
+        std::vector<std::pair<vk::RenderPass, vk::UniquePipeline>> passes;
+};
 
-export UniquePipelineMap createPipelines(
+export pipeline_set createPipelines(
     vk::Device device,
     vk::PipelineCache pipelineCache,
     const vk::GraphicsPipelineCreateInfo& createInfo,
-    const std::vector<vk::RenderPass>& renderPasses,
+    const render_targets& targets,
     const std::string& debugName)
 {
-    std::vector<vk::GraphicsPipelineCreateInfo> createInfos(renderPasses.size(), createInfo);
+    std::vector<vk::GraphicsPipelineCreateInfo> createInfos(targets.renderPasses.size(), createInfo);
+    for (size_t i = 0; i < targets.renderPasses.size(); ++i)
+    {
+        createInfos[i].renderPass = targets.renderPasses[i];
+    }
+    vk::PipelineRenderingCreateInfo renderingInfo = vk::PipelineRenderingCreateInfo()
+        .setColorAttachmentFormats(targets.colorFormat)
+        .setPNext(createInfo.pNext);
+    if(targets.has_dynamic()) {
+        auto& info = createInfos.emplace_back(createInfo);
+        info.renderPass = nullptr;
+        info.subpass = 0;
+        info.pNext = &renderingInfo;
+    }
+    if(createInfos.empty())
+        throw std::invalid_argument("No render targets to create \""+debugName+"\" for");
+
     createInfos[0].flags |= vk::PipelineCreateFlagBits::eAllowDerivatives;
-    createInfos[0].renderPass = renderPasses[0];
     createInfos[0].basePipelineIndex = -1;
-
-    for (size_t i = 1; i < renderPasses.size(); ++i)
+    for (size_t i = 1; i < createInfos.size(); ++i)
     {
         createInfos[i].flags |= vk::PipelineCreateFlagBits::eDerivative;
-        createInfos[i].renderPass = renderPasses[i];
         createInfos[i].basePipelineHandle = nullptr;
         createInfos[i].basePipelineIndex = 0;
     }
@@ -109,11 +208,11 @@ export UniquePipelineMap createPipelines(
     if(result.result != vk::Result::eSuccess)
         throw std::runtime_error("Failed to create graphics pipeline(s) (error code: "+to_string(result.result)+")");
 
-    UniquePipelineMap pipelines;
-    for (size_t i = 0; i < renderPasses.size(); ++i)
+    pipeline_set pipelines;
+    for (size_t i = 0; i < createInfos.size(); ++i)
     {
         dreamrender::debugName(device, result.value[i].get(), debugName);
-        pipelines[renderPasses[i]] = std::move(result.value[i]);
+        pipelines.insert(i < targets.renderPasses.size() ? targets.renderPasses[i] : vk::RenderPass{}, std::move(result.value[i]));
     }
     return pipelines;
 }
@@ -188,6 +287,98 @@ bool input_available(int fd) {
 #endif
 }
 
+// A read-only view of a whole file. It is memory-mapped where supported, so only the pages
+// that are read are loaded, and read into memory otherwise.
+export class mapped_file {
+    public:
+        explicit mapped_file(const std::filesystem::path& path) {
+#if __linux__
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0) {
+                throw std::runtime_error("Failed to open file: " + path.string());
+            }
+            struct stat st{};
+            if(::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error("Failed to stat file: " + path.string());
+            }
+            length = static_cast<std::size_t>(st.st_size);
+            if(length > 0) {
+                void* m = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(m == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error("Failed to map file: " + path.string());
+                }
+                mapping = static_cast<const uint8_t*>(m);
+            }
+            ::close(fd);
+#else
+            std::ifstream in(path, std::ios::binary);
+            if(!in) {
+                throw std::runtime_error("Failed to open file: " + path.string());
+            }
+            contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+#endif
+        }
+        ~mapped_file() {
+#if __linux__
+            if(mapping) {
+                ::munmap(const_cast<uint8_t*>(mapping), length);
+            }
+#endif
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        mapped_file(mapped_file&& other) noexcept
+#if __linux__
+            : mapping(std::exchange(other.mapping, nullptr)), length(std::exchange(other.length, 0))
+#else
+            : contents(std::move(other.contents))
+#endif
+        {}
+        mapped_file& operator=(mapped_file&& other) noexcept {
+#if __linux__
+            std::swap(mapping, other.mapping);
+            std::swap(length, other.length);
+#else
+            std::swap(contents, other.contents);
+#endif
+            return *this;
+        }
+
+        std::span<const uint8_t> data() const {
+#if __linux__
+            return {mapping, length};
+#else
+            return contents;
+#endif
+        }
+        std::size_t size() const {
+            return data().size();
+        }
+
+        // Hints that the range will be read soon, so the OS can read it ahead.
+        void will_need(std::size_t offset, std::size_t count) const {
+#if __linux__
+            if(!mapping || offset >= length) {
+                return;
+            }
+            static const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            const std::size_t begin = offset / page * page;
+            const std::size_t end = std::min(length, offset + count);
+            ::madvise(const_cast<uint8_t*>(mapping) + begin, end - begin, MADV_WILLNEED);
+#endif
+        }
+    private:
+#if __linux__
+        const uint8_t* mapping = nullptr;
+        std::size_t length = 0;
+#else
+        std::vector<uint8_t> contents;
+#endif
+};
+
 export void save_bmp(std::span<const char> data, int width, int height, const std::filesystem::path& path) {
     std::ofstream out(path, std::ios::binary);
     if(!out) {
@@ -228,79 +419,4 @@ export void save_bmp(std::span<const char> data, int width, int height, const st
     out.write(data.data(), data.size());
 }
 
-void terminal_output(std::span<const char> data, vk::Extent2D extent, std::ostream& out) {
-    std::cout << "\033[2J\033[0;0H";
-#if __linux__
-    struct winsize w{};
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-#else
-    struct winsize {
-        unsigned short ws_row;
-        unsigned short ws_col;
-        unsigned short ws_xpixel;
-        unsigned short ws_ypixel;
-    } w = {24, 80, 640, 480};
-#endif
-
-    float x_per_c = static_cast<float>(w.ws_xpixel) / static_cast<float>(w.ws_col);
-    float y_per_c = static_cast<float>(w.ws_ypixel) / static_cast<float>(w.ws_row);
-    float character_ratio = w.ws_xpixel == 0 ? 2.0f : x_per_c / y_per_c;
-    character_ratio /= 2.0;
-
-    float fsx = static_cast<float>(extent.width) / w.ws_col;
-    float fsy = static_cast<float>(extent.height) / (w.ws_row*2) / character_ratio;
-    fsx = std::max(fsx, fsy);
-    fsy = fsx * character_ratio;
-    int sx = std::ceil(fsx);
-    int sy = std::ceil(fsy);
-
-    using color = std::tuple<int, int, int>;
-
-    auto get_color = [&](int x, int y) {
-        int tr = 0, tg = 0, tb = 0, t = 0;
-        for(int dy=0; dy<sy && y+dy < extent.height; dy++)
-        {
-            for(int dx=0; dx<sx && x+dx < extent.width; dx++)
-            {
-                unsigned int i = (y+dy)*extent.width*4 + (x+dx)*4;
-                tr += static_cast<unsigned char>(data[i+0]);
-                tg += static_cast<unsigned char>(data[i+1]);
-                tb += static_cast<unsigned char>(data[i+2]);
-                t++;
-            }
-        }
-        if(t == 0) {
-            return color{0, 0, 0}; // No pixels, return black
-        }
-        int r = tr/t, g = tg/t, b = tb/t;
-        return color{r, g, b};
-    };
-
-    for(int y=0; y<extent.height; y+=2*sy)
-    {
-        color last_upper = {-1, -1, -1};
-        color last_lower = {-1, -1, -1};
-        for(int x=0; x<extent.width; x+=sx)
-        {
-            color upper = get_color(x, y);
-            color lower = get_color(x, y+sy);
-
-            if(upper != last_upper) {
-                std::cout << std::format("\x1B[48;2;{};{};{}m",
-                    std::get<0>(upper), std::get<1>(upper), std::get<2>(upper));
-                last_upper = upper;
-            }
-            if(lower != last_lower) {
-                std::cout << std::format("\x1B[38;2;{};{};{}m",
-                    std::get<0>(lower), std::get<1>(lower), std::get<2>(lower));
-                last_lower = lower;
-            }
-            std::cout << "\u2584";
-        }
-        std::cout << "\x1B[0m";
-        if(y+sy < extent.height)
-            std::cout << '\n';
-    }
-}
-
 }
@@ -0,0 +1,246 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+module;
+
+#include <algorithm>
+#include <array>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#define popen _popen
+#define pclose _pclose
+#endif
+
+export module dreamrender:video_output;
+
+import :shaders;
+import :utils;
+
+import spdlog;
+import vulkan_hpp;
+
+namespace dreamrender {
+
+export enum class video_format {
+    // YUV4MPEG2 stream with I420 frames
+    y4m,
+    // headerless planar frames
+    i420,
+    // headerless frames with interleaved chroma
+    nv12,
+};
+
+export video_format parse_video_format(std::string_view name) {
+    if(name == "y4m") return video_format::y4m;
+    if(name == "i420" || name == "yuv420p") return video_format::i420;
+    if(name == "nv12") return video_format::nv12;
+    throw std::invalid_argument(std::format("Unknown video format \"{}\", supported formats are: y4m, i420, nv12", name));
+}
+
+// The converter writes blocks of 8x2 pixels, so the width is rounded down to a multiple of 8
+// and the height to a multiple of 2.
+export vk::Extent2D video_frame_extent(vk::Extent2D requested) {
+    return vk::Extent2D{std::max(8u, requested.width & ~7u), std::max(2u, requested.height & ~1u)};
+}
+export vk::DeviceSize video_frame_size(vk::Extent2D extent) {
+    return static_cast<vk::DeviceSize>(extent.width) * extent.height * 3 / 2;
+}
+
+// Converts RGBA images into 4:2:0 YUV frames in a buffer with a compute shader,
+// optionally scaling them to a different size.
+export class yuv_converter {
+    public:
+        yuv_converter(vk::Device device, vk::PipelineCache pipelineCache, unsigned int setCount) : device(device) {
+            sampler = device.createSamplerUnique(vk::SamplerCreateInfo({}, vk::Filter::eLinear, vk::Filter::eLinear,
+                vk::SamplerMipmapMode::eNearest, vk::SamplerAddressMode::eClampToEdge, vk::SamplerAddressMode::eClampToEdge,
+                vk::SamplerAddressMode::eClampToEdge));
+            {
+                std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+                    vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute),
+                    vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+                };
+                descriptorLayout = device.createDescriptorSetLayoutUnique(vk::DescriptorSetLayoutCreateInfo({}, bindings));
+                debugName(device, descriptorLayout.get(), "YUV Converter Descriptor Layout");
+            }
+            {
+                vk::PushConstantRange range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants));
+                pipelineLayout = device.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, descriptorLayout.get(), range));
+                debugName(device, pipelineLayout.get(), "YUV Converter Pipeline Layout");
+            }
+            {
+                vk::UniqueShaderModule shader = shaders::yuv_convert::comp(device);
+                vk::ComputePipelineCreateInfo info({},
+                    vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, shader.get(), "main"),
+                    pipelineLayout.get());
+                pipeline = device.createComputePipelineUnique(pipelineCache, info).value;
+                debugName(device, pipeline.get(), "YUV Converter Pipeline");
+            }
+            {
+                std::array<vk::DescriptorPoolSize, 2> sizes = {
+                    vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, setCount),
+                    vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, setCount),
+                };
+                descriptorPool = device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo({}, setCount, sizes));
+                std::vector<vk::DescriptorSetLayout> layouts(setCount, descriptorLayout.get());
+                descriptorSets = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo(descriptorPool.get(), layouts));
+            }
+        }
+
+        // Records the conversion of source (in eShaderReadOnlyOptimal) into output.
+        // The descriptor set must not be in use by a pending submission.
+        void convert(vk::CommandBuffer cmd, unsigned int set, vk::ImageView source, vk::Buffer output,
+            vk::Extent2D outputExtent, video_format format)
+        {
+            vk::DescriptorImageInfo imageInfo(sampler.get(), source, vk::ImageLayout::eShaderReadOnlyOptimal);
+            vk::DescriptorBufferInfo bufferInfo(output, 0, video_frame_size(outputExtent));
+            std::array<vk::WriteDescriptorSet, 2> writes = {
+                vk::WriteDescriptorSet(descriptorSets[set], 0, 0, vk::DescriptorType::eCombinedImageSampler, imageInfo),
+                vk::WriteDescriptorSet(descriptorSets[set], 1, 0, vk::DescriptorType::eStorageBuffer, {}, bufferInfo),
+            };
+            device.updateDescriptorSets(writes, {});
+
+            push_constants push{
+                .width = outputExtent.width,
+                .height = outputExtent.height,
+                .layout = format == video_format::nv12 ? 1u : 0u,
+            };
+            cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.get());
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout.get(), 0, descriptorSets[set], {});
+            cmd.pushConstants<push_constants>(pipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, push);
+            const uint32_t blocksX = (outputExtent.width / 8 + 7) / 8;
+            const uint32_t blocksY = (outputExtent.height / 2 + 7) / 8;
+            cmd.dispatch(blocksX, blocksY, 1);
+        }
+    private:
+        struct push_constants {
+            uint32_t width;
+            uint32_t height;
+            uint32_t layout;
+        };
+
+        vk::Device device;
+        vk::UniqueSampler sampler;
+        vk::UniqueDescriptorSetLayout descriptorLayout;
+        vk::UniquePipelineLayout pipelineLayout;
+        vk::UniquePipeline pipeline;
+        vk::UniqueDescriptorPool descriptorPool;
+        std::vector<vk::DescriptorSet> descriptorSets;
+};
+
+// Writes YUV frames to a file, to stdout ("-") or into the stdin of a command ("|command").
+export class video_sink {
+    public:
+        video_sink(const std::string& target, video_format format, vk::Extent2D extent, int fps) :
+            format(format), frameSize(video_frame_size(extent))
+        {
+            if(target == "-") {
+#if defined(_WIN32)
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                file = stdout;
+            } else if(target.starts_with('|')) {
+#if defined(SIGPIPE)
+                // Report a closed pipe as a write error instead of terminating.
+                std::signal(SIGPIPE, SIG_IGN);
+#endif
+#if defined(_WIN32)
+                file = popen(target.c_str() + 1, "wb");
+#else
+                file = popen(target.c_str() + 1, "w");
+#endif
+                pipe = true;
+            } else {
+                file = std::fopen(target.c_str(), "wb");
+            }
+            if(!file) {
+                throw std::runtime_error("Failed to open video output: " + target);
+            }
+
+            if(format == video_format::y4m) {
+                std::string header = std::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C420jpeg\n", extent.width, extent.height, fps);
+                write(header);
+            }
+            spdlog::info("Streaming {}x{} video at {} fps to {}", extent.width, extent.height, fps, target);
+        }
+        ~video_sink() {
+            if(!file) {
+                return;
+            }
+            if(pipe) {
+                pclose(file);
+            } else if(file == stdout) {
+                std::fflush(file);
+            } else {
+                std::fclose(file);
+            }
+        }
+
+        video_sink(const video_sink&) = delete;
+        video_sink& operator=(const video_sink&) = delete;
+
+        void write_frame(std::span<const char> yuv) {
+            if(yuv.size() < frameSize) {
+                throw std::invalid_argument("Video frame is too small");
+            }
+            if(format == video_format::y4m) {
+                write("FRAME\n");
+            }
+            write(yuv.first(frameSize));
+            if(repeatable) {
+                lastFrame.assign(yuv.begin(), yuv.begin() + frameSize);
+            }
+        }
+        // Writes the previous frame again, which is only kept if the sink is repeatable.
+        void repeat_frame() {
+            if(lastFrame.empty()) {
+                throw std::logic_error("No frame to repeat");
+            }
+            if(format == video_format::y4m) {
+                write("FRAME\n");
+            }
+            write(lastFrame);
+        }
+        void set_repeatable(bool repeatable) {
+            this->repeatable = repeatable;
+            if(!repeatable) {
+                lastFrame.clear();
+            }
+        }
+
+        uint64_t bytes_written() const {
+            return written;
+        }
+    private:
+        video_format format;
+        vk::DeviceSize frameSize;
+        std::FILE* file = nullptr;
+        bool pipe = false;
+        uint64_t written = 0;
+        bool repeatable = false;
+        std::vector<char> lastFrame;
+
+        void write(std::span<const char> data) {
+            if(std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+                throw std::runtime_error("Failed to write video output");
+            }
+            written += data.size();
+        }
+        void write(std::string_view data) {
+            write(std::span<const char>(data.data(), data.size()));
+        }
+};
+
+}
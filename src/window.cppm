@@ -14,11 +14,16 @@ module;
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstdint>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <iterator>
 #include <iostream>
@@ -26,8 +31,10 @@ module;
 #include <map>
 #include <memory>
 #include <mutex>
+#include <numeric>
 #include <optional>
 #include <set>
+#include <span>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -58,9 +65,20 @@ module;
 
 export module dreamrender:window;
 
+import :audio_analyser;
+import :font_cache;
+import :frame_encoder;
+import :frame_pacer;
+import :job_system;
+import :memory_tracker;
+import :pipeline_compiler;
+import :profiler;
+import :terminal_presenter;
+import :video_output;
 import :resource_loader;
 import :phase;
 import :input;
+import :input_log;
 import :utils;
 
 import sdl2;
@@ -135,6 +153,21 @@ export struct window_config {
     std::string headless_output_format = "{:05d}.jpg";
     int headless_output_quality = 90;
     int headless_frames = -1;
+    // Frames the phase reports as unchanged (frame_snapshot::unchanged) are not rendered or encoded.
+    // No image is written for them, and a stream repeats the previous frame.
+    bool headless_skip_unchanged = false;
+    // Encoder threads for headless output, 0 encodes on the job system.
+    unsigned int headless_encoder_threads = 0;
+    // Frames that may wait for or be in encoding before rendering is throttled.
+    unsigned int headless_encoder_queue = 4;
+
+    // Stream YUV video instead of writing images: a file path, "-" for stdout or "|command" for a pipe.
+    std::string headless_stream;
+    video_format headless_stream_format = video_format::y4m;
+    // Size of the streamed video, 0 keeps the frame size.
+    unsigned int headless_stream_width = 0;
+    unsigned int headless_stream_height = 0;
+    int headless_stream_fps = 60;
 
     std::string name;
     int version = 1;
@@ -145,11 +178,41 @@ export struct window_config {
 
     vk::PresentModeKHR preferredPresentMode = vk::PresentModeKHR::eFifoRelaxed;
     int fpsLimit = -1;
+    frame_pacing_config pacing{};
+    // Record and submit frames on a render thread, while the main thread handles input and
+    // updates the phase, see phase::update.
+    bool threaded_render = false;
+    // Pipeline compiler threads, 0 picks half of the hardware threads (at most 4).
+    unsigned int pipeline_threads = 0;
+    // Workers of the job system that decodes resources and encodes headless output,
+    // 0 uses one per hardware thread.
+    unsigned int job_threads = 0;
+    // Keep prebuilt font atlases in the cache directory, see font_cache.
+    bool cache_fonts = true;
+    // Snapshots the main thread may queue ahead of the render thread.
+    unsigned int render_queue = 1;
     vk::SampleCountFlagBits sampleCount = vk::SampleCountFlagBits::e1;
     bool profileFrames = false;
     uint64_t profileFrameInterval = 120;
+    // Collect CPU and GPU zones with a profiler, see window::frameProfiler.
+    bool profileGpu = false;
+    // Write a Chrome trace of the collected zones here when the window is destroyed, implies profileGpu.
+    std::filesystem::path profileTrace;
+    // Warn when the GPU memory of a tag grows beyond this many bytes, see memory_tracker.
+    std::map<memory_tag, vk::DeviceSize> memory_thresholds;
+    // Write a JSON report of the GPU memory when the window is destroyed.
+    std::filesystem::path memory_report;
+
+    // Write the input events of the session with their frame numbers to this binary log.
+    std::filesystem::path input_record;
+    // Replay a log written with input_record instead of live input. In headless mode this uses
+    // the synthetic clock with the recorded frame interval, so the session renders identically.
+    std::filesystem::path input_replay;
 
     bool workaround_no_swapchain = false;
+
+    // Analyse the mixed audio output, see window::audioAnalyser.
+    std::optional<audio_analyser_config> audio_analysis;
 };
 
 static std::filesystem::path env_path(const char* name) {
@@ -204,6 +267,7 @@ export class window
         ~window() {
             spdlog::debug("Destroying window");
 
+            stop_render_thread(false);
             std::scoped_lock lock(renderLock);
 
             if(device) {
@@ -213,29 +277,40 @@ export class window
                     spdlog::warn("Failed to wait for device idle during shutdown: {}", e.what());
                 }
 
-                if(pipelineCache) {
+                if(frameProfiler && !config.profileTrace.empty()) {
                     try {
-                        auto data = device->getPipelineCacheData(pipelineCache.get());
-                        spdlog::debug("Saving pipeline cache of {} bytes", data.size()*sizeof(decltype(data)::value_type));
-                        auto path = get_cache_dir() / config.name / "pipeline_cache.bin";
-
-                        if(!std::filesystem::exists(path.parent_path()))
-                            std::filesystem::create_directories(path.parent_path());
-
-                        std::ofstream out(path, std::ios::binary);
-                        if(out) {
-                            std::ranges::copy(data, std::ostream_iterator<uint8_t>(out));
-                        } else {
-                            spdlog::warn("Failed to open pipeline cache for writing: {}", path.string());
-                        }
+                        frameProfiler->save_chrome_trace(config.profileTrace);
                     } catch(const std::exception& e) {
-                        spdlog::warn("Failed to save pipeline cache: {}", e.what());
+                        spdlog::warn("Failed to save profiler trace: {}", e.what());
                     }
                 }
+                if(memoryTracker && !config.memory_report.empty()) {
+                    try {
+                        memoryTracker->save_json(config.memory_report);
+                    } catch(const std::exception& e) {
+                        spdlog::warn("Failed to save memory report: {}", e.what());
+                    }
+                }
+            }
+            frameProfiler.reset();
+            headlessEncoder.reset();
+            headlessStream.reset();
+            headlessTerminal.reset();
+            headlessConverter.reset();
+            if(pendingPhase && pendingPhase->prepared.valid()) {
+                pendingPhase->prepared.wait();
             }
+            pendingPhase.reset();
             current_renderer.reset();
+            // Saves the pipeline cache, after the renderers waited for their pipelines.
+            pipelineCompiler.reset();
+            pipelineCache = nullptr;
             loader.reset();
+            // After everything that submits jobs, it runs the jobs that are still queued.
+            jobSystem.reset();
+            fontCache.reset();
 
+            headlessOutputMappings.clear();
             headlessTextures.clear();
             headlessOutputBuffers.clear();
             headlessOutputAllocations.clear();
@@ -247,7 +322,9 @@ export class window
                 }
                 allocatorInitialized = false;
             }
+            memoryTracker.reset();
 
+            audioAnalyser.reset();
             if(audioInitialized) {
                 sdl::mix::CloseAudio();
                 sdl::mix::Quit();
@@ -283,7 +360,8 @@ export class window
                     spdlog::info("Switching log to stderr");
                     // https://github.com/gabime/spdlog/wiki/0.-FAQ#switch-the-default-logger-to-stderr
                     //spdlog::set_default_logger(spdlog::stderr_color_st("temp")); does not work :(
-                    spdlog::set_default_logger(spdlog::stderr_color_st("stderr"));
+                    // Frames are presented from the encoder threads, so the logger must be thread-safe.
+                    spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
 
 #if __linux__
                     struct termios term{};
@@ -291,9 +369,6 @@ export class window
                     term.c_lflag &= ~ICANON & ~ECHO;
                     tcsetattr(STDIN_FILENO, TCSANOW, &term);
 #endif
-
-                    static std::vector<char> buffer(32*1024*1024); // 32 MiB buffer, so it is smooth
-                    std::setvbuf(stdout, buffer.data(), _IOFBF, buffer.size());
                 }
                 if(const char* c = std::getenv("DREAMRENDER_HEADLESS_OUTPUT_DIR")) {
                     config.headless_output_dir = c;
@@ -313,6 +388,47 @@ export class window
                 if(const char* c = std::getenv("DREAMRENDER_HEADLESS_FRAMES")) {
                     config.headless_frames = std::stoi(c);
                 }
+                if(std::getenv("DREAMRENDER_HEADLESS_SKIP_UNCHANGED")) {
+                    config.headless_skip_unchanged = env_truthy("DREAMRENDER_HEADLESS_SKIP_UNCHANGED");
+                }
+                if(const char* c = std::getenv("DREAMRENDER_HEADLESS_ENCODER_THREADS")) {
+                    config.headless_encoder_threads = std::stoi(c);
+                }
+                if(const char* c = std::getenv("DREAMRENDER_HEADLESS_ENCODER_QUEUE")) {
+                    config.headless_encoder_queue = std::max(1, std::stoi(c));
+                }
+                if(const char* c = std::getenv("DREAMRENDER_HEADLESS_STREAM")) {
+                    config.headless_stream = c;
+                }
+                if(const char* c = std::getenv("DREAMRENDER_HEADLESS_STREAM_FORMAT")) {
+                    config.headless_stream_format = parse_video_format(c);
+                }
+                if(const char* c = std::getenv("DREAMRENDER_HEADLESS_STREAM_WIDTH")) {
+                    config.headless_stream_width = std::stoi(c);
+                }
+                if(const char* c = std::getenv("DREAMRENDER_HEADLESS_STREAM_HEIGHT")) {
+                    config.headless_stream_height = std::stoi(c);
+                }
+                if(const char* c = std::getenv("DREAMRENDER_HEADLESS_STREAM_FPS")) {
+                    config.headless_stream_fps = std::stoi(c);
+                }
+                if(config.headless_stream == "-" && !config.headless_terminal) {
+                    // Frames are written to stdout, so log lines there would corrupt the stream.
+                    spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+                }
+                if(!config.headless_stream.empty() && (!config.headless_output_dir.empty() || config.headless_terminal)) {
+                    spdlog::warn("Streaming headless output to \"{}\", image and terminal output are disabled", config.headless_stream);
+                    config.headless_output_dir.clear();
+                    config.headless_terminal = false;
+                }
+                if(!config.headless_output_dir.empty()) {
+                    std::string ext = std::filesystem::path(config.headless_output_format).extension().string();
+                    if(ext != ".png" && ext != ".jpg" && ext != ".jpeg" && ext != ".bmp") {
+                        spdlog::error("Unknown output format \"{}\". Supported formats are: PNG, JPG, BMP", ext);
+                        spdlog::warn("Disabling output of images!");
+                        config.headless_output_dir.clear();
+                    }
+                }
                 if(!config.headless_output_dir.empty() &&
                    !std::filesystem::exists(config.headless_output_dir))
                 {
@@ -329,6 +445,91 @@ export class window
             if(const char* c = std::getenv("DREAMRENDER_PROFILE_FRAME_INTERVAL")) {
                 config.profileFrameInterval = std::max<uint64_t>(1, std::stoull(c));
             }
+            if(std::getenv("DREAMRENDER_PROFILE_GPU")) {
+                config.profileGpu = env_truthy("DREAMRENDER_PROFILE_GPU");
+            }
+            if(auto path = env_path("DREAMRENDER_PROFILE_TRACE"); !path.empty()) {
+                config.profileTrace = path;
+            }
+            if(!config.profileTrace.empty()) {
+                config.profileGpu = true;
+            }
+            if(const char* c = std::getenv("DREAMRENDER_MEMORY_THRESHOLDS")) {
+                config.memory_thresholds = parse_memory_thresholds(c);
+            }
+            if(auto path = env_path("DREAMRENDER_MEMORY_REPORT"); !path.empty()) {
+                config.memory_report = path;
+            }
+            if(const char* c = std::getenv("DREAMRENDER_FPS_LIMIT")) {
+                config.fpsLimit = std::stoi(c);
+            }
+            if(const char* c = std::getenv("DREAMRENDER_RENDER_AHEAD")) {
+                config.pacing.render_ahead = std::max(1, std::stoi(c));
+            }
+            if(std::getenv("DREAMRENDER_LATE_INPUT")) {
+                config.pacing.late_input = env_truthy("DREAMRENDER_LATE_INPUT");
+            }
+            if(std::getenv("DREAMRENDER_SYNTHETIC_CLOCK")) {
+                config.pacing.synthetic_clock = env_truthy("DREAMRENDER_SYNTHETIC_CLOCK");
+            }
+            if(auto path = env_path("DREAMRENDER_INPUT_RECORD"); !path.empty()) {
+                config.input_record = path;
+            }
+            if(auto path = env_path("DREAMRENDER_INPUT_REPLAY"); !path.empty()) {
+                config.input_replay = path;
+            }
+            if(!config.input_replay.empty() && config.headless) {
+                config.pacing.synthetic_clock = true;
+            }
+            if(config.pacing.synthetic_clock && !config.headless) {
+                spdlog::warn("The synthetic clock is only supported in headless mode");
+                config.pacing.synthetic_clock = false;
+            }
+            config.pacing.render_ahead = std::clamp<unsigned int>(config.pacing.render_ahead, 1, MAX_FRAMES_IN_FLIGHT);
+            if(std::getenv("DREAMRENDER_THREADED_RENDER")) {
+                config.threaded_render = env_truthy("DREAMRENDER_THREADED_RENDER");
+            }
+            if(const char* c = std::getenv("DREAMRENDER_PIPELINE_THREADS")) {
+                config.pipeline_threads = std::stoi(c);
+            }
+            if(const char* c = std::getenv("DREAMRENDER_JOB_THREADS")) {
+                config.job_threads = std::stoi(c);
+            }
+            if(std::getenv("DREAMRENDER_FONT_CACHE")) {
+                config.cache_fonts = env_truthy("DREAMRENDER_FONT_CACHE");
+            }
+            if(const char* c = std::getenv("DREAMRENDER_RENDER_QUEUE")) {
+                config.render_queue = std::stoi(c);
+            }
+            config.render_queue = std::max(1u, config.render_queue);
+            if(config.threaded_render && config.workaround_no_swapchain) {
+                spdlog::warn("A render thread is not supported without a swapchain, frames are blitted to the window surface on the main thread");
+                config.threaded_render = false;
+            }
+            if(config.threaded_render && config.pacing.late_input) {
+                spdlog::warn("Late input sampling is not supported with a render thread, input is sampled before the handoff");
+                config.pacing.late_input = false;
+            }
+            pacer = std::make_unique<frame_pacer>(config.pacing);
+            if(config.fpsLimit > 0) {
+                pacer->set_interval(std::chrono::duration_cast<frame_pacer::duration>(std::chrono::duration<double>(1.0 / config.fpsLimit)));
+            } else if(config.pacing.synthetic_clock) {
+                pacer->set_interval(frame_pacer::default_synthetic_interval);
+            }
+            if(!config.input_replay.empty()) {
+                inputReplayer = std::make_unique<input::replayer>(config.input_replay);
+                if(!config.pacing.synthetic_clock) {
+                    spdlog::warn("Replaying input without the synthetic clock, animations will not match the recording");
+                } else if(inputReplayer->frame_interval() > std::chrono::nanoseconds::zero()) {
+                    pacer->set_interval(std::chrono::duration_cast<frame_pacer::duration>(inputReplayer->frame_interval()));
+                }
+                spdlog::info("Replaying input from {}", config.input_replay.string());
+            }
+            if(!config.input_record.empty()) {
+                inputRecorder = std::make_unique<input::recorder>(config.input_record,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(pacer->get_interval()));
+                spdlog::info("Recording input to {}", config.input_record.string());
+            }
             static sdl::initializer sdl_init;
             if(!config.headless) {
                 spdlog::debug("Initializing SDL window");
@@ -342,233 +543,54 @@ export class window
             initVulkan();
             spdlog::debug("Window initialization complete");
         }
+        // Start of the current frame on the pacing clock. With the synthetic clock this
+        // advances by exactly one frame interval per frame, for deterministic animation.
+        // Only valid on the main thread, the render thread uses frame_snapshot::time.
+        std::chrono::steady_clock::time_point frame_time() const {
+            return pacer->frame_start();
+        }
         void loop() {
             startTime = std::chrono::steady_clock::now();
-            lastFrame = startTime;
+            lastEncoderReport = startTime;
             lastFPS = startTime;
             framesInSecond = 0;
 
-            int currentFrame = 0;
-            vk::Result r{};
+            if(config.threaded_render) {
+                threaded_loop();
+                return;
+            }
             for(;;) {
-                auto frameStart = std::chrono::steady_clock::now();
-                auto afterEvents = frameStart;
-                auto afterLimiter = frameStart;
-                auto afterFence = frameStart;
-                auto afterAcquire = frameStart;
-                auto afterRender = frameStart;
-                auto afterPresent = frameStart;
-                if(config.headless) {
-                    if(config.headless_frames > 0 && totalFrameNumber >= config.headless_frames) {
-                        spdlog::info("Finished rendering {} frames", totalFrameNumber);
-                        return;
-                    }
+                frame_timings times{};
+                times.frameStart = std::chrono::steady_clock::now();
+                if(headless_frames_done(totalFrameNumber)) {
+                    finish_loop();
+                    return;
+                }
 
-                    bool quit = false;
-                    if(config.headless_terminal) {
-                        handle_headless_terminal(quit);
-                    } else {
-                        handle_headless_commands(quit);
-                    }
-                    handle_sdl_events(quit);
-                    if(quit) {
-                        return;
-                    }
-                    afterEvents = std::chrono::steady_clock::now();
-                    afterLimiter = afterEvents;
-                } else {
-                    bool quit = false;
-                    handle_sdl_events(quit);
+                wait_while_idle();
+                bool quit = false;
+                if(!config.pacing.late_input) {
+                    poll_input(quit, totalFrameNumber);
                     if(quit) {
+                        finish_headless_output();
                         return;
                     }
-
-                    auto now = std::chrono::steady_clock::now();
-                    afterEvents = now;
-                    auto dt = std::chrono::duration<double>(now - lastFrame).count();
-
-                    // Honour FPS limit if set — sleep until target time based on lastFrame
-                    if(config.fpsLimit > 0) {
-                        auto frame_time = std::chrono::duration<double>(std::chrono::seconds(1)) / config.fpsLimit;
-                        auto target = lastFrame + frame_time;
-                        if(now < target) {
-                            std::this_thread::sleep_until(target);
-                            now = std::chrono::steady_clock::now();
-                        }
-                    }
-                    lastFrame = now;
-                    afterLimiter = now;
                 }
+                times.afterEvents = std::chrono::steady_clock::now();
 
-                std::scoped_lock lock(renderLock);
-                r = device->waitForFences(inFlightFences[currentFrame], true, UINT64_MAX);
-                if(r != vk::Result::eSuccess)
-                    spdlog::error("Waiting for inFlightFences[{}] failed with result {}", currentFrame, vk::to_string(r));
-                afterFence = std::chrono::steady_clock::now();
+                pacer->wait_for_next_frame();
+                times.afterLimiter = std::chrono::steady_clock::now();
 
-                if(swapchainDirty && !config.headless && !config.workaround_no_swapchain) {
-                    spdlog::debug("Swapchain marked dirty; recreating before acquire");
-                    recreateSwapchain();
-                    continue;
+                std::unique_ptr<frame_snapshot> snapshot;
+                if(!config.pacing.late_input) {
+                    snapshot = update_phase(totalFrameNumber);
                 }
+                times.afterUpdate = std::chrono::steady_clock::now();
 
-                unsigned int imageIndex = 0;
-                if(config.headless || config.workaround_no_swapchain) {
-                    // This is incredibly weird and hacky, but by some miracle it works.
-                    imageIndex = (currentFrame)%swapchainImageCount;
-
-                    if(imagesInFlight[imageIndex]) {
-                        r = device->waitForFences({imagesInFlight[imageIndex], headlessFences[imageIndex].get()}, true, UINT64_MAX);
-                        if(r != vk::Result::eSuccess)
-                            spdlog::error("Waiting for imagesInFlight[{0}] and headlessFences[{0}] failed with result {1}", imageIndex, vk::to_string(r));
-
-                        if(!config.headless_output_dir.empty() || config.headless_terminal || config.workaround_no_swapchain) {
-                            std::vector<char> data(swapchainExtent.width*swapchainExtent.height*4);
-                            r = allocator.copyAllocationToMemory(headlessOutputAllocations[imageIndex].get(),
-                                0, data.data(), swapchainExtent.width*swapchainExtent.height*4);
-                            if(r != vk::Result::eSuccess)
-                                spdlog::error("Copying headlessOutputAllocations[{}] to memory failed with result {}", imageIndex, vk::to_string(r));
-
-                            sdl::unique_surface surface{sdl::CreateRGBSurfaceWithFormatFrom(data.data(),
-                                swapchainExtent.width, swapchainExtent.height, 32, swapchainExtent.width*4,
-                                sdl::PixelFormatEnumVales::ARGB8888)};
-
-                            if(!config.headless_output_dir.empty()) {
-                                std::filesystem::path path = config.headless_output_dir / std::vformat(config.headless_output_format, std::make_format_args(totalFrameNumber));
-                                std::string ext = path.extension().string();
-                                if(ext == ".png") {
-                                    sdl::image::SavePNG(surface.get(), path.string().c_str());
-                                } else if(ext == ".jpg" || ext == ".jpeg") {
-                                    sdl::image::SaveJPG(surface.get(), path.string().c_str(), config.headless_output_quality);
-                                } else if(ext == ".bmp") {
-                                    save_bmp(data, static_cast<int>(swapchainExtent.width), static_cast<int>(swapchainExtent.height), path);
-                                } else {
-                                    spdlog::error("Unknown output format \"{}\". Supported formats are: PNG, JPG, BMP", ext);
-                                    spdlog::warn("Disabling output of images!");
-                                    config.headless_output_dir.clear();
-                                }
-                                spdlog::debug("Saved headless output to {}", path.string());
-                            }
-                            if(config.headless_terminal) {
-                                terminal_output(data, swapchainExtent, std::cout);
-                                std::cout << std::flush;
-                            }
-                            if(config.workaround_no_swapchain) {
-                                auto window_surface = sdl::GetWindowSurface(win.get());
-                                sdl::BlitSurface(surface.get(), nullptr, window_surface, nullptr);
-                                sdl::UpdateWindowSurface(win.get());
-                            }
-                        }
-                    }
-
-                    // We need this just to signal the semaphore. THIS IS BAD. Oh well...
-                    vk::CommandBuffer& commandBuffer = headlessCommandBuffersPre[imageIndex];
-                    commandBuffer.begin(vk::CommandBufferBeginInfo());
-                    commandBuffer.end();
-
-                    vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-                    vk::SubmitInfo submitInfo(0, {}, {}, 1, &commandBuffer, 1, &imageAvailableSemaphores[currentFrame].get());
-                    graphicsQueue.submit(submitInfo, {}); // no fence here, we just don't give a shit anymore
-                    afterAcquire = std::chrono::steady_clock::now();
-                } else {
-                    std::tie(r, imageIndex) = device->acquireNextImageKHR(swapchain.get(), UINT64_MAX, imageAvailableSemaphores[currentFrame].get());
-                    if(r == vk::Result::eErrorOutOfDateKHR) {
-                        spdlog::debug("Swapchain out of date on acquire; recreating");
-                        recreateSwapchain();
-                        continue; // retry next frame
-                    } else if(r == vk::Result::eSuboptimalKHR) {
-                        spdlog::debug("Swapchain suboptimal on acquire; recreating");
-                        recreateSwapchain();
-                        continue; // retry next frame
-                    } else if(r != vk::Result::eSuccess) {
-                        spdlog::error("AcquireNextImage failed with result {}", vk::to_string(r));
-                        recreateSwapchain();
-                        continue;
-                    }
-                    if(imagesInFlight[imageIndex]) {
-                        r = device->waitForFences(imagesInFlight[imageIndex], true, UINT64_MAX);
-                        if(r != vk::Result::eSuccess)
-                            spdlog::error("Waiting for imagesInFlight[{}] failed with result {}", imageIndex, vk::to_string(r));
-                    }
-                    afterAcquire = std::chrono::steady_clock::now();
-                }
-                imagesInFlight[imageIndex] = inFlightFences[currentFrame];
-
-                device->resetFences(fences[currentFrame].get());
-
-                if(!current_renderer)
-                    throw std::runtime_error("No renderer set!");
-                current_renderer->render(imageIndex, imageAvailableSemaphores[currentFrame].get(), renderFinishedSemaphores[currentFrame].get(), inFlightFences[currentFrame]);
-                afterRender = std::chrono::steady_clock::now();
-
-                if(config.headless || config.workaround_no_swapchain) {
-                    device->resetFences(headlessFences[imageIndex].get());
-
-                    vk::CommandBuffer& commandBuffer = headlessCommandBuffersPost[imageIndex];
-                    commandBuffer.begin(vk::CommandBufferBeginInfo());
-                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput,
-                        vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
-                        vk::ImageMemoryBarrier(vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eTransferRead,
-                            swapchainFinalLayout, vk::ImageLayout::eTransferSrcOptimal,
-                            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, headlessTextures[imageIndex].image,
-                            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
-                    commandBuffer.copyImageToBuffer(headlessTextures[imageIndex].image, vk::ImageLayout::eTransferSrcOptimal,
-                        headlessOutputBuffers[imageIndex].get(),
-                        vk::BufferImageCopy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-                            vk::Offset3D(0, 0, 0),
-                            vk::Extent3D(swapchainExtent, 1)));
-                    commandBuffer.end();
-
-                    vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-                    vk::SubmitInfo submitInfo(1, &renderFinishedSemaphores[currentFrame].get(), &waitStages, 1, &commandBuffer, 0, {});
-                    graphicsQueue.submit(submitInfo, headlessFences[imageIndex].get()); // we need this fence, or everything explodes
-                    afterPresent = std::chrono::steady_clock::now();
-                } else {
-                    vk::PresentInfoKHR present_info(renderFinishedSemaphores[currentFrame].get(), swapchain.get(), imageIndex);
-                    r = presentQueue.presentKHR(present_info);
-                    if(r == vk::Result::eErrorOutOfDateKHR || r == vk::Result::eSuboptimalKHR) {
-                        spdlog::debug("Present {} ; recreating swapchain", (r==vk::Result::eErrorOutOfDateKHR?"out-of-date":"suboptimal"));
-                        recreateSwapchain();
-                    } else if(r != vk::Result::eSuccess) {
-                        spdlog::error("Present failed with result {}", vk::to_string(r));
-                    }
-                    afterPresent = std::chrono::steady_clock::now();
-                }
-
-                uint64_t profileInterval = std::max<uint64_t>(1, config.profileFrameInterval);
-                if(config.profileFrames && totalFrameNumber % profileInterval == 0) {
-                    auto ms = [](auto duration) {
-                        return std::chrono::duration<double, std::milli>(duration).count();
-                    };
-                    spdlog::debug("Frame {} CPU timings: events/limit/fence/acquire/render/present/total = {:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f} ms",
-                        totalFrameNumber,
-                        ms(afterEvents - frameStart),
-                        ms(afterLimiter - afterEvents),
-                        ms(afterFence - afterLimiter),
-                        ms(afterAcquire - afterFence),
-                        ms(afterRender - afterAcquire),
-                        ms(afterPresent - afterRender),
-                        ms(afterPresent - frameStart));
-                }
-
-                currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-
-                totalFrameNumber++;
-                framesInSecond++;
-                auto t = std::chrono::steady_clock::now();
-                using namespace std::chrono_literals;
-                if((t-lastFPS) > (1000ms/fpsSampleRate))
-                {
-                    currentFPS = framesInSecond / std::chrono::duration<double>(t-lastFPS).count();
-                    lastFPS = t;
-                    framesInSecond = 0;
-
-                    if(fpsCount%fpsSampleRate == 0)
-                    {
-                        spdlog::debug("{} FPS", currentFPS);
-                        fpsCount = 0;
-                    }
-                    fpsCount++;
+                render_frame(times, snapshot.get(), quit);
+                if(quit) {
+                    finish_headless_output();
+                    return;
                 }
             }
         }
@@ -583,6 +605,11 @@ export class window
 
             if(recreate) {
                 device->waitIdle();
+                // A staged phase may be preparing with the old swapchain images.
+                if(pendingPhase && pendingPhase->prepared.valid()) {
+                    pendingPhase->prepared.wait();
+                }
+                swapchainGeneration++;
             }
 
             swapchainSupport = querySwapChainSupport(physicalDevice);
@@ -632,22 +659,30 @@ export class window
             }
             imagesInFlight.assign(swapchainImageCount, vk::Fence());
             swapchainDirty = false;
+            if(frameProfiler) {
+                frameProfiler->set_frame_count(swapchainImageCount);
+            }
 
             if(recreate && current_renderer) {
                 current_renderer->prepare(swapchainImages, swapchainImageViewsRaw);
             }
+            redrawRequired = true;
         }
 
         void set_phase(phase* renderer, input::keyboard_handler* keyboard_handler = nullptr, input::controller_handler* controller_handler = nullptr) {
-            current_renderer.reset(renderer);
-
-            this->keyboard_handler = keyboard_handler;
-            this->controller_handler = controller_handler;
-            if(controller_handler) {
-                for(auto& [id, controller] : controllers) {
-                    controller_handler->add_controller(controller.get());
+            wait_render_idle();
+            std::scoped_lock lock(renderLock);
+            // A phase staged earlier must not replace the one set explicitly.
+            if(pendingPhase) {
+                spdlog::debug("Dropping staged phase \"{}\"", type_name(*pendingPhase->next));
+                if(pendingPhase->prepared.valid()) {
+                    pendingPhase->prepared.wait();
                 }
+                pendingPhase.reset();
             }
+            current_renderer.reset(renderer);
+            redrawRequired = true;
+            set_input_handlers(keyboard_handler, controller_handler);
 
             auto t0 = std::chrono::high_resolution_clock::now();
             spdlog::debug("Preparing phase: preload");
@@ -658,6 +693,9 @@ export class window
             auto tPrepare = std::chrono::high_resolution_clock::now();
             spdlog::debug("Preparing phase: waitLoad");
             current_renderer->waitLoad(); // replace with loading screen
+            if(pipelineCompiler) {
+                pipelineCompiler->wait_idle();
+            }
             auto tWaitLoad = std::chrono::high_resolution_clock::now();
             spdlog::debug("Preparing phase: init");
             current_renderer->init();
@@ -673,16 +711,57 @@ export class window
             spdlog::debug("Timing for phase \"{}\": preload/prepare/load/init/total: {}/{}/{}/{}/{} ms", name, dPreload, dPrepare, dWaitLoad, dInit, dTotal);
         }
 
+        // Stages a transition to the phase without stopping the current one. The phase is
+        // preloaded and prepared on a background thread, and replaces the current phase at the
+        // start of the first frame after it is ready (see phase::ready) and the pipeline compiler
+        // is idle. Its init() is called then. Must be called on the main thread, a phase that was
+        // queued before and did not replace the current one yet is dropped.
+        void queue_phase(phase* next, input::keyboard_handler* keyboard_handler = nullptr, input::controller_handler* controller_handler = nullptr) {
+            if(!current_renderer) {
+                set_phase(next, keyboard_handler, controller_handler);
+                return;
+            }
+            auto staged = std::make_unique<pending_phase>();
+            staged->next.reset(next);
+            staged->keyboard_handler = keyboard_handler;
+            staged->controller_handler = controller_handler;
+            staged->queued = std::chrono::steady_clock::now();
+
+            std::unique_ptr<pending_phase> dropped;
+            {
+                std::scoped_lock lock(renderLock);
+                staged->swapchainGeneration = swapchainGeneration;
+                staged->prepared = std::async(std::launch::async,
+                    [p = staged->next.get(), images = swapchainImages, views = swapchainImageViewsRaw]() {
+                        p->preload();
+                        p->prepare(images, views);
+                    }).share();
+                dropped = std::exchange(pendingPhase, std::move(staged));
+            }
+            if(dropped) {
+                spdlog::debug("Dropping staged phase \"{}\"", type_name(*dropped->next));
+                dropped->prepared.wait();
+            }
+        }
+        // A phase was queued with queue_phase and did not replace the current one yet.
+        bool phase_pending() const {
+            return pendingPhase != nullptr;
+        }
+
         window_config config;
 
         std::unique_ptr<resource_loader> loader;
 
         std::unique_ptr<phase> current_renderer;
+        // Objects the phases share, see phase::shared.
+        shared_objects sharedObjects;
         input::keyboard_handler* keyboard_handler = nullptr;
         input::controller_handler* controller_handler = nullptr;
 
         sdl::unique_window win;
-        uint32_t window_width, window_height;
+        // Drawable size in pixels, published by the thread handling SDL events and read by
+        // the thread recreating the swapchain, which must not query SDL itself.
+        std::atomic<uint32_t> window_width = 0, window_height = 0;
 
         vk::UniqueInstance instance;
         vk::UniqueSurfaceKHR surface;
@@ -717,9 +796,28 @@ export class window
         std::vector<vk::CommandBuffer> headlessCommandBuffersPre;
         std::vector<vk::CommandBuffer> headlessCommandBuffersPost;
         std::vector<vma::UniqueBuffer> headlessOutputBuffers;
-        std::vector<vma::UniqueAllocation> headlessOutputAllocations;
+        std::vector<tracked_allocation> headlessOutputAllocations;
+        std::vector<vma::MemoryMapping> headlessOutputMappings;
         std::vector<vk::UniqueFence> headlessFences;
 
+        // Readback buffers are not tied to an image, so a frame can be encoded while later ones render.
+        struct headless_readback {
+            int output = -1;
+            uint64_t frame = 0;
+        };
+        std::vector<headless_readback> headlessPending;
+        std::vector<unsigned int> headlessFreeOutputs;
+        std::mutex headlessOutputLock;
+        std::condition_variable headlessOutputAvailable;
+        std::unique_ptr<frame_encoder> headlessEncoder;
+        std::unique_ptr<yuv_converter> headlessConverter;
+        std::unique_ptr<video_sink> headlessStream;
+        std::unique_ptr<terminal_presenter> headlessTerminal;
+        vk::Extent2D headlessStreamExtent;
+        vk::DeviceSize headlessOutputSize = 0;
+        uint64_t lastEncoderFrames = 0;
+        std::chrono::steady_clock::time_point lastEncoderReport;
+
         const int MAX_FRAMES_IN_FLIGHT = 2;
         std::vector<vk::UniqueSemaphore> imageAvailableSemaphores;
         std::vector<vk::UniqueSemaphore> renderFinishedSemaphores;
@@ -728,10 +826,23 @@ export class window
         std::vector<vk::Fence> imagesInFlight;
         std::vector<vk::Fence> inFlightFences;
 
-        vk::UniquePipelineCache pipelineCache;
+        // Compiles the pipelines of the renderers in the background, it is the active compiler.
+        std::unique_ptr<pipeline_compiler> pipelineCompiler;
+        // The compiler's cache, for pipelines that are created synchronously.
+        vk::PipelineCache pipelineCache;
+
+        // Only created if window_config::profileGpu is set. It is the active profiler,
+        // so the zones opened by the renderers report to it.
+        std::unique_ptr<profiler> frameProfiler;
+        // The active memory tracker, it counts the allocations of all subsystems.
+        std::unique_ptr<memory_tracker> memoryTracker;
+        // The active job system, for the loader, the headless encoder and other CPU work.
+        std::unique_ptr<job_system> jobSystem;
+        // The active font cache, unless window_config::cache_fonts is off.
+        std::unique_ptr<font_cache> fontCache;
 
         std::chrono::steady_clock::time_point startTime;
-        std::chrono::steady_clock::time_point lastFrame;
+        std::unique_ptr<frame_pacer> pacer;
 
         uint64_t totalFrameNumber{};
         static constexpr int fpsSampleRate = 5;
@@ -740,11 +851,51 @@ export class window
         int fpsCount{};
         double currentFPS{};
         int refreshRate{};
-        bool swapchainDirty = false;
+        // Set on the main thread, handled where frames are rendered. With a render thread it is
+        // also set by that thread, and the main thread recreates the swapchain.
+        std::atomic<bool> swapchainDirty = false;
+        // The images do not hold anything the phase drew, so frames must not be skipped.
+        // Guarded by renderLock.
+        bool redrawRequired = true;
+        uint64_t skippedFrames{};
+        // The last frame was skipped outside of headless mode, see wait_while_idle.
+        std::atomic<bool> idleFrame = false;
+        // Damage of the frame being rendered, see phase::set_present_region.
+        std::vector<vk::RectLayerKHR> presentRegion;
         bool audioInitialized = false;
         bool allocatorInitialized = false;
+
+        // Only created if window_config::audio_analysis is set and audio could be opened.
+        std::unique_ptr<audio_analyser> audioAnalyser;
         std::recursive_mutex renderLock{};
 
+        // Frame index for the semaphores and fences, cycles through MAX_FRAMES_IN_FLIGHT.
+        int currentFrame = 0;
+
+        // Only running during loop() with window_config::threaded_render.
+        std::thread renderThread;
+        std::mutex handoffLock;
+        std::condition_variable handoffChanged;
+        std::deque<std::unique_ptr<const frame_snapshot>> handoff;
+        bool renderThreadStop = false;
+        bool renderThreadDrain = false;
+        bool renderThreadBusy = false;
+        std::exception_ptr renderThreadError;
+
+        // A phase staged with queue_phase. Replaced on the main thread under renderLock.
+        struct pending_phase {
+            std::unique_ptr<phase> next;
+            input::keyboard_handler* keyboard_handler = nullptr;
+            input::controller_handler* controller_handler = nullptr;
+            // Preloaded and prepared for the swapchain of this generation.
+            std::shared_future<void> prepared;
+            uint64_t swapchainGeneration = 0;
+            std::chrono::steady_clock::time_point queued;
+        };
+        std::unique_ptr<pending_phase> pendingPhase;
+        // Counts swapchain recreations, guarded by renderLock.
+        uint64_t swapchainGeneration = 0;
+
         struct sdl_controller_closer {
             void operator()(sdl::GameController* ptr) const {
                 sdl::GameControllerClose(ptr);
@@ -752,28 +903,51 @@ export class window
         };
         std::map<sdl::JoystickID, std::unique_ptr<sdl::GameController, sdl_controller_closer>> controllers;
 
+        std::unique_ptr<input::recorder> inputRecorder;
+        std::unique_ptr<input::replayer> inputReplayer;
+        // Frame the polled input is applied to, see poll_input.
+        uint64_t inputFrame{};
+        std::vector<input::event> replayEvents;
+
         vk::UniqueDebugUtilsMessengerEXT debugMessenger;
     private:
+        void log_profiler_statistics() {
+            auto cpu = frameProfiler->cpu_frame_statistics();
+            auto gpu = frameProfiler->gpu_frame_statistics();
+            spdlog::debug("CPU frame time p50/p95/p99/max = {:.3f}/{:.3f}/{:.3f}/{:.3f} ms", cpu.p50, cpu.p95, cpu.p99, cpu.max);
+            if(gpu.samples > 0) {
+                spdlog::debug("GPU frame time p50/p95/p99/max = {:.3f}/{:.3f}/{:.3f}/{:.3f} ms", gpu.p50, gpu.p95, gpu.p99, gpu.max);
+            }
+            for(const auto& [name, zone] : frameProfiler->gpu_zone_statistics()) {
+                spdlog::debug("  {}: p50/p95/p99 = {:.3f}/{:.3f}/{:.3f} ms per frame", name, zone.p50, zone.p95, zone.p99);
+            }
+            if(uint64_t dropped = frameProfiler->dropped_gpu_zones(); dropped > 0) {
+                spdlog::debug("  {} GPU zones dropped, raise profiler_config::max_gpu_zones", dropped);
+            }
+        }
+
         vk::Extent2D chooseSwapchainExtent(const vk::SurfaceCapabilitiesKHR& capabilities) {
             if(capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
-                window_width = capabilities.currentExtent.width;
-                window_height = capabilities.currentExtent.height;
                 return capabilities.currentExtent;
             }
+            return vk::Extent2D{
+                std::clamp(window_width.load(), capabilities.minImageExtent.width, capabilities.maxImageExtent.width),
+                std::clamp(window_height.load(), capabilities.minImageExtent.height, capabilities.maxImageExtent.height)
+            };
+        }
 
+        // Must be called on the thread handling SDL events.
+        void update_window_size() {
             int drawableWidth = 0;
             int drawableHeight = 0;
-            SDL_Vulkan_GetDrawableSize(win.get(), &drawableWidth, &drawableHeight);
+            if(!config.workaround_no_swapchain) {
+                SDL_Vulkan_GetDrawableSize(win.get(), &drawableWidth, &drawableHeight);
+            }
             if(drawableWidth <= 0 || drawableHeight <= 0) {
                 SDL_GetWindowSize(win.get(), &drawableWidth, &drawableHeight);
             }
-
             window_width = static_cast<uint32_t>(std::max(1, drawableWidth));
             window_height = static_cast<uint32_t>(std::max(1, drawableHeight));
-            return vk::Extent2D{
-                std::clamp(window_width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width),
-                std::clamp(window_height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height)
-            };
         }
 
         void initWindow() {
@@ -813,8 +987,7 @@ export class window
                 mode = sdl::DisplayMode{};
             }
 
-            window_width = rect.w;
-            window_height = rect.h;
+            update_window_size();
 
             refreshRate = mode.refresh_rate;
         }
@@ -841,6 +1014,22 @@ export class window
                 return;
             }
             audioInitialized = true;
+
+            if(config.audio_analysis) {
+                int frequency = 0;
+                uint16_t format = 0;
+                int channels = 0;
+                sdl::mix::QuerySpec(&frequency, &format, &channels);
+
+                audio_analyser_config analyserConfig = *config.audio_analysis;
+                analyserConfig.sample_rate = static_cast<float>(frequency);
+                audioAnalyser = std::make_unique<audio_analyser>(analyserConfig);
+                if(audioAnalyser->attach_mixer()) {
+                    audioAnalyser->start();
+                } else {
+                    audioAnalyser.reset();
+                }
+            }
         }
         void initVulkan() {
             std::scoped_lock lock(renderLock);
@@ -1090,11 +1279,29 @@ export class window
                 .setDescriptorIndexing(supportedVulkan12Features.descriptorBindingPartiallyBound) // TODO: fix
                 .setDescriptorBindingPartiallyBound(supportedVulkan12Features.descriptorBindingPartiallyBound)
                 .setDescriptorBindingSampledImageUpdateAfterBind(supportedVulkan12Features.descriptorBindingSampledImageUpdateAfterBind)
-                .setDrawIndirectCount(supportedVulkan12Features.drawIndirectCount);
+                .setDrawIndirectCount(supportedVulkan12Features.drawIndirectCount)
+                .setHostQueryReset(supportedVulkan12Features.hostQueryReset);
             vk::PhysicalDeviceFeatures2 features2 = vk::PhysicalDeviceFeatures2()
                 .setFeatures(features)
                 .setPNext(&vulkan12Features);
 
+            const auto availableExtensions = physicalDevice.enumerateDeviceExtensionProperties();
+            auto extensionSupported = [&availableExtensions](std::string_view name) {
+                return std::ranges::any_of(availableExtensions, [name](const vk::ExtensionProperties& e) {
+                    return std::string_view(e.extensionName.data()) == name;
+                });
+            };
+
+            // Dynamic rendering is core in Vulkan 1.3, but we only require 1.2, so it is used through the extension.
+            bool dynamicRendering = false;
+            if(!std::getenv("DREAMRENDER_NO_FEATURES") && !env_truthy("DREAMRENDER_NO_DYNAMIC_RENDERING")) {
+                if(extensionSupported(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+                    auto dynamicChain = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDynamicRenderingFeatures>();
+                    dynamicRendering = dynamicChain.get<vk::PhysicalDeviceDynamicRenderingFeatures>().dynamicRendering;
+                }
+            }
+            vk::PhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures(true);
+
             std::vector<const char*> deviceExtensions = {
                 VK_KHR_MAINTENANCE_3_EXTENSION_NAME,
             };
@@ -1103,7 +1310,16 @@ export class window
             }
             if(!config.headless && !config.workaround_no_swapchain) {
                 deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+                if(extensionSupported(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME)) {
+                    deviceExtensions.push_back(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+                    gpuFeatures.incrementalPresent = true;
+                }
             }
+            if(dynamicRendering) {
+                deviceExtensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+                vulkan12Features.setPNext(&dynamicRenderingFeatures);
+            }
+            spdlog::debug("Dynamic rendering: {}", dynamicRendering ? "enabled" : "disabled");
             #if defined(__APPLE__)
             deviceExtensions.push_back("VK_KHR_portability_subset");
             #endif
@@ -1114,7 +1330,9 @@ export class window
                 .setPNext(&features2);
             gpuFeatures.features = features;
             gpuFeatures.vulkan12Features = vulkan12Features;
+            gpuFeatures.vulkan12Features.pNext = nullptr;
             gpuFeatures.limits = physicalDevice.getProperties().limits;
+            gpuFeatures.dynamicRendering = dynamicRendering;
 
             device = physicalDevice.createDeviceUnique(device_info);
             VULKAN_HPP_DEFAULT_DISPATCHER.init(*device);
@@ -1141,6 +1359,20 @@ export class window
             allocator = vma::createAllocator(allocator_info);
             allocatorInitialized = true;
 
+            memoryTracker = std::make_unique<memory_tracker>(allocator, physicalDevice.getMemoryProperties());
+            for(const auto& [tag, bytes] : config.memory_thresholds) {
+                memoryTracker->set_threshold(tag, bytes);
+            }
+            memory_tracker::set_active(memoryTracker.get());
+
+            jobSystem = std::make_unique<job_system>(config.job_threads);
+            job_system::set_active(jobSystem.get());
+
+            if(config.cache_fonts) {
+                fontCache = std::make_unique<font_cache>(get_cache_dir() / config.name / "fonts");
+                font_cache::set_active(fontCache.get());
+            }
+
             // Upload command buffers publish resources for shader and vertex reads, so keep
             // them on the graphics family until cross-family ownership transfers are added.
             loader = std::make_unique<resource_loader>(device.get(), allocator,
@@ -1153,7 +1385,7 @@ export class window
                     (config.headless_terminal && !config.workaround_no_swapchain) ? vk::Format::eR8G8B8A8Srgb : vk::Format::eB8G8R8A8Srgb,
                     vk::ColorSpaceKHR::eSrgbNonlinear
                 };
-                swapchainExtent = config.workaround_no_swapchain ? vk::Extent2D{window_width, window_height} : vk::Extent2D{config.width, config.height};
+                swapchainExtent = config.workaround_no_swapchain ? vk::Extent2D{window_width.load(), window_height.load()} : vk::Extent2D{config.width, config.height};
                 swapchainImageCount = MAX_FRAMES_IN_FLIGHT;
                 swapchainPresentMode = vk::PresentModeKHR::eImmediate;
                 swapchainFinalLayout = vk::ImageLayout::eTransferSrcOptimal;
@@ -1168,19 +1400,54 @@ export class window
                         static_cast<int>(swapchainExtent.width), static_cast<int>(swapchainExtent.height),
                         vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled,
                         swapchainFormat.format, vk::SampleCountFlagBits::e1);
+                    headlessTextures.back().set_memory_tag(memory_tag::headless_output);
                     swapchainImages.push_back(headlessTextures.back().image);
                     vk::ImageViewCreateInfo view_info({}, swapchainImages.back(), vk::ImageViewType::e2D, swapchainFormat.format,
                         vk::ComponentMapping{}, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
                     swapchainImageViews.push_back(device->createImageViewUnique(view_info));
                     swapchainImageViewsRaw.push_back(swapchainImageViews.back().get());
 
-                    vk::BufferCreateInfo buffer_info({}, swapchainExtent.width*swapchainExtent.height*4, vk::BufferUsageFlagBits::eTransferDst);
+                    headlessFences.push_back(device->createFenceUnique(vk::FenceCreateInfo()));
+                }
+                headlessPending.assign(swapchainImageCount, {});
+
+                const bool streamOutput = !config.headless_stream.empty() && !config.workaround_no_swapchain;
+                const bool encodeOutput = !config.headless_output_dir.empty() || config.headless_terminal || streamOutput;
+                if(streamOutput) {
+                    headlessStreamExtent = video_frame_extent(vk::Extent2D{
+                        config.headless_stream_width ? config.headless_stream_width : swapchainExtent.width,
+                        config.headless_stream_height ? config.headless_stream_height : swapchainExtent.height});
+                    headlessOutputSize = video_frame_size(headlessStreamExtent);
+                    headlessStream = std::make_unique<video_sink>(config.headless_stream, config.headless_stream_format,
+                        headlessStreamExtent, config.headless_stream_fps);
+                    headlessStream->set_repeatable(config.headless_skip_unchanged);
+                } else {
+                    headlessOutputSize = swapchainExtent.width*swapchainExtent.height*4;
+                }
+                const unsigned int outputCount = swapchainImageCount + (encodeOutput ? config.headless_encoder_queue : 0);
+                for(unsigned int i=0; i<outputCount; i++) {
+                    vk::BufferCreateInfo buffer_info({}, headlessOutputSize,
+                        streamOutput ? vk::BufferUsageFlagBits::eStorageBuffer : vk::BufferUsageFlagBits::eTransferDst);
                     vma::AllocationCreateInfo alloc_info({}, vma::MemoryUsage::eGpuToCpu);
-                    auto [buf, alloc] = allocator.createBufferUnique(buffer_info, alloc_info);
+                    auto [buf, alloc] = create_tracked_buffer(allocator, memory_tag::headless_output, buffer_info, alloc_info);
+                    headlessOutputMappings.emplace_back(allocator, alloc.get());
                     headlessOutputBuffers.push_back(std::move(buf));
                     headlessOutputAllocations.push_back(std::move(alloc));
-
-                    headlessFences.push_back(device->createFenceUnique(vk::FenceCreateInfo()));
+                    headlessFreeOutputs.push_back(i);
+                }
+                if(config.headless_terminal) {
+                    headlessTerminal = std::make_unique<terminal_presenter>();
+                }
+                if(encodeOutput) {
+                    headlessEncoder = std::make_unique<frame_encoder>(config.headless_encoder_threads, config.headless_encoder_queue,
+                        [this](uint64_t frame, std::span<const char> pixels) { encode_headless_output(frame, pixels); },
+                        [this](uint64_t frame, std::span<const char> pixels) { commit_headless_output(frame, pixels); });
+                    if(headlessEncoder->on_job_system()) {
+                        spdlog::debug("Encoding headless output on the job system with {} readback buffers", outputCount);
+                    } else {
+                        spdlog::debug("Using {} headless encoder threads with {} readback buffers",
+                            config.headless_encoder_threads ? config.headless_encoder_threads : std::max(1u, std::thread::hardware_concurrency() / 2), outputCount);
+                    }
                 }
 
                 vk::CommandPoolCreateInfo pool_info({}, queueFamilyIndices.graphicsFamily.value());
@@ -1225,21 +1492,22 @@ export class window
             }
 #endif
 
-            {
-                auto path = get_cache_dir() / config.name / "pipeline_cache.bin";
+            pipelineCompiler = std::make_unique<pipeline_compiler>(device.get(), deviceProperties,
+                get_cache_dir() / config.name / "pipeline_cache.bin", config.pipeline_threads);
+            pipeline_compiler::set_active(pipelineCompiler.get());
+            pipelineCache = pipelineCompiler->cache();
 
-                std::ifstream in(path, std::ios::binary);
-                if(in) {
-                    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
-                    spdlog::debug("Loaded pipeline cache of {} bytes", data.size()*sizeof(decltype(data)::value_type));
-                    vk::PipelineCacheCreateInfo cache_info({}, data.size(), data.data());
-                    pipelineCache = device->createPipelineCacheUnique(cache_info);
-                }
-                else {
-                    spdlog::debug("No existing pipeline cache found");
-                    vk::PipelineCacheCreateInfo cache_info({}, 0, nullptr);
-                    pipelineCache = device->createPipelineCacheUnique(cache_info);
-                }
+            if(headlessStream) {
+                headlessConverter = std::make_unique<yuv_converter>(device.get(), pipelineCache, swapchainImageCount);
+            }
+
+            if(config.profileGpu) {
+                auto families = physicalDevice.getQueueFamilyProperties();
+                frameProfiler = std::make_unique<profiler>(device.get(), deviceProperties,
+                    families[queueFamilyIndices.graphicsFamily.value()].timestampValidBits,
+                    gpuFeatures.vulkan12Features.hostQueryReset);
+                frameProfiler->set_frame_count(swapchainImageCount);
+                profiler::set_active(frameProfiler.get());
             }
         }
 
@@ -1303,38 +1571,26 @@ export class window
                         should_exit = true;
                         return;
                     case sdl::EventType::SDL_KEYDOWN:
-                        if(keyboard_handler)
-                            keyboard_handler->key_down(event.key.keysym);
+                        handle_input({input::event_type::key_down, event.key.keysym});
                         break;
                     case sdl::EventType::SDL_KEYUP:
-                        if(keyboard_handler)
-                            keyboard_handler->key_up(event.key.keysym);
+                        handle_input({input::event_type::key_up, event.key.keysym});
                         break;
                     case sdl::EventType::SDL_WINDOWEVENT:
                         if(event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED || event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                            window_width = static_cast<uint32_t>(std::max(1, event.window.data1));
-                            window_height = static_cast<uint32_t>(std::max(1, event.window.data2));
+                            update_window_size();
                             swapchainDirty = true;
                         }
                         break;
                     case sdl::EventType::SDL_CONTROLLERBUTTONDOWN:
-                        if(controller_handler)
-                            controller_handler->button_down(controllers[event.cbutton.which].get(),
-                                static_cast<sdl::GameControllerButton>(event.cbutton.button)
-                            );
+                        handle_input({.type = input::event_type::button_down, .controller = event.cbutton.which, .control = event.cbutton.button});
                         break;
                     case sdl::EventType::SDL_CONTROLLERBUTTONUP:
-                        if(controller_handler)
-                            controller_handler->button_up(controllers[event.cbutton.which].get(),
-                                static_cast<sdl::GameControllerButton>(event.cbutton.button)
-                            );
+                        handle_input({.type = input::event_type::button_up, .controller = event.cbutton.which, .control = event.cbutton.button});
                         break;
                     case sdl::EventType::SDL_CONTROLLERAXISMOTION:
-                        if(controller_handler)
-                            controller_handler->axis_motion(controllers[event.caxis.which].get(),
-                                static_cast<sdl::GameControllerAxis>(event.caxis.axis),
-                                event.caxis.value
-                            );
+                        handle_input({.type = input::event_type::axis_motion, .controller = event.caxis.which,
+                            .control = event.caxis.axis, .value = event.caxis.value});
                         break;
                     case sdl::EventType::SDL_CONTROLLERDEVICEADDED:
                         if(sdl::IsGameController(event.cdevice.which)) {
@@ -1343,16 +1599,14 @@ export class window
                                 sdl::JoystickID id = sdl::JoystickInstanceID(sdl::GameControllerGetJoystick(controller));
                                 controllers[id] = std::unique_ptr<sdl::GameController, sdl_controller_closer>(controller);
                                 spdlog::debug("Connected controller \"{}\" with id {}", sdl::GameControllerName(controller), id);
-                                if(controller_handler)
-                                    controller_handler->add_controller(controller);
+                                handle_input({.type = input::event_type::controller_added, .controller = id});
                             } else {
                                 spdlog::warn("Failed to open controller {}: {}", event.cdevice.which, sdl::GetError());
                             }
                         }
                         break;
                     case sdl::EventType::SDL_CONTROLLERDEVICEREMOVED:
-                        if(controller_handler)
-                            controller_handler->remove_controller(controllers[event.cdevice.which].get());
+                        handle_input({.type = input::event_type::controller_removed, .controller = event.cdevice.which});
                         if(controllers.contains(event.cdevice.which)) {
                             spdlog::debug("Disconnected controller \"{}\" with id {}", sdl::GameControllerName(controllers[event.cdevice.which].get()), event.cdevice.which);
                             controllers.erase(event.cdevice.which);
@@ -1361,6 +1615,739 @@ export class window
             }
         }
 
+        // Input is applied before the update of the given frame.
+        void poll_input(bool& quit, uint64_t frame) {
+            inputFrame = frame;
+            if(config.headless) {
+                if(config.headless_terminal) {
+                    handle_headless_terminal(quit);
+                } else {
+                    handle_headless_commands(quit);
+                }
+            }
+            handle_sdl_events(quit);
+            if(inputReplayer && !quit) {
+                replayEvents.clear();
+                inputReplayer->poll(frame, replayEvents);
+                for(const auto& e : replayEvents) {
+                    if(e.type == input::event_type::quit) {
+                        quit = true;
+                        break;
+                    }
+                    dispatch_input(e);
+                }
+                if(inputReplayer->finished() && !quit) {
+                    spdlog::info("Input replay finished at frame {}", frame);
+                    inputReplayer.reset();
+                }
+            }
+            if(quit && inputRecorder) {
+                inputRecorder->record(frame, {input::event_type::quit});
+            }
+            pacer->input_sampled();
+        }
+        // Live input is ignored while a log is replayed.
+        void handle_input(const input::event& e) {
+            if(!inputReplayer) {
+                dispatch_input(e);
+            }
+        }
+        // Controllers that are not connected, e.g. during a headless replay, are passed as nullptr.
+        void dispatch_input(const input::event& e) {
+            if(inputRecorder) {
+                inputRecorder->record(inputFrame, e);
+            }
+            sdl::GameController* controller = nullptr;
+            if(auto it = controllers.find(e.controller); it != controllers.end()) {
+                controller = it->second.get();
+            }
+            switch(e.type) {
+                case input::event_type::key_down:
+                    if(keyboard_handler)
+                        keyboard_handler->key_down(e.key);
+                    break;
+                case input::event_type::key_up:
+                    if(keyboard_handler)
+                        keyboard_handler->key_up(e.key);
+                    break;
+                case input::event_type::button_down:
+                    if(controller_handler)
+                        controller_handler->button_down(controller, static_cast<sdl::GameControllerButton>(e.control));
+                    break;
+                case input::event_type::button_up:
+                    if(controller_handler)
+                        controller_handler->button_up(controller, static_cast<sdl::GameControllerButton>(e.control));
+                    break;
+                case input::event_type::axis_motion:
+                    if(controller_handler)
+                        controller_handler->axis_motion(controller, static_cast<sdl::GameControllerAxis>(e.control), e.value);
+                    break;
+                case input::event_type::controller_added:
+                    if(controller_handler)
+                        controller_handler->add_controller(controller);
+                    break;
+                case input::event_type::controller_removed:
+                    if(controller_handler)
+                        controller_handler->remove_controller(controller);
+                    break;
+                case input::event_type::quit:
+                    break;
+            }
+        }
+        // Waits until at most render_ahead - 1 earlier frames are still executing on the GPU.
+        void wait_render_ahead(int frame) {
+            const int renderAhead = static_cast<int>(config.pacing.render_ahead);
+            for(int k = MAX_FRAMES_IN_FLIGHT; k >= renderAhead; k--) {
+                int index = (frame - k % MAX_FRAMES_IN_FLIGHT + MAX_FRAMES_IN_FLIGHT) % MAX_FRAMES_IN_FLIGHT;
+                vk::Result r = device->waitForFences(inFlightFences[index], true, UINT64_MAX);
+                if(r != vk::Result::eSuccess)
+                    spdlog::error("Waiting for inFlightFences[{}] failed with result {}", index, vk::to_string(r));
+            }
+        }
+
+        struct frame_timings {
+            std::chrono::steady_clock::time_point frameStart;
+            std::chrono::steady_clock::time_point afterEvents;
+            std::chrono::steady_clock::time_point afterLimiter;
+            std::chrono::steady_clock::time_point afterUpdate;
+            std::chrono::steady_clock::time_point afterFence;
+            std::chrono::steady_clock::time_point afterLateEvents;
+            std::chrono::steady_clock::time_point afterAcquire;
+            std::chrono::steady_clock::time_point afterRender;
+            std::chrono::steady_clock::time_point afterPresent;
+        };
+
+        bool headless_frames_done(uint64_t frames) const {
+            return config.headless && config.headless_frames > 0 && frames >= static_cast<uint64_t>(config.headless_frames);
+        }
+        void finish_loop() {
+            finish_headless_output();
+            spdlog::info("Finished rendering {} frames", totalFrameNumber);
+            if(headlessEncoder) {
+                spdlog::info("Wrote {} frames at {:.2f} frames per second", headlessEncoder->frames_written(),
+                    headlessEncoder->frames_written() / std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+            }
+            if(headlessStream) {
+                spdlog::info("Streamed {:.1f} MiB of video", headlessStream->bytes_written() / (1024.0 * 1024.0));
+            }
+        }
+
+        // A frame that looks like the previous one is neither rendered nor presented.
+        // Headless output is flushed first, so the encoder repeats the frame in order.
+        void skip_frame() {
+            if(config.headless && headlessEncoder) {
+                flush_headless_output();
+                headlessEncoder->repeat(totalFrameNumber);
+            }
+            if(!config.headless) {
+                idleFrame = true;
+            }
+            skippedFrames++;
+            totalFrameNumber++;
+        }
+        // Nothing waits on presentation after a skipped frame, so without a frame limit the loop
+        // would spin. Blocks the thread handling events until an event arrives or one refresh
+        // interval of the display has passed.
+        void wait_while_idle() {
+            if(!idleFrame.exchange(false)) {
+                return;
+            }
+            const int rate = refreshRate > 0 ? refreshRate : 60;
+            sdl::WaitEventTimeout(nullptr, std::max(1, 1000 / rate));
+        }
+
+        void set_input_handlers(input::keyboard_handler* keyboard_handler, input::controller_handler* controller_handler) {
+            this->keyboard_handler = keyboard_handler;
+            this->controller_handler = controller_handler;
+            if(controller_handler) {
+                for(auto& [id, controller] : controllers) {
+                    controller_handler->add_controller(controller.get());
+                }
+            }
+        }
+
+        // Replaces the current phase with the staged one once it is ready. Runs on the main
+        // thread at the start of a frame, so the snapshot of the frame comes from the new phase.
+        void activate_pending_phase() {
+            if(!pendingPhase) {
+                return;
+            }
+            if(pendingPhase->prepared.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return;
+            }
+            if(!pendingPhase->next->ready() || (pipelineCompiler && pipelineCompiler->pending() > 0)) {
+                return;
+            }
+
+            wait_render_idle();
+            std::scoped_lock lock(renderLock);
+            auto t0 = std::chrono::steady_clock::now();
+            std::unique_ptr<pending_phase> staged = std::move(pendingPhase);
+            // Rethrows if preloading failed.
+            staged->prepared.get();
+
+            // The previous phase is destroyed below, so its frames must be done on the GPU.
+            vk::Result r = device->waitForFences(inFlightFences, true, UINT64_MAX);
+            if(r != vk::Result::eSuccess) {
+                spdlog::error("Waiting for inFlightFences failed with result {}", vk::to_string(r));
+            }
+            if(staged->swapchainGeneration != swapchainGeneration) {
+                staged->next->prepare(swapchainImages, swapchainImageViewsRaw);
+            }
+            std::unique_ptr<phase> previous = std::exchange(current_renderer, std::move(staged->next));
+            redrawRequired = true;
+            set_input_handlers(staged->keyboard_handler, staged->controller_handler);
+            current_renderer->init();
+            previous.reset();
+
+            auto t1 = std::chrono::steady_clock::now();
+            spdlog::debug("Switched to phase \"{}\" {} ms after it was queued, the switch took {} ms", type_name(*current_renderer),
+                std::chrono::duration_cast<std::chrono::milliseconds>(t1 - staged->queued).count(),
+                std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count());
+        }
+
+        std::unique_ptr<frame_snapshot> update_phase(uint64_t frameNumber) {
+            activate_pending_phase();
+            if(!current_renderer)
+                throw std::runtime_error("No renderer set!");
+            std::unique_ptr<frame_snapshot> snapshot = current_renderer->update();
+            if(!snapshot)
+                throw std::runtime_error("Phase did not produce a frame snapshot");
+            snapshot->source = current_renderer.get();
+            snapshot->frame_number = frameNumber;
+            snapshot->time = pacer->frame_start();
+            snapshot->input_time = pacer->input_time();
+            return snapshot;
+        }
+
+        // Records, submits and presents one frame. Without a snapshot, input is sampled here
+        // if late input is enabled and the phase is updated right before recording.
+        // Returns false if the swapchain had to be recreated instead, or if input asked to quit.
+        bool render_frame(frame_timings& times, const frame_snapshot* snapshot, bool& quit) {
+            std::scoped_lock lock(renderLock);
+            wait_render_ahead(currentFrame);
+            times.afterFence = std::chrono::steady_clock::now();
+
+            // Sample input only once the GPU has caught up, right before recording.
+            std::unique_ptr<frame_snapshot> lateSnapshot;
+            times.afterLateEvents = times.afterFence;
+            if(!snapshot) {
+                if(config.pacing.late_input) {
+                    poll_input(quit, totalFrameNumber);
+                    if(quit) {
+                        return false;
+                    }
+                }
+                lateSnapshot = update_phase(totalFrameNumber);
+                snapshot = lateSnapshot.get();
+                times.afterLateEvents = std::chrono::steady_clock::now();
+            }
+
+            if(swapchainDirty && !config.headless && !config.workaround_no_swapchain) {
+                if(on_render_thread()) {
+                    spdlog::debug("Swapchain marked dirty; dropping frame {} until it is recreated", snapshot->frame_number);
+                    return true;
+                }
+                spdlog::debug("Swapchain marked dirty; recreating before acquire");
+                recreateSwapchain();
+                return false;
+            }
+
+            if(snapshot->unchanged && !redrawRequired && (!config.headless || config.headless_skip_unchanged)) {
+                skip_frame();
+                return true;
+            }
+
+            vk::Result r{};
+            unsigned int imageIndex = 0;
+            if(config.headless || config.workaround_no_swapchain) {
+                // This is incredibly weird and hacky, but by some miracle it works.
+                imageIndex = (currentFrame)%swapchainImageCount;
+
+                if(imagesInFlight[imageIndex]) {
+                    r = device->waitForFences({imagesInFlight[imageIndex], headlessFences[imageIndex].get()}, true, UINT64_MAX);
+                    if(r != vk::Result::eSuccess)
+                        spdlog::error("Waiting for imagesInFlight[{0}] and headlessFences[{0}] failed with result {1}", imageIndex, vk::to_string(r));
+
+                    submit_headless_output(imageIndex);
+                }
+
+                // We need this just to signal the semaphore. THIS IS BAD. Oh well...
+                vk::CommandBuffer& commandBuffer = headlessCommandBuffersPre[imageIndex];
+                commandBuffer.begin(vk::CommandBufferBeginInfo());
+                commandBuffer.end();
+
+                vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+                vk::SubmitInfo submitInfo(0, {}, {}, 1, &commandBuffer, 1, &imageAvailableSemaphores[currentFrame].get());
+                graphicsQueue.submit(submitInfo, {}); // no fence here, we just don't give a shit anymore
+                times.afterAcquire = std::chrono::steady_clock::now();
+            } else {
+                std::tie(r, imageIndex) = device->acquireNextImageKHR(swapchain.get(), UINT64_MAX, imageAvailableSemaphores[currentFrame].get());
+                if(r == vk::Result::eErrorOutOfDateKHR) {
+                    spdlog::debug("Swapchain out of date on acquire; recreating");
+                    request_swapchain_recreation();
+                    return false; // retry next frame
+                } else if(r == vk::Result::eSuboptimalKHR) {
+                    spdlog::debug("Swapchain suboptimal on acquire; recreating");
+                    request_swapchain_recreation();
+                    return false; // retry next frame
+                } else if(r != vk::Result::eSuccess) {
+                    spdlog::error("AcquireNextImage failed with result {}", vk::to_string(r));
+                    request_swapchain_recreation();
+                    return false;
+                }
+                if(imagesInFlight[imageIndex]) {
+                    r = device->waitForFences(imagesInFlight[imageIndex], true, UINT64_MAX);
+                    if(r != vk::Result::eSuccess)
+                        spdlog::error("Waiting for imagesInFlight[{}] failed with result {}", imageIndex, vk::to_string(r));
+                }
+                times.afterAcquire = std::chrono::steady_clock::now();
+            }
+            if(frameProfiler) {
+                frameProfiler->begin_frame(imageIndex, totalFrameNumber);
+            }
+            imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
+            device->resetFences(fences[currentFrame].get());
+
+            presentRegion.clear();
+            current_renderer->render(imageIndex, *snapshot, imageAvailableSemaphores[currentFrame].get(), renderFinishedSemaphores[currentFrame].get(), inFlightFences[currentFrame]);
+            redrawRequired = false;
+            times.afterRender = std::chrono::steady_clock::now();
+
+            if(config.headless || config.workaround_no_swapchain) {
+                device->resetFences(headlessFences[imageIndex].get());
+
+                vk::CommandBuffer& commandBuffer = headlessCommandBuffersPost[imageIndex];
+                commandBuffer.begin(vk::CommandBufferBeginInfo());
+                if(headlessConverter) {
+                    record_headless_conversion(commandBuffer, imageIndex);
+                } else {
+                    record_headless_copy(commandBuffer, imageIndex);
+                }
+                commandBuffer.end();
+
+                vk::PipelineStageFlags waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+                vk::SubmitInfo submitInfo(1, &renderFinishedSemaphores[currentFrame].get(), &waitStages, 1, &commandBuffer, 0, {});
+                graphicsQueue.submit(submitInfo, headlessFences[imageIndex].get()); // we need this fence, or everything explodes
+                pacer->submitted(snapshot->input_time);
+                times.afterPresent = std::chrono::steady_clock::now();
+            } else {
+                pacer->submitted(snapshot->input_time);
+                vk::PresentInfoKHR present_info(renderFinishedSemaphores[currentFrame].get(), swapchain.get(), imageIndex);
+                vk::PresentRegionKHR region(presentRegion);
+                vk::PresentRegionsKHR regions(region);
+                if(gpuFeatures.incrementalPresent && !presentRegion.empty()) {
+                    present_info.setPNext(&regions);
+                }
+                r = presentQueue.presentKHR(present_info);
+                if(r == vk::Result::eErrorOutOfDateKHR || r == vk::Result::eSuboptimalKHR) {
+                    spdlog::debug("Present {} ; recreating swapchain", (r==vk::Result::eErrorOutOfDateKHR?"out-of-date":"suboptimal"));
+                    request_swapchain_recreation();
+                } else if(r != vk::Result::eSuccess) {
+                    spdlog::error("Present failed with result {}", vk::to_string(r));
+                }
+                times.afterPresent = std::chrono::steady_clock::now();
+            }
+
+            if(frameProfiler) {
+                frameProfiler->end_frame(imageIndex);
+                if(!config.threaded_render) {
+                    frameProfiler->record_cpu("events", times.frameStart, times.afterEvents);
+                    frameProfiler->record_cpu("limit", times.afterEvents, times.afterLimiter);
+                    frameProfiler->record_cpu("update", times.afterLimiter, times.afterUpdate);
+                }
+                frameProfiler->record_cpu("fence", times.afterUpdate, times.afterFence);
+                if(lateSnapshot) {
+                    frameProfiler->record_cpu("late events", times.afterFence, times.afterLateEvents);
+                }
+                frameProfiler->record_cpu("acquire", times.afterLateEvents, times.afterAcquire);
+                frameProfiler->record_cpu("render", times.afterAcquire, times.afterRender);
+                frameProfiler->record_cpu("present", times.afterRender, times.afterPresent);
+            }
+
+            uint64_t profileInterval = std::max<uint64_t>(1, config.profileFrameInterval);
+            if(config.profileFrames && totalFrameNumber % profileInterval == 0) {
+                auto ms = [](auto duration) {
+                    return std::chrono::duration<double, std::milli>(duration).count();
+                };
+                spdlog::debug("Frame {} CPU timings: events/limit/update/fence/acquire/render/present/total = {:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f}/{:.3f} ms",
+                    totalFrameNumber,
+                    ms(times.afterEvents - times.frameStart),
+                    ms(times.afterLimiter - times.afterEvents),
+                    ms((times.afterUpdate - times.afterLimiter) + (times.afterLateEvents - times.afterFence)),
+                    ms(times.afterFence - times.afterUpdate),
+                    ms(times.afterAcquire - times.afterLateEvents),
+                    ms(times.afterRender - times.afterAcquire),
+                    ms(times.afterPresent - times.afterRender),
+                    ms(times.afterPresent - times.frameStart));
+            }
+
+            currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+            totalFrameNumber++;
+            framesInSecond++;
+            auto t = std::chrono::steady_clock::now();
+            using namespace std::chrono_literals;
+            if((t-lastFPS) > (1000ms/fpsSampleRate))
+            {
+                currentFPS = framesInSecond / std::chrono::duration<double>(t-lastFPS).count();
+                lastFPS = t;
+                framesInSecond = 0;
+
+                if(fpsCount%fpsSampleRate == 0)
+                {
+                    spdlog::debug("{} FPS", currentFPS);
+                    if(skippedFrames > 0) {
+                        spdlog::debug("Skipped {} unchanged frames", std::exchange(skippedFrames, 0));
+                    }
+                    spdlog::debug("Input to submit latency: {:.3f} ms average, {:.3f} ms max",
+                        pacer->input_latency_ms(), pacer->take_max_input_latency_ms());
+                    if(frameProfiler && config.profileFrames) {
+                        log_profiler_statistics();
+                    }
+                    if(memoryTracker) {
+                        memoryTracker->check_budget();
+                    }
+                    if(jobSystem && spdlog::should_log(spdlog::level::debug)) {
+                        std::vector<double> u = jobSystem->utilisation();
+                        spdlog::debug("Job system: {:.0f}% average, {:.0f}% max worker utilisation",
+                            100.0 * std::accumulate(u.begin(), u.end(), 0.0) / u.size(), 100.0 * std::ranges::max(u));
+                    }
+                    if(headlessEncoder) {
+                        uint64_t written = headlessEncoder->frames_written();
+                        double seconds = std::chrono::duration<double>(t - lastEncoderReport).count();
+                        spdlog::debug("Headless output: {:.2f} frames per second written, {} queued",
+                            (written - lastEncoderFrames) / seconds, headlessEncoder->queued());
+                        lastEncoderFrames = written;
+                        lastEncoderReport = t;
+                    }
+                    fpsCount = 0;
+                }
+                fpsCount++;
+            }
+            return true;
+        }
+
+        // The main thread handles input and updates the phase, then hands the snapshot to
+        // the render thread. The handoff is bounded, so the main thread runs at most
+        // window_config::render_queue frames ahead of the render thread.
+        void threaded_loop() {
+            {
+                std::scoped_lock lock(handoffLock);
+                handoff.clear();
+                renderThreadStop = false;
+                renderThreadDrain = false;
+                renderThreadBusy = false;
+                renderThreadError = nullptr;
+            }
+            renderThread = std::thread(&window::render_thread_main, this);
+
+            uint64_t queuedFrames = totalFrameNumber;
+            bool finished = false;
+            try {
+                for(;;) {
+                    auto frameStart = std::chrono::steady_clock::now();
+                    if(headless_frames_done(queuedFrames)) {
+                        finished = true;
+                        break;
+                    }
+
+                    wait_while_idle();
+                    bool quit = false;
+                    poll_input(quit, queuedFrames);
+                    if(quit) {
+                        break;
+                    }
+                    if(swapchainDirty && !config.headless && !config.workaround_no_swapchain) {
+                        wait_render_idle();
+                        recreateSwapchain();
+                    }
+                    auto afterEvents = std::chrono::steady_clock::now();
+
+                    pacer->wait_for_next_frame();
+                    auto afterLimiter = std::chrono::steady_clock::now();
+
+                    std::unique_ptr<frame_snapshot> snapshot = update_phase(queuedFrames);
+                    auto afterUpdate = std::chrono::steady_clock::now();
+
+                    {
+                        std::unique_lock lock(handoffLock);
+                        handoffChanged.wait(lock, [this]{
+                            return renderThreadStop || handoff.size() < config.render_queue;
+                        });
+                        if(renderThreadStop) {
+                            break;
+                        }
+                        handoff.push_back(std::move(snapshot));
+                    }
+                    handoffChanged.notify_all();
+                    queuedFrames++;
+                    auto afterHandoff = std::chrono::steady_clock::now();
+
+                    if(frameProfiler) {
+                        frameProfiler->record_cpu("events", frameStart, afterEvents);
+                        frameProfiler->record_cpu("limit", afterEvents, afterLimiter);
+                        frameProfiler->record_cpu("update", afterLimiter, afterUpdate);
+                        frameProfiler->record_cpu("handoff", afterUpdate, afterHandoff);
+                    }
+                }
+            } catch(...) {
+                stop_render_thread(false);
+                throw;
+            }
+
+            // Frames still queued are rendered when the requested number of frames is reached,
+            // and dropped when quitting.
+            stop_render_thread(finished);
+            if(renderThreadError) {
+                std::rethrow_exception(std::exchange(renderThreadError, nullptr));
+            }
+            if(finished) {
+                finish_loop();
+            } else {
+                finish_headless_output();
+            }
+        }
+        void render_thread_main() {
+            try {
+                for(;;) {
+                    std::unique_ptr<const frame_snapshot> snapshot;
+                    {
+                        std::unique_lock lock(handoffLock);
+                        handoffChanged.wait(lock, [this]{
+                            return !handoff.empty() || renderThreadStop;
+                        });
+                        if(renderThreadStop && (!renderThreadDrain || handoff.empty())) {
+                            return;
+                        }
+                        snapshot = std::move(handoff.front());
+                        handoff.pop_front();
+                        renderThreadBusy = true;
+                    }
+                    handoffChanged.notify_all();
+
+                    {
+                        std::scoped_lock lock(renderLock);
+                        // Snapshots are typed by the phase that produced them.
+                        if(snapshot->source == current_renderer.get()) {
+                            bool quit = false;
+                            for(;;) {
+                                frame_timings times{};
+                                times.frameStart = times.afterEvents = times.afterLimiter = times.afterUpdate = std::chrono::steady_clock::now();
+                                if(render_frame(times, snapshot.get(), quit)) {
+                                    break;
+                                }
+                                std::scoped_lock handoffGuard(handoffLock);
+                                if(renderThreadStop && !renderThreadDrain) {
+                                    break;
+                                }
+                            }
+                        } else {
+                            spdlog::debug("Dropping snapshot of frame {} from a previous phase", snapshot->frame_number);
+                        }
+                    }
+
+                    {
+                        std::scoped_lock lock(handoffLock);
+                        renderThreadBusy = false;
+                    }
+                    handoffChanged.notify_all();
+                }
+            } catch(...) {
+                spdlog::error("Render thread failed, stopping");
+                {
+                    std::scoped_lock lock(handoffLock);
+                    renderThreadError = std::current_exception();
+                    renderThreadStop = true;
+                    renderThreadBusy = false;
+                    handoff.clear();
+                }
+                handoffChanged.notify_all();
+            }
+        }
+        void stop_render_thread(bool drain) {
+            if(!renderThread.joinable()) {
+                return;
+            }
+            {
+                std::scoped_lock lock(handoffLock);
+                if(!renderThreadStop) {
+                    renderThreadDrain = drain;
+                }
+                renderThreadStop = true;
+                if(!drain) {
+                    handoff.clear();
+                }
+            }
+            handoffChanged.notify_all();
+            renderThread.join();
+        }
+        bool on_render_thread() const {
+            return renderThread.joinable() && renderThread.get_id() == std::this_thread::get_id();
+        }
+        // The phase is updated on the main thread without renderLock, so the render thread must
+        // not prepare it again. It drops its frames instead until the main thread recreated the swapchain.
+        void request_swapchain_recreation() {
+            if(on_render_thread()) {
+                swapchainDirty = true;
+                return;
+            }
+            recreateSwapchain();
+        }
+        // Waits until the render thread has rendered every queued snapshot.
+        void wait_render_idle() {
+            if(!renderThread.joinable() || on_render_thread()) {
+                return;
+            }
+            std::unique_lock lock(handoffLock);
+            handoffChanged.wait(lock, [this]{
+                return renderThreadStop || (handoff.empty() && !renderThreadBusy);
+            });
+        }
+
+        void record_headless_copy(vk::CommandBuffer commandBuffer, unsigned int imageIndex) {
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+                vk::ImageMemoryBarrier(vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eTransferRead,
+                    swapchainFinalLayout, vk::ImageLayout::eTransferSrcOptimal,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, headlessTextures[imageIndex].image,
+                    vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+            if(!headlessEncoder && !config.workaround_no_swapchain) {
+                return;
+            }
+
+            // Blocks while all readback buffers are queued for encoding.
+            unsigned int output = acquire_headless_output();
+            headlessPending[imageIndex] = {static_cast<int>(output), totalFrameNumber};
+            commandBuffer.copyImageToBuffer(headlessTextures[imageIndex].image, vk::ImageLayout::eTransferSrcOptimal,
+                headlessOutputBuffers[output].get(),
+                vk::BufferImageCopy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+                    vk::Offset3D(0, 0, 0),
+                    vk::Extent3D(swapchainExtent, 1)));
+        }
+        // Converts (and scales) the frame to YUV on the GPU, so only the video frame is read back.
+        void record_headless_conversion(vk::CommandBuffer commandBuffer, unsigned int imageIndex) {
+            unsigned int output = acquire_headless_output();
+            headlessPending[imageIndex] = {static_cast<int>(output), totalFrameNumber};
+
+            vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                vk::PipelineStageFlagBits::eComputeShader, {}, {}, {},
+                vk::ImageMemoryBarrier(vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eShaderRead,
+                    swapchainFinalLayout, vk::ImageLayout::eShaderReadOnlyOptimal,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, headlessTextures[imageIndex].image, range));
+            headlessConverter->convert(commandBuffer, imageIndex, swapchainImageViewsRaw[imageIndex],
+                headlessOutputBuffers[output].get(), headlessStreamExtent, config.headless_stream_format);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                vk::PipelineStageFlagBits::eHost | vk::PipelineStageFlagBits::eColorAttachmentOutput, {},
+                vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead), {},
+                vk::ImageMemoryBarrier(vk::AccessFlagBits::eShaderRead, {},
+                    vk::ImageLayout::eShaderReadOnlyOptimal, swapchainFinalLayout,
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, headlessTextures[imageIndex].image, range));
+        }
+
+        unsigned int acquire_headless_output() {
+            std::unique_lock<std::mutex> l(headlessOutputLock);
+            headlessOutputAvailable.wait(l, [this]{ return !headlessFreeOutputs.empty(); });
+            unsigned int output = headlessFreeOutputs.back();
+            headlessFreeOutputs.pop_back();
+            return output;
+        }
+        void release_headless_output(unsigned int output) {
+            {
+                std::scoped_lock<std::mutex> l(headlessOutputLock);
+                headlessFreeOutputs.push_back(output);
+            }
+            headlessOutputAvailable.notify_one();
+        }
+
+        // Must be called after headlessFences[imageIndex] has signalled.
+        void submit_headless_output(unsigned int imageIndex) {
+            auto [output, frame] = std::exchange(headlessPending[imageIndex], {});
+            if(output < 0) {
+                return;
+            }
+            allocator.invalidateAllocation(headlessOutputAllocations[output].get(), 0, vk::WholeSize);
+            std::span<const char> pixels(static_cast<const char*>(static_cast<const void*>(headlessOutputMappings[output])),
+                headlessOutputSize);
+
+            if(config.workaround_no_swapchain) {
+                // SDL window surfaces belong to the main thread.
+                sdl::unique_surface surface{sdl::CreateRGBSurfaceWithFormatFrom(const_cast<char*>(pixels.data()),
+                    swapchainExtent.width, swapchainExtent.height, 32, swapchainExtent.width*4,
+                    sdl::PixelFormatEnumVales::ARGB8888)};
+                auto window_surface = sdl::GetWindowSurface(win.get());
+                sdl::BlitSurface(surface.get(), nullptr, window_surface, nullptr);
+                sdl::UpdateWindowSurface(win.get());
+            }
+            if(headlessEncoder) {
+                headlessEncoder->submit(frame, pixels, [this, output]{ release_headless_output(output); });
+            } else {
+                release_headless_output(output);
+            }
+        }
+        // Hands every frame still being read back to the encoder, in frame order.
+        void flush_headless_output() {
+            std::scoped_lock lock(renderLock);
+            std::vector<unsigned int> pending;
+            for(unsigned int i=0; i<headlessPending.size(); i++) {
+                if(headlessPending[i].output >= 0) {
+                    pending.push_back(i);
+                }
+            }
+            std::ranges::sort(pending, {}, [this](unsigned int i) { return headlessPending[i].frame; });
+            for(unsigned int i : pending) {
+                vk::Result r = device->waitForFences(headlessFences[i].get(), true, UINT64_MAX);
+                if(r != vk::Result::eSuccess)
+                    spdlog::error("Waiting for headlessFences[{}] failed with result {}", i, vk::to_string(r));
+                submit_headless_output(i);
+            }
+        }
+        void finish_headless_output() {
+            flush_headless_output();
+            if(headlessEncoder) {
+                headlessEncoder->wait_idle();
+            }
+        }
+
+        // Runs on the encoder threads, in any order. Repeated frames have no pixels and are not written.
+        void encode_headless_output(uint64_t frame, std::span<const char> pixels) {
+            if(config.headless_output_dir.empty() || pixels.empty()) {
+                return;
+            }
+            std::filesystem::path path = config.headless_output_dir / std::vformat(config.headless_output_format, std::make_format_args(frame));
+            std::string ext = path.extension().string();
+            if(ext == ".bmp") {
+                save_bmp(pixels, static_cast<int>(swapchainExtent.width), static_cast<int>(swapchainExtent.height), path);
+            } else {
+                sdl::unique_surface surface{sdl::CreateRGBSurfaceWithFormatFrom(const_cast<char*>(pixels.data()),
+                    swapchainExtent.width, swapchainExtent.height, 32, swapchainExtent.width*4,
+                    sdl::PixelFormatEnumVales::ARGB8888)};
+                if(ext == ".png") {
+                    sdl::image::SavePNG(surface.get(), path.string().c_str());
+                } else {
+                    sdl::image::SaveJPG(surface.get(), path.string().c_str(), config.headless_output_quality);
+                }
+            }
+            spdlog::debug("Saved headless output to {}", path.string());
+        }
+        // Runs on the encoder threads, strictly in frame order.
+        void commit_headless_output(uint64_t frame, std::span<const char> pixels) {
+            if(pixels.empty()) {
+                if(headlessStream) {
+                    headlessStream->repeat_frame();
+                }
+                return;
+            }
+            if(headlessStream) {
+                headlessStream->write_frame(pixels);
+            }
+            if(headlessTerminal) {
+                headlessTerminal->present(pixels, swapchainExtent);
+            }
+        }
+
         void handle_headless_commands(bool& should_exit) {
             while(input_available(STDIN_FILENO) && !std::cin.eof()) {
                 std::string line;
@@ -1372,6 +2359,10 @@ export class window
                 if(cmd == "quit" || cmd == "exit") {
                     should_exit = true;
                     return;
+                } else if(cmd == "memory") {
+                    if(memoryTracker) {
+                        spdlog::info("GPU memory: {}", memoryTracker->dump_json());
+                    }
                 } else if(cmd == "keyboard") {
                     std::string subcmd;
                     iss >> subcmd;
@@ -1382,13 +2373,9 @@ export class window
                     keysym.scancode = static_cast<decltype(keysym.scancode)>(scancode);
 
                     if(subcmd == "down") {
-                        if(keyboard_handler) {
-                            keyboard_handler->key_down(keysym);
-                        }
+                        handle_input({input::event_type::key_down, keysym});
                     } else if(subcmd == "up") {
-                        if(keyboard_handler) {
-                            keyboard_handler->key_up(keysym);
-                        }
+                        handle_input({input::event_type::key_up, keysym});
                     }
                 }
             }
@@ -1396,11 +2383,9 @@ export class window
 
         void handle_headless_terminal(bool& should_exit) {
             const auto emulate_key = [this](sdl::Scancode scancode, sdl::KeyCode sym, sdl::Keymod mod) {
-                if(keyboard_handler) {
-                    sdl::Keysym keysym{scancode, sym, static_cast<uint16_t>(mod)};
-                    keyboard_handler->key_down(keysym);
-                    keyboard_handler->key_up(keysym);
-                }
+                sdl::Keysym keysym{scancode, sym, static_cast<uint16_t>(mod)};
+                handle_input({input::event_type::key_down, keysym});
+                handle_input({input::event_type::key_up, keysym});
             };
 
             using sdl::Scancode;
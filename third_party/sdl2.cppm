@@ -245,6 +245,11 @@ export namespace sdl {
         constexpr auto default_format = MIX_DEFAULT_FORMAT;
         constexpr auto default_channels = MIX_DEFAULT_CHANNELS;
 
+        constexpr auto format_u8 = AUDIO_U8;
+        constexpr auto format_s16 = AUDIO_S16SYS;
+        constexpr auto format_s32 = AUDIO_S32SYS;
+        constexpr auto format_f32 = AUDIO_F32SYS;
+
         using Chunk = Mix_Chunk;
         using Music = Mix_Music;
         using MusicType = Mix_MusicType;
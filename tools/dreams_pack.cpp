@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+import dreamrender;
+import sdl2;
+import spdlog;
+
+struct pack_options {
+    std::filesystem::path output;
+    std::vector<std::filesystem::path> roots;
+    bool decode = false;
+    uint32_t alignment = 64;
+};
+
+static void usage() {
+    std::cerr << "Usage: dreams_pack [options] --output PACK DIRECTORY...\n"
+        "Packs every file below the directories, named by their path relative to the directory.\n"
+        "Options:\n"
+        "  --output PATH      the pack to write\n"
+        "  --decode           store images decoded as RGBA, so they are uploaded without decoding\n"
+        "  --align N          alignment of the data of every asset, a power of two (default 64)\n";
+}
+
+static pack_options parse_options(int argc, char** argv) {
+    pack_options options;
+    for(int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = [&]() -> std::string_view {
+            if(i + 1 >= argc) {
+                throw std::invalid_argument(std::format("Missing value for {}", arg));
+            }
+            return argv[++i];
+        };
+        if(arg == "--help" || arg == "-h") {
+            usage();
+            std::exit(0);
+        } else if(arg == "--output") {
+            options.output = value();
+        } else if(arg == "--decode") {
+            options.decode = true;
+        } else if(arg == "--align") {
+            options.alignment = static_cast<uint32_t>(std::stoul(std::string(value())));
+        } else if(arg.starts_with("--")) {
+            throw std::invalid_argument(std::format("Unknown option {}", arg));
+        } else {
+            options.roots.emplace_back(arg);
+        }
+    }
+    if(options.output.empty() || options.roots.empty()) {
+        throw std::invalid_argument("An output and at least one directory are required");
+    }
+    return options;
+}
+
+// The type a LoadDataView of the file gets, its extension in upper case.
+static std::string file_type(const std::filesystem::path& path) {
+    std::string ext = path.extension().string();
+    if(!ext.empty()) {
+        ext.erase(0, 1);
+    }
+    std::ranges::transform(ext, ext.begin(), [](unsigned char c){ return std::toupper(c); });
+    return ext == "JPEG" ? "JPG" : ext;
+}
+
+static bool is_image(std::string_view type) {
+    return type == "PNG" || type == "JPG" || type == "BMP" || type == "TGA" || type == "GIF" || type == "WEBP";
+}
+
+static std::vector<uint8_t> read_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in) {
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Decodes an image to tightly packed RGBA, returns false if SDL_image cannot read it.
+static bool decode_image(const std::filesystem::path& path, std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height) {
+    sdl::unique_surface surface{sdl::image::Load(path.string().c_str())};
+    if(!surface) {
+        return false;
+    }
+    if(surface->format->format != sdl::PixelFormatEnumVales::RGBA32) {
+        surface = sdl::unique_surface{sdl::ConvertSurfaceFormat(surface.get(), sdl::PixelFormatEnumVales::RGBA32, 0)};
+        if(!surface) {
+            return false;
+        }
+    }
+    width = static_cast<uint32_t>(surface->w);
+    height = static_cast<uint32_t>(surface->h);
+    pixels.resize(static_cast<size_t>(width) * height * 4);
+
+    sdl::surface_lock lock{surface.get()};
+    const auto* source = static_cast<const uint8_t*>(lock.pixels());
+    for(uint32_t y = 0; y < height; y++) {
+        std::memcpy(pixels.data() + static_cast<size_t>(y) * width * 4, source + static_cast<size_t>(y) * surface->pitch, static_cast<size_t>(width) * 4);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+    spdlog::set_level(spdlog::level::info);
+
+    pack_options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        usage();
+        return 1;
+    }
+
+    try {
+        dreamrender::asset_pack_writer writer(options.alignment);
+        uint64_t inputBytes = 0;
+        unsigned int decoded = 0;
+        for(const auto& root : options.roots) {
+            for(const auto& file : std::filesystem::recursive_directory_iterator(root)) {
+                if(!file.is_regular_file()) {
+                    continue;
+                }
+                const std::string name = file.path().lexically_relative(root).generic_string();
+                const std::string type = file_type(file.path());
+                inputBytes += file.file_size();
+
+                std::vector<uint8_t> pixels;
+                uint32_t width = 0, height = 0;
+                if(options.decode && is_image(type) && decode_image(file.path(), pixels, width, height)) {
+                    writer.add(name, std::move(pixels), "RGBA", width, height);
+                    decoded++;
+                    continue;
+                }
+                writer.add(name, read_file(file.path()), type);
+            }
+        }
+        writer.write(options.output);
+        spdlog::info("Packed {} files ({} decoded, {:.1f} MiB read) into {} ({:.1f} MiB)", writer.size(), decoded,
+            inputBytes / (1024.0 * 1024.0), options.output.string(), std::filesystem::file_size(options.output) / (1024.0 * 1024.0));
+    } catch(const std::exception& e) {
+        spdlog::error("{}", e.what());
+        return 1;
+    }
+    return 0;
+}